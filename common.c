@@ -134,3 +134,132 @@ parse_generic_option(int i, struct pci_access *pacc, char *arg)
     }
   return 1;
 }
+
+/* Hex dumps */
+
+static const char hex_pairs[] =
+  "000102030405060708090a0b0c0d0e0f"
+  "101112131415161718191a1b1c1d1e1f"
+  "202122232425262728292a2b2c2d2e2f"
+  "303132333435363738393a3b3c3d3e3f"
+  "404142434445464748494a4b4c4d4e4f"
+  "505152535455565758595a5b5c5d5e5f"
+  "606162636465666768696a6b6c6d6e6f"
+  "707172737475767778797a7b7c7d7e7f"
+  "808182838485868788898a8b8c8d8e8f"
+  "909192939495969798999a9b9c9d9e9f"
+  "a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+  "b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+  "c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+  "d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+  "e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+  "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+char *
+format_hex(char *out, const byte *data, unsigned int len, int sep)
+{
+  unsigned int i;
+
+  if (sep)
+    for (i=0; i<len; i++)
+      {
+	*out++ = sep;
+	memcpy(out, hex_pairs + 2*data[i], 2);
+	out += 2;
+      }
+  else
+    for (i=0; i<len; i++)
+      {
+	memcpy(out, hex_pairs + 2*data[i], 2);
+	out += 2;
+      }
+  return out;
+}
+
+char *
+format_hex_dump(char *out, const byte *data, unsigned int len)
+{
+  unsigned int pos, n;
+
+  for (pos=0; pos<len; pos+=16)
+    {
+      if (pos >= 0x100)
+	*out++ = hex_pairs[2*(pos >> 8) + 1];
+      memcpy(out, hex_pairs + 2*(pos & 0xff), 2);
+      out[2] = ':';
+      out += 3;
+      n = (len - pos < 16) ? len - pos : 16;
+      out = format_hex(out, data + pos, n, ' ');
+      if (n == 16)
+	*out++ = '\n';
+    }
+  return out;
+}
+
+/* Statistics of libpci (-O stats=1) */
+
+static void
+show_time(char *buf, u64 ns)
+{
+  if (ns < 10000)
+    sprintf(buf, "%dns", (int) ns);
+  else if (ns < 10000000)
+    sprintf(buf, "%dus", (int) (ns / 1000));
+  else if (ns < 10000000000ULL)
+    sprintf(buf, "%dms", (int) (ns / 1000000));
+  else
+    sprintf(buf, "%ds", (int) (ns / 1000000000));
+}
+
+void
+show_pci_stats(struct pci_access *pacc)
+{
+  static const char * const op_names[PCI_STATS_OPS] = { "scan", "fill_info", "read", "write", "read_vpd" };
+  static const char * const src_names[PCI_STATS_NAME_SOURCES] = { "local", "hwdb", "net", "cache", "unknown" };
+  struct pci_stats *s = pci_get_stats(pacc);
+  char tbuf[32];
+  int i, j;
+
+  if (!s)
+    return;
+  fprintf(stderr, "Statistics:\n");
+  for (i=0; i<PCI_STATS_OPS; i++)
+    {
+      struct pci_op_stats *o = &s->ops[i];
+      if (!o->calls)
+	continue;
+      show_time(tbuf, o->ns);
+      fprintf(stderr, "  %-10s %" PCI_U64_FMT_U " calls, %" PCI_U64_FMT_U " failed, %" PCI_U64_FMT_U " bytes, %s,",
+	      op_names[i], o->calls, o->failed, o->bytes, tbuf);
+      show_time(tbuf, o->ns / o->calls);
+      fprintf(stderr, " %s per call\n", tbuf);
+      fprintf(stderr, "  %-10s", "");
+      for (j=0; j<PCI_STATS_BUCKETS; j++)
+	if (o->histogram[j])
+	  {
+	    show_time(tbuf, 1ULL << j);
+	    fprintf(stderr, " >=%s:%" PCI_U64_FMT_U, tbuf, o->histogram[j]);
+	  }
+      fputc('\n', stderr);
+    }
+  fprintf(stderr, "  cache      %" PCI_U64_FMT_U " hits, %" PCI_U64_FMT_U " misses\n", s->cache_hits, s->cache_misses);
+  fprintf(stderr, "  files      %" PCI_U64_FMT_U " hits, %" PCI_U64_FMT_U " opens, %" PCI_U64_FMT_U " evictions\n",
+	  s->fd_hits, s->fd_opens, s->fd_evictions);
+  fprintf(stderr, "  names     ");
+  for (i=0; i<PCI_STATS_NAME_SOURCES; i++)
+    fprintf(stderr, " %s:%" PCI_U64_FMT_U, src_names[i], s->names[i]);
+  fputc('\n', stderr);
+}
+
+void
+add_pci_stats(struct pci_access *to, struct pci_access *from)
+{
+  struct pci_stats *t = pci_get_stats(to), *f = pci_get_stats(from);
+  u64 *tc = (u64 *) t, *fc = (u64 *) f;
+  unsigned int i;
+
+  /* The structure consists of counters only */
+  if (t && f)
+    for (i=0; i < sizeof(struct pci_stats) / sizeof(u64); i++)
+      tc[i] += fc[i];
+}
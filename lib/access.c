@@ -18,7 +18,102 @@
 void
 pci_scan_bus(struct pci_access *a)
 {
+  u64 start;
+
+  if (!a->stats)
+    {
+      a->methods->scan(a);
+      return;
+    }
+  start = pci_stats_start();
   a->methods->scan(a);
+  pci_stats_end(a, PCI_STATS_SCAN, start, 0, 1);
+}
+
+/*
+ *  Calls of the access method, with statistics and tracing if enabled.
+ *  If thread safety is enabled, calls of back-ends which are not reentrant
+ *  are serialized.
+ */
+
+static inline int
+locked_read(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  struct pci_access *a = d->access;
+  int ok;
+
+  if (!a->locks || PCI_METHODS(d)->reentrant)
+    return PCI_METHODS(d)->read(d, pos, buf, len);
+  pci_lock(a, PCI_LOCK_METHOD);
+  ok = PCI_METHODS(d)->read(d, pos, buf, len);
+  pci_unlock(a, PCI_LOCK_METHOD);
+  return ok;
+}
+
+static inline int
+locked_write(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  struct pci_access *a = d->access;
+  int ok;
+
+  if (!a->locks || PCI_METHODS(d)->reentrant)
+    return PCI_METHODS(d)->write(d, pos, buf, len);
+  pci_lock(a, PCI_LOCK_METHOD);
+  ok = PCI_METHODS(d)->write(d, pos, buf, len);
+  pci_unlock(a, PCI_LOCK_METHOD);
+  return ok;
+}
+
+static int
+method_read(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  struct pci_access *a = d->access;
+  u64 start;
+  int ok;
+
+  if (!a->stats && !pci_tracing(a))
+    return locked_read(d, pos, buf, len);
+  start = pci_stats_start();
+  ok = locked_read(d, pos, buf, len);
+  if (a->stats)
+    pci_stats_end(a, PCI_STATS_READ, start, len, ok);
+  if (pci_tracing(a))
+    pci_trace(d, PCI_TRACE_METHOD_READ, pos, buf, len, ok, start);
+  return ok;
+}
+
+static int
+method_write(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  struct pci_access *a = d->access;
+  u64 start;
+  int ok;
+
+  if (!a->stats && !pci_tracing(a))
+    return locked_write(d, pos, buf, len);
+  start = pci_stats_start();
+  ok = locked_write(d, pos, buf, len);
+  if (a->stats)
+    pci_stats_end(a, PCI_STATS_WRITE, start, len, ok);
+  if (pci_tracing(a))
+    pci_trace(d, PCI_TRACE_METHOD_WRITE, pos, buf, len, ok, start);
+  return ok;
+}
+
+static void
+method_fill_info(struct pci_dev *d, unsigned int flags)
+{
+  struct pci_access *a = d->access;
+  u64 start;
+
+  if (!a->stats)
+    {
+      PCI_METHODS(d)->fill_info(d, flags);
+      return;
+    }
+  start = pci_stats_start();
+  PCI_METHODS(d)->fill_info(d, flags);
+  pci_stats_end(a, PCI_STATS_FILL_INFO, start, 0, 1);
 }
 
 struct pci_dev *
@@ -36,11 +131,176 @@ pci_alloc_dev(struct pci_access *a)
   return d;
 }
 
+/*
+ *  Index of all linked devices by their address. It is kept up to date by
+ *  pci_link_dev() and pci_free_dev(), so lookups are safe even in parallel
+ *  with other read-only operations.
+ */
+
+struct pci_dev_index {
+  unsigned int mask;
+  unsigned int count;
+  struct pci_dev *buckets[1];
+};
+
+#define DEV_INDEX_MIN_SIZE 64
+
+static unsigned int
+dev_index_hash(struct pci_dev_index *x, int domain, int bus, int dev, int func)
+{
+  unsigned int h = (((unsigned int) domain * 256 + bus) * 32 + dev) * 8 + func;
+  h *= 0x9e3779b1;
+  return (h ^ (h >> 16)) & x->mask;
+}
+
+static struct pci_dev_index *
+dev_index_alloc(struct pci_access *a, unsigned int size)
+{
+  struct pci_dev_index *x = pci_malloc(a, sizeof(*x) + (size-1) * sizeof(x->buckets[0]));
+
+  memset(x, 0, sizeof(*x) + (size-1) * sizeof(x->buckets[0]));
+  x->mask = size - 1;
+  return x;
+}
+
+static void
+dev_index_add(struct pci_access *a, struct pci_dev *d)
+{
+  struct pci_dev_index *x = a->dev_index;
+  unsigned int h, i;
+
+  if (!x)
+    x = a->dev_index = dev_index_alloc(a, DEV_INDEX_MIN_SIZE);
+  else if (x->count >= 2 * (x->mask + 1))
+    {
+      /* Grow and rehash, keeping the relative order of devices with the same address */
+      struct pci_dev_index *y = dev_index_alloc(a, 4 * (x->mask + 1));
+      for (i=0; i<=x->mask; i++)
+	{
+	  struct pci_dev *e, *f, *rev = NULL;
+	  for (e = x->buckets[i]; e; e = f)
+	    {
+	      f = e->index_next;
+	      e->index_next = rev;
+	      rev = e;
+	    }
+	  for (e = rev; e; e = f)
+	    {
+	      f = e->index_next;
+	      h = dev_index_hash(y, e->domain, e->bus, e->dev, e->func);
+	      e->index_next = y->buckets[h];
+	      y->buckets[h] = e;
+	    }
+	}
+      y->count = x->count;
+      pci_mfree(x);
+      x = a->dev_index = y;
+    }
+
+  /* Newer devices shadow older ones with the same address, just like in a->devices */
+  h = dev_index_hash(x, d->domain, d->bus, d->dev, d->func);
+  d->index_next = x->buckets[h];
+  x->buckets[h] = d;
+  x->count++;
+}
+
+static void
+dev_index_remove(struct pci_access *a, struct pci_dev *d)
+{
+  struct pci_dev_index *x = a->dev_index;
+  struct pci_dev **pp;
+
+  if (!x)
+    return;
+  for (pp = &x->buckets[dev_index_hash(x, d->domain, d->bus, d->dev, d->func)]; *pp; pp = &(*pp)->index_next)
+    if (*pp == d)
+      {
+	*pp = d->index_next;
+	d->index_next = NULL;
+	x->count--;
+	return;
+      }
+}
+
+void
+pci_free_dev_index(struct pci_access *a)
+{
+  pci_mfree(a->dev_index);
+  a->dev_index = NULL;
+}
+
+struct pci_dev *
+pci_find_dev(struct pci_access *a, int domain, int bus, int dev, int func)
+{
+  struct pci_dev_index *x = a->dev_index;
+  struct pci_dev *d;
+
+  if (!x)
+    return NULL;
+  for (d = x->buckets[dev_index_hash(x, domain, bus, dev, func)]; d; d = d->index_next)
+    if (d->domain == domain && d->bus == bus && d->dev == dev && d->func == func)
+      return d;
+  return NULL;
+}
+
+struct pci_dev *
+pci_probe_dev(struct pci_access *a, int domain, int bus, int dev, int func)
+{
+  struct pci_dev *d;
+
+  if (d = pci_find_dev(a, domain, bus, dev, func))
+    return d;
+
+  if (!a->methods->probe_dev)
+    {
+      /* The back-end can only scan everything */
+      if (!a->devices)
+	pci_scan_bus(a);
+      return pci_find_dev(a, domain, bus, dev, func);
+    }
+
+  d = pci_get_dev(a, domain, bus, dev, func);
+  if (!a->methods->probe_dev(d))
+    {
+      pci_free_dev(d);
+      return NULL;
+    }
+  pci_link_dev(a, d);
+  return d;
+}
+
+int
+pci_get_domains(struct pci_access *a, struct pci_bus_range *ranges, int max)
+{
+  if (a->methods->get_domains)
+    return a->methods->get_domains(a, ranges, max);
+  if (max > 0)
+    {
+      ranges[0].domain = 0;
+      ranges[0].start_bus = 0;
+      ranges[0].end_bus = 255;
+    }
+  return 1;
+}
+
+struct pci_dev *
+pci_get_dev_filled(struct pci_access *a, int domain, int bus, int dev, int func, unsigned int flags)
+{
+  struct pci_dev *d, *p;
+
+  d = pci_probe_dev(a, domain, bus, dev, func);
+  for (p = d; p; p = p->parent)
+    pci_fill_info_v314(p, flags);
+  return d;
+}
+
 int
 pci_link_dev(struct pci_access *a, struct pci_dev *d)
 {
   d->next = a->devices;
   a->devices = d;
+  dev_index_add(a, d);
+  pci_topo_free(a);
 
   /*
    * Applications compiled with older versions of libpci do not expect
@@ -69,37 +329,366 @@ pci_get_dev(struct pci_access *a, int domain, int bus, int dev, int func)
   return d;
 }
 
+static void pci_reset_properties(struct pci_dev *d);
+
+/*
+ *  Probe handles are used to test many addresses for presence of a device
+ *  without allocating a new pci_dev for each of them. Reads through them
+ *  bypass the config space cache, so moving a handle to another address only
+ *  has to forget the properties and tell the back-end.
+ */
+
+struct pci_dev *
+pci_alloc_probe(struct pci_access *a)
+{
+  struct pci_dev *d = pci_alloc_dev(a);
+
+  d->probe_handle = 1;
+  return d;
+}
+
+void
+pci_set_probe_addr(struct pci_dev *d, int domain, int bus, int dev, int func)
+{
+  if (d->methods->reset_dev)
+    d->methods->reset_dev(d);
+  else if (d->methods->cleanup_dev)
+    {
+      d->methods->cleanup_dev(d);
+      if (d->methods->init_dev)
+	d->methods->init_dev(d);
+    }
+  pci_reset_properties(d);
+  d->cache = NULL;
+  d->cache_len = 0;
+  d->hdrtype = -1;
+  d->numa_node = -1;
+  d->domain = domain;
+  d->bus = bus;
+  d->dev = dev;
+  d->func = func;
+}
+
+/*
+ *  Properties and capability records of a device are small and they are never
+ *  freed one by one, so they are carved from chunks owned by the device and
+ *  released all at once when the device is freed or re-filled with PCI_FILL_RESCAN.
+ *  A replaced property stays in the arena until then.
+ */
+
+#define DEV_ARENA_CHUNK 512
+
+struct pci_dev_arena {
+  struct pci_dev_arena *next;
+  unsigned int size, used;
+  u64 data[1];				/* Forces alignment of the data */
+};
+
+void *
+pci_dev_alloc(struct pci_dev *d, unsigned int size)
+{
+  struct pci_dev_arena *ar = d->arena;
+  void *p;
+
+  size = (size + 7) & ~7U;
+  if (!ar || ar->used + size > ar->size)
+    {
+      unsigned int chunk = (size > DEV_ARENA_CHUNK) ? size : DEV_ARENA_CHUNK;
+      ar = pci_malloc(d->access, sizeof(*ar) - sizeof(ar->data) + chunk);
+      ar->next = d->arena;
+      ar->size = chunk;
+      ar->used = 0;
+      d->arena = ar;
+    }
+  p = (byte *) ar->data + ar->used;
+  ar->used += size;
+  return p;
+}
+
 static void
-pci_free_properties(struct pci_dev *d)
+pci_free_dev_arena(struct pci_dev *d)
 {
-  struct pci_property *p;
+  struct pci_dev_arena *ar;
 
-  while (p = d->properties)
+  d->properties = NULL;
+  while (ar = d->arena)
     {
-      d->properties = p->next;
-      pci_mfree(p);
+      d->arena = ar->next;
+      pci_mfree(ar);
     }
 }
 
 void pci_free_dev(struct pci_dev *d)
 {
+  pci_free_bar_maps(d);
   if (d->methods->cleanup_dev)
     d->methods->cleanup_dev(d);
 
+  dev_index_remove(d->access, d);
+  if (d->topo_bus)
+    pci_topo_free(d->access);
   pci_free_caps(d);
-  pci_free_properties(d);
+  pci_free_doe(d);
+  pci_free_dev_arena(d);
+  pci_free_config_cache(d);
   pci_mfree(d);
 }
 
-static inline void
-pci_read_data(struct pci_dev *d, void *buf, int pos, int len)
+/*
+ *  Config space cache: if enabled by pci_enable_config_cache(), everything
+ *  read from the config space is remembered with dword granularity and served
+ *  from memory afterwards. Writes drop the written dwords from the cache, since
+ *  many registers do not read back what was written.
+ *
+ *  Most devices in a large system have no extended config space, so the cache
+ *  holds only the standard 256 bytes in the same allocation as the bitmap.
+ *  A separate buffer for the whole 4096 bytes is allocated when the extended
+ *  space is accessed and released again if nothing could be read from it.
+ */
+
+#define CONFIG_CACHE_SIZE 4096
+#define CONFIG_CACHE_STD_SIZE 256
+
+struct pci_config_cache {
+  u32 valid[CONFIG_CACHE_SIZE / 4 / 32];	/* One bit per dword */
+  int prefetch;				/* Whole config space is to be read on the first miss */
+  int size;				/* Size of data: CONFIG_CACHE_STD_SIZE or CONFIG_CACHE_SIZE */
+  byte *data;				/* Points either to std or to a separate buffer */
+  byte std[CONFIG_CACHE_STD_SIZE];
+};
+
+static inline int
+config_cache_valid(struct pci_config_cache *c, int dw)
+{
+  return c->valid[dw / 32] & (1U << (dw % 32));
+}
+
+static void
+config_cache_mark(struct pci_config_cache *c, int pos, int len, int valid)
+{
+  int dw;
+
+  for (dw = pos / 4; dw < (pos + len + 3) / 4; dw++)
+    if (valid)
+      c->valid[dw / 32] |= 1U << (dw % 32);
+    else
+      c->valid[dw / 32] &= ~(1U << (dw % 32));
+}
+
+/* Get the cache of a device, making room for the given range */
+static struct pci_config_cache *
+config_cache_get(struct pci_dev *d, int pos, int len)
+{
+  struct pci_config_cache *c = d->config_cache;
+
+  if (!d->access->config_cache || d->probe_handle || pos < 0 || len <= 0 || pos + len > CONFIG_CACHE_SIZE)
+    return NULL;
+  if (!c)
+    {
+      char *prefetch = pci_get_param(d->access, "cache.prefetch");
+      c = d->config_cache = pci_malloc(d->access, sizeof(struct pci_config_cache));
+      memset(c->valid, 0, sizeof(c->valid));
+      c->prefetch = prefetch && atoi(prefetch);
+      c->size = CONFIG_CACHE_STD_SIZE;
+      c->data = c->std;
+    }
+  if (pos + len > c->size)
+    {
+      c->data = pci_malloc(d->access, CONFIG_CACHE_SIZE);
+      memcpy(c->data, c->std, CONFIG_CACHE_STD_SIZE);
+      c->size = CONFIG_CACHE_SIZE;
+    }
+  return c;
+}
+
+/* Give up the extended part if nothing is cached there */
+static void
+config_cache_trim(struct pci_config_cache *c)
+{
+  unsigned int i;
+
+  if (c->size == CONFIG_CACHE_STD_SIZE)
+    return;
+  for (i = CONFIG_CACHE_STD_SIZE / 4 / 32; i < sizeof(c->valid) / sizeof(c->valid[0]); i++)
+    if (c->valid[i])
+      return;
+  memcpy(c->std, c->data, CONFIG_CACHE_STD_SIZE);
+  pci_mfree(c->data);
+  c->data = c->std;
+  c->size = CONFIG_CACHE_STD_SIZE;
+}
+
+/*
+ *  Try to read the whole config space in (at most) two blocks: the standard
+ *  one and the extended one, which need not exist. This is only speculative:
+ *  if a block cannot be read as a whole (e.g., unprivileged users see just
+ *  the first 64 bytes in sysfs), the bytes actually requested are read on
+ *  their own afterwards.
+ */
+static void
+config_cache_prefetch(struct pci_dev *d, struct pci_config_cache *c)
+{
+  c->prefetch = 0;
+  if (!method_read(d, 0, c->data, 256))
+    return;
+  config_cache_mark(c, 0, 256, 1);
+  c = config_cache_get(d, 256, CONFIG_CACHE_SIZE - 256);
+  if (method_read(d, 256, c->data + 256, CONFIG_CACHE_SIZE - 256))
+    config_cache_mark(c, 256, CONFIG_CACHE_SIZE - 256, 1);
+  else
+    config_cache_trim(c);
+}
+
+/* Is the whole range cached? */
+static int
+config_cache_hit(struct pci_config_cache *c, int pos, int len)
+{
+  int dw;
+
+  for (dw = pos / 4; dw < (pos + len + 3) / 4; dw++)
+    if (!config_cache_valid(c, dw))
+      return 0;
+  return 1;
+}
+
+static int
+config_cache_read(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  struct pci_config_cache *c = config_cache_get(d, pos, len);
+  int dw, end_dw, start;
+
+  if (!c)
+    {
+      PCI_STAT(d->access, cache_misses, 1);
+      return method_read(d, pos, buf, len);
+    }
+  if (d->access->stats)
+    {
+      if (config_cache_hit(c, pos, len))
+	PCI_STAT(d->access, cache_hits, 1);
+      else
+	PCI_STAT(d->access, cache_misses, 1);
+    }
+  if (c->prefetch && !config_cache_hit(c, pos, len))
+    {
+      config_cache_prefetch(d, c);
+      c = config_cache_get(d, pos, len);	/* The extended part may have been trimmed */
+    }
+
+  /*
+   *  Fetch all missing runs of dwords. Since the size of config space is
+   *  always a multiple of 4, rounding never makes a valid read fail.
+   */
+  end_dw = (pos + len + 3) / 4;
+  for (dw = pos / 4; dw < end_dw; )
+    {
+      if (config_cache_valid(c, dw))
+	{
+	  dw++;
+	  continue;
+	}
+      start = dw;
+      while (dw < end_dw && !config_cache_valid(c, dw))
+	dw++;
+      if (!method_read(d, 4*start, c->data + 4*start, 4*(dw-start)))
+	{
+	  config_cache_trim(c);
+	  return 0;
+	}
+      config_cache_mark(c, 4*start, 4*(dw-start), 1);
+    }
+
+  memcpy(buf, c->data + pos, len);
+  return 1;
+}
+
+static int
+pci_cached_read(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  int ok;
+
+  if (!d->access->locks || !d->access->config_cache)
+    return config_cache_read(d, pos, buf, len);
+  pci_lock_dev(d);
+  ok = config_cache_read(d, pos, buf, len);
+  pci_unlock_dev(d);
+  return ok;
+}
+
+void
+pci_enable_config_cache(struct pci_access *a, int enable)
+{
+  struct pci_dev *d;
+
+  a->config_cache = enable;
+  if (!enable)
+    for (d = a->devices; d; d = d->next)
+      pci_free_config_cache(d);
+}
+
+void
+pci_invalidate_config_cache(struct pci_dev *d, int pos, int len)
+{
+  if (!d->config_cache)
+    return;
+  if (pos < 0)
+    {
+      len += pos;
+      pos = 0;
+    }
+  if (pos + len > CONFIG_CACHE_SIZE)
+    len = CONFIG_CACHE_SIZE - pos;
+  if (len > 0)
+    {
+      pci_lock_dev(d);
+      config_cache_mark(d->config_cache, pos, len, 0);
+      pci_unlock_dev(d);
+    }
+}
+
+void
+pci_free_config_cache(struct pci_dev *d)
+{
+  if (d->config_cache && d->config_cache->data != d->config_cache->std)
+    pci_mfree(d->config_cache->data);
+  pci_mfree(d->config_cache);
+  d->config_cache = NULL;
+}
+
+static inline int
+pci_read_data_untraced(struct pci_dev *d, void *buf, int pos, int len)
 {
   if (pos & (len-1))
     d->access->error("Unaligned read: pos=%02x, len=%d", pos, len);
   if (pos + len <= d->cache_len)
-    memcpy(buf, d->cache + pos, len);
-  else if (!d->methods->read(d, pos, buf, len))
-    memset(buf, 0xff, len);
+    {
+      memcpy(buf, d->cache + pos, len);
+      PCI_STAT(d->access, cache_hits, 1);
+    }
+  else if (!pci_cached_read(d, pos, buf, len))
+    {
+      memset(buf, 0xff, len);
+      return 0;
+    }
+  return 1;
+}
+
+/* Kept out of line, so that the common path stays small */
+static void __attribute__((noinline))
+pci_read_data_traced(struct pci_dev *d, void *buf, int pos, int len)
+{
+  u64 start = pci_stats_start();
+  int ok = pci_read_data_untraced(d, buf, pos, len);
+  pci_trace(d, PCI_TRACE_READ, pos, buf, len, ok, start);
+}
+
+static inline void
+pci_read_data(struct pci_dev *d, void *buf, int pos, int len)
+{
+  if (pci_tracing(d->access))
+    pci_read_data_traced(d, buf, pos, len);
+  else
+    pci_read_data_untraced(d, buf, pos, len);
 }
 
 byte
@@ -129,13 +718,148 @@ pci_read_long(struct pci_dev *d, int pos)
 int
 pci_read_block(struct pci_dev *d, int pos, byte *buf, int len)
 {
-  return d->methods->read(d, pos, buf, len);
+  u64 start;
+  int ok;
+
+  if (!pci_tracing(d->access))
+    return pci_cached_read(d, pos, buf, len);
+  start = pci_stats_start();
+  ok = pci_cached_read(d, pos, buf, len);
+  pci_trace(d, PCI_TRACE_READ, pos, buf, len, ok, start);
+  return ok;
+}
+
+int
+pci_read_multi(struct pci_access *a, struct pci_read_req *reqs, int n)
+{
+  struct pci_read_req *miss = reqs;
+  int *miss_idx = NULL;
+  int i, cnt = 0, nmiss = n;
+  int trace = pci_tracing(a);
+  u64 trace_start = trace ? pci_stats_start() : 0;
+
+  if (a->config_cache)
+    {
+      /* Serve what we can from the cache and submit only the rest */
+      miss = pci_malloc(a, (n ? n : 1) * sizeof(*miss));
+      miss_idx = pci_malloc(a, (n ? n : 1) * sizeof(*miss_idx));
+      nmiss = 0;
+      for (i=0; i<n; i++)
+	{
+	  struct pci_config_cache *c;
+	  pci_lock_dev(reqs[i].dev);
+	  c = config_cache_get(reqs[i].dev, reqs[i].pos, reqs[i].len);
+	  if (c && config_cache_hit(c, reqs[i].pos, reqs[i].len))
+	    {
+	      memcpy(reqs[i].buf, c->data + reqs[i].pos, reqs[i].len);
+	      reqs[i].ok = 1;
+	      PCI_STAT(a, cache_hits, 1);
+	    }
+	  else
+	    {
+	      PCI_STAT(a, cache_misses, 1);
+	      miss_idx[nmiss] = i;
+	      miss[nmiss++] = reqs[i];
+	    }
+	  pci_unlock_dev(reqs[i].dev);
+	}
+    }
+
+  if (a->methods->read_multi)
+    {
+      u64 start = (a->stats || trace) ? pci_stats_start() : 0;
+      int bytes = 0;
+      pci_lock(a, PCI_LOCK_METHOD);
+      a->methods->read_multi(a, miss, nmiss);
+      pci_unlock(a, PCI_LOCK_METHOD);
+      if (a->stats)
+	{
+	  for (i=0; i<nmiss; i++)
+	    if (miss[i].ok)
+	      bytes += miss[i].len;
+	  pci_stats_end(a, PCI_STATS_READ, start, bytes, 1);
+	}
+      if (trace)
+	for (i=0; i<nmiss; i++)
+	  pci_trace(miss[i].dev, PCI_TRACE_METHOD_READ, miss[i].pos, miss[i].buf, miss[i].len, miss[i].ok, start);
+    }
+  else
+    for (i=0; i<nmiss; i++)
+      miss[i].ok = method_read(miss[i].dev, miss[i].pos, miss[i].buf, miss[i].len);
+
+  if (miss != reqs)
+    {
+      for (i=0; i<nmiss; i++)
+	{
+	  struct pci_read_req *r = &miss[i];
+	  struct pci_config_cache *c;
+	  reqs[miss_idx[i]].ok = r->ok;
+	  pci_lock_dev(r->dev);
+	  c = config_cache_get(r->dev, r->pos, r->len);
+	  if (r->ok && c)
+	    {
+	      /* Only whole dwords can be remembered */
+	      int start = (r->pos + 3) & ~3;
+	      int end = (r->pos + r->len) & ~3;
+	      if (start < end)
+		{
+		  memcpy(c->data + start, r->buf + (start - r->pos), end - start);
+		  config_cache_mark(c, start, end - start, 1);
+		}
+	    }
+	  else if (c)
+	    config_cache_trim(c);
+	  pci_unlock_dev(r->dev);
+	}
+      pci_mfree(miss_idx);
+      pci_mfree(miss);
+    }
+
+  for (i=0; i<n; i++)
+    {
+      if (reqs[i].ok)
+	cnt++;
+      if (trace)
+	pci_trace(reqs[i].dev, PCI_TRACE_READ, reqs[i].pos, reqs[i].buf, reqs[i].len, reqs[i].ok, trace_start);
+    }
+  return cnt;
 }
 
 int
 pci_read_vpd(struct pci_dev *d, int pos, byte *buf, int len)
 {
-  return d->methods->read_vpd ? d->methods->read_vpd(d, pos, buf, len) : 0;
+  struct pci_access *a = d->access;
+  u64 start;
+  int ok;
+
+  if (!d->methods->read_vpd)
+    return 0;
+  if (!a->stats && !a->locks)
+    return d->methods->read_vpd(d, pos, buf, len);
+  start = a->stats ? pci_stats_start() : 0;
+  if (!d->methods->reentrant)
+    pci_lock(a, PCI_LOCK_METHOD);
+  ok = d->methods->read_vpd(d, pos, buf, len);
+  if (!d->methods->reentrant)
+    pci_unlock(a, PCI_LOCK_METHOD);
+  if (a->stats)
+    pci_stats_end(a, PCI_STATS_READ_VPD, start, len, ok);
+  return ok;
+}
+
+/* Writes are never served by caches, but the application-level event is reported anyway */
+static int
+traced_write(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  u64 start;
+  int ok;
+
+  if (!pci_tracing(d->access))
+    return method_write(d, pos, buf, len);
+  start = pci_stats_start();
+  ok = method_write(d, pos, buf, len);
+  pci_trace(d, PCI_TRACE_WRITE, pos, buf, len, ok, start);
+  return ok;
 }
 
 static inline int
@@ -145,7 +869,8 @@ pci_write_data(struct pci_dev *d, void *buf, int pos, int len)
     d->access->error("Unaligned write: pos=%02x,len=%d", pos, len);
   if (pos + len <= d->cache_len)
     memcpy(d->cache + pos, buf, len);
-  return d->methods->write(d, pos, buf, len);
+  pci_invalidate_config_cache(d, pos, len);
+  return traced_write(d, pos, buf, len);
 }
 
 int
@@ -176,7 +901,8 @@ pci_write_block(struct pci_dev *d, int pos, byte *buf, int len)
       int l = (pos + len >= d->cache_len) ? (d->cache_len - pos) : len;
       memcpy(d->cache + pos, buf, l);
     }
-  return d->methods->write(d, pos, buf, len);
+  pci_invalidate_config_cache(d, pos, len);
+  return traced_write(d, pos, buf, len);
 }
 
 static void
@@ -186,34 +912,43 @@ pci_reset_properties(struct pci_dev *d)
   d->phy_slot = NULL;
   d->module_alias = NULL;
   d->label = NULL;
+  d->vpd = NULL;
   pci_free_caps(d);
-  pci_free_properties(d);
+  pci_free_bar_maps(d);
+  pci_free_dev_arena(d);
+  pci_invalidate_config_cache(d, 0, CONFIG_CACHE_SIZE);
 }
 
 int
-pci_fill_info_v313(struct pci_dev *d, int flags)
+pci_fill_info_v314(struct pci_dev *d, int flags)
 {
   unsigned int uflags = flags;
+  int known;
+
+  pci_lock(d->access, PCI_LOCK_FILL);
   if (uflags & PCI_FILL_RESCAN)
     {
       uflags &= ~PCI_FILL_RESCAN;
       pci_reset_properties(d);
     }
   if (uflags & ~d->known_fields)
-    d->methods->fill_info(d, uflags);
-  return d->known_fields;
+    method_fill_info(d, uflags);
+  known = d->known_fields;
+  pci_unlock(d->access, PCI_LOCK_FILL);
+  return known;
 }
 
 /* In version 3.1, pci_fill_info got new flags => versioned alias */
-/* In versions 3.2, 3.3, 3.4, 3.5, 3.8 and 3.12, the same has happened */
-STATIC_ALIAS(int pci_fill_info(struct pci_dev *d, int flags), pci_fill_info_v313(d, flags));
-DEFINE_ALIAS(int pci_fill_info_v30(struct pci_dev *d, int flags), pci_fill_info_v313);
-DEFINE_ALIAS(int pci_fill_info_v31(struct pci_dev *d, int flags), pci_fill_info_v313);
-DEFINE_ALIAS(int pci_fill_info_v32(struct pci_dev *d, int flags), pci_fill_info_v313);
-DEFINE_ALIAS(int pci_fill_info_v33(struct pci_dev *d, int flags), pci_fill_info_v313);
-DEFINE_ALIAS(int pci_fill_info_v34(struct pci_dev *d, int flags), pci_fill_info_v313);
-DEFINE_ALIAS(int pci_fill_info_v35(struct pci_dev *d, int flags), pci_fill_info_v313);
-DEFINE_ALIAS(int pci_fill_info_v38(struct pci_dev *d, int flags), pci_fill_info_v313);
+/* In versions 3.2, 3.3, 3.4, 3.5, 3.8, 3.12 and 3.14, the same has happened */
+STATIC_ALIAS(int pci_fill_info(struct pci_dev *d, int flags), pci_fill_info_v314(d, flags));
+DEFINE_ALIAS(int pci_fill_info_v30(struct pci_dev *d, int flags), pci_fill_info_v314);
+DEFINE_ALIAS(int pci_fill_info_v31(struct pci_dev *d, int flags), pci_fill_info_v314);
+DEFINE_ALIAS(int pci_fill_info_v32(struct pci_dev *d, int flags), pci_fill_info_v314);
+DEFINE_ALIAS(int pci_fill_info_v33(struct pci_dev *d, int flags), pci_fill_info_v314);
+DEFINE_ALIAS(int pci_fill_info_v34(struct pci_dev *d, int flags), pci_fill_info_v314);
+DEFINE_ALIAS(int pci_fill_info_v35(struct pci_dev *d, int flags), pci_fill_info_v314);
+DEFINE_ALIAS(int pci_fill_info_v38(struct pci_dev *d, int flags), pci_fill_info_v314);
+DEFINE_ALIAS(int pci_fill_info_v313(struct pci_dev *d, int flags), pci_fill_info_v314);
 SYMBOL_VERSION(pci_fill_info_v30, pci_fill_info@LIBPCI_3.0);
 SYMBOL_VERSION(pci_fill_info_v31, pci_fill_info@LIBPCI_3.1);
 SYMBOL_VERSION(pci_fill_info_v32, pci_fill_info@LIBPCI_3.2);
@@ -221,7 +956,34 @@ SYMBOL_VERSION(pci_fill_info_v33, pci_fill_info@LIBPCI_3.3);
 SYMBOL_VERSION(pci_fill_info_v34, pci_fill_info@LIBPCI_3.4);
 SYMBOL_VERSION(pci_fill_info_v35, pci_fill_info@LIBPCI_3.5);
 SYMBOL_VERSION(pci_fill_info_v38, pci_fill_info@LIBPCI_3.8);
-SYMBOL_VERSION(pci_fill_info_v313, pci_fill_info@@LIBPCI_3.13);
+SYMBOL_VERSION(pci_fill_info_v313, pci_fill_info@LIBPCI_3.13);
+SYMBOL_VERSION(pci_fill_info_v314, pci_fill_info@@LIBPCI_3.14);
+
+void
+pci_fill_info_batch(struct pci_access *a, int flags)
+{
+  unsigned int uflags = flags;
+  struct pci_dev *d;
+
+  pci_lock(a, PCI_LOCK_FILL);
+  if (uflags & PCI_FILL_RESCAN)
+    {
+      uflags &= ~PCI_FILL_RESCAN;
+      for (d = a->devices; d; d = d->next)
+	pci_reset_properties(d);
+    }
+  if (a->methods->fill_info_batch)
+    {
+      u64 start = a->stats ? pci_stats_start() : 0;
+      a->methods->fill_info_batch(a, uflags);
+      if (a->stats)
+	pci_stats_end(a, PCI_STATS_FILL_INFO, start, 0, 1);
+    }
+  for (d = a->devices; d; d = d->next)
+    if (uflags & ~d->known_fields)
+      method_fill_info(d, uflags);
+  pci_unlock(a, PCI_LOCK_FILL);
+}
 
 void
 pci_setup_cache(struct pci_dev *d, byte *cache, int len)
@@ -239,10 +1001,7 @@ pci_set_property(struct pci_dev *d, u32 key, char *value)
   while (p = *pp)
     {
       if (p->key == key)
-	{
-	  *pp = p->next;
-	  pci_mfree(p);
-	}
+	*pp = p->next;
       else
 	pp = &p->next;
     }
@@ -250,7 +1009,7 @@ pci_set_property(struct pci_dev *d, u32 key, char *value)
   if (!value)
     return NULL;
 
-  p = pci_malloc(d->access, sizeof(*p) + strlen(value));
+  p = pci_dev_alloc(d, sizeof(*p) + strlen(value));
   *pp = p;
   p->next = NULL;
   p->key = key;
@@ -259,7 +259,7 @@ aix_write(struct pci_dev *d, int pos, byte *buf, int len)
   return 1;
 }
 
-struct pci_methods pm_aix_device = {
+const struct pci_methods pm_aix_device = {
   .name = "aix-device",
   .help = "AIX /dev/pci[0-n]",
   .detect = aix_detect,
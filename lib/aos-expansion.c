@@ -220,7 +220,7 @@ aos_expansion_cleanup_dev(struct pci_dev *d)
 	}
 }
 
-struct pci_methods pm_aos_expansion = {
+const struct pci_methods pm_aos_expansion = {
 	.name = "aos-expansion",
 	.help = "The Expansion.library on AmigaOS 4.x",
 	.detect = aos_expansion_detect,		// detect, mandatory because called without check
@@ -0,0 +1,99 @@
+/*
+ *	The PCI Library -- Mapping of Memory BARs
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <string.h>
+
+#include "internal.h"
+
+/*
+ *  The address and size of the BAR are taken from the device fields,
+ *  the mapping itself is done by the back-end. Mappings are remembered per
+ *  BAR and reused by later calls, so polling of registers costs only the
+ *  memory accesses themselves. An existing mapping is never replaced, as the
+ *  callers may still hold pointers into it: a request it cannot satisfy fails.
+ */
+
+#define PCI_MAP_FLAGS (PCI_MAP_WRITE | PCI_MAP_WC)
+
+void *
+pci_map_bar(struct pci_dev *d, int bar, int flags, pciaddr_t *size)
+{
+  struct pci_access *a = d->access;
+  struct pci_bar_map *m;
+  void *ptr = NULL;
+
+  if (bar < 0 || bar >= 6 || (flags & ~PCI_MAP_FLAGS))
+    return NULL;
+  pci_fill_info_v314(d, PCI_FILL_BASES | PCI_FILL_SIZES);
+  if (!(d->known_fields & PCI_FILL_SIZES) || !d->size[bar] ||
+      (d->base_addr[bar] & PCI_BASE_ADDRESS_SPACE) != PCI_BASE_ADDRESS_SPACE_MEMORY)
+    {
+      a->debug("map_bar: BAR %d of %04x:%02x:%02x.%d is not a known memory BAR\n", bar, d->domain, d->bus, d->dev, d->func);
+      return NULL;
+    }
+  if (!d->methods->map_bar)
+    {
+      a->debug("map_bar: Not supported by the %s back-end\n", d->methods->name);
+      return NULL;
+    }
+
+  pci_lock_dev(d);
+  if (!d->bar_maps)
+    {
+      d->bar_maps = pci_malloc(a, 6 * sizeof(struct pci_bar_map));
+      memset(d->bar_maps, 0, 6 * sizeof(struct pci_bar_map));
+    }
+  m = &d->bar_maps[bar];
+  if (!m->ptr)
+    {
+      m->addr = d->base_addr[bar] & PCI_ADDR_MEM_MASK;
+      m->size = d->size[bar];
+      m->flags = flags;
+      if (!d->methods->map_bar(d, bar, flags, m))
+	m->ptr = NULL;
+    }
+  if (m->ptr && ((m->flags & flags) != flags || ((m->flags ^ flags) & PCI_MAP_WC)))
+    a->debug("map_bar: BAR %d of %04x:%02x:%02x.%d is already mapped with different flags\n", bar, d->domain, d->bus, d->dev, d->func);
+  else
+    ptr = m->ptr;
+  if (ptr && size)
+    *size = m->size;
+  pci_unlock_dev(d);
+  return ptr;
+}
+
+void
+pci_unmap_bar(struct pci_dev *d, int bar)
+{
+  struct pci_bar_map *m;
+
+  if (bar < 0 || bar >= 6 || !d->bar_maps)
+    return;
+  pci_lock_dev(d);
+  m = &d->bar_maps[bar];
+  if (m->ptr)
+    {
+      d->methods->unmap_bar(d, m);
+      m->ptr = NULL;
+    }
+  pci_unlock_dev(d);
+}
+
+void
+pci_free_bar_maps(struct pci_dev *d)
+{
+  int i;
+
+  if (!d->bar_maps)
+    return;
+  for (i = 0; i < 6; i++)
+    if (d->bar_maps[i].ptr)
+      d->methods->unmap_bar(d, &d->bar_maps[i]);
+  pci_mfree(d->bar_maps);
+  d->bar_maps = NULL;
+}
@@ -12,11 +12,101 @@
 
 #include "internal.h"
 
+/*
+ *  Besides the list of capabilities, each device has an index of the list,
+ *  which is a small hash table mapping (type, id) to the first capability
+ *  of that kind and the number of such capabilities. It is built on the
+ *  first lookup and dropped whenever the list changes.
+ */
+
+struct pci_cap_slot {
+  u32 key;				/* (type << 16) | id, 0 if the slot is empty */
+  unsigned int count;
+  struct pci_cap *first;
+};
+
+struct pci_cap_index {
+  unsigned int mask;
+  struct pci_cap_slot slots[1];
+};
+
+static inline u32
+cap_key(unsigned int id, unsigned int type)
+{
+  return (type << 16) | id;
+}
+
+static inline unsigned int
+cap_hash(u32 key)
+{
+  return key * 0x9e3779b1 >> 16;
+}
+
+static void
+pci_free_cap_index(struct pci_dev *d)
+{
+  pci_mfree(d->cap_index);
+  d->cap_index = NULL;
+}
+
+static struct pci_cap_slot *
+cap_index_slot(struct pci_cap_index *x, u32 key)
+{
+  unsigned int i = cap_hash(key) & x->mask;
+
+  while (x->slots[i].key && x->slots[i].key != key)
+    i = (i + 1) & x->mask;
+  return &x->slots[i];
+}
+
+static void
+pci_build_cap_index(struct pci_dev *d)
+{
+  struct pci_cap_index *x;
+  struct pci_cap *c;
+  unsigned int n = 0, size = 4;
+
+  for (c=d->first_cap; c; c=c->next)
+    n++;
+  while (size < 2*n)
+    size *= 2;
+
+  x = pci_malloc(d->access, sizeof(*x) + (size-1) * sizeof(x->slots[0]));
+  memset(x->slots, 0, size * sizeof(x->slots[0]));
+  x->mask = size - 1;
+  for (c=d->first_cap; c; c=c->next)
+    {
+      struct pci_cap_slot *s = cap_index_slot(x, cap_key(c->id, c->type));
+      if (!s->key)
+	{
+	  s->key = cap_key(c->id, c->type);
+	  s->first = c;
+	}
+      s->count++;
+    }
+  d->cap_index = x;
+}
+
+/* Config space offsets we have seen while walking a capability list */
+
+#define CAP_SEEN_WORDS (0x1000 / 4 / 32)
+
+static inline int
+cap_seen(u32 *seen, int where)
+{
+  u32 bit = 1U << ((where / 4) % 32);
+  int old = seen[where / 128] & bit;
+
+  seen[where / 128] |= bit;
+  return old;
+}
+
 static void
 pci_add_cap(struct pci_dev *d, unsigned int addr, unsigned int id, unsigned int type)
 {
-  struct pci_cap *cap = pci_malloc(d->access, sizeof(*cap));
+  struct pci_cap *cap = pci_dev_alloc(d, sizeof(*cap));
 
+  pci_free_cap_index(d);
   if (d->last_cap)
     d->last_cap->next = cap;
   else
@@ -34,19 +124,19 @@ static void
 pci_scan_trad_caps(struct pci_dev *d)
 {
   word status = pci_read_word(d, PCI_STATUS);
-  byte been_there[256];
+  u32 seen[256 / 4 / 32];
   int where;
 
   if (!(status & PCI_STATUS_CAP_LIST))
     return;
 
-  memset(been_there, 0, 256);
+  memset(seen, 0, sizeof(seen));
   where = pci_read_byte(d, PCI_CAPABILITY_LIST) & ~3;
   while (where)
     {
       byte id = pci_read_byte(d, where + PCI_CAP_LIST_ID);
       byte next = pci_read_byte(d, where + PCI_CAP_LIST_NEXT) & ~3;
-      if (been_there[where]++)
+      if (cap_seen(seen, where))
 	break;
       if (id == 0xff)
 	break;
@@ -58,13 +148,13 @@ pci_scan_trad_caps(struct pci_dev *d)
 static void
 pci_scan_ext_caps(struct pci_dev *d)
 {
-  byte been_there[0x1000];
+  u32 seen[CAP_SEEN_WORDS];
   int where = 0x100;
 
   if (!pci_find_cap(d, PCI_CAP_ID_EXP, PCI_CAP_NORMAL))
     return;
 
-  memset(been_there, 0, 0x1000);
+  memset(seen, 0, sizeof(seen));
   do
     {
       u32 header;
@@ -74,7 +164,7 @@ pci_scan_ext_caps(struct pci_dev *d)
       if (!header || header == 0xffffffff)
 	break;
       id = header & 0xffff;
-      if (been_there[where]++)
+      if (cap_seen(seen, where))
 	break;
       pci_add_cap(d, where, id, PCI_CAP_EXTENDED);
       where = (header >> 20) & ~3;
@@ -82,6 +172,170 @@ pci_scan_ext_caps(struct pci_dev *d)
   while (where);
 }
 
+/*
+ *  All virtual functions of an SR-IOV physical function have the same layout
+ *  of capabilities. When we find an SR-IOV capability, we remember the routing
+ *  ID's of its VF's. The capabilities of the first VF we scan are kept as
+ *  a template and the other VF's just copy it, after checking that their
+ *  identity and the header of their first capability match.
+ */
+
+struct pci_cap_template {
+  u16 vendor_id, device_id;
+  u8 rev_id;
+  u32 check;				/* Spot check, see cap_template_check() */
+  int num_caps;
+  struct {
+    u16 id;
+    unsigned int addr;
+  } caps[1];
+};
+
+struct pci_vf_family {
+  struct pci_vf_family *next;
+  int domain;
+  u16 pf_rid, first_rid, stride, num_vfs;
+  struct pci_cap_template *tmpl[2];	/* Indexed by type-1 */
+};
+
+static inline unsigned int
+dev_rid(struct pci_dev *d)
+{
+  return (d->bus << 8) | (d->dev << 3) | d->func;
+}
+
+static void
+free_vf_family(struct pci_vf_family *f)
+{
+  pci_mfree(f->tmpl[0]);
+  pci_mfree(f->tmpl[1]);
+  pci_mfree(f);
+}
+
+static void
+add_vf_family(struct pci_dev *d, struct pci_cap *sriov)
+{
+  struct pci_access *a = d->access;
+  struct pci_vf_family *f, **fp;
+  unsigned int offset, stride, num;
+
+  for (fp = &a->vf_families; f = *fp; fp = &f->next)
+    if (f->domain == d->domain && f->pf_rid == dev_rid(d))
+      {
+	*fp = f->next;
+	free_vf_family(f);
+	break;
+      }
+
+  if (!(pci_read_word(d, sriov->addr + PCI_IOV_CTRL) & PCI_IOV_CTRL_VFE))
+    return;
+  num = pci_read_word(d, sriov->addr + PCI_IOV_NUMVF);
+  offset = pci_read_word(d, sriov->addr + PCI_IOV_OFFSET);
+  stride = pci_read_word(d, sriov->addr + PCI_IOV_STRIDE);
+  if (!num || !offset || (num > 1 && !stride) || dev_rid(d) + offset + (num-1) * stride > 0xffff)
+    return;
+
+  f = pci_malloc(a, sizeof(*f));
+  memset(f, 0, sizeof(*f));
+  f->domain = d->domain;
+  f->pf_rid = dev_rid(d);
+  f->first_rid = dev_rid(d) + offset;
+  f->stride = stride;
+  f->num_vfs = num;
+  f->next = a->vf_families;
+  a->vf_families = f;
+}
+
+static struct pci_vf_family *
+find_vf_family(struct pci_dev *d)
+{
+  struct pci_vf_family *f;
+  unsigned int rid = dev_rid(d);
+
+  for (f = d->access->vf_families; f; f = f->next)
+    if (f->domain == d->domain && rid >= f->first_rid &&
+	(!f->stride ? rid == f->first_rid :
+	 (rid - f->first_rid) % f->stride == 0 && (rid - f->first_rid) / f->stride < f->num_vfs))
+      return f;
+  return NULL;
+}
+
+static u32
+cap_template_check(struct pci_dev *d, unsigned int type, struct pci_cap_template *t)
+{
+  if (type == PCI_CAP_EXTENDED)
+    return pci_read_long(d, 0x100);
+  if (!(pci_read_word(d, PCI_STATUS) & PCI_STATUS_CAP_LIST))
+    return 0;
+  /* Only ID and next pointer, the rest of the header can differ */
+  return pci_read_byte(d, PCI_CAPABILITY_LIST) | (t->num_caps ? pci_read_word(d, t->caps[0].addr) << 8 : 0);
+}
+
+static int
+cap_template_matches(struct pci_dev *d, unsigned int type, struct pci_cap_template *t)
+{
+  return d->vendor_id == t->vendor_id && d->device_id == t->device_id &&
+    pci_read_byte(d, PCI_REVISION_ID) == t->rev_id &&
+    cap_template_check(d, type, t) == t->check;
+}
+
+static void
+save_cap_template(struct pci_dev *d, unsigned int type, struct pci_vf_family *f)
+{
+  struct pci_cap_template *t;
+  struct pci_cap *c;
+  int n = 0;
+
+  for (c=d->first_cap; c; c=c->next)
+    if (c->type == type)
+      n++;
+  t = pci_malloc(d->access, sizeof(*t) + (n ? n-1 : 0) * sizeof(t->caps[0]));
+  t->vendor_id = d->vendor_id;
+  t->device_id = d->device_id;
+  t->rev_id = pci_read_byte(d, PCI_REVISION_ID);
+  t->num_caps = 0;
+  for (c=d->first_cap; c; c=c->next)
+    if (c->type == type)
+      {
+	t->caps[t->num_caps].id = c->id;
+	t->caps[t->num_caps].addr = c->addr;
+	t->num_caps++;
+      }
+  t->check = cap_template_check(d, type, t);
+  f->tmpl[type-1] = t;
+}
+
+static void
+scan_caps_of_type(struct pci_dev *d, unsigned int type)
+{
+  struct pci_vf_family *f = (d->known_fields & PCI_FILL_IDENT) ? find_vf_family(d) : NULL;
+  struct pci_cap_template *t = f ? f->tmpl[type-1] : NULL;
+  int i;
+
+  if (t && cap_template_matches(d, type, t))
+    {
+      d->access->debug("%04x:%02x:%02x.%d: Using capabilities of a sibling virtual function\n",
+	d->domain, d->bus, d->dev, d->func);
+      for (i=0; i<t->num_caps; i++)
+	pci_add_cap(d, t->caps[i].addr, t->caps[i].id, type);
+      return;
+    }
+
+  if (type == PCI_CAP_NORMAL)
+    pci_scan_trad_caps(d);
+  else
+    pci_scan_ext_caps(d);
+
+  if (f && !t)
+    save_cap_template(d, type, f);
+  if (type == PCI_CAP_EXTENDED)
+    {
+      struct pci_cap *sriov = pci_find_cap(d, PCI_EXT_CAP_ID_SRIOV, PCI_CAP_EXTENDED);
+      if (sriov)
+	add_vf_family(d, sriov);
+    }
+}
+
 void
 pci_scan_caps(struct pci_dev *d, unsigned int want_fields)
 {
@@ -89,23 +343,47 @@ pci_scan_caps(struct pci_dev *d, unsigned int want_fields)
     want_fields |= PCI_FILL_CAPS;
 
   if (want_fill(d, want_fields, PCI_FILL_CAPS))
-    pci_scan_trad_caps(d);
+    scan_caps_of_type(d, PCI_CAP_NORMAL);
   if (want_fill(d, want_fields, PCI_FILL_EXT_CAPS))
-    pci_scan_ext_caps(d);
+    scan_caps_of_type(d, PCI_CAP_EXTENDED);
 }
 
+/* Called when a device disappears, so that a new PF at the same address starts afresh */
 void
-pci_free_caps(struct pci_dev *d)
+pci_forget_vf_family(struct pci_dev *d)
+{
+  struct pci_vf_family *f, **fp;
+
+  for (fp = &d->access->vf_families; f = *fp; fp = &f->next)
+    if (f->domain == d->domain && f->pf_rid == dev_rid(d))
+      {
+	*fp = f->next;
+	free_vf_family(f);
+	return;
+      }
+}
+
+void
+pci_free_vf_families(struct pci_access *a)
 {
-  struct pci_cap *cap;
+  struct pci_vf_family *f;
 
-  while (cap = d->first_cap)
+  while (f = a->vf_families)
     {
-      d->first_cap = cap->next;
-      pci_mfree(cap);
+      a->vf_families = f->next;
+      free_vf_family(f);
     }
 }
 
+void
+pci_free_caps(struct pci_dev *d)
+{
+  /* The capabilities themselves live in the arena of the device */
+  d->first_cap = NULL;
+  d->last_cap = NULL;
+  pci_free_cap_index(d);
+}
+
 struct pci_cap *
 pci_find_cap(struct pci_dev *d, unsigned int id, unsigned int type)
 {
@@ -126,23 +404,21 @@ pci_find_cap_nr(struct pci_dev *d, unsigned int id, unsigned int type,
                 unsigned int *cap_number)
 {
   struct pci_cap *c;
-  struct pci_cap *found = NULL;
+  struct pci_cap_slot *s;
   unsigned int target = (cap_number ? *cap_number : 0);
   unsigned int index = 0;
 
-  pci_fill_info_v313(d, ((type == PCI_CAP_NORMAL) ? PCI_FILL_CAPS : PCI_FILL_EXT_CAPS));
-
-  for (c=d->first_cap; c; c=c->next)
-    {
-      if (c->type == type && c->id == id)
-	{
-	  if (target == index)
-	    found = c;
-	  index++;
-	}
-    }
+  pci_fill_info_v314(d, ((type == PCI_CAP_NORMAL) ? PCI_FILL_CAPS : PCI_FILL_EXT_CAPS));
 
+  if (!d->cap_index)
+    pci_build_cap_index(d);
+  s = cap_index_slot(d->cap_index, cap_key(id, type));
   if (cap_number)
-    *cap_number = index;
-  return found;
+    *cap_number = s->count;
+  if (!s->key || target >= s->count)
+    return NULL;
+
+  for (c=s->first; ; c=c->next)
+    if (c->type == type && c->id == id && index++ == target)
+      return c;
 }
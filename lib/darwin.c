@@ -98,24 +98,33 @@ darwin_detect(struct pci_access *a)
   return 1;
 }
 
+struct darwin_access {
+  int no_qword;				/* The platform refused a 64-bit access */
+};
+
 static void
-darwin_init(struct pci_access *a UNUSED)
+darwin_init(struct pci_access *a)
 {
+  struct darwin_access *da = pci_malloc(a, sizeof(*da));
+
+  memset(da, 0, sizeof(*da));
+  a->backend_data = da;
 }
 
 static void
-darwin_cleanup(struct pci_access *a UNUSED)
+darwin_cleanup(struct pci_access *a)
 {
+  pci_mfree(a->backend_data);
+  a->backend_data = NULL;
 }
 
-static int
-darwin_read(struct pci_dev *d, int pos, byte *buf, int len)
+/* A single round-trip to the kernel */
+static kern_return_t
+darwin_call(struct pci_dev *d, UInt32 method, int pos, int len, UInt64 *value)
 {
-  if (!(len == 1 || len == 2 || len == 4))
-    return pci_generic_block_read(d, pos, buf, len);
-
   AddressSpaceParam param;
-  kern_return_t     status;
+  size_t outSize;
+  kern_return_t status;
 
   param.spaceID   = kIOACPIAddressSpaceIDPCIConfiguration;
   param.bitWidth  = len * 8;
@@ -128,75 +137,126 @@ darwin_read(struct pci_dev *d, int pos, byte *buf, int len)
   param.address.pci.bus      = d->bus;
   param.address.pci.segment  = d->domain;
   param.address.pci.reserved = 0;
-  param.value                = -1ULL;
 
-  size_t outSize = sizeof(param);
-  status = IOConnectCallStructMethod(d->access->fd, kACPIMethodAddressSpaceRead,
-    &param, sizeof(param),
-    &param, &outSize);
+  if (method == kACPIMethodAddressSpaceRead)
+    {
+      param.value = -1ULL;
+      outSize = sizeof(param);
+      status = IOConnectCallStructMethod(d->access->fd, method, &param, sizeof(param), &param, &outSize);
+      *value = param.value;
+    }
+  else
+    {
+      param.value = *value;
+      outSize = 0;
+      status = IOConnectCallStructMethod(d->access->fd, method, &param, sizeof(param), NULL, &outSize);
+    }
+  return status;
+}
+
+static int darwin_block_read(struct pci_dev *d, int pos, byte *buf, int len);
+
+static int
+darwin_read(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  kern_return_t status;
+  UInt64 value;
+
+  if (!(len == 1 || len == 2 || len == 4))
+    return darwin_block_read(d, pos, buf, len);
+
+  status = darwin_call(d, kACPIMethodAddressSpaceRead, pos, len, &value);
   if ((kIOReturnSuccess != status))
     d->access->error("darwin_read: kACPIMethodAddressSpaceRead failed: %s", mach_error_string(status));
 
   switch (len)
     {
     case 1:
-      buf[0] = (u8) param.value;
+      buf[0] = (u8) value;
       break;
     case 2:
-      ((u16 *) buf)[0] = cpu_to_le16((u16) param.value);
+      ((u16 *) buf)[0] = cpu_to_le16((u16) value);
       break;
     case 4:
-      ((u32 *) buf)[0] = cpu_to_le32((u32) param.value);
+      ((u32 *) buf)[0] = cpu_to_le32((u32) value);
       break;
     }
   return 1;
 }
 
+/*
+ *  Every access costs a round-trip to the kernel, so block reads are split
+ *  to as few accesses as possible. ACPI allows accessing an address space
+ *  by 64 bits at once; if the platform refuses it, we stay with 32 bits.
+ */
 static int
-darwin_write(struct pci_dev *d, int pos, byte *buf, int len)
+darwin_block_read(struct pci_dev *d, int pos, byte *buf, int len)
 {
-  if (!(len == 1 || len == 2 || len == 4))
-    return pci_generic_block_write(d, pos, buf, len);
+  struct darwin_access *da = d->access->backend_data;
+  UInt64 value;
+  int i, width;
 
-  AddressSpaceParam param;
-  kern_return_t     status;
+  while (len > 0)
+    {
+      if (!(pos & 7) && len >= 8 && !da->no_qword)
+	{
+	  if (darwin_call(d, kACPIMethodAddressSpaceRead, pos, 8, &value) == kIOReturnSuccess)
+	    {
+	      for (i = 0; i < 8; i++)
+		buf[i] = value >> (8*i);
+	      pos += 8;
+	      buf += 8;
+	      len -= 8;
+	      continue;
+	    }
+	  d->access->debug("darwin: 64-bit accesses not supported, using 32-bit ones\n");
+	  da->no_qword = 1;
+	}
+      if (!(pos & 3) && len >= 4)
+	width = 4;
+      else if (!(pos & 1) && len >= 2)
+	width = 2;
+      else
+	width = 1;
+      if (!darwin_read(d, pos, buf, width))
+	return 0;
+      pos += width;
+      buf += width;
+      len -= width;
+    }
+  return 1;
+}
 
-  param.spaceID   = kIOACPIAddressSpaceIDPCIConfiguration;
-  param.bitWidth  = len * 8;
-  param.bitOffset = 0;
-  param.options   = 0;
+static int
+darwin_write(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  kern_return_t status;
+  UInt64 value;
 
-  param.address.pci.offset   = pos;
-  param.address.pci.function = d->func;
-  param.address.pci.device   = d->dev;
-  param.address.pci.bus      = d->bus;
-  param.address.pci.segment  = d->domain;
-  param.address.pci.reserved = 0;
+  if (!(len == 1 || len == 2 || len == 4))
+    return pci_generic_block_write(d, pos, buf, len);
 
   switch (len)
     {
     case 1:
-      param.value = buf[0];
+      value = buf[0];
       break;
     case 2:
-      param.value = le16_to_cpu(((u16 *) buf)[0]);
+      value = le16_to_cpu(((u16 *) buf)[0]);
       break;
-    case 4:
-      param.value = le32_to_cpu(((u32 *) buf)[0]);
+    default:
+      value = le32_to_cpu(((u32 *) buf)[0]);
       break;
     }
 
-  size_t outSize = 0;
-  status = IOConnectCallStructMethod(d->access->fd, kACPIMethodAddressSpaceWrite,
-    &param, sizeof(param),
-    NULL, &outSize);
+  status = darwin_call(d, kACPIMethodAddressSpaceWrite, pos, len, &value);
   if ((kIOReturnSuccess != status))
-    d->access->error("darwin_read: kACPIMethodAddressSpaceWrite failed: %s", mach_error_string(status));
+    d->access->error("darwin_write: kACPIMethodAddressSpaceWrite failed: %s", mach_error_string(status));
 
   return 1;
 }
 
-struct pci_methods pm_darwin = {
+const struct pci_methods pm_darwin = {
     .name = "darwin",
     .help = "Darwin",
     .config = darwin_config,
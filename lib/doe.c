@@ -0,0 +1,283 @@
+/*
+ *	The PCI Library -- Data Object Exchange Mailboxes
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "internal.h"
+
+#ifdef PCI_OS_WINDOWS
+#include <windows.h>
+#endif
+
+/*
+ *  A data object is written to the Write Data Mailbox one dword at a time,
+ *  then the exchange is started by setting DOE Go. When the response is
+ *  ready, it is read from the Read Data Mailbox, writing to the mailbox after
+ *  each dword to advance to the next one (PCIe Base Spec r6.0, sec. 6.30).
+ *
+ *  Polling starts with back-to-back reads of the status register, which is
+ *  what completes most exchanges handled by the device firmware quickly,
+ *  and only then it falls back to sleeping with exponentially growing
+ *  intervals. The mailbox registers must never be served from the config
+ *  space cache, so they are invalidated before every read.
+ */
+
+#define DOE_TIMEOUT_US		1000000		/* As required by the spec */
+#define DOE_SPIN_POLLS		64
+#define DOE_MAX_SLEEP_US	10000
+#define DOE_MAX_PROTOCOLS	256
+
+/* Discovery is always supported as PCI-SIG protocol 0 */
+#define DOE_VENDOR_PCI_SIG	0x0001
+#define DOE_TYPE_DISCOVERY	0
+
+struct pci_doe {
+  struct pci_doe *next;
+  int where;				/* Address of the DOE capability */
+  int num_protocols;			/* -1 if the discovery failed */
+  struct pci_doe_protocol *protocols;
+};
+
+static void
+doe_sleep(unsigned int us)
+{
+#ifdef PCI_OS_WINDOWS
+  Sleep((us + 999) / 1000);
+#else
+  struct timespec ts;
+
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000;
+  nanosleep(&ts, NULL);
+#endif
+}
+
+static u32
+doe_read(struct pci_dev *d, int pos)
+{
+  u32 val;
+
+  pci_invalidate_config_cache(d, pos, 4);
+  if (!pci_read_block(d, pos, (byte *) &val, 4))
+    return 0xffffffff;
+  return le32_to_cpu(val);
+}
+
+/* Wait until all bits of mask in the status register are equal to those of want */
+static u32
+doe_wait(struct pci_dev *d, int where, u32 mask, u32 want)
+{
+  unsigned int polls = 0, slept = 0, interval = 1;
+  u64 start = pci_stats_start();
+  u32 sts;
+
+  for (;;)
+    {
+      sts = doe_read(d, where + PCI_DOE_STS);
+      if (sts == 0xffffffff)
+	return sts;
+      if ((sts & mask) == want || (sts & PCI_DOE_STS_ERROR))
+	return sts;
+      /* Without a monotonic clock, only the time spent sleeping is counted */
+      if ((start ? (pci_stats_start() - start) / 1000 : slept) >= DOE_TIMEOUT_US)
+	return sts;
+      if (++polls < DOE_SPIN_POLLS)
+	continue;
+      doe_sleep(interval);
+      slept += interval;
+      if (interval < DOE_MAX_SLEEP_US)
+	interval *= 2;
+    }
+}
+
+static int
+doe_abort(struct pci_dev *d, int where)
+{
+  u32 sts;
+
+  d->access->debug("doe: aborting exchange at %04x:%02x:%02x.%d/%03x\n", d->domain, d->bus, d->dev, d->func, where);
+  pci_write_long(d, where + PCI_DOE_CTL, PCI_DOE_CTL_ABORT);
+  sts = doe_wait(d, where, PCI_DOE_STS_BUSY | PCI_DOE_STS_ERROR, 0);
+  return sts != 0xffffffff && !(sts & (PCI_DOE_STS_BUSY | PCI_DOE_STS_ERROR));
+}
+
+int
+pci_doe_exchange(struct pci_dev *d, int where, int vendor_id, int type, u32 *req, int req_len, u32 *resp, int resp_max)
+{
+  struct pci_access *a = d->access;
+  u32 sts, hdr, len;
+  int i;
+
+  sts = doe_read(d, where + PCI_DOE_STS);
+  if (sts == 0xffffffff)
+    return -1;
+  if (sts & PCI_DOE_STS_BUSY)
+    sts = doe_wait(d, where, PCI_DOE_STS_BUSY, 0);
+  if ((sts & (PCI_DOE_STS_BUSY | PCI_DOE_STS_ERROR | PCI_DOE_STS_OBJECT_READY)) && !doe_abort(d, where))
+    return -1;
+
+  pci_write_long(d, where + PCI_DOE_WRITE, (vendor_id & 0xffff) | ((type & 0xff) << 16));
+  pci_write_long(d, where + PCI_DOE_WRITE, req_len + 2);
+  for (i = 0; i < req_len; i++)
+    pci_write_long(d, where + PCI_DOE_WRITE, req[i]);
+  pci_write_long(d, where + PCI_DOE_CTL, (doe_read(d, where + PCI_DOE_CTL) & PCI_DOE_CTL_INT) | PCI_DOE_CTL_GO);
+
+  sts = doe_wait(d, where, PCI_DOE_STS_OBJECT_READY, PCI_DOE_STS_OBJECT_READY);
+  if (sts == 0xffffffff || !(sts & PCI_DOE_STS_OBJECT_READY) || (sts & PCI_DOE_STS_ERROR))
+    {
+      a->debug("doe: no response (status %08x)\n", sts);
+      doe_abort(d, where);
+      return -1;
+    }
+
+  hdr = doe_read(d, where + PCI_DOE_READ);
+  pci_write_long(d, where + PCI_DOE_READ, 0);
+  len = doe_read(d, where + PCI_DOE_READ) & 0x3ffff;
+  pci_write_long(d, where + PCI_DOE_READ, 0);
+  if (!len)
+    len = 0x40000;
+  if ((hdr & 0xffffff) != ((vendor_id & 0xffff) | ((u32) (type & 0xff) << 16)) || len < 2)
+    {
+      a->debug("doe: unexpected response header %08x, length %u\n", hdr, len);
+      doe_abort(d, where);
+      return -1;
+    }
+  len -= 2;
+
+  for (i = 0; i < (int) len; i++)
+    {
+      u32 val = doe_read(d, where + PCI_DOE_READ);
+      pci_write_long(d, where + PCI_DOE_READ, 0);
+      if (i < resp_max)
+	resp[i] = val;
+    }
+  if ((int) len > resp_max)
+    a->debug("doe: response truncated from %u to %d dwords\n", len, resp_max);
+  return len;
+}
+
+static struct pci_doe *
+doe_get(struct pci_dev *d, int where)
+{
+  struct pci_doe *m;
+  u32 req, resp;
+  int index = 0, n = 0;
+
+  for (m = d->doe; m; m = m->next)
+    if (m->where == where)
+      return m;
+
+  m = pci_malloc(d->access, sizeof(*m));
+  m->where = where;
+  m->protocols = pci_malloc(d->access, DOE_MAX_PROTOCOLS * sizeof(struct pci_doe_protocol));
+  do
+    {
+      req = index;
+      if (pci_doe_exchange(d, where, DOE_VENDOR_PCI_SIG, DOE_TYPE_DISCOVERY, &req, 1, &resp, 1) < 1)
+	{
+	  n = -1;
+	  break;
+	}
+      m->protocols[n].vendor_id = resp & 0xffff;
+      m->protocols[n].type = (resp >> 16) & 0xff;
+      n++;
+      index = resp >> 24;
+    }
+  while (index && n < DOE_MAX_PROTOCOLS);
+  m->num_protocols = n;
+  d->access->debug("doe: %04x:%02x:%02x.%d/%03x supports %d protocols\n", d->domain, d->bus, d->dev, d->func, where, n);
+
+  m->next = d->doe;
+  d->doe = m;
+  return m;
+}
+
+int
+pci_doe_get_protocols(struct pci_dev *d, int where, struct pci_doe_protocol **protocols)
+{
+  struct pci_doe *m = doe_get(d, where);
+
+  *protocols = m->protocols;
+  return m->num_protocols;
+}
+
+int
+pci_doe_find_mailbox(struct pci_dev *d, int vendor_id, int type)
+{
+  struct pci_cap *cap;
+  struct pci_doe *m;
+  int i;
+
+  pci_fill_info_v314(d, PCI_FILL_EXT_CAPS);
+  for (cap = d->first_cap; cap; cap = cap->next)
+    if (cap->type == PCI_CAP_EXTENDED && cap->id == PCI_EXT_CAP_ID_DOE)
+      {
+	m = doe_get(d, cap->addr);
+	for (i = 0; i < m->num_protocols; i++)
+	  if (m->protocols[i].vendor_id == vendor_id && m->protocols[i].type == type)
+	    return cap->addr;
+      }
+  return 0;
+}
+
+struct doe_discover {
+  struct pci_dev **devs;
+};
+
+static void
+doe_discover_job(void *data, int job)
+{
+  struct doe_discover *x = data;
+  struct pci_dev *d = x->devs[job];
+  struct pci_cap *cap;
+
+  for (cap = d->first_cap; cap; cap = cap->next)
+    if (cap->type == PCI_CAP_EXTENDED && cap->id == PCI_EXT_CAP_ID_DOE)
+      doe_get(d, cap->addr);
+}
+
+void
+pci_doe_discover(struct pci_access *a, int threads)
+{
+  struct doe_discover x;
+  struct pci_dev *d;
+  int n = 0;
+
+  for (d = a->devices; d; d = d->next)
+    n++;
+  x.devs = pci_malloc(a, (n + 1) * sizeof(struct pci_dev *));
+
+  /* Capabilities are filled beforehand, since filling is serialized anyway */
+  n = 0;
+  for (d = a->devices; d; d = d->next)
+    if (pci_find_cap(d, PCI_EXT_CAP_ID_DOE, PCI_CAP_EXTENDED))
+      x.devs[n++] = d;
+  /* Without the locks, back-ends and their caches would be used from multiple threads at once */
+  if (threads > 1 && !a->locks)
+    {
+      a->debug("doe: thread safety not enabled, discovering serially\n");
+      threads = 1;
+    }
+  if (n)
+    pci_run_parallel(a, threads, n, doe_discover_job, &x);
+  pci_mfree(x.devs);
+}
+
+void
+pci_free_doe(struct pci_dev *d)
+{
+  struct pci_doe *m;
+
+  while (m = d->doe)
+    {
+      d->doe = m->next;
+      pci_mfree(m->protocols);
+      pci_mfree(m);
+    }
+}
@@ -9,21 +9,103 @@
  */
 
 #include <stdio.h>
-#include <ctype.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "internal.h"
 
+#ifdef PCI_HAVE_MMAP
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ *  Besides the text format produced by `lspci -x', we read binary dumps
+ *  written by pci_write_dump() (`lspci -B'). A binary dump consists of
+ *  a header (magic, version, number of devices and a reserved word) followed
+ *  by a record for each device: domain, bus, device, function, a reserved byte,
+ *  length of the config space, length of the properties (since version 2),
+ *  the config space itself padded to a multiple of 4 bytes and the properties.
+ *  Properties are provided by the OS (e.g., resources, NUMA node or the driver),
+ *  each of them is identified by a PCI_FILL_xxx flag and followed by its length
+ *  and value padded to a multiple of 4 bytes. All numbers are little-endian
+ *  regardless of the machine which created the dump. Binary dumps are mapped
+ *  to memory and the devices refer to the mapping directly.
+ */
+
+#define DUMP_BIN_MAGIC 0x44554d50	/* "PMUD" in the file */
+#define DUMP_BIN_VERSION 2
+#define DUMP_BIN_HEADER_SIZE 16
+#define DUMP_BIN_DEV_SIZE 16		/* 12 in version 1 */
+#define DUMP_BIN_PROP_SIZE 8
+
+/*
+ *  PCI_FILL_BASES stands for all resources: 64-bit (base, size, flags) of the 6 regions,
+ *  of the expansion ROM and of the 4 bridge windows.
+ */
+#define DUMP_BIN_RESOURCES 33
+
+/* The data need not be aligned, so numbers are always accessed by memcpy() */
+
+static inline u32
+dump_get_u32(byte *p)
+{
+  u32 x;
+  memcpy(&x, p, 4);
+  return le32_to_cpu(x);
+}
+
+static inline void
+dump_put_u32(byte *p, u32 x)
+{
+  x = cpu_to_le32(x);
+  memcpy(p, &x, 4);
+}
+
+static inline u64
+dump_get_u64(byte *p)
+{
+  return dump_get_u32(p) | ((u64) dump_get_u32(p + 4) << 32);
+}
+
+static inline void
+dump_put_u64(byte *p, u64 x)
+{
+  dump_put_u32(p, x);
+  dump_put_u32(p + 4, x >> 32);
+}
+
+/*
+ *  Devices read from the dump are kept in a list and pci_dev's referring
+ *  to them are created by every scan of the bus.
+ */
+
 struct dump_data {
-  int len, allocated;
-  byte data[1];
+  struct dump_data *next;
+  int domain, bus, dev, func;
+  int len;
+  byte *data;				/* Either buf[] or a part of the mapped binary dump */
+  byte *props;				/* Properties in the binary dump (if any) */
+  u32 props_len;
+  byte buf[1];
+};
+
+struct dump_file {
+  byte *data;
+  size_t size;
+  int mapped;
+  struct dump_data *first, **last;	/* Devices in the order of the dump */
 };
 
 static void
 dump_config(struct pci_access *a)
 {
   pci_define_param(a, "dump.name", "", "Name of the bus dump file to read from");
+  pci_define_param(a, "dump.writable", "0", "Let writes change the config space in memory (the file is never modified)");
 }
 
 static int
@@ -33,152 +115,538 @@ dump_detect(struct pci_access *a)
   return name && name[0];
 }
 
+static int
+dump_read_stream(struct pci_access *a, struct dump_file *df, FILE *f)
+{
+  size_t allocated = 65536, n;
+
+  df->data = pci_malloc(a, allocated);
+  df->size = 0;
+  while (n = fread(df->data + df->size, 1, allocated - df->size, f))
+    {
+      df->size += n;
+      if (df->size == allocated)
+	{
+	  allocated *= 2;
+	  df->data = pci_realloc(a, df->data, allocated);
+	}
+    }
+  return !ferror(f);
+}
+
+static void
+dump_open(struct pci_access *a, struct dump_file *df, char *name, char *who)
+{
+  FILE *f;
+  int ok;
+
+  df->data = NULL;
+  df->size = 0;
+  df->mapped = 0;
+  df->first = NULL;
+  df->last = &df->first;
+
+#ifdef PCI_HAVE_MMAP
+  {
+    struct stat st;
+    int fd = open(name, O_RDONLY);
+    if (fd < 0)
+      a->error("%s: Cannot open %s: %s", who, name, strerror(errno));
+    if (fstat(fd, &st) >= 0 && S_ISREG(st.st_mode))
+      {
+	if (!st.st_size)
+	  {
+	    close(fd);
+	    return;
+	  }
+	/* The mapping is private, so writes allowed by dump.writable never reach the file */
+	df->data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (df->data != MAP_FAILED)
+	  {
+	    close(fd);
+	    df->size = st.st_size;
+	    df->mapped = 1;
+	    return;
+	  }
+	df->data = NULL;
+      }
+    /* Not a regular file (e.g., a pipe), so read it sequentially */
+    if (!(f = fdopen(fd, "rb")))
+      {
+	close(fd);
+	a->error("%s: Cannot open %s: %s", who, name, strerror(errno));
+      }
+  }
+#else
+  if (!(f = fopen(name, "rb")))
+    a->error("%s: Cannot open %s: %s", who, name, strerror(errno));
+#endif
+
+  ok = dump_read_stream(a, df, f);
+  fclose(f);
+  if (!ok)
+    {
+      pci_mfree(df->data);
+      a->error("%s: Error reading %s", who, name);
+    }
+}
+
 static void
-dump_alloc_data(struct pci_dev *dev, int len)
+dump_close(struct dump_file *df)
 {
-  struct dump_data *dd = pci_malloc(dev->access, sizeof(struct dump_data) + len - 1);
-  dd->allocated = len;
-  dd->len = 0;
-  memset(dd->data, 0xff, len);
-  dev->backend_data = dd;
+#ifdef PCI_HAVE_MMAP
+  if (df->mapped)
+    munmap(df->data, df->size);
+  else
+#endif
+    pci_mfree(df->data);
+  df->data = NULL;
+}
+
+static struct dump_data *
+dump_add_data(struct pci_access *a, unsigned int domain, unsigned int bus, unsigned int dev, unsigned int func, int len)
+{
+  struct dump_file *df = a->backend_data;
+  struct dump_data *dd = pci_malloc(a, sizeof(struct dump_data) + (len ? len-1 : 0));
+
+  dd->next = NULL;
+  dd->domain = domain;
+  dd->bus = bus;
+  dd->dev = dev;
+  dd->func = func;
+  dd->len = len;
+  dd->data = dd->buf;
+  dd->props = NULL;
+  dd->props_len = 0;
+  *df->last = dd;
+  df->last = &dd->next;
+  return dd;
+}
+
+static void
+dump_load_bin(struct pci_access *a, struct dump_file *df)
+{
+  u32 version = dump_get_u32(df->data + 4);
+  u32 num_devices = dump_get_u32(df->data + 8);
+  size_t pos = DUMP_BIN_HEADER_SIZE;
+  size_t rec_size = DUMP_BIN_DEV_SIZE;
+  u32 i;
+
+  if (version == 1)
+    rec_size -= 4;
+  else if (version != DUMP_BIN_VERSION)
+    a->error("dump: Unsupported version %u of the binary dump", version);
+  for (i=0; i<num_devices; i++)
+    {
+      byte *r;
+      struct dump_data *dd;
+      u32 len, props_len;
+
+      if (df->size - pos < rec_size)
+	a->error("dump: Truncated binary dump");
+      r = df->data + pos;
+      pos += rec_size;
+      len = dump_get_u32(r + 8);
+      props_len = (version >= 2) ? dump_get_u32(r + 12) : 0;
+      if (len > 4096 || df->size - pos < ((len + 3) & ~3U) ||
+	  (props_len & 3) || df->size - pos - ((len + 3) & ~3U) < props_len)
+	a->error("dump: Malformed binary dump");
+
+      dd = dump_add_data(a, dump_get_u32(r), r[4], r[5], r[6], 0);
+      dd->len = len;
+      dd->data = df->data + pos;
+      pos += (len + 3) & ~3U;
+      dd->props = props_len ? df->data + pos : NULL;
+      dd->props_len = props_len;
+      pos += props_len;
+    }
+}
+
+/* Values of hex digits plus one, zero for other characters */
+static const byte dump_hex_values[256] = {
+  ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+  ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+  ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+  ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+static inline int
+dump_hex_digit(int c)
+{
+  return dump_hex_values[c & 0xff] - 1;
+}
+
+/*
+ *  Parse a complete line of 16 bytes "xx xx ... xx" (47 characters), which is
+ *  what almost all lines of a dump look like, with one table lookup per digit
+ *  and no branches per byte. Returns 0 if the line has to be parsed the slow way.
+ */
+static int
+dump_hex_line(byte *p, byte *out)
+{
+  byte tmp[16];
+  unsigned int i, ok = 1, sep = 0;
+
+  for (i=0; i<16; i++, p+=3)
+    {
+      unsigned int hi = dump_hex_values[p[0]], lo = dump_hex_values[p[1]];
+      ok &= (hi != 0) & (lo != 0);
+      tmp[i] = ((hi - 1) << 4) | (lo - 1);
+      if (i < 15)
+	sep |= p[2] ^ ' ';
+    }
+  if (!ok || sep)
+    return 0;
+  memcpy(out, tmp, 16);
+  return 1;
+}
+
+/* Parse a hex number of min to max digits followed by the given separator; returns the next position or NULL */
+static byte *
+dump_hex_field(byte *p, byte *end, int min, int max, int sep, unsigned int *val)
+{
+  int digits = 0, x;
+
+  *val = 0;
+  while (p < end && digits < max && (x = dump_hex_digit(*p)) >= 0)
+    {
+      *val = (*val << 4) | x;
+      p++, digits++;
+    }
+  if (digits < min || p >= end || *p != sep)
+    return NULL;
+  return p + 1;
 }
 
+/* Recognize "[domain:]bus:dev.func " at the start of a line */
 static int
-dump_validate(char *s, char *fmt)
+dump_parse_addr(byte *p, byte *end, unsigned int *domain, unsigned int *bus, unsigned int *dev, unsigned int *func)
 {
-  while (*fmt)
+  unsigned int x;
+  byte *q;
+
+  *domain = 0;
+  if (!(q = dump_hex_field(p, end, 2, 6, ':', &x)))
+    return 0;
+  if (q - p == 3)
     {
-      if (*fmt == '#' ? !isxdigit(*s) : *fmt != *s)
-	return 0;
-      fmt++, s++;
+      /* Either "bus:dev.func" or a 2-digit domain, which is not valid */
+      byte *r = dump_hex_field(q, end, 2, 2, '.', dev);
+      if (r)
+	{
+	  *bus = x;
+	  q = r;
+	  goto func;
+	}
     }
+  if (q - p < 5)
+    return 0;
+  *domain = x;
+  if (!(q = dump_hex_field(q, end, 2, 2, ':', bus)) ||
+      !(q = dump_hex_field(q, end, 2, 2, '.', dev)))
+    return 0;
+func:
+  if (q + 1 >= end || *q < '0' || *q > '9' || q[1] != ' ')
+    return 0;
+  *func = *q - '0';
   return 1;
 }
 
+static void
+dump_finish_dev(struct pci_access *a, unsigned int *addr, byte *buf, int len)
+{
+  struct dump_data *dd;
+
+  if (!addr)
+    return;
+  dd = dump_add_data(a, addr[0], addr[1], addr[2], addr[3], len);
+  memcpy(dd->data, buf, len);
+}
+
+static void
+dump_load_text(struct pci_access *a, struct dump_file *df)
+{
+  byte *p = df->data, *stop = df->data + df->size;
+  unsigned int addr[4], *dev = NULL;
+  byte buf[4096];
+  int len = 0;
+
+  while (p < stop)
+    {
+      byte *end = memchr(p, '\n', stop - p);
+      byte *next;
+      unsigned int mn, bn, dn, fn, i;
+
+      if (end)
+	next = end + 1;
+      else
+	next = end = stop;
+      if (end > p && end[-1] == '\r')
+	end--;
+
+      if (dump_parse_addr(p, end, &mn, &bn, &dn, &fn))
+	{
+	  dump_finish_dev(a, dev, buf, len);
+	  addr[0] = mn;
+	  addr[1] = bn;
+	  addr[2] = dn;
+	  addr[3] = fn;
+	  dev = addr;
+	  memset(buf, 0xff, sizeof(buf));
+	  len = 0;
+	}
+      else if (p == end)
+	{
+	  dump_finish_dev(a, dev, buf, len);
+	  dev = NULL;
+	}
+      else if (dev && (p = dump_hex_field(p, end, 2, 8, ':', &i)) && p < end && *p == ' ')
+	{
+	  p++;
+	  if (end - p == 47 && i <= 4096 - 16 && dump_hex_line(p, buf + i))
+	    {
+	      i += 16;
+	      if ((int) i > len)
+		len = i;
+	      p = next;
+	      continue;
+	    }
+	  while (end - p >= 2 && (end - p == 2 || p[2] == ' ') &&
+		 dump_hex_digit(p[0]) >= 0 && dump_hex_digit(p[1]) >= 0)
+	    {
+	      if (i >= 4096)
+		a->error("dump: At most 4096 bytes of config space are supported");
+	      buf[i++] = (dump_hex_digit(p[0]) << 4) | dump_hex_digit(p[1]);
+	      if ((int) i > len)
+		len = i;
+	      p += 2;
+	      if (p < end)
+		p++;
+	    }
+	  if (p < end)
+	    a->error("dump: Malformed line");
+	}
+      p = next;
+    }
+  dump_finish_dev(a, dev, buf, len);
+}
+
 static void
 dump_init(struct pci_access *a)
 {
   char *name = pci_get_param(a, "dump.name");
-  FILE *f;
-  char buf[256];
-  struct pci_dev *dev = NULL;
-  int len, mn, bn, dn, fn, i, j;
+  struct dump_file *df;
 
   if (!name)
     a->error("dump: File name not given.");
-  if (!(f = fopen(name, "r")))
-    a->error("dump: Cannot open %s: %s", name, strerror(errno));
-  while (fgets(buf, sizeof(buf)-1, f))
-    {
-      char *z = strchr(buf, '\n');
-      if (!z)
-	{
-	  fclose(f);
-	  a->error("dump: line too long or unterminated");
-	}
-      *z-- = 0;
-      if (z >= buf && *z == '\r')
-	*z-- = 0;
-      len = z - buf + 1;
-      mn = 0;
-      if (dump_validate(buf, "##:##.# ") && sscanf(buf, "%x:%x.%d", &bn, &dn, &fn) == 3 ||
-	  dump_validate(buf, "####:##:##.# ") && sscanf(buf, "%x:%x:%x.%d", &mn, &bn, &dn, &fn) == 4 ||
-	  dump_validate(buf, "#####:##:##.# ") && sscanf(buf, "%x:%x:%x.%d", &mn, &bn, &dn, &fn) == 4 ||
-	  dump_validate(buf, "######:##:##.# ") && sscanf(buf, "%x:%x:%x.%d", &mn, &bn, &dn, &fn) == 4)
-	{
-	  dev = pci_get_dev(a, mn, bn, dn, fn);
-	  dump_alloc_data(dev, 256);
-	  pci_link_dev(a, dev);
-	}
-      else if (!len)
-	dev = NULL;
-      else if (dev &&
-	       (dump_validate(buf, "##: ") || dump_validate(buf, "###: ") || dump_validate(buf, "####: ") ||
-		dump_validate(buf, "#####: ") || dump_validate(buf, "######: ") ||
-		dump_validate(buf, "#######: ") || dump_validate(buf, "########: ")) &&
-	       sscanf(buf, "%x: ", &i) == 1)
-	{
-	  struct dump_data *dd = dev->backend_data;
-	  z = strchr(buf, ' ') + 1;
-	  while (isxdigit(z[0]) && isxdigit(z[1]) && (!z[2] || z[2] == ' ') &&
-		 sscanf(z, "%x", &j) == 1 && j < 256)
+  df = pci_malloc(a, sizeof(*df));
+  a->backend_data = df;
+  dump_open(a, df, name, "dump");
+
+  if (df->size >= DUMP_BIN_HEADER_SIZE && dump_get_u32(df->data) == DUMP_BIN_MAGIC)
+    {
+      a->debug("dump: Reading binary dump\n");
+      dump_load_bin(a, df);
+    }
+  else
+    {
+      dump_load_text(a, df);
+      dump_close(df);
+    }
+}
+
+static void
+dump_cleanup(struct pci_access *a)
+{
+  struct dump_file *df = a->backend_data;
+
+  if (df)
+    {
+      while (df->first)
+	{
+	  struct dump_data *dd = df->first;
+	  df->first = dd->next;
+	  pci_mfree(dd);
+	}
+      dump_close(df);
+      pci_mfree(df);
+      a->backend_data = NULL;
+    }
+}
+
+static void
+dump_scan(struct pci_access *a)
+{
+  struct dump_file *df = a->backend_data;
+  struct dump_data *dd;
+
+  for (dd = df->first; dd; dd = dd->next)
+    {
+      struct pci_dev *d = pci_get_dev(a, dd->domain, dd->bus, dd->dev, dd->func);
+      d->backend_data = dd;
+      pci_link_dev(a, d);
+    }
+}
+
+static struct dump_data *
+dump_get_data(struct pci_dev *d)
+{
+  struct dump_file *df = d->access->backend_data;
+  struct dump_data *dd;
+
+  if (d->backend_data)
+    return d->backend_data;
+
+  /* A device obtained by pci_get_dev(), find it in the dump */
+  for (dd = df->first; dd; dd = dd->next)
+    if (dd->domain == d->domain && dd->bus == d->bus && dd->dev == d->dev && dd->func == d->func)
+      {
+	d->backend_data = dd;
+	break;
+      }
+  return dd;
+}
+
+static void
+dump_fill_props(struct pci_dev *d, struct dump_data *dd, unsigned int flags)
+{
+  u32 pos = 0;
+
+  while (dd->props_len - pos >= DUMP_BIN_PROP_SIZE)
+    {
+      byte *p = dd->props + pos;
+      byte *val = p + DUMP_BIN_PROP_SIZE;
+      u32 key = dump_get_u32(p);
+      u32 len = dump_get_u32(p + 4);
+
+      pos += DUMP_BIN_PROP_SIZE;
+      if (len > dd->props_len - pos)
+	break;
+      pos += (len + 3) & ~3U;
+
+      switch (key)
+	{
+	case PCI_FILL_BASES:
+	  if (len == DUMP_BIN_RESOURCES * 8 && !d->access->buscentric &&
+	      want_fill(d, flags, PCI_FILL_BASES | PCI_FILL_ROM_BASE | PCI_FILL_SIZES | PCI_FILL_IO_FLAGS | PCI_FILL_BRIDGE_BASES))
 	    {
-	      if (i >= 4096)
+	      int i;
+	      for (i=0; i<6; i++)
 		{
-		  fclose(f);
-		  a->error("dump: At most 4096 bytes of config space are supported");
+		  d->base_addr[i] = dump_get_u64(val);
+		  d->size[i] = dump_get_u64(val + 8);
+		  d->flags[i] = dump_get_u64(val + 16);
+		  val += 24;
 		}
-	      if (i >= dd->allocated)	/* Need to re-allocate the buffer */
+	      d->rom_base_addr = dump_get_u64(val);
+	      d->rom_size = dump_get_u64(val + 8);
+	      d->rom_flags = dump_get_u64(val + 16);
+	      val += 24;
+	      for (i=0; i<4; i++)
 		{
-		  dump_alloc_data(dev, 4096);
-		  memcpy(((struct dump_data *) dev->backend_data)->data, dd->data, 256);
-		  pci_mfree(dd);
-		  dd = dev->backend_data;
+		  d->bridge_base_addr[i] = dump_get_u64(val);
+		  d->bridge_size[i] = dump_get_u64(val + 8);
+		  d->bridge_flags[i] = dump_get_u64(val + 16);
+		  val += 24;
 		}
-	      dd->data[i++] = j;
-	      if (i > dd->len)
-		dd->len = i;
-	      z += 2;
-	      if (*z)
-		z++;
 	    }
-	  if (*z)
+	  break;
+	case PCI_FILL_IRQ:
+	  if (len == 4 && !d->access->buscentric && want_fill(d, flags, PCI_FILL_IRQ))
+	    d->irq = (int) dump_get_u32(val);
+	  break;
+	case PCI_FILL_NUMA_NODE:
+	  if (len == 4 && want_fill(d, flags, PCI_FILL_NUMA_NODE))
+	    d->numa_node = (int) dump_get_u32(val);
+	  break;
+	case PCI_FILL_PHYS_SLOT:
+	case PCI_FILL_MODULE_ALIAS:
+	case PCI_FILL_LABEL:
+	case PCI_FILL_DT_NODE:
+	case PCI_FILL_IOMMU_GROUP:
+	case PCI_FILL_DRIVER:
+	  if (len && !val[len-1] && want_fill(d, flags, key))
 	    {
-	      fclose(f);
-	      a->error("dump: Malformed line");
+	      char *v = pci_set_property(d, key, (char *) val);
+	      if (key == PCI_FILL_PHYS_SLOT)
+		d->phy_slot = v;
+	      else if (key == PCI_FILL_MODULE_ALIAS)
+		d->module_alias = v;
+	      else if (key == PCI_FILL_LABEL)
+		d->label = v;
 	    }
+	  break;
 	}
     }
-  fclose(f);
 }
 
 static void
-dump_cleanup(struct pci_access *a UNUSED)
+dump_fill_info(struct pci_dev *d, unsigned int flags)
 {
-}
+  struct dump_data *dd = dump_get_data(d);
 
-static void
-dump_scan(struct pci_access *a UNUSED)
-{
+  if (dd && dd->props)
+    dump_fill_props(d, dd, flags);
+  pci_generic_fill_info(d, flags);
 }
 
 static int
 dump_read(struct pci_dev *d, int pos, byte *buf, int len)
 {
-  struct dump_data *dd;
-  if (!(dd = d->backend_data))
-    {
-      struct pci_dev *e = d->access->devices;
-      while (e && (e->domain != d->domain || e->bus != d->bus || e->dev != d->dev || e->func != d->func))
-	e = e->next;
-      if (!e)
-	return 0;
-      dd = e->backend_data;
-    }
-  if (pos + len > dd->len)
+  struct dump_data *dd = dump_get_data(d);
+
+  if (!dd || pos + len > dd->len)
     return 0;
   memcpy(buf, dd->data + pos, len);
   return 1;
 }
 
 static int
-dump_write(struct pci_dev *d UNUSED, int pos UNUSED, byte *buf UNUSED, int len UNUSED)
+dump_write(struct pci_dev *d, int pos, byte *buf, int len)
 {
-  d->access->error("Writing to dump files is not supported.");
-  return 0;
+  struct dump_data *dd = dump_get_data(d);
+  char *writable = pci_get_param(d->access, "dump.writable");
+
+  if (!writable || !atoi(writable))
+    {
+      d->access->error("Writing to dump files is not supported.");
+      return 0;
+    }
+  if (!dd || pos + len > dd->len)
+    return 0;
+  memcpy(dd->data + pos, buf, len);
+  return 1;
 }
 
 static void
 dump_cleanup_dev(struct pci_dev *d)
 {
-  if (d->backend_data)
+  d->backend_data = NULL;			/* Owned by the dump_file */
+}
+
+static int
+dump_get_domains(struct pci_access *a, struct pci_bus_range *ranges, int max)
+{
+  struct dump_file *df = a->backend_data;
+  struct dump_data *dd;
+  int *domains = NULL;
+  int n = 0, size = 0;
+
+  for (dd = df->first; dd; dd = dd->next)
     {
-      pci_mfree(d->backend_data);
-      d->backend_data = NULL;
+      if (n >= size)
+	{
+	  size = 2*size + 16;
+	  domains = pci_realloc(a, domains, size * sizeof(int));
+	}
+      domains[n++] = dd->domain;
     }
+  n = pci_generic_domains(domains, n, ranges, max);
+  pci_mfree(domains);
+  return n;
 }
 
-struct pci_methods pm_dump = {
+const struct pci_methods pm_dump = {
   .name = "dump",
   .help = "Reading of register dumps (set the `dump.name' parameter)",
   .config = dump_config,
@@ -186,8 +654,561 @@ struct pci_methods pm_dump = {
   .init = dump_init,
   .cleanup = dump_cleanup,
   .scan = dump_scan,
-  .fill_info = pci_generic_fill_info,
+  .fill_info = dump_fill_info,
+  .read = dump_read,
+  .write = dump_write,
+  .cleanup_dev = dump_cleanup_dev,
+  .reentrant = 1,
+  .get_domains = dump_get_domains,
+};
+
+/*
+ *  Writing of binary dumps. The config space of each device is saved
+ *  as far as it can be read: 64 bytes for unprivileged users (128 for
+ *  CardBus bridges), 256 bytes or the whole extended config space.
+ *  It is followed by the properties which cannot be derived from it.
+ */
+
+static unsigned int
+dump_put_prop(byte *buf, unsigned int pos, unsigned int size, u32 key, byte *data, u32 len)
+{
+  unsigned int padded = (len + 3) & ~3U;
+
+  if (pos + DUMP_BIN_PROP_SIZE + padded > size)
+    return pos;
+  dump_put_u32(buf + pos, key);
+  dump_put_u32(buf + pos + 4, len);
+  memcpy(buf + pos + DUMP_BIN_PROP_SIZE, data, len);
+  memset(buf + pos + DUMP_BIN_PROP_SIZE + len, 0, padded - len);
+  return pos + DUMP_BIN_PROP_SIZE + padded;
+}
+
+static unsigned int
+dump_put_props(struct pci_dev *d, byte *buf, unsigned int size)
+{
+  static const u32 string_props[] = {
+    PCI_FILL_PHYS_SLOT, PCI_FILL_MODULE_ALIAS, PCI_FILL_LABEL,
+    PCI_FILL_DT_NODE, PCI_FILL_IOMMU_GROUP, PCI_FILL_DRIVER, 0
+  };
+  unsigned int pos = 0, i;
+  byte x[DUMP_BIN_RESOURCES * 8], *p;
+  char *str;
+
+  pci_fill_info_v314(d, PCI_FILL_IRQ | PCI_FILL_BASES | PCI_FILL_ROM_BASE | PCI_FILL_SIZES |
+		     PCI_FILL_IO_FLAGS | PCI_FILL_BRIDGE_BASES | PCI_FILL_NUMA_NODE |
+		     PCI_FILL_PHYS_SLOT | PCI_FILL_MODULE_ALIAS | PCI_FILL_LABEL |
+		     PCI_FILL_DT_NODE | PCI_FILL_IOMMU_GROUP | PCI_FILL_DRIVER);
+
+  if ((d->known_fields & (PCI_FILL_BASES | PCI_FILL_SIZES)) == (PCI_FILL_BASES | PCI_FILL_SIZES))
+    {
+      p = x;
+      for (i=0; i<6; i++)
+	{
+	  dump_put_u64(p, d->base_addr[i]);
+	  dump_put_u64(p + 8, d->size[i]);
+	  dump_put_u64(p + 16, d->flags[i]);
+	  p += 24;
+	}
+      dump_put_u64(p, d->rom_base_addr);
+      dump_put_u64(p + 8, d->rom_size);
+      dump_put_u64(p + 16, d->rom_flags);
+      p += 24;
+      for (i=0; i<4; i++)
+	{
+	  dump_put_u64(p, d->bridge_base_addr[i]);
+	  dump_put_u64(p + 8, d->bridge_size[i]);
+	  dump_put_u64(p + 16, d->bridge_flags[i]);
+	  p += 24;
+	}
+      pos = dump_put_prop(buf, pos, size, PCI_FILL_BASES, x, sizeof(x));
+    }
+  if (d->known_fields & PCI_FILL_IRQ)
+    {
+      dump_put_u32(x, d->irq);
+      pos = dump_put_prop(buf, pos, size, PCI_FILL_IRQ, x, 4);
+    }
+  if ((d->known_fields & PCI_FILL_NUMA_NODE) && d->numa_node >= 0)
+    {
+      dump_put_u32(x, d->numa_node);
+      pos = dump_put_prop(buf, pos, size, PCI_FILL_NUMA_NODE, x, 4);
+    }
+  for (i=0; string_props[i]; i++)
+    if (str = pci_get_string_property(d, string_props[i]))
+      pos = dump_put_prop(buf, pos, size, string_props[i], (byte *) str, strlen(str) + 1);
+
+  return pos;
+}
+
+int
+pci_write_dump(struct pci_access *a, char *name, struct pci_dev **devs, int n)
+{
+  static const int sizes[] = { 64, 128, 256, 4096, 0 };
+  byte hdr[DUMP_BIN_HEADER_SIZE], rec[DUMP_BIN_DEV_SIZE], buf[4096], props[4096];
+  FILE *f;
+  int i, j, ok;
+
+  if (!(f = fopen(name, "wb")))
+    {
+      a->warning("dump: Cannot create %s: %s", name, strerror(errno));
+      return 0;
+    }
+
+  memset(hdr, 0, sizeof(hdr));
+  dump_put_u32(hdr, DUMP_BIN_MAGIC);
+  dump_put_u32(hdr + 4, DUMP_BIN_VERSION);
+  dump_put_u32(hdr + 8, n);
+  fwrite(hdr, sizeof(hdr), 1, f);
+
+  for (i=0; i<n; i++)
+    {
+      struct pci_dev *d = devs[i];
+      int len = 0;
+      unsigned int props_len;
+
+      for (j=0; sizes[j] && pci_read_block(d, len, buf + len, sizes[j] - len); j++)
+	len = sizes[j];
+      props_len = dump_put_props(d, props, sizeof(props));
+
+      memset(rec, 0, sizeof(rec));
+      dump_put_u32(rec, d->domain);
+      rec[4] = d->bus;
+      rec[5] = d->dev;
+      rec[6] = d->func;
+      dump_put_u32(rec + 8, len);
+      dump_put_u32(rec + 12, props_len);
+      fwrite(rec, sizeof(rec), 1, f);
+      fwrite(buf, len, 1, f);		/* Always a multiple of 4 */
+      fwrite(props, props_len, 1, f);
+    }
+
+  ok = !ferror(f);
+  if (fclose(f))
+    ok = 0;
+  if (!ok)
+    a->warning("dump: Error writing %s", name);
+  return ok;
+}
+
+/*
+ *  Archives contain dumps of many hosts. They start with a header, which
+ *  is followed by a table of hosts sorted by name, a table of devices,
+ *  a table of config space blocks and the names of hosts. Devices of each
+ *  host form a contiguous part of the device table and each device refers
+ *  to a block, which can be shared by any number of identical devices.
+ *  Since version 2, a device can also refer to a block with its properties
+ *  in the format used by binary dumps. Like binary dumps, archives are little-endian and they are read directly
+ *  from the mapped file.
+ *
+ *  The header contains the magic, version, numbers of hosts, devices and
+ *  blocks, size of the string table and 64-bit positions of the four tables.
+ *  A host is described by the position of its name in the string table,
+ *  its first device and the number of devices, followed by a reserved word.
+ *  A device record has the same address fields as in binary dumps, followed
+ *  by the number of its block and (since version 2) the number of the block
+ *  with its properties or ARCHIVE_NO_PROPS. A block is given by a 64-bit position of its
+ *  data in the file and its length, followed by a reserved word.
+ */
+
+#define ARCHIVE_MAGIC 0x50434941	/* "AICP" in the file */
+#define ARCHIVE_VERSION 2
+#define ARCHIVE_HEADER_SIZE 56
+#define ARCHIVE_HOST_SIZE 16
+#define ARCHIVE_DEV_SIZE 16		/* 12 in version 1 */
+#define ARCHIVE_BLOCK_SIZE 16
+#define ARCHIVE_NO_PROPS 0xffffffff
+
+static void
+archive_config(struct pci_access *a)
+{
+  pci_define_param(a, "archive.name", "", "Name of the dump archive to read from");
+  pci_define_param(a, "archive.host", "", "Name of the host in the archive (can be omitted if there is only one)");
+}
+
+static int
+archive_detect(struct pci_access *a)
+{
+  char *name = pci_get_param(a, "archive.name");
+  return name && name[0];
+}
+
+static byte *
+archive_table(struct pci_access *a, struct dump_file *df, u64 pos, u64 count, size_t size)
+{
+  if (pos > df->size || count > (df->size - pos) / size)
+    a->error("archive: Malformed archive");
+  return df->data + pos;
+}
+
+static void
+archive_init(struct pci_access *a)
+{
+  char *name = pci_get_param(a, "archive.name");
+  char *host = pci_get_param(a, "archive.host");
+  struct dump_file *df;
+  byte *h, *hosts, *devs, *blocks, *ho = NULL;
+  u32 num_hosts, num_devices, num_blocks, strings_size, version, first_dev, num_devs;
+  size_t dev_size = ARCHIVE_DEV_SIZE;
+  char *strings;
+  u32 i;
+
+  if (!name || !name[0])
+    a->error("archive: File name not given.");
+  df = pci_malloc(a, sizeof(*df));
+  a->backend_data = df;
+  dump_open(a, df, name, "archive");
+
+  h = df->data;
+  if (df->size < ARCHIVE_HEADER_SIZE || dump_get_u32(h) != ARCHIVE_MAGIC)
+    a->error("archive: %s is not a dump archive", name);
+  version = dump_get_u32(h + 4);
+  if (version == 1)
+    dev_size -= 4;
+  else if (version != ARCHIVE_VERSION)
+    a->error("archive: Unsupported version %u of the archive", version);
+  num_hosts = dump_get_u32(h + 8);
+  num_devices = dump_get_u32(h + 12);
+  num_blocks = dump_get_u32(h + 16);
+  strings_size = dump_get_u32(h + 20);
+  hosts = archive_table(a, df, dump_get_u64(h + 24), num_hosts, ARCHIVE_HOST_SIZE);
+  devs = archive_table(a, df, dump_get_u64(h + 32), num_devices, dev_size);
+  blocks = archive_table(a, df, dump_get_u64(h + 40), num_blocks, ARCHIVE_BLOCK_SIZE);
+  strings = (char *) archive_table(a, df, dump_get_u64(h + 48), strings_size, 1);
+  if (!strings_size || strings[strings_size-1])
+    a->error("archive: Malformed archive");
+
+  if (host && host[0])
+    {
+      u32 l = 0, r = num_hosts;
+      while (l < r)
+	{
+	  u32 m = (l + r) / 2;
+	  u32 nm = dump_get_u32(hosts + m * ARCHIVE_HOST_SIZE);
+	  int cmp;
+	  if (nm >= strings_size)
+	    a->error("archive: Malformed archive");
+	  cmp = strcmp(host, strings + nm);
+	  if (!cmp)
+	    {
+	      ho = hosts + m * ARCHIVE_HOST_SIZE;
+	      break;
+	    }
+	  if (cmp < 0)
+	    r = m;
+	  else
+	    l = m + 1;
+	}
+      if (!ho)
+	a->error("archive: Host %s not found in %s", host, name);
+    }
+  else if (num_hosts == 1)
+    {
+      ho = hosts;
+      if (dump_get_u32(ho) >= strings_size)
+	a->error("archive: Malformed archive");
+    }
+  else
+    a->error("archive: Host name not given (%s contains %u hosts)", name, num_hosts);
+
+  first_dev = dump_get_u32(ho + 4);
+  num_devs = dump_get_u32(ho + 8);
+  a->debug("archive: Reading %u devices of host %s\n", num_devs, strings + dump_get_u32(ho));
+  if (first_dev > num_devices || num_devs > num_devices - first_dev)
+    a->error("archive: Malformed archive");
+  for (i=0; i<num_devs; i++)
+    {
+      byte *r = devs + (first_dev + i) * dev_size;
+      u32 block = dump_get_u32(r + 8);
+      byte *b;
+      struct dump_data *dd;
+      u32 len;
+
+      if (block >= num_blocks)
+	a->error("archive: Malformed archive");
+      b = blocks + block * ARCHIVE_BLOCK_SIZE;
+      len = dump_get_u32(b + 8);
+      if (len > 4096)
+	a->error("archive: Malformed archive");
+      dd = dump_add_data(a, dump_get_u32(r), r[4], r[5], r[6], 0);
+      dd->len = len;
+      dd->data = archive_table(a, df, dump_get_u64(b), len, 1);
+      if (version >= 2 && (block = dump_get_u32(r + 12)) != ARCHIVE_NO_PROPS)
+	{
+	  if (block >= num_blocks)
+	    a->error("archive: Malformed archive");
+	  b = blocks + block * ARCHIVE_BLOCK_SIZE;
+	  len = dump_get_u32(b + 8);
+	  if (len & 3)
+	    a->error("archive: Malformed archive");
+	  dd->props = archive_table(a, df, dump_get_u64(b), len, 1);
+	  dd->props_len = len;
+	}
+    }
+}
+
+const struct pci_methods pm_dump_archive = {
+  .name = "archive",
+  .help = "Reading of register dumps of many hosts from an archive (set the `archive.name' parameter)",
+  .config = archive_config,
+  .detect = archive_detect,
+  .init = archive_init,
+  .cleanup = dump_cleanup,
+  .scan = dump_scan,
+  .fill_info = dump_fill_info,
   .read = dump_read,
   .write = dump_write,
   .cleanup_dev = dump_cleanup_dev,
+  .reentrant = 1,
+  .get_domains = dump_get_domains,
+};
+
+/*
+ *  Writing of archives. Dumps of all hosts are loaded one by one and
+ *  blocks are deduplicated using a hash table. Device records
+ *  are kept in their final form, hosts are converted when writing.
+ */
+
+struct archive_host {
+  u32 name;				/* Offset in the string table */
+  u32 first_dev;
+  u32 num_devs;
+};
+
+struct archive_wblock {
+  struct archive_wblock *next;		/* In the hash chain */
+  u32 hash;
+  u32 id;
+  u32 len;
+  byte data[1];
+};
+
+struct archive_writer {
+  struct pci_access *a;
+  struct archive_wblock **hash;
+  unsigned int hash_mask;
+  struct archive_wblock **blocks;
+  u32 num_blocks, max_blocks;
+  byte *devs;				/* ARCHIVE_DEV_SIZE bytes per device */
+  u32 num_devs, max_devs;
+  u64 data_size;
+};
+
+static u32
+archive_block_hash(byte *data, u32 len)
+{
+  u32 h = len, i;
+
+  for (i=0; i+4 <= len; i+=4)
+    h = h*0x9e3779b1 + (data[i] | (data[i+1] << 8) | (data[i+2] << 16) | ((u32) data[i+3] << 24));
+  for (; i<len; i++)
+    h = h*0x9e3779b1 + data[i];
+  return h ^ (h >> 16);
+}
+
+static void
+archive_grow_hash(struct archive_writer *w)
+{
+  unsigned int size = (w->hash_mask + 1) * 4;
+  unsigned int i;
+
+  pci_mfree(w->hash);
+  w->hash = pci_malloc(w->a, size * sizeof(struct archive_wblock *));
+  memset(w->hash, 0, size * sizeof(struct archive_wblock *));
+  w->hash_mask = size - 1;
+  for (i=0; i<w->num_blocks; i++)
+    {
+      struct archive_wblock *b = w->blocks[i];
+      b->next = w->hash[b->hash & w->hash_mask];
+      w->hash[b->hash & w->hash_mask] = b;
+    }
+}
+
+static u32
+archive_add_block(struct archive_writer *w, byte *data, u32 len)
+{
+  u32 hash = archive_block_hash(data, len);
+  struct archive_wblock *b;
+
+  for (b = w->hash[hash & w->hash_mask]; b; b = b->next)
+    if (b->hash == hash && b->len == len && !memcmp(b->data, data, len))
+      return b->id;
+
+  if (w->num_blocks >= w->max_blocks)
+    {
+      w->max_blocks = 2*w->max_blocks + 256;
+      w->blocks = pci_realloc(w->a, w->blocks, w->max_blocks * sizeof(struct archive_wblock *));
+    }
+  b = pci_malloc(w->a, sizeof(*b) + (len ? len-1 : 0));
+  b->hash = hash;
+  b->id = w->num_blocks;
+  b->len = len;
+  memcpy(b->data, data, len);
+  b->next = w->hash[hash & w->hash_mask];
+  w->hash[hash & w->hash_mask] = b;
+  w->blocks[w->num_blocks++] = b;
+  w->data_size += (len + 3) & ~3U;
+  if (w->num_blocks > 2 * (w->hash_mask + 1))
+    archive_grow_hash(w);
+  return b->id;
+}
+
+static void
+archive_add_host(struct archive_writer *w, struct archive_host *ho, char *dump)
+{
+  struct pci_access *b = pci_clone_access(w->a);
+  struct pci_dev *d;
+
+  b->method = PCI_ACCESS_DUMP;
+  pci_set_param(b, "dump.name", dump);
+  pci_init_v35(b);
+  pci_scan_bus(b);
+
+  ho->first_dev = w->num_devs;
+  for (d = b->devices; d; d = d->next)
+    {
+      struct dump_data *dd = d->backend_data;
+      byte *r;
+
+      if (w->num_devs >= w->max_devs)
+	{
+	  w->max_devs = 2*w->max_devs + 256;
+	  w->devs = pci_realloc(w->a, w->devs, w->max_devs * ARCHIVE_DEV_SIZE);
+	}
+      r = w->devs + w->num_devs++ * ARCHIVE_DEV_SIZE;
+      memset(r, 0, ARCHIVE_DEV_SIZE);
+      dump_put_u32(r, d->domain);
+      r[4] = d->bus;
+      r[5] = d->dev;
+      r[6] = d->func;
+      dump_put_u32(r + 8, archive_add_block(w, dd->data, dd->len));
+      dump_put_u32(r + 12, dd->props ? archive_add_block(w, dd->props, dd->props_len) : ARCHIVE_NO_PROPS);
+    }
+  ho->num_devs = w->num_devs - ho->first_dev;
+
+  pci_cleanup(b);
+}
+
+struct archive_input {
+  char *host, *dump;
 };
+
+static int
+archive_cmp_inputs(const void *A, const void *B)
+{
+  const struct archive_input *a = A, *b = B;
+  return strcmp(a->host, b->host);
+}
+
+int
+pci_write_dump_archive(struct pci_access *a, char *name, char **hosts, char **dumps, int n)
+{
+  struct archive_writer w;
+  byte h[ARCHIVE_HEADER_SIZE], x[ARCHIVE_BLOCK_SIZE];
+  struct archive_host *ho;
+  struct archive_input *in;
+  u32 strings_size = 0, strings_used;
+  u64 hosts_pos, devices_pos, blocks_pos, strings_pos, pos;
+  FILE *f;
+  int i, ok;
+  u32 j;
+
+  pci_init_handlers(a);
+  memset(&w, 0, sizeof(w));
+  w.a = a;
+  w.hash_mask = 255;
+  w.hash = pci_malloc(a, 256 * sizeof(struct archive_wblock *));
+  memset(w.hash, 0, 256 * sizeof(struct archive_wblock *));
+
+  /* Hosts are stored sorted by name, so that they can be found by binary search */
+  if (n < 0)
+    n = 0;
+  in = pci_malloc(a, (n + 1) * sizeof(struct archive_input));
+  for (i=0; i<n; i++)
+    {
+      in[i].host = hosts[i];
+      in[i].dump = dumps[i];
+    }
+  qsort(in, n, sizeof(struct archive_input), archive_cmp_inputs);
+  for (i=1; i<n; i++)
+    if (!strcmp(in[i-1].host, in[i].host))
+      a->error("archive: Duplicate host name %s", in[i].host);
+
+  ho = pci_malloc(a, (n + 1) * sizeof(struct archive_host));
+  memset(ho, 0, (n + 1) * sizeof(struct archive_host));
+  for (i=0; i<n; i++)
+    {
+      a->debug("archive: Adding %s as host %s\n", in[i].dump, in[i].host);
+      ho[i].name = strings_size;
+      strings_size += strlen(in[i].host) + 1;
+      archive_add_host(&w, &ho[i], in[i].dump);
+    }
+  strings_used = strings_size;
+  strings_size = (strings_size + 4) & ~3U;	/* Make sure that the table is non-empty and aligned */
+
+  hosts_pos = ARCHIVE_HEADER_SIZE;
+  devices_pos = hosts_pos + (u64) n * ARCHIVE_HOST_SIZE;
+  blocks_pos = devices_pos + (u64) w.num_devs * ARCHIVE_DEV_SIZE;
+  strings_pos = blocks_pos + (u64) w.num_blocks * ARCHIVE_BLOCK_SIZE;
+  pos = strings_pos + strings_size;
+
+  memset(h, 0, sizeof(h));
+  dump_put_u32(h, ARCHIVE_MAGIC);
+  dump_put_u32(h + 4, ARCHIVE_VERSION);
+  dump_put_u32(h + 8, n);
+  dump_put_u32(h + 12, w.num_devs);
+  dump_put_u32(h + 16, w.num_blocks);
+  dump_put_u32(h + 20, strings_size);
+  dump_put_u64(h + 24, hosts_pos);
+  dump_put_u64(h + 32, devices_pos);
+  dump_put_u64(h + 40, blocks_pos);
+  dump_put_u64(h + 48, strings_pos);
+
+  ok = 0;
+  if (f = fopen(name, "wb"))
+    {
+      static const byte zeros[4];
+      fwrite(h, sizeof(h), 1, f);
+      for (i=0; i<n; i++)
+	{
+	  memset(x, 0, ARCHIVE_HOST_SIZE);
+	  dump_put_u32(x, ho[i].name);
+	  dump_put_u32(x + 4, ho[i].first_dev);
+	  dump_put_u32(x + 8, ho[i].num_devs);
+	  fwrite(x, ARCHIVE_HOST_SIZE, 1, f);
+	}
+      fwrite(w.devs, ARCHIVE_DEV_SIZE, w.num_devs, f);
+      for (j=0; j<w.num_blocks; j++)
+	{
+	  memset(x, 0, ARCHIVE_BLOCK_SIZE);
+	  dump_put_u64(x, pos);
+	  dump_put_u32(x + 8, w.blocks[j]->len);
+	  fwrite(x, ARCHIVE_BLOCK_SIZE, 1, f);
+	  pos += (w.blocks[j]->len + 3) & ~3U;
+	}
+      for (i=0; i<n; i++)
+	fwrite(in[i].host, strlen(in[i].host) + 1, 1, f);
+      for (j=strings_used; j<strings_size; j++)
+	fputc(0, f);
+      for (j=0; j<w.num_blocks; j++)
+	{
+	  fwrite(w.blocks[j]->data, w.blocks[j]->len, 1, f);
+	  fwrite(zeros, (4 - w.blocks[j]->len % 4) % 4, 1, f);
+	}
+      ok = !ferror(f);
+      if (fclose(f))
+	ok = 0;
+      if (!ok)
+	a->warning("archive: Error writing %s", name);
+    }
+  else
+    a->warning("archive: Cannot create %s: %s", name, strerror(errno));
+
+  a->debug("archive: %u hosts, %u devices, %u distinct config spaces\n", n, w.num_devs, w.num_blocks);
+  for (j=0; j<w.num_blocks; j++)
+    pci_mfree(w.blocks[j]);
+  pci_mfree(w.blocks);
+  pci_mfree(w.hash);
+  pci_mfree(w.devs);
+  pci_mfree(ho);
+  pci_mfree(in);
+  return ok;
+}
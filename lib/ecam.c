@@ -36,6 +36,10 @@
 #include "win32-helpers.h"
 #endif
 
+#ifdef PCI_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 struct acpi_rsdp {
   char signature[8];
   u8 checksum;
@@ -85,6 +89,7 @@ struct acpi_mcfg {
 } PCI_PACKED;
 
 struct mmap_cache {
+  struct mmap_cache *next;
   void *map;
   u64 addr;
   u32 length;
@@ -93,10 +98,25 @@ struct mmap_cache {
   int w;
 };
 
+/*
+ * Mappings of buses are kept in a small hash table for the whole lifetime
+ * of the pci_access, so that scanning does not remap ECAM on every bus change.
+ * A writeable mapping is used for reads, too. The number of mappings is limited
+ * (each bus takes up to 1 MB of address space), when the limit is reached,
+ * all mappings are dropped.
+ */
+#define ECAM_CACHE_HASH 256
+#define ECAM_CACHE_MAX (sizeof(void *) > 4 ? 4096 : 64)
+
 // Back-end data linked to struct pci_access
 struct ecam_access {
   struct acpi_mcfg *mcfg;
-  struct mmap_cache *cache;
+  struct mmap_cache *cache[ECAM_CACHE_HASH];
+  unsigned int cache_count;
+  int scanning;				/* Parallel scan in progress: lock the cache, never flush it */
+#ifdef PCI_HAVE_PTHREAD
+  pthread_mutex_t cache_lock;
+#endif
   struct physmem *physmem;
   long pagesize;
 };
@@ -794,32 +814,46 @@ static void
 munmap_reg(struct pci_access *a)
 {
   struct ecam_access *eacc = a->backend_data;
-  struct mmap_cache *cache = eacc->cache;
   struct physmem *physmem = eacc->physmem;
   long pagesize = eacc->pagesize;
+  struct mmap_cache *cache;
+  int i;
 
-  if (!cache)
-    return;
+  for (i = 0; i < ECAM_CACHE_HASH; i++)
+    while (cache = eacc->cache[i])
+      {
+        eacc->cache[i] = cache->next;
+        physmem_unmap(physmem, cache->map, cache->length + (cache->addr & (pagesize-1)));
+        pci_mfree(cache);
+      }
+  eacc->cache_count = 0;
+}
 
-  physmem_unmap(physmem, cache->map, cache->length + (cache->addr & (pagesize-1)));
-  pci_mfree(cache);
-  eacc->cache = NULL;
+static inline unsigned int
+cache_hash(int domain, u8 bus)
+{
+  return ((unsigned int)domain * 0x9e3779b1 + bus) % ECAM_CACHE_HASH;
 }
 
 static int
-mmap_reg(struct pci_access *a, int w, int domain, u8 bus, u8 dev, u8 func, int pos, volatile void **reg)
+mmap_reg_locked(struct pci_access *a, int w, int domain, u8 bus, u8 dev, u8 func, int pos, volatile void **reg)
 {
   struct ecam_access *eacc = a->backend_data;
-  struct mmap_cache *cache = eacc->cache;
+  struct mmap_cache *cache;
   struct physmem *physmem = eacc->physmem;
   long pagesize = eacc->pagesize;
+  unsigned int h = cache_hash(domain, bus);
   const char *addrs;
   void *map;
   u64 addr;
   u32 length;
   u32 offset;
 
-  if (cache && cache->domain == domain && cache->bus == bus && !!cache->w == !!w)
+  for (cache = eacc->cache[h]; cache; cache = cache->next)
+    if (cache->domain == domain && cache->bus == bus)
+      break;
+
+  if (cache && (cache->w || !w))
     {
       map = cache->map;
       addr = cache->addr;
@@ -836,9 +870,19 @@ mmap_reg(struct pci_access *a, int w, int domain, u8 bus, u8 dev, u8 func, int p
         return 0;
 
       if (cache)
-        physmem_unmap(physmem, cache->map, cache->length + (cache->addr & (pagesize-1)));
+        {
+          /* Upgrade of a read-only mapping to a writeable one */
+          physmem_unmap(physmem, cache->map, cache->length + (cache->addr & (pagesize-1)));
+        }
       else
-        cache = eacc->cache = pci_malloc(a, sizeof(*cache));
+        {
+          if (eacc->cache_count >= ECAM_CACHE_MAX && !eacc->scanning)
+            munmap_reg(a);
+          cache = pci_malloc(a, sizeof(*cache));
+          cache->next = eacc->cache[h];
+          eacc->cache[h] = cache;
+          eacc->cache_count++;
+        }
 
       cache->map = map;
       cache->addr = addr;
@@ -861,6 +905,151 @@ mmap_reg(struct pci_access *a, int w, int domain, u8 bus, u8 dev, u8 func, int p
   return 1;
 }
 
+static int
+mmap_reg(struct pci_access *a, int w, int domain, u8 bus, u8 dev, u8 func, int pos, volatile void **reg)
+{
+#ifdef PCI_HAVE_PTHREAD
+  struct ecam_access *eacc = a->backend_data;
+  int ret;
+
+  if (eacc->scanning)
+    {
+      pthread_mutex_lock(&eacc->cache_lock);
+      ret = mmap_reg_locked(a, w, domain, bus, dev, func, pos, reg);
+      pthread_mutex_unlock(&eacc->cache_lock);
+      return ret;
+    }
+#endif
+  return mmap_reg_locked(a, w, domain, bus, dev, func, pos, reg);
+}
+
+/*
+ * Locating the MCFG table may require mapping firmware tables or scanning
+ * the BIOS area, so the allocations found are remembered in a cache file
+ * in the format of the ecam.addrs parameter, together with the boot ID
+ * of the kernel. The cache is used only during the same boot, because
+ * firmware tables cannot change without rebooting.
+ */
+
+#ifdef PCI_OS_LINUX
+
+static int
+get_boot_id(char *buf, int size)
+{
+  FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+  char *p;
+
+  if (!f)
+    return 0;
+  if (!fgets(buf, size, f))
+    buf[0] = 0;
+  fclose(f);
+  if (p = strchr(buf, '\n'))
+    *p = 0;
+  return buf[0] != 0;
+}
+
+static void
+load_mcfg_cache(struct pci_access *a)
+{
+  const char *name = pci_get_param(a, "ecam.cache");
+  char boot_id[64], line[64], *addrs;
+  long length;
+  FILE *f;
+
+  if (!name[0] || pci_get_param(a, "ecam.addrs")[0] || !get_boot_id(boot_id, sizeof(boot_id)))
+    return;
+  f = fopen(name, "r");
+  if (!f)
+    return;
+
+  addrs = NULL;
+  if (fgets(line, sizeof(line), f) && !strncmp(line, boot_id, strlen(boot_id)) && line[strlen(boot_id)] == '\n' &&
+      fseek(f, 0, SEEK_END) == 0 && (length = ftell(f)) > 0 &&
+      fseek(f, strlen(line), SEEK_SET) == 0)
+    {
+      addrs = pci_malloc(a, length + 1);
+      if (!fgets(addrs, length + 1, f))
+        addrs[0] = 0;
+      if (strchr(addrs, '\n'))
+        *strchr(addrs, '\n') = 0;
+      if (!addrs[0] || !validate_addrs(addrs))
+        {
+          pci_mfree(addrs);
+          addrs = NULL;
+        }
+    }
+  fclose(f);
+
+  if (addrs)
+    {
+      a->debug("using ecam addresses cached in %s...", name);
+      pci_set_param_internal(a, "ecam.addrs", addrs, 1);
+      pci_mfree(addrs);
+    }
+  else
+    a->debug("ignoring stale ecam cache %s...", name);
+}
+
+static void
+save_mcfg_cache(struct pci_access *a, struct acpi_mcfg *mcfg)
+{
+  const char *name = pci_get_param(a, "ecam.cache");
+  char boot_id[64], *tmpname;
+  int domain, i, count, ok;
+  u8 start_bus, end_bus;
+  u64 addr;
+  FILE *f;
+
+  if (!name[0] || !get_boot_id(boot_id, sizeof(boot_id)))
+    return;
+
+  count = get_mcfg_allocations_count(mcfg);
+  for (i = 0; i < count; i++)
+    if (mcfg->allocations[i].end_bus_number < mcfg->allocations[i].start_bus_number)
+      return;
+
+  tmpname = pci_malloc(a, strlen(name) + 32);
+  sprintf(tmpname, "%s.tmp-%d", name, (int) getpid());
+  f = fopen(tmpname, "w");
+  if (!f)
+    {
+      a->debug("cannot write ecam cache %s: %s...", tmpname, strerror(errno));
+      pci_mfree(tmpname);
+      return;
+    }
+  fprintf(f, "%s\n", boot_id);
+  for (i = 0; i < count; i++)
+    {
+      get_mcfg_allocation(mcfg, i, &domain, &start_bus, &end_bus, &addr, NULL);
+      fprintf(f, "%s%x:%x-%x:%llx", (i ? "," : ""), domain, start_bus, end_bus, (unsigned long long) addr);
+    }
+  fputc('\n', f);
+  ok = !ferror(f);
+  if (fclose(f) || !ok || rename(tmpname, name) < 0)
+    {
+      a->debug("cannot write ecam cache %s...", name);
+      unlink(tmpname);
+    }
+  else
+    a->debug("ecam addresses saved to %s...", name);
+  pci_mfree(tmpname);
+}
+
+#else
+
+static void
+load_mcfg_cache(struct pci_access *a UNUSED)
+{
+}
+
+static void
+save_mcfg_cache(struct pci_access *a UNUSED, struct acpi_mcfg *mcfg UNUSED)
+{
+}
+
+#endif
+
 static void
 ecam_config(struct pci_access *a)
 {
@@ -874,6 +1063,8 @@ ecam_config(struct pci_access *a)
   pci_define_param(a, "ecam.x86bios", "1", "Scan x86 BIOS memory for ACPI MCFG table");
 #endif
   pci_define_param(a, "ecam.addrs", "", "Physical addresses of memory mapped PCIe ECAM interface"); /* format: [domain:]start_bus[-end_bus]:start_addr[+length],... */
+  pci_define_param(a, "ecam.scan_threads", "4", "Number of threads used for scanning of the buses");
+  pci_define_param(a, "ecam.cache", "", "Cache file for the ecam addresses found in ACPI MCFG table");
 }
 
 static int
@@ -888,13 +1079,15 @@ ecam_detect(struct pci_access *a)
 #if defined(__amd64__) || defined(__i386__)
   const char *x86bios = pci_get_param(a, "ecam.x86bios");
 #endif
-  const char *addrs = pci_get_param(a, "ecam.addrs");
+  const char *addrs;
   struct ecam_access *eacc;
 #ifndef PCI_OS_WINDOWS
   glob_t mcfg_glob;
   int ret;
 #endif
 
+  load_mcfg_cache(a);
+  addrs = pci_get_param(a, "ecam.addrs");
   if (!*addrs)
     {
       a->debug("ecam.addrs was not specified...");
@@ -993,7 +1186,9 @@ ecam_detect(struct pci_access *a)
         }
 
       eacc->mcfg = NULL;
-      eacc->cache = NULL;
+      memset(eacc->cache, 0, sizeof(eacc->cache));
+      eacc->cache_count = 0;
+      eacc->scanning = 0;
       a->backend_data = eacc;
       eacc->mcfg = find_mcfg(a, acpimcfg, efisystab, use_bsd, use_x86bios);
       if (!eacc->mcfg)
@@ -1003,6 +1198,7 @@ ecam_detect(struct pci_access *a)
           a->backend_data = NULL;
           return 0;
         }
+      save_mcfg_cache(a, eacc->mcfg);
     }
 
   if (use_addrs)
@@ -1024,7 +1220,7 @@ ecam_init(struct pci_access *a)
 #if defined(__amd64__) || defined(__i386__)
   const char *x86bios = pci_get_param(a, "ecam.x86bios");
 #endif
-  const char *addrs = pci_get_param(a, "ecam.addrs");
+  const char *addrs;
   struct physmem *physmem = NULL;
   struct ecam_access *eacc = a->backend_data;
   long pagesize = 0;
@@ -1034,6 +1230,8 @@ ecam_init(struct pci_access *a)
   u8 test_bus = 0;
   volatile void *test_reg;
 
+  load_mcfg_cache(a);
+  addrs = pci_get_param(a, "ecam.addrs");
   if (!validate_addrs(addrs))
     a->error("Option ecam.addrs has invalid address format \"%s\".", addrs);
 
@@ -1049,7 +1247,9 @@ ecam_init(struct pci_access *a)
 
       eacc = pci_malloc(a, sizeof(*eacc));
       eacc->mcfg = NULL;
-      eacc->cache = NULL;
+      memset(eacc->cache, 0, sizeof(eacc->cache));
+      eacc->cache_count = 0;
+      eacc->scanning = 0;
       eacc->physmem = physmem;
       eacc->pagesize = pagesize;
       a->backend_data = eacc;
@@ -1066,7 +1266,11 @@ ecam_init(struct pci_access *a)
         use_x86bios = 1;
 #endif
       if (!eacc->mcfg)
-        eacc->mcfg = find_mcfg(a, acpimcfg, efisystab, use_bsd, use_x86bios);
+        {
+          eacc->mcfg = find_mcfg(a, acpimcfg, efisystab, use_bsd, use_x86bios);
+          if (eacc->mcfg)
+            save_mcfg_cache(a, eacc->mcfg);
+        }
       if (!eacc->mcfg)
         a->error("Option ecam.addrs was not specified and ACPI MCFG table cannot be found.");
     }
@@ -1094,12 +1298,53 @@ ecam_cleanup(struct pci_access *a)
 }
 
 static void
-ecam_scan(struct pci_access *a)
+get_domain_bus_range(struct acpi_mcfg *mcfg, const char *addrs, struct pci_bus_range *range)
+{
+  int cur_domain;
+  u8 start_bus, end_bus;
+  int i, count;
+
+  range->start_bus = 0xff;
+  range->end_bus = 0;
+  if (mcfg)
+    {
+      count = get_mcfg_allocations_count(mcfg);
+      for (i = 0; i < count; i++)
+        {
+          get_mcfg_allocation(mcfg, i, &cur_domain, &start_bus, &end_bus, NULL, NULL);
+          if (cur_domain == range->domain)
+            {
+              if (start_bus < range->start_bus)
+                range->start_bus = start_bus;
+              if (end_bus > range->end_bus)
+                range->end_bus = end_bus;
+            }
+        }
+    }
+  else
+    {
+      while (addrs)
+        {
+          if (parse_next_addrs(addrs, &addrs, &cur_domain, &start_bus, &end_bus, NULL, NULL) && cur_domain == range->domain)
+            {
+              if (start_bus < range->start_bus)
+                range->start_bus = start_bus;
+              if (end_bus > range->end_bus)
+                range->end_bus = end_bus;
+            }
+        }
+    }
+}
+
+/* Collect all domains with their bus ranges, in ascending order */
+static struct pci_bus_range *
+ecam_get_ranges(struct pci_access *a, int *num_domains)
 {
   const char *addrs = pci_get_param(a, "ecam.addrs");
   struct ecam_access *eacc = a->backend_data;
+  struct pci_bus_range *ranges;
   u32 *segments;
-  int i, j, count;
+  int i, j, count, n;
   int domain;
 
   segments = pci_malloc(a, 0xFFFF/8);
@@ -1113,23 +1358,131 @@ ecam_scan(struct pci_access *a)
     }
   else
     {
-      while (addrs)
+      const char *p = addrs;
+      while (p)
         {
-          if (parse_next_addrs(addrs, &addrs, &domain, NULL, NULL, NULL, NULL))
+          if (parse_next_addrs(p, &p, &domain, NULL, NULL, NULL, NULL))
             segments[domain / 32] |= 1 << (domain % 32);
         }
     }
 
+  n = 0;
+  for (i = 0; i < 0xFFFF/32; i++)
+    for (j = 0; j < 32; j++)
+      if (segments[i] & (1 << j))
+        n++;
+
+  ranges = pci_malloc(a, (n ? n : 1) * sizeof(*ranges));
+  n = 0;
   for (i = 0; i < 0xFFFF/32; i++)
     {
       if (!segments[i])
         continue;
       for (j = 0; j < 32; j++)
         if (segments[i] & (1 << j))
-          pci_generic_scan_domain(a, 32*i + j);
+          {
+            ranges[n].domain = 32*i + j;
+            get_domain_bus_range(eacc->mcfg, addrs, &ranges[n]);
+            n++;
+          }
     }
 
   pci_mfree(segments);
+  *num_domains = n;
+  return ranges;
+}
+
+static int
+ecam_get_domains(struct pci_access *a, struct pci_bus_range *ranges, int max)
+{
+  int i, n;
+  struct pci_bus_range *all = ecam_get_ranges(a, &n);
+
+  for (i = 0; i < n && i < max; i++)
+    ranges[i] = all[i];
+  pci_mfree(all);
+  return n;
+}
+
+static void
+ecam_scan(struct pci_access *a)
+{
+#ifdef PCI_HAVE_PTHREAD
+  struct ecam_access *eacc = a->backend_data;
+#endif
+  int threads = atoi(pci_get_param(a, "ecam.scan_threads"));
+  struct pci_bus_range *ranges;
+  int num_domains;
+
+  ranges = ecam_get_ranges(a, &num_domains);
+
+#ifdef PCI_HAVE_PTHREAD
+  if (threads > 1)
+    {
+      pthread_mutex_init(&eacc->cache_lock, NULL);
+      eacc->scanning = 1;
+    }
+#else
+  threads = 1;
+#endif
+  pci_generic_scan_domains(a, ranges, num_domains, threads);
+#ifdef PCI_HAVE_PTHREAD
+  if (eacc->scanning)
+    {
+      eacc->scanning = 0;
+      pthread_mutex_destroy(&eacc->cache_lock);
+    }
+#endif
+
+  pci_mfree(ranges);
+}
+
+/*
+ * Block reads resolve the mapping once and then read the registers directly,
+ * using naturally aligned accesses of at most 32 bits like pci_generic_block_read().
+ */
+static int
+ecam_block_read(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  volatile unsigned char *reg;
+  volatile void *end;
+  u32 val;
+
+  if (pos + len > 4096)
+    return 0;
+
+  if (!mmap_reg(d->access, 0, d->domain, d->bus, d->dev, d->func, pos & ~3, (volatile void **) &reg) ||
+      !mmap_reg(d->access, 0, d->domain, d->bus, d->dev, d->func, (pos + len - 1) & ~3, &end))
+    return 0;
+  reg += pos & 3;
+
+  if ((pos & 1) && len >= 1)
+    {
+      *buf = physmem_readb(reg);
+      pos++; reg++; buf++; len--;
+    }
+  if ((pos & 3) && len >= 2)
+    {
+      u16 w = physmem_readw(reg);
+      memcpy(buf, &w, 2);
+      pos += 2; reg += 2; buf += 2; len -= 2;
+    }
+  while (len >= 4)
+    {
+      val = physmem_readl(reg);
+      memcpy(buf, &val, 4);
+      reg += 4; buf += 4; len -= 4;
+    }
+  if (len >= 2)
+    {
+      u16 w = physmem_readw(reg);
+      memcpy(buf, &w, 2);
+      reg += 2; buf += 2; len -= 2;
+    }
+  if (len)
+    *buf = physmem_readb(reg);
+
+  return 1;
 }
 
 static int
@@ -1141,7 +1494,7 @@ ecam_read(struct pci_dev *d, int pos, byte *buf, int len)
     return 0;
 
   if (len != 1 && len != 2 && len != 4)
-    return pci_generic_block_read(d, pos, buf, len);
+    return ecam_block_read(d, pos, buf, len);
 
   if (!mmap_reg(d->access, 0, d->domain, d->bus, d->dev, d->func, pos, &reg))
     return 0;
@@ -1192,7 +1545,23 @@ ecam_write(struct pci_dev *d, int pos, byte *buf, int len)
   return 1;
 }
 
-struct pci_methods pm_ecam = {
+static int
+ecam_map_bar(struct pci_dev *d, int bar UNUSED, int flags UNUSED, struct pci_bar_map *m)
+{
+  struct ecam_access *eacc = d->access->backend_data;
+
+  return physmem_map_bar(eacc->physmem, d, m);
+}
+
+static void
+ecam_unmap_bar(struct pci_dev *d, struct pci_bar_map *m)
+{
+  struct ecam_access *eacc = d->access->backend_data;
+
+  physmem_unmap_bar(eacc->physmem, m);
+}
+
+const struct pci_methods pm_ecam = {
   .name = "ecam",
   .help = "Raw memory mapped access using PCIe ECAM interface",
   .config = ecam_config,
@@ -1203,4 +1572,7 @@ struct pci_methods pm_ecam = {
   .fill_info = pci_generic_fill_info,
   .read = ecam_read,
   .write = ecam_write,
+  .get_domains = ecam_get_domains,
+  .map_bar = ecam_map_bar,
+  .unmap_bar = ecam_unmap_bar,
 };
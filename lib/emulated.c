@@ -8,6 +8,8 @@
  *	SPDX-License-Identifier: GPL-2.0-or-later
  */
 
+#include <string.h>
+
 #include "internal.h"
 
 static u32
@@ -71,19 +73,14 @@ odd_baseres_to_pcires(pciaddr_t addr0, pciaddr_t ioflg0, pciaddr_t addr, pciaddr
   return val;
 }
 
-int
-pci_emulated_read(struct pci_dev *d, int pos, byte *buf, int len)
+/* Synthesize the dword of the standard header at the given position */
+static u32
+emulated_dword(struct pci_dev *d, int pos)
 {
   u32 ht = PCI_HEADER_TYPE_NORMAL;
   u32 val = 0;
   int i;
 
-  if (pos >= 64)
-    return 0;
-
-  if (len > 4)
-    return pci_generic_block_read(d, pos, buf, len);
-
   if (d->device_class == PCI_CLASS_BRIDGE_PCI)
     ht = PCI_HEADER_TYPE_BRIDGE;
   else if (d->device_class == PCI_CLASS_BRIDGE_CARDBUS)
@@ -289,13 +286,41 @@ pci_emulated_read(struct pci_dev *d, int pos, byte *buf, int len)
           break;
       }
 
-  if (len <= 2)
-    val = (val >> (8 * (pos & 3))) & ((1 << (len * 8)) - 1);
+  return val;
+}
+
+/*
+ *  All the information the header is synthesized from is known once the
+ *  device is filled, so the whole header is built on the first read and
+ *  later reads are served from it. It is built under the fill lock, so that
+ *  threads reading the same device do not build it twice. The back-end using
+ *  the emulation frees the header by pci_free_emulated() in its cleanup_dev
+ *  hook.
+ */
+int
+pci_emulated_read(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  int i;
+
+  if (pos < 0 || pos + len > 64)
+    return 0;
 
-  while (len-- > 0)
+  pci_lock(d->access, PCI_LOCK_FILL);
+  if (!d->emulated)
     {
-      *(buf++) = val & 0xff;
-      val >>= 8;
+      d->emulated = pci_malloc(d->access, 64);
+      for (i = 0; i < 16; i++)
+        d->emulated[i] = cpu_to_le32(emulated_dword(d, 4*i));
     }
+  pci_unlock(d->access, PCI_LOCK_FILL);
+
+  memcpy(buf, (byte *) d->emulated + pos, len);
   return 1;
 }
+
+void
+pci_free_emulated(struct pci_dev *d)
+{
+  pci_mfree(d->emulated);
+  d->emulated = NULL;
+}
@@ -99,6 +99,65 @@ fbsd_cleanup(struct pci_access *a)
     }
 }
 
+/*
+ *  The result of PCIOCGETCONF for each device is kept in its backend_data,
+ *  so that the identification of the device can be filled in without
+ *  further ioctls (and without config space access, which needs write
+ *  permissions to /dev/pci).
+ */
+
+#define FBSD_CONF_FILL (PCI_FILL_IDENT | PCI_FILL_CLASS | PCI_FILL_CLASS_EXT | PCI_FILL_SUBSYS)
+
+static void
+fbsd_set_conf(struct pci_dev *d, struct pci_conf *conf)
+{
+  if (!d->backend_data)
+    d->backend_data = pci_malloc(d->access, sizeof(struct pci_conf));
+  memcpy(d->backend_data, conf, sizeof(struct pci_conf));
+}
+
+/* Fill what is known from PCIOCGETCONF, return the flags which have been handled */
+static unsigned int
+fbsd_fill_conf(struct pci_dev *d, unsigned int flags)
+{
+  struct pci_conf *conf = d->backend_data;
+  unsigned int done = PCI_FILL_IDENT | PCI_FILL_CLASS | PCI_FILL_CLASS_EXT;
+
+  if (!conf)
+    return 0;
+
+  if (want_fill(d, flags, PCI_FILL_IDENT))
+    {
+      d->vendor_id = conf->pc_vendor;
+      d->device_id = conf->pc_device;
+    }
+  if (want_fill(d, flags, PCI_FILL_CLASS))
+    d->device_class = (conf->pc_class << 8) | conf->pc_subclass;
+  if (want_fill(d, flags, PCI_FILL_CLASS_EXT))
+    {
+      d->prog_if = conf->pc_progif;
+      d->rev_id = conf->pc_revid;
+    }
+  /* The kernel reports subsystem IDs reliably only for normal devices */
+  if ((conf->pc_hdr & 0x7f) == PCI_HEADER_TYPE_NORMAL)
+    {
+      if (want_fill(d, flags, PCI_FILL_SUBSYS))
+	{
+	  d->subsys_vendor_id = conf->pc_subvendor;
+	  d->subsys_id = conf->pc_subdevice;
+	}
+      done |= PCI_FILL_SUBSYS;
+    }
+  return done;
+}
+
+static void
+fbsd_cleanup_dev(struct pci_dev *d)
+{
+  pci_mfree(d->backend_data);
+  d->backend_data = NULL;
+}
+
 static void
 fbsd_scan(struct pci_access *a)
 {
@@ -152,6 +211,7 @@ fbsd_scan(struct pci_access *a)
 	  t->device_id = matches[i].pc_device;
 	  t->known_fields = PCI_FILL_IDENT;
 	  t->hdrtype = matches[i].pc_hdr;
+	  fbsd_set_conf(t, &matches[i]);
 	  pci_link_dev(a, t);
 	}
       offset += conf.num_matches;
@@ -168,52 +228,79 @@ fbsd_fill_info(struct pci_dev *d, unsigned int flags)
   struct pci_bar_io bar;
   struct pci_match_conf pattern;
   struct pci_conf match;
-  int i;
+  int i, num_bars;
 
   if (d->access->fd_rw >= 0)
-    return pci_generic_fill_info(d, flags);
+    {
+      flags &= ~fbsd_fill_conf(d, flags);
+      if (flags)
+	pci_generic_fill_info(d, flags);
+      return;
+    }
 
   /*
-   * Can only handle PCI_FILL_IDENT, PCI_FILL_CLASS, PCI_FILL_BASES and
-   * PCI_FILL_SIZES requests with the PCIOCGETCONF and PCIOCGETBAR IOCTLs.
+   * Can only handle PCI_FILL_IDENT, PCI_FILL_CLASS, PCI_FILL_CLASS_EXT, PCI_FILL_SUBSYS,
+   * PCI_FILL_BASES and PCI_FILL_SIZES requests with the PCIOCGETCONF and PCIOCGETBAR IOCTLs.
+   * Devices which have not been found by the scan do not have the result of PCIOCGETCONF yet.
    */
 
-  conf.pat_buf_len = sizeof(struct pci_match_conf);
-  conf.num_patterns = 1;
-  conf.patterns = &pattern;
-  conf.match_buf_len = sizeof(struct pci_conf);
-  conf.num_matches = 1;
-  conf.matches = &match;
-  conf.offset = 0;
-  conf.generation = 0;
-  conf.status = 0;
+  if (!d->backend_data)
+    {
+      conf.pat_buf_len = sizeof(struct pci_match_conf);
+      conf.num_patterns = 1;
+      conf.patterns = &pattern;
+      conf.match_buf_len = sizeof(struct pci_conf);
+      conf.num_matches = 1;
+      conf.matches = &match;
+      conf.offset = 0;
+      conf.generation = 0;
+      conf.status = 0;
 
-  pattern.pc_sel.pc_domain = d->domain;
-  pattern.pc_sel.pc_bus = d->bus;
-  pattern.pc_sel.pc_dev = d->dev;
-  pattern.pc_sel.pc_func = d->func;
-  pattern.flags = PCI_GETCONF_MATCH_DOMAIN | PCI_GETCONF_MATCH_BUS |
-	  PCI_GETCONF_MATCH_DEV | PCI_GETCONF_MATCH_FUNC;
+      pattern.pc_sel.pc_domain = d->domain;
+      pattern.pc_sel.pc_bus = d->bus;
+      pattern.pc_sel.pc_dev = d->dev;
+      pattern.pc_sel.pc_func = d->func;
+      pattern.flags = PCI_GETCONF_MATCH_DOMAIN | PCI_GETCONF_MATCH_BUS |
+	      PCI_GETCONF_MATCH_DEV | PCI_GETCONF_MATCH_FUNC;
 
-  if (ioctl(d->access->fd, PCIOCGETCONF, &conf) < 0)
-    {
-      if (errno != ENODEV)
-	d->access->error("fbsd_fill_info: ioctl(PCIOCGETCONF) failed: %s", strerror(errno));
-      return;
+      if (ioctl(d->access->fd, PCIOCGETCONF, &conf) < 0)
+	{
+	  if (errno != ENODEV)
+	    d->access->error("fbsd_fill_info: ioctl(PCIOCGETCONF) failed: %s", strerror(errno));
+	  return;
+	}
+      if (conf.num_matches < 1)
+	return;
+      fbsd_set_conf(d, &match);
     }
 
-  if (want_fill(d, flags, PCI_FILL_IDENT))
-    {
-      d->vendor_id = match.pc_vendor;
-      d->device_id = match.pc_device;
-    }
-  if (want_fill(d, flags, PCI_FILL_CLASS))
-    d->device_class = (match.pc_class << 8) | match.pc_subclass;
+  fbsd_fill_conf(d, flags);
+
   if (want_fill(d, flags, PCI_FILL_BASES | PCI_FILL_SIZES))
     {
+      struct pci_conf *c = d->backend_data;
+
+      /* Ask only for the BARs the header type has */
+      switch (c->pc_hdr & 0x7f)
+	{
+	case PCI_HEADER_TYPE_BRIDGE:
+	  num_bars = 2;
+	  break;
+	case PCI_HEADER_TYPE_CARDBUS:
+	  num_bars = 1;
+	  break;
+	default:
+	  num_bars = 6;
+	}
+
       d->rom_base_addr = 0;
       d->rom_size = 0;
       for (i = 0; i < 6; i++)
+	{
+	  d->base_addr[i] = 0;
+	  d->size[i] = 0;
+	}
+      for (i = 0; i < num_bars; i++)
         {
 	  bar.pbi_sel.pc_domain = d->domain;
 	  bar.pbi_sel.pc_bus = d->bus;
@@ -227,18 +314,17 @@ fbsd_fill_info(struct pci_dev *d, unsigned int flags)
 	    {
 	      if (errno == ENODEV)
 		return;
-	      if (errno == EINVAL)
-	        {
-		  d->base_addr[i] = 0;
-		  d->size[i] = 0;
-		}
-	      else
+	      if (errno != EINVAL)
 	        d->access->error("fbsd_fill_info: ioctl(PCIOCGETBAR) failed: %s", strerror(errno));
 	    }
 	  else
 	    {
 	      d->base_addr[i] = bar.pbi_base;
 	      d->size[i] = bar.pbi_length;
+	      /* The upper half of a 64-bit BAR is reported together with the lower one */
+	      if ((bar.pbi_base & (PCI_BASE_ADDRESS_SPACE | PCI_BASE_ADDRESS_MEM_TYPE_MASK)) ==
+		  (PCI_BASE_ADDRESS_SPACE_MEMORY | PCI_BASE_ADDRESS_MEM_TYPE_64))
+		i++;
 	    }
 	}
     }
@@ -349,7 +435,7 @@ fbsd_write(struct pci_dev *d, int pos, byte *buf, int len)
   return 1;
 }
 
-struct pci_methods pm_fbsd_device = {
+const struct pci_methods pm_fbsd_device = {
   .name = "fbsd-device",
   .help = "FreeBSD /dev/pci device",
   .config = fbsd_config,
@@ -358,6 +444,7 @@ struct pci_methods pm_fbsd_device = {
   .cleanup = fbsd_cleanup,
   .scan = fbsd_scan,
   .fill_info = fbsd_fill_info,
+  .cleanup_dev = fbsd_cleanup_dev,
   .read = fbsd_read,
   .write = fbsd_write,
 };
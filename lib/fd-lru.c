@@ -0,0 +1,86 @@
+/*
+ *	The PCI Library -- LRU List of Devices with Open Files
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "internal.h"
+#include "fd-lru.h"
+
+void
+pci_fd_lru_init(struct pci_fd_lru *l, int max, void (*evict)(struct pci_access *a, struct pci_fd_lru_entry *e))
+{
+  l->first = l->last = NULL;
+  l->len = 0;
+  l->max = (max < 1) ? 1 : max;
+  l->evict = evict;
+}
+
+void
+pci_fd_lru_remove(struct pci_fd_lru *l, struct pci_fd_lru_entry *e)
+{
+  if (!e->in_lru)
+    return;
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    l->first = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    l->last = e->prev;
+  e->in_lru = 0;
+  l->len--;
+}
+
+/* Move the entry to the head of the list, making room for it if it is new */
+void
+pci_fd_lru_use(struct pci_access *a, struct pci_fd_lru *l, struct pci_fd_lru_entry *e)
+{
+  if (l->first == e)
+    return;
+
+  if (e->in_lru)
+    {
+      /* Unlink from the middle of the list */
+      e->prev->next = e->next;
+      if (e->next)
+	e->next->prev = e->prev;
+      else
+	l->last = e->prev;
+    }
+  else
+    {
+      struct pci_fd_lru_entry *victim = l->last;
+      while (l->len >= l->max && victim)
+	{
+	  struct pci_fd_lru_entry *prev = victim->prev;
+	  if (!victim->users)
+	    {
+	      l->evict(a, victim);
+	      PCI_STAT(a, fd_evictions, 1);
+	    }
+	  victim = prev;
+	}
+      e->in_lru = 1;
+      l->len++;
+    }
+
+  /* Insert at the head */
+  e->prev = NULL;
+  e->next = l->first;
+  if (l->first)
+    l->first->prev = e;
+  else
+    l->last = e;
+  l->first = e;
+}
+
+void
+pci_fd_lru_evict_all(struct pci_access *a, struct pci_fd_lru *l)
+{
+  while (l->first)
+    l->evict(a, l->first);
+}
@@ -0,0 +1,36 @@
+/*
+ *	The PCI Library -- LRU List of Devices with Open Files
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*
+ *  Back-ends which access devices through per-device files keep the files of
+ *  recently used devices open, so that interleaved accesses to multiple devices
+ *  do not need to re-open them all the time. Devices with open files form an
+ *  LRU list of bounded length, the least recently used ones are evicted.
+ *
+ *  The back-end embeds struct pci_fd_lru_entry in its per-device data and
+ *  provides a function which closes the files of an entry and removes it from
+ *  the list by pci_fd_lru_remove(). Entries with non-zero users are never evicted.
+ *  The caller is responsible for locking.
+ */
+
+struct pci_fd_lru_entry {
+  struct pci_fd_lru_entry *prev, *next;
+  int in_lru;
+  int users;				/* References held by the back-end */
+};
+
+struct pci_fd_lru {
+  struct pci_fd_lru_entry *first, *last;	/* Most recently used first */
+  int len, max;
+  void (*evict)(struct pci_access *a, struct pci_fd_lru_entry *e);
+};
+
+void pci_fd_lru_init(struct pci_fd_lru *l, int max, void (*evict)(struct pci_access *a, struct pci_fd_lru_entry *e));
+void pci_fd_lru_use(struct pci_access *a, struct pci_fd_lru *l, struct pci_fd_lru_entry *e);
+void pci_fd_lru_remove(struct pci_fd_lru *l, struct pci_fd_lru_entry *e);
+void pci_fd_lru_evict_all(struct pci_access *a, struct pci_fd_lru *l);
@@ -194,34 +194,224 @@ pci_filter_parse_id_v38(struct pci_filter *f, char *str)
   return NULL;
 }
 
+static unsigned int
+filter_fill_flags(struct pci_filter *f)
+{
+  unsigned int flags = 0;
+
+  if (f->device >= 0 || f->vendor >= 0)
+    flags |= PCI_FILL_IDENT;
+  if (f->device_class >= 0)
+    flags |= PCI_FILL_CLASS;
+  if (f->prog_if >= 0)
+    flags |= PCI_FILL_CLASS_EXT;
+  return flags;
+}
+
+/* Tests which can be evaluated without any access to the device */
+static int
+filter_match_addr(struct pci_filter *f, struct pci_dev *d)
+{
+  return !((f->domain >= 0 && f->domain != d->domain) ||
+	   (f->bus >= 0 && f->bus != d->bus) ||
+	   (f->slot >= 0 && f->slot != d->dev) ||
+	   (f->func >= 0 && f->func != d->func));
+}
+
+/* The rest, assuming that the necessary fields have been filled in */
+static int
+filter_match_fields(struct pci_filter *f, struct pci_dev *d)
+{
+  return !((f->device >= 0 && f->device != d->device_id) ||
+	   (f->vendor >= 0 && f->vendor != d->vendor_id) ||
+	   (f->device_class >= 0 && ((f->device_class ^ d->device_class) & f->device_class_mask)) ||
+	   (f->prog_if >= 0 && f->prog_if != d->prog_if));
+}
+
 int
 pci_filter_match_v38(struct pci_filter *f, struct pci_dev *d)
 {
-  if ((f->domain >= 0 && f->domain != d->domain) ||
-      (f->bus >= 0 && f->bus != d->bus) ||
-      (f->slot >= 0 && f->slot != d->dev) ||
-      (f->func >= 0 && f->func != d->func))
+  unsigned int flags;
+
+  if (!filter_match_addr(f, d))
     return 0;
-  if (f->device >= 0 || f->vendor >= 0)
-    {
-      pci_fill_info_v313(d, PCI_FILL_IDENT);
-      if ((f->device >= 0 && f->device != d->device_id) ||
-	  (f->vendor >= 0 && f->vendor != d->vendor_id))
-	return 0;
-    }
-  if (f->device_class >= 0)
+  if (flags = filter_fill_flags(f))
+    pci_fill_info_v314(d, flags);
+  return filter_match_fields(f, d);
+}
+
+/*
+ *  Compiled filters: a disjunction of any number of filters, which is matched
+ *  against each device with at most one call to pci_fill_info(). Only the
+ *  information needed by the filters which pass the address tests is filled in.
+ */
+
+struct pci_filter_item {
+  struct pci_filter f;
+  unsigned int flags;			/* PCI_FILL_xxx needed by this filter */
+};
+
+struct pci_filter_set {
+  struct pci_access *access;
+  int num_items;
+  unsigned int flags;			/* Union of flags of all items */
+  struct pci_dev **devs;		/* Result of the last pci_filter_select() */
+  int max_devs;
+  struct pci_filter_item items[1];
+};
+
+struct pci_filter_set *
+pci_filter_compile(struct pci_access *a, struct pci_filter *filters, int n)
+{
+  struct pci_filter_set *set;
+  int i;
+
+  set = pci_malloc(a, sizeof(*set) + (n ? n-1 : 0) * sizeof(struct pci_filter_item));
+  set->access = a;
+  set->num_items = n;
+  set->flags = 0;
+  set->devs = NULL;
+  set->max_devs = 0;
+  for (i=0; i<n; i++)
     {
-      pci_fill_info_v313(d, PCI_FILL_CLASS);
-      if ((f->device_class ^ d->device_class) & f->device_class_mask)
-	return 0;
+      set->items[i].f = filters[i];
+      set->items[i].flags = filter_fill_flags(&filters[i]);
+      set->flags |= set->items[i].flags;
     }
-  if (f->prog_if >= 0)
+  return set;
+}
+
+void
+pci_filter_free(struct pci_filter_set *set)
+{
+  if (!set)
+    return;
+  pci_mfree(set->devs);
+  pci_mfree(set);
+}
+
+int
+pci_filter_set_match(struct pci_filter_set *set, struct pci_dev *d)
+{
+  unsigned int flags = 0;
+  int i, candidates = 0;
+
+  if (!set->num_items)
+    return 1;
+
+  for (i=0; i<set->num_items; i++)
+    if (filter_match_addr(&set->items[i].f, d))
+      {
+	if (!set->items[i].flags)
+	  return 1;
+	flags |= set->items[i].flags;
+	candidates++;
+      }
+  if (!candidates)
+    return 0;
+
+  pci_fill_info_v314(d, flags);
+  for (i=0; i<set->num_items; i++)
+    if (filter_match_addr(&set->items[i].f, d) &&
+	filter_match_fields(&set->items[i].f, d))
+      return 1;
+  return 0;
+}
+
+struct pci_dev **
+pci_filter_select(struct pci_filter_set *set, int *count)
+{
+  struct pci_dev *d;
+  int n = 0;
+
+  for (d = set->access->devices; d; d = d->next)
+    if (pci_filter_set_match(set, d))
+      {
+	if (n + 1 >= set->max_devs)
+	  {
+	    set->max_devs = set->max_devs ? 2*set->max_devs : 16;
+	    set->devs = pci_realloc(set->access, set->devs, set->max_devs * sizeof(struct pci_dev *));
+	  }
+	set->devs[n++] = d;
+      }
+  if (!set->devs)
     {
-      pci_fill_info_v313(d, PCI_FILL_CLASS_EXT);
-      if (f->prog_if != d->prog_if)
-	return 0;
+      set->max_devs = 1;
+      set->devs = pci_malloc(set->access, sizeof(struct pci_dev *));
     }
-  return 1;
+  set->devs[n] = NULL;
+  if (count)
+    *count = n;
+  return set->devs;
+}
+
+/*
+ *  Filtered scan: the filter is made available to the back-end, which can skip
+ *  devices early if they can be tested cheaply (e.g., by their address). The
+ *  remaining devices which do not match are removed afterwards.
+ */
+
+void
+pci_scan_bus_filtered(struct pci_access *a, struct pci_filter *f)
+{
+  struct pci_dev **dp, *d;
+
+  a->scan_filter = f;
+  pci_scan_bus(a);
+  a->scan_filter = NULL;
+  if (!f)
+    return;
+
+  for (dp = &a->devices; d = *dp; )
+    if (pci_filter_match_v38(f, d))
+      dp = &d->next;
+    else
+      {
+	*dp = d->next;
+	pci_free_dev(d);
+      }
+}
+
+int
+pci_scan_wants_addr(struct pci_access *a, int domain, int bus, int dev, int func)
+{
+  struct pci_filter *f = a->scan_filter;
+
+  return !f ||
+    !((f->domain >= 0 && domain >= 0 && f->domain != domain) ||
+      (f->bus >= 0 && bus >= 0 && f->bus != bus) ||
+      (f->slot >= 0 && dev >= 0 && f->slot != dev) ||
+      (f->func >= 0 && func >= 0 && f->func != func));
+}
+
+/* Can a matching device be on any of the buses in the given range? */
+int
+pci_scan_wants_buses(struct pci_access *a, int domain, int start_bus, int end_bus)
+{
+  struct pci_filter *f = a->scan_filter;
+
+  return !f ||
+    !((f->domain >= 0 && f->domain != domain) ||
+      (f->bus >= 0 && (f->bus < start_bus || f->bus > end_bus)));
+}
+
+int
+pci_scan_wants_ids(struct pci_access *a, int vendor, int device, int device_class, int prog_if)
+{
+  struct pci_filter *f = a->scan_filter;
+
+  return !f ||
+    !((f->vendor >= 0 && vendor >= 0 && f->vendor != vendor) ||
+      (f->device >= 0 && device >= 0 && f->device != device) ||
+      (f->device_class >= 0 && device_class >= 0 && ((f->device_class ^ device_class) & f->device_class_mask)) ||
+      (f->prog_if >= 0 && prog_if >= 0 && f->prog_if != prog_if));
+}
+
+/* Which information the IDs tested by the filter come from (0 if none) */
+unsigned int
+pci_scan_wants_fill(struct pci_access *a)
+{
+  return a->scan_filter ? filter_fill_flags(a->scan_filter) : 0;
 }
 
 /*
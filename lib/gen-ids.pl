@@ -0,0 +1,171 @@
+#!/usr/bin/perl
+# Generate the built-in ID table (ids-builtin.h) from a subset of pci.ids
+#
+# Can be freely distributed and used under the terms of the GNU GPL v2+.
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Usage: gen-ids.pl <vendors> <pci.ids> > ids-builtin.h
+#
+# <vendors> is a list of hexadecimal vendor ID's separated by commas or spaces,
+# or "all". All classes are always included. The table is a perfect hash
+# built by hash-and-displace; the hash function must match builtin_hash()
+# in names-builtin.c.
+
+use strict;
+use warnings;
+
+my ($ID_VENDOR, $ID_DEVICE, $ID_SUBSYSTEM, $ID_GEN_SUBSYSTEM, $ID_CLASS, $ID_SUBCLASS, $ID_PROGIF) = (1..7);
+
+@ARGV == 2 or die "Usage: $0 <vendors> <pci.ids>\n";
+my ($vendor_list, $ids_file) = @ARGV;
+
+my $all = ($vendor_list =~ /^\s*all\s*$/i);
+my %want;
+if (!$all) {
+	for my $v (split /[\s,]+/, $vendor_list) {
+		next if $v eq '';
+		$v =~ /^(0x)?[0-9a-f]{1,4}$/i or die "$0: Invalid vendor ID $v\n";
+		$want{hex $v} = 1;
+	}
+}
+
+# Parse pci.ids the same way as names-parse.c does
+
+my @entries;			# [cat, id12, id34, name]
+my %seen;
+open my $f, '<', $ids_file or die "$0: Cannot open $ids_file: $!\n";
+my ($cat, $id1, $id2, $take) = (0, 0, 0, 0);
+while (<$f>) {
+	chomp;
+	s/\r$//;
+	s/[ \t]$//;
+	next if /^\s*(#.*)?$/;
+	my ($c, $i12, $i34, $name);
+	if (/^C ([0-9a-f]{2})\s+(.*)/i) {
+		($cat, $id1, $take) = ($ID_CLASS, hex $1, 1);
+		($c, $i12, $i34, $name) = ($ID_CLASS, $id1 << 16, 0, $2);
+	} elsif (/^S ([0-9a-f]{4})$/i) {
+		($cat, $id1) = ($ID_GEN_SUBSYSTEM, hex $1);
+		$take = $all || $want{$id1};
+		next;
+	} elsif (/^[A-Z] /) {
+		($cat, $take) = (0, 0);
+		next;
+	} elsif (/^([0-9a-f]{4})\s+(.*)/i) {
+		($cat, $id1) = ($ID_VENDOR, hex $1);
+		$take = $all || $want{$id1};
+		($c, $i12, $i34, $name) = ($ID_VENDOR, $id1 << 16, 0, $2);
+	} elsif (!$cat) {
+		next;
+	} elsif (/^\t([0-9a-f]{4})\s+(.*)/i && $cat != $ID_CLASS && $cat != $ID_SUBCLASS && $cat != $ID_PROGIF) {
+		$id2 = hex $1;
+		$cat = $ID_DEVICE if $cat != $ID_GEN_SUBSYSTEM;
+		($c, $i12, $i34, $name) = ($cat, ($id1 << 16) | $id2, 0, $2);
+	} elsif (/^\t\t([0-9a-f]{4})\s+([0-9a-f]{4})\s+(.*)/i && ($cat == $ID_DEVICE || $cat == $ID_SUBSYSTEM)) {
+		$cat = $ID_SUBSYSTEM;
+		($c, $i12, $i34, $name) = ($cat, ($id1 << 16) | $id2, (hex($1) << 16) | hex($2), $3);
+	} elsif (/^\t([0-9a-f]{2})\s+(.*)/i && $cat >= $ID_CLASS) {
+		$id2 = hex $1;
+		$cat = $ID_SUBCLASS;
+		($c, $i12, $i34, $name) = ($cat, ($id1 << 16) | $id2, 0, $2);
+	} elsif (/^\t\t([0-9a-f]{2})\s+(.*)/i && ($cat == $ID_SUBCLASS || $cat == $ID_PROGIF)) {
+		$cat = $ID_PROGIF;
+		($c, $i12, $i34, $name) = ($cat, ($id1 << 16) | $id2, hex($1) << 16, $2);
+	} else {
+		die "$0: Parse error at $ids_file, line $.\n";
+	}
+	next if !$take || $name eq '';
+	next if $seen{"$c:$i12:$i34"}++;
+	push @entries, [$c, $i12, $i34, $name];
+}
+close $f;
+
+# Build the perfect hash
+
+sub mul32 {
+	my ($x, $y) = @_;
+	return ($x * ($y & 0xffff) + ((($x * ($y >> 16)) & 0xffff) << 16)) & 0xffffffff;
+}
+
+sub builtin_hash {
+	my ($seed, $c, $i12, $i34) = @_;
+	my $h = (mul32($seed, 0x9e3779b1) + $c) & 0xffffffff;
+	$h = mul32($h ^ $i12, 0x85ebca6b);
+	$h ^= $h >> 15;
+	$h = mul32($h ^ $i34, 0xc2b2ae35);
+	$h ^= $h >> 13;
+	return $h;
+}
+
+my $n = @entries;
+my $size = $n + int($n / 4) + 1;
+my $num_buckets = int($n / 4) + 1;
+my @buckets;
+for my $e (@entries) {
+	push @{$buckets[builtin_hash(0, @$e[0..2]) % $num_buckets]}, $e;
+}
+
+my @slots = (undef) x $size;
+my @seeds = (0) x $num_buckets;
+for my $b (sort { @{$buckets[$b] || []} <=> @{$buckets[$a] || []} || $a <=> $b } 0..$num_buckets-1) {
+	my $list = $buckets[$b] or next;
+	SEED: for (my $seed = 1; ; $seed++) {
+		die "$0: Cannot build the hash table\n" if $seed > 0xffffff;
+		my %used;
+		for my $e (@$list) {
+			my $s = builtin_hash($seed, @$e[0..2]) % $size;
+			next SEED if defined $slots[$s] || $used{$s}++;
+		}
+		for my $e (@$list) {
+			$slots[builtin_hash($seed, @$e[0..2]) % $size] = $e;
+		}
+		$seeds[$b] = $seed;
+		last;
+	}
+}
+
+# Build the string pool
+
+my $pool = "\0";		# Offset 0 is used by empty slots
+my %offsets;
+for my $e (@entries) {
+	next if defined $offsets{$e->[3]};
+	$offsets{$e->[3]} = length $pool;
+	$pool .= $e->[3] . "\0";
+}
+die "$0: Too many names\n" if length($pool) > 0xffffff;
+
+sub c_string {
+	my ($s) = @_;
+	$s =~ s/([^ !#-\[\]-~]|\?)/sprintf("\\%03o", ord $1)/ge;
+	return "\"$s\"";
+}
+
+print "/* Generated by gen-ids.pl from $ids_file, do not edit */\n\n";
+printf "#define BUILTIN_IDS_ALL_VENDORS %d\n", $all ? 1 : 0;
+print "#define BUILTIN_IDS_SIZE $size\n";
+print "#define BUILTIN_IDS_BUCKETS $num_buckets\n\n";
+
+print "static const u32 builtin_id_seeds[BUILTIN_IDS_BUCKETS] = {\n";
+for (my $i = 0; $i < $num_buckets; $i += 8) {
+	my $last = ($i + 7 < $num_buckets) ? $i + 7 : $num_buckets - 1;
+	print "  ", join(", ", @seeds[$i..$last]), ",\n";
+}
+print "};\n\n";
+
+print "static const struct builtin_id builtin_ids[BUILTIN_IDS_SIZE] = {\n";
+for my $e (@slots) {
+	if ($e) {
+		printf "  { 0x%08x, 0x%08x, 0x%08x },\n", $e->[1], $e->[2], ($e->[0] << 24) | $offsets{$e->[3]};
+	} else {
+		print "  { 0, 0, 0 },\n";
+	}
+}
+print "};\n\n";
+
+print "static const char builtin_id_strings[] =\n";
+for my $s (split /(?<=\0)/, $pool) {
+	print "  ", c_string($s), "\n";
+}
+print "  ;\n";
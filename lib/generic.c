@@ -8,67 +8,382 @@
  *	SPDX-License-Identifier: GPL-2.0-or-later
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "internal.h"
 
-void
-pci_generic_scan_bus(struct pci_access *a, byte *busmap, int domain, int bus)
+#ifdef PCI_HAVE_PTHREAD
+#include <pthread.h>
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+#define SCAN_LOCK() pthread_mutex_lock(&scan_lock)
+#define SCAN_UNLOCK() pthread_mutex_unlock(&scan_lock)
+#else
+#define SCAN_LOCK() do { } while (0)
+#define SCAN_UNLOCK() do { } while (0)
+#endif
+
+/*
+ *  A scan job walks a bus and (usually) everything behind it. Devices are
+ *  either linked to the pci_access immediately, or collected in scan order
+ *  and linked later, which is used when jobs run in parallel. A job can also
+ *  defer buses behind bridges to sub-jobs instead of recursing into them.
+ *
+ *  With the scan.fast parameter set, the scan trusts the bus topology: it
+ *  skips buses outside the range of the domain and bridges with unassigned
+ *  bus numbers, probes only device 0 on links below PCIe ports and follows
+ *  ARI next function numbers instead of probing all functions.
+ */
+struct scan_job {
+  struct pci_access *a;
+  byte *busmap;
+  int domain, bus, bus_flags;
+  int fast, start_bus, end_bus;
+  struct pci_dev *parent;		/* Bridge leading to the bus of a sub-job */
+  struct pci_dev *first, **last;	/* Collected devices, last==NULL if linking directly */
+  int defer;
+  struct scan_job *sub;			/* Deferred sub-jobs */
+  int num_sub, max_sub;
+  byte busmap_space[256];
+};
+
+#define SCAN_ONE_DEV 1			/* Only device 0 can exist on the bus */
+#define SCAN_ARI 2			/* ARI forwarding is enabled */
+
+static void
+scan_job_init(struct scan_job *j, struct pci_access *a, byte *busmap, int domain)
+{
+  char *fast = pci_get_param(a, "scan.fast");
+
+  memset(j, 0, sizeof(*j));
+  j->a = a;
+  j->busmap = busmap;
+  j->domain = domain;
+  j->fast = fast && atoi(fast);
+  j->end_bus = 255;
+}
+
+static void
+scan_add_dev(struct scan_job *j, struct pci_dev *d)
+{
+  if (j->last)
+    {
+      d->next = NULL;
+      *j->last = d;
+      j->last = &d->next;
+    }
+  else
+    pci_link_dev(j->a, d);
+}
+
+static void
+scan_defer(struct scan_job *j, struct pci_dev *bridge, int bus, int bus_flags)
+{
+  struct scan_job *s;
+
+  if (j->num_sub >= j->max_sub)
+    {
+      j->max_sub = j->max_sub ? 2*j->max_sub : 16;
+      j->sub = pci_realloc(j->a, j->sub, j->max_sub * sizeof(*j->sub));
+    }
+  s = &j->sub[j->num_sub++];
+  memset(s, 0, sizeof(*s));
+  s->a = j->a;
+  s->busmap = j->busmap;
+  s->domain = j->domain;
+  s->bus = bus;
+  s->bus_flags = bus_flags;
+  s->fast = j->fast;
+  s->start_bus = j->start_bus;
+  s->end_bus = j->end_bus;
+  s->parent = bridge;
+}
+
+/* Find out what can live on the secondary bus of a bridge */
+static int
+scan_bridge_flags(struct pci_dev *t)
+{
+  int pos, ttl = 48;
+
+  if (!(pci_read_word(t, PCI_STATUS) & PCI_STATUS_CAP_LIST))
+    return 0;
+  pos = pci_read_byte(t, PCI_CAPABILITY_LIST) & ~3;
+  while (pos >= 0x40 && ttl--)
+    {
+      int id = pci_read_byte(t, pos + PCI_CAP_LIST_ID);
+      if (id == 0xff)
+	break;
+      if (id == PCI_CAP_ID_EXP)
+	{
+	  word flags = pci_read_word(t, pos + PCI_EXP_FLAGS);
+	  int type = (flags & PCI_EXP_FLAGS_TYPE) >> 4;
+	  int f = 0;
+	  if (type == PCI_EXP_TYPE_ROOT_PORT || type == PCI_EXP_TYPE_DOWNSTREAM || type == PCI_EXP_TYPE_PCIE_BRIDGE)
+	    {
+	      f = SCAN_ONE_DEV;
+	      if ((flags & PCI_EXP_FLAGS_VERS) >= 2 &&
+		  (pci_read_word(t, pos + PCI_EXP_DEVCTL2) & PCI_EXP_DEVCTL2_ARI))
+		f |= SCAN_ARI;
+	    }
+	  return f;
+	}
+      pos = pci_read_byte(t, pos + PCI_CAP_LIST_NEXT) & ~3;
+    }
+  return 0;
+}
+
+/* Return ARI next function number, -1 if the function has no ARI capability */
+static int
+scan_ari_next(struct pci_dev *t)
+{
+  int pos = 0x100, ttl = (0x1000 - 0x100) / 8;
+
+  while (pos >= 0x100 && ttl--)
+    {
+      u32 h = pci_read_long(t, pos);
+      if (!h || h == 0xffffffff)
+	break;
+      if ((h & 0xffff) == PCI_EXT_CAP_ID_ARI)
+	return PCI_ARI_CAP_NFN(pci_read_word(t, pos + PCI_ARI_CAP));
+      pos = (h >> 20) & ~3;
+    }
+  return -1;
+}
+
+static void scan_bus(struct scan_job *j, int bus, int bus_flags);
+
+/* Probe the function addressed by t, return its header type or -1 if it is not present */
+static int
+scan_func(struct scan_job *j, struct pci_dev *t)
 {
-  int dev, multi, ht;
+  struct pci_access *a = j->a;
+  u32 vd = pci_read_long(t, PCI_VENDOR_ID);
+  struct pci_dev *d;
+  int ht, sec, sub, flags;
+
+  if (!vd || vd == 0xffffffff)
+    return -1;
+  ht = pci_read_byte(t, PCI_HEADER_TYPE);
+  d = pci_alloc_dev(a);
+  d->domain = t->domain;
+  d->bus = t->bus;
+  d->dev = t->dev;
+  d->func = t->func;
+  d->vendor_id = vd & 0xffff;
+  d->device_id = vd >> 16U;
+  d->known_fields = PCI_FILL_IDENT;
+  d->hdrtype = ht & 0x7f;
+  scan_add_dev(j, d);
+  switch (ht & 0x7f)
+    {
+    case PCI_HEADER_TYPE_NORMAL:
+      break;
+    case PCI_HEADER_TYPE_BRIDGE:
+    case PCI_HEADER_TYPE_CARDBUS:
+      sec = pci_read_byte(t, PCI_SECONDARY_BUS);
+      flags = 0;
+      if (j->fast)
+	{
+	  sub = pci_read_byte(t, PCI_SUBORDINATE_BUS);
+	  if (sec <= t->bus || sec > sub)
+	    {
+	      a->debug("Bridge %04x:%02x:%02x.%d has no valid bus range, skipping.\n", d->domain, d->bus, d->dev, d->func);
+	      break;
+	    }
+	  flags = scan_bridge_flags(t);
+	  if (!pci_scan_wants_buses(a, d->domain, sec, sub))
+	    {
+	      a->debug("Bridge %04x:%02x:%02x.%d leads to no wanted buses, skipping.\n", d->domain, d->bus, d->dev, d->func);
+	      break;
+	    }
+	}
+      if (j->defer)
+	scan_defer(j, d, sec, flags);
+      else
+	scan_bus(j, sec, flags);
+      break;
+    default:
+      a->debug("Device %04x:%02x:%02x.%d has unknown header type %02x.\n", d->domain, d->bus, d->dev, d->func, ht & 0x7f);
+    }
+  return ht;
+}
+
+static void
+scan_bus(struct scan_job *j, int bus, int bus_flags)
+{
+  struct pci_access *a = j->a;
+  int dev, max_dev, multi, ht, seen, fn, next;
   struct pci_dev *t;
 
+  if (bus < j->start_bus || bus > j->end_bus)
+    {
+      a->debug("Bus %02x is outside of the domain, skipping.\n", bus);
+      return;
+    }
+  if (!pci_scan_wants_buses(a, j->domain, 0, 255))
+    return;
   a->debug("Scanning bus %02x for devices...\n", bus);
-  if (busmap[bus])
+  SCAN_LOCK();
+  seen = j->busmap[bus];
+  j->busmap[bus] = 1;
+  SCAN_UNLOCK();
+  if (seen)
     {
       a->warning("Bus %02x seen twice (firmware bug). Ignored.", bus);
       return;
     }
-  busmap[bus] = 1;
-  t = pci_alloc_dev(a);
-  t->domain = domain;
-  t->bus = bus;
-  for (dev=0; dev<32; dev++)
+  t = pci_alloc_probe(a);
+  max_dev = (bus_flags & SCAN_ONE_DEV) ? 1 : 32;
+  for (dev=0; dev<max_dev; dev++)
     {
-      t->dev = dev;
-      multi = 0;
-      for (t->func=0; !t->func || multi && t->func<8; t->func++)
+      pci_set_probe_addr(t, j->domain, bus, dev, 0);
+      ht = scan_func(j, t);
+      if (ht < 0)
+	continue;
+      if ((bus_flags & SCAN_ARI) && (next = scan_ari_next(t)) >= 0)
 	{
-	  u32 vd = pci_read_long(t, PCI_VENDOR_ID);
-	  struct pci_dev *d;
-
-	  if (!vd || vd == 0xffffffff)
-	    continue;
-	  ht = pci_read_byte(t, PCI_HEADER_TYPE);
-	  if (!t->func)
-	    multi = ht & 0x80;
-	  ht &= 0x7f;
-	  d = pci_alloc_dev(a);
-	  d->domain = t->domain;
-	  d->bus = t->bus;
-	  d->dev = t->dev;
-	  d->func = t->func;
-	  d->vendor_id = vd & 0xffff;
-	  d->device_id = vd >> 16U;
-	  d->known_fields = PCI_FILL_IDENT;
-	  d->hdrtype = ht;
-	  pci_link_dev(a, d);
-	  switch (ht)
+	  /* Function numbers are 8-bit, they overlap the device number */
+	  fn = 0;
+	  while (next > fn)
 	    {
-	    case PCI_HEADER_TYPE_NORMAL:
-	      break;
-	    case PCI_HEADER_TYPE_BRIDGE:
-	    case PCI_HEADER_TYPE_CARDBUS:
-	      pci_generic_scan_bus(a, busmap, domain, pci_read_byte(t, PCI_SECONDARY_BUS));
-	      break;
-	    default:
-	      a->debug("Device %04x:%02x:%02x.%d has unknown header type %02x.\n", d->domain, d->bus, d->dev, d->func, ht);
+	      fn = next;
+	      pci_set_probe_addr(t, j->domain, bus, fn >> 3, fn & 7);
+	      if (scan_func(j, t) < 0)
+		break;
+	      next = scan_ari_next(t);
 	    }
+	  break;
+	}
+      multi = ht & 0x80;
+      for (fn=1; multi && fn<8; fn++)
+	{
+	  pci_set_probe_addr(t, j->domain, bus, dev, fn);
+	  scan_func(j, t);
 	}
     }
   pci_free_dev(t);
 }
 
+void
+pci_generic_scan_bus(struct pci_access *a, byte *busmap, int domain, int bus)
+{
+  struct scan_job j;
+
+  scan_job_init(&j, a, busmap, domain);
+  scan_bus(&j, bus, 0);
+}
+
+static void
+scan_job_link(struct scan_job *j)
+{
+  struct pci_dev *d, *next;
+
+  for (d = j->first; d; d = next)
+    {
+      next = d->next;
+      pci_link_dev(j->a, d);
+    }
+}
+
+static void
+scan_root_worker(void *data, int job)
+{
+  struct scan_job *j = (struct scan_job *) data + job;
+  scan_bus(j, j->bus, 0);
+}
+
+static void
+scan_sub_worker(void *data, int job)
+{
+  struct scan_job *j = ((struct scan_job **) data)[job];
+  scan_bus(j, j->bus, j->bus_flags);
+}
+
+static void
+scan_job_set_range(struct scan_job *j, struct pci_bus_range *r)
+{
+  if (j->fast)
+    {
+      j->start_bus = r->start_bus;
+      j->end_bus = r->end_bus;
+      j->bus = r->start_bus;
+    }
+}
+
+/*
+ *  Scan multiple domains using up to the given number of threads. The root
+ *  bus of every domain is scanned first, then the subtrees behind bridges on
+ *  root buses are scanned concurrently. The back-end's read method must be
+ *  thread-safe. Devices are linked in the same order as by the serial scan.
+ *  Bus ranges of the domains are only used by the fast scan.
+ */
+void
+pci_generic_scan_domains(struct pci_access *a, struct pci_bus_range *ranges, int num_domains, int threads)
+{
+  struct scan_job *roots, **subs;
+  int i, k, num_subs;
+
+  if (threads <= 1)
+    {
+      for (i = 0; i < num_domains; i++)
+	{
+	  struct scan_job j;
+	  byte busmap[256];
+
+	  memset(busmap, 0, sizeof(busmap));
+	  scan_job_init(&j, a, busmap, ranges[i].domain);
+	  scan_job_set_range(&j, &ranges[i]);
+	  scan_bus(&j, j.bus, 0);
+	}
+      return;
+    }
+
+  roots = pci_malloc(a, (num_domains ? num_domains : 1) * sizeof(*roots));
+  for (i = 0; i < num_domains; i++)
+    {
+      struct scan_job *j = &roots[i];
+      scan_job_init(j, a, j->busmap_space, ranges[i].domain);
+      scan_job_set_range(j, &ranges[i]);
+      j->last = &j->first;
+      j->defer = 1;
+    }
+  a->debug("Scanning %d domains using %d threads\n", num_domains, threads);
+  pci_run_parallel(a, threads, num_domains, scan_root_worker, roots);
+
+  num_subs = 0;
+  for (i = 0; i < num_domains; i++)
+    num_subs += roots[i].num_sub;
+  subs = pci_malloc(a, (num_subs ? num_subs : 1) * sizeof(*subs));
+  num_subs = 0;
+  for (i = 0; i < num_domains; i++)
+    for (k = 0; k < roots[i].num_sub; k++)
+      {
+	struct scan_job *s = &roots[i].sub[k];
+	s->last = &s->first;
+	subs[num_subs++] = s;
+      }
+  pci_run_parallel(a, threads, num_subs, scan_sub_worker, subs);
+
+  for (i = 0; i < num_domains; i++)
+    {
+      struct scan_job *j = &roots[i];
+      struct pci_dev *d, *next;
+
+      k = 0;
+      for (d = j->first; d; d = next)
+	{
+	  next = d->next;
+	  pci_link_dev(a, d);
+	  while (k < j->num_sub && j->sub[k].parent == d)
+	    scan_job_link(&j->sub[k++]);
+	}
+      pci_mfree(j->sub);
+    }
+
+  pci_mfree(subs);
+  pci_mfree(roots);
+}
+
 void
 pci_generic_scan_domain(struct pci_access *a, int domain)
 {
@@ -85,10 +400,99 @@ pci_generic_scan(struct pci_access *a)
 }
 
 static int
-get_hdr_type(struct pci_dev *d)
+cmp_domains(const void *A, const void *B)
+{
+  int a = *(const int *) A, b = *(const int *) B;
+  return (a < b) ? -1 : (a > b);
+}
+
+/*
+ *  For get_domains of back-ends which know only which domains exist:
+ *  sorts the list of their numbers (which may contain duplicates) and
+ *  reports each domain once with all buses.
+ */
+int
+pci_generic_domains(int *domains, int n, struct pci_bus_range *ranges, int max)
+{
+  int i, k = 0;
+
+  if (n)
+    qsort(domains, n, sizeof(int), cmp_domains);
+  for (i = 0; i < n; i++)
+    if (!i || domains[i] != domains[i-1])
+      {
+	if (k < max)
+	  {
+	    ranges[k].domain = domains[i];
+	    ranges[k].start_bus = 0;
+	    ranges[k].end_bus = 255;
+	  }
+	k++;
+      }
+  return k;
+}
+
+/*
+ *  The standard header is fetched by a single block read before it is
+ *  decoded, so that back-ends without a cache of their own do not issue
+ *  a separate config space access for every field. CardBus bridges have
+ *  their subsystem IDs just past the header, so they are fetched, too.
+ *  If the block read fails or the caller has set up a cache of the header
+ *  by pci_setup_cache(), the fields are read one by one as usual.
+ */
+
+#define FILL_HEADER (PCI_FILL_IDENT | PCI_FILL_CLASS | PCI_FILL_CLASS_EXT | PCI_FILL_SUBSYS | PCI_FILL_IRQ | PCI_FILL_BASES | PCI_FILL_ROM_BASE)
+
+struct fill_header {
+  u32 data[PCI_CB_LEGACY_MODE_BASE / 4];
+  int len;
+};
+
+static void
+fill_header_prefetch(struct pci_dev *d, struct fill_header *h, unsigned int flags)
+{
+  h->len = 0;
+  if (!(flags & FILL_HEADER & ~d->known_fields) || d->cache_len >= 64)
+    return;
+  if (!pci_read_block(d, 0, (byte *) h->data, 64))
+    return;
+  h->len = 64;
+  if (d->hdrtype < 0)
+    d->hdrtype = ((byte *) h->data)[PCI_HEADER_TYPE] & 0x7f;
+  if (d->hdrtype == PCI_HEADER_TYPE_CARDBUS && (flags & PCI_FILL_SUBSYS & ~d->known_fields) &&
+      pci_read_block(d, 64, (byte *) h->data + 64, sizeof(h->data) - 64))
+    h->len = sizeof(h->data);
+}
+
+static u32
+fill_long(struct pci_dev *d, struct fill_header *h, int pos)
+{
+  if (pos + 4 <= h->len)
+    return le32_to_cpu(h->data[pos / 4]);
+  return pci_read_long(d, pos);
+}
+
+static word
+fill_word(struct pci_dev *d, struct fill_header *h, int pos)
+{
+  if (pos + 2 <= h->len)
+    return fill_long(d, h, pos & ~3) >> (8 * (pos & 2));
+  return pci_read_word(d, pos);
+}
+
+static byte
+fill_byte(struct pci_dev *d, struct fill_header *h, int pos)
+{
+  if (pos < h->len)
+    return fill_long(d, h, pos & ~3) >> (8 * (pos & 3));
+  return pci_read_byte(d, pos);
+}
+
+static int
+get_hdr_type(struct pci_dev *d, struct fill_header *h)
 {
   if (d->hdrtype < 0)
-    d->hdrtype = pci_read_byte(d, PCI_HEADER_TYPE) & 0x7f;
+    d->hdrtype = fill_byte(d, h, PCI_HEADER_TYPE) & 0x7f;
   return d->hdrtype;
 }
 
@@ -97,29 +501,32 @@ pci_generic_fill_info(struct pci_dev *d, unsigned int flags)
 {
   struct pci_access *a = d->access;
   struct pci_cap *cap;
+  struct fill_header h;
+
+  fill_header_prefetch(d, &h, flags);
 
   if (want_fill(d, flags, PCI_FILL_IDENT))
     {
-      d->vendor_id = pci_read_word(d, PCI_VENDOR_ID);
-      d->device_id = pci_read_word(d, PCI_DEVICE_ID);
+      d->vendor_id = fill_word(d, &h, PCI_VENDOR_ID);
+      d->device_id = fill_word(d, &h, PCI_DEVICE_ID);
     }
 
   if (want_fill(d, flags, PCI_FILL_CLASS))
-    d->device_class = pci_read_word(d, PCI_CLASS_DEVICE);
+    d->device_class = fill_word(d, &h, PCI_CLASS_DEVICE);
 
   if (want_fill(d, flags, PCI_FILL_CLASS_EXT))
     {
-      d->prog_if = pci_read_byte(d, PCI_CLASS_PROG);
-      d->rev_id = pci_read_byte(d, PCI_REVISION_ID);
+      d->prog_if = fill_byte(d, &h, PCI_CLASS_PROG);
+      d->rev_id = fill_byte(d, &h, PCI_REVISION_ID);
     }
 
   if (want_fill(d, flags, PCI_FILL_SUBSYS))
     {
-      switch (get_hdr_type(d))
+      switch (get_hdr_type(d, &h))
         {
         case PCI_HEADER_TYPE_NORMAL:
-          d->subsys_vendor_id = pci_read_word(d, PCI_SUBSYSTEM_VENDOR_ID);
-          d->subsys_id = pci_read_word(d, PCI_SUBSYSTEM_ID);
+          d->subsys_vendor_id = fill_word(d, &h, PCI_SUBSYSTEM_VENDOR_ID);
+          d->subsys_id = fill_word(d, &h, PCI_SUBSYSTEM_ID);
           break;
         case PCI_HEADER_TYPE_BRIDGE:
           cap = pci_find_cap(d, PCI_CAP_ID_SSVID, PCI_CAP_NORMAL);
@@ -130,8 +537,8 @@ pci_generic_fill_info(struct pci_dev *d, unsigned int flags)
             }
           break;
         case PCI_HEADER_TYPE_CARDBUS:
-          d->subsys_vendor_id = pci_read_word(d, PCI_CB_SUBSYSTEM_VENDOR_ID);
-          d->subsys_id = pci_read_word(d, PCI_CB_SUBSYSTEM_ID);
+          d->subsys_vendor_id = fill_word(d, &h, PCI_CB_SUBSYSTEM_VENDOR_ID);
+          d->subsys_id = fill_word(d, &h, PCI_CB_SUBSYSTEM_ID);
           break;
         default:
           clear_fill(d, PCI_FILL_SUBSYS);
@@ -139,13 +546,13 @@ pci_generic_fill_info(struct pci_dev *d, unsigned int flags)
     }
 
   if (want_fill(d, flags, PCI_FILL_IRQ))
-    d->irq = pci_read_byte(d, PCI_INTERRUPT_LINE);
+    d->irq = fill_byte(d, &h, PCI_INTERRUPT_LINE);
 
   if (want_fill(d, flags, PCI_FILL_BASES))
     {
       int cnt = 0, i;
       memset(d->base_addr, 0, sizeof(d->base_addr));
-      switch (get_hdr_type(d))
+      switch (get_hdr_type(d, &h))
 	{
 	case PCI_HEADER_TYPE_NORMAL:
 	  cnt = 6;
@@ -161,7 +568,7 @@ pci_generic_fill_info(struct pci_dev *d, unsigned int flags)
 	{
 	  for (i=0; i<cnt; i++)
 	    {
-	      u32 x = pci_read_long(d, PCI_BASE_ADDRESS_0 + i*4);
+	      u32 x = fill_long(d, &h, PCI_BASE_ADDRESS_0 + i*4);
 	      if (!x || x == (u32) ~0)
 		continue;
 	      if ((x & PCI_BASE_ADDRESS_SPACE) == PCI_BASE_ADDRESS_SPACE_IO)
@@ -174,7 +581,7 @@ pci_generic_fill_info(struct pci_dev *d, unsigned int flags)
 		    a->warning("%04x:%02x:%02x.%d: Invalid 64-bit address seen for BAR %d.", d->domain, d->bus, d->dev, d->func, i);
 		  else
 		    {
-		      u32 y = pci_read_long(d, PCI_BASE_ADDRESS_0 + (++i)*4);
+		      u32 y = fill_long(d, &h, PCI_BASE_ADDRESS_0 + (++i)*4);
 #ifdef PCI_HAVE_64BIT_ADDRESS
 		      d->base_addr[i-1] = x | (((pciaddr_t) y) << 32);
 #else
@@ -193,7 +600,7 @@ pci_generic_fill_info(struct pci_dev *d, unsigned int flags)
     {
       int reg = 0;
       d->rom_base_addr = 0;
-      switch (get_hdr_type(d))
+      switch (get_hdr_type(d, &h))
 	{
 	case PCI_HEADER_TYPE_NORMAL:
 	  reg = PCI_ROM_ADDRESS;
@@ -204,12 +611,15 @@ pci_generic_fill_info(struct pci_dev *d, unsigned int flags)
 	}
       if (reg)
 	{
-	  u32 u = pci_read_long(d, reg);
+	  u32 u = fill_long(d, &h, reg);
 	  if (u != 0xffffffff)
 	    d->rom_base_addr = u;
 	}
     }
 
+  if (want_fill(d, flags, PCI_FILL_VPD))
+    pci_fill_vpd(d);
+
   pci_scan_caps(d, flags);
 }
 
@@ -249,11 +659,11 @@ pci_generic_block_op(struct pci_dev *d, int pos, byte *buf, int len,
 int
 pci_generic_block_read(struct pci_dev *d, int pos, byte *buf, int len)
 {
-  return pci_generic_block_op(d, pos, buf, len, d->access->methods->read);
+  return pci_generic_block_op(d, pos, buf, len, PCI_METHODS(d->access)->read);
 }
 
 int
 pci_generic_block_write(struct pci_dev *d, int pos, byte *buf, int len)
 {
-  return pci_generic_block_op(d, pos, buf, len, d->access->methods->write);
+  return pci_generic_block_op(d, pos, buf, len, PCI_METHODS(d->access)->write);
 }
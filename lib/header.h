@@ -1428,6 +1428,8 @@
 #define  PCI_DOE_STS_INT		0x2	/* DOE Interrupt Status */
 #define  PCI_DOE_STS_ERROR		0x4	/* DOE Error */
 #define  PCI_DOE_STS_OBJECT_READY	0x80000000 /* Data Object Ready */
+#define PCI_DOE_WRITE		0x10	/* DOE Write Data Mailbox Register */
+#define PCI_DOE_READ		0x14	/* DOE Read Data Mailbox Register */
 
 /* Lane Margining at the Receiver Extended Capability */
 #define PCI_LMR_CAPS			0x4 /* Margining Port Capabilities Register */
@@ -355,7 +355,7 @@ hurd_fill_info(struct pci_dev *d, unsigned int flags)
   pci_generic_fill_info(d, flags);
 }
 
-struct pci_methods pm_hurd = {
+const struct pci_methods pm_hurd = {
   .name = "hurd",
   .help = "Hurd access using RPCs",
   .detect = hurd_detect,
@@ -75,7 +75,7 @@ conf12_cleanup(struct pci_access *a)
  */
 
 static int
-intel_sanity_check(struct pci_access *a, struct pci_methods *m)
+intel_sanity_check(struct pci_access *a, const struct pci_methods *m)
 {
   struct pci_dev d;
 
@@ -131,6 +131,54 @@ conf1_detect(struct pci_access *a)
   return res;
 }
 
+/*
+ *  Blocks are read under a single lock by a series of the widest aligned cycles,
+ *  the address register is written only when moving to the next dword.
+ */
+static int
+conf1_block_read(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  u32 cmd = 0x80000000 | ((d->bus & 0xff) << 16) | (PCI_DEVFN(d->dev, d->func) << 8);
+  int last = -1, n;
+  u16 w;
+  u32 l;
+
+  if (pos + len > 256)
+    return 0;
+
+  intel_io_lock();
+  while (len > 0)
+    {
+      if ((pos & ~3) != last)
+	{
+	  last = pos & ~3;
+	  intel_outl(cmd | last, 0xcf8);
+	}
+      if ((pos & 1) || len < 2)
+	{
+	  buf[0] = intel_inb(0xcfc + (pos&3));
+	  n = 1;
+	}
+      else if ((pos & 2) || len < 4)
+	{
+	  w = cpu_to_le16(intel_inw(0xcfc + (pos&3)));
+	  memcpy(buf, &w, 2);
+	  n = 2;
+	}
+      else
+	{
+	  l = cpu_to_le32(intel_inl(0xcfc));
+	  memcpy(buf, &l, 4);
+	  n = 4;
+	}
+      pos += n;
+      buf += n;
+      len -= n;
+    }
+  intel_io_unlock();
+  return 1;
+}
+
 static int
 conf1_read(struct pci_dev *d, int pos, byte *buf, int len)
 {
@@ -141,7 +189,7 @@ conf1_read(struct pci_dev *d, int pos, byte *buf, int len)
     return 0;
 
   if (len != 1 && len != 2 && len != 4)
-    return pci_generic_block_read(d, pos, buf, len);
+    return conf1_block_read(d, pos, buf, len);
 
   intel_io_lock();
   intel_outl(0x80000000 | ((d->bus & 0xff) << 16) | (PCI_DEVFN(d->dev, d->func) << 8) | (pos&~3), 0xcf8);
@@ -294,7 +342,7 @@ conf2_write(struct pci_dev *d, int pos, byte *buf, int len)
   return res;
 }
 
-struct pci_methods pm_intel_conf1 = {
+const struct pci_methods pm_intel_conf1 = {
   .name = "intel-conf1",
   .help = "Raw I/O port access using Intel conf1 interface",
   .detect = conf1_detect,
@@ -306,7 +354,7 @@ struct pci_methods pm_intel_conf1 = {
   .write = conf1_write,
 };
 
-struct pci_methods pm_intel_conf2 = {
+const struct pci_methods pm_intel_conf2 = {
   .name = "intel-conf2",
   .help = "Raw I/O port access using Intel conf2 interface",
   .detect = conf2_detect,
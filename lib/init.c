@@ -14,6 +14,7 @@
 #include <string.h>
 
 #include "internal.h"
+#include "names.h"
 
 #ifdef PCI_OS_DJGPP
 #include <crt0.h> /* for __dos_argv0 */
@@ -72,7 +73,7 @@ extern HINSTANCE _hInstance;
 
 #endif
 
-static struct pci_methods *pci_methods[PCI_ACCESS_MAX] = {
+static const struct pci_methods *pci_methods[PCI_ACCESS_MAX] = {
   NULL,
 #ifdef PCI_HAVE_PM_LINUX_SYSFS
   &pm_linux_sysfs,
@@ -111,7 +112,7 @@ static struct pci_methods *pci_methods[PCI_ACCESS_MAX] = {
 #else
   NULL,
 #endif
-#ifdef PCI_HAVE_PM_DUMP
+#if defined(PCI_HAVE_PM_DUMP) && !defined(PCI_FIXED_METHOD)
   &pm_dump,
 #else
   NULL,
@@ -163,6 +164,16 @@ static struct pci_methods *pci_methods[PCI_ACCESS_MAX] = {
 #else
   NULL,
 #endif
+#if defined(PCI_HAVE_PM_DUMP) && !defined(PCI_FIXED_METHOD)
+  &pm_dump_archive,
+#else
+  NULL,
+#endif
+#ifdef PCI_HAVE_PM_REMOTE
+  &pm_remote,
+#else
+  NULL,
+#endif
 };
 
 // If PCI_ACCESS_AUTO is selected, we probe the access methods in this order
@@ -242,6 +253,16 @@ pci_malloc(struct pci_access *a, int size)
   return x;
 }
 
+void *
+pci_realloc(struct pci_access *a, void *old, int size)
+{
+  void *x = realloc(old, size);
+
+  if (!x)
+    (a && a->error ? a->error : pci_generic_error)("Out of memory (allocation of %d bytes failed)", size);
+  return x;
+}
+
 void
 pci_mfree(void *x)
 {
@@ -437,6 +458,7 @@ static void
 pci_init_dns(struct pci_access *a)
 {
   pci_define_param(a, "net.domain", PCI_ID_DOMAIN, "DNS domain used for resolving of ID's");
+  pci_define_param(a, "net.threads", "8", "Number of DNS queries issued in parallel by pci_lookup_prefetch()");
   a->id_lookup_mode = PCI_LOOKUP_CACHE;
 
   char *cache_dir = getenv("XDG_CACHE_HOME");
@@ -463,6 +485,15 @@ pci_alloc(void)
 #ifdef PCI_USE_DNS
   pci_init_dns(a);
 #endif
+  pci_define_param(a, "names.lazy", "0", "Parse only the parts of the ID list which are needed");
+  pci_define_param(a, "names.memo", "0", "Remember formatted names returned by pci_lookup_name()");
+#ifdef PCI_HAVE_BUILTIN_IDS
+  pci_define_param(a, "names.builtin", "1", "Look up names in the built-in ID table first");
+#endif
+  pci_define_param(a, "cache.prefetch", "0", "Read whole config space of a device at once when it is cached");
+  pci_define_param(a, "scan.fast", "0", "Skip devices which cannot exist according to bus topology when scanning");
+  pci_define_param(a, "stats", "0", "Collect statistics of operations, see pci_get_stats()");
+  pci_define_param(a, "numa.bind", "0", "Bind worker threads to the NUMA nodes of the devices they work with");
 #ifdef PCI_HAVE_HWDB
   pci_define_param(a, "hwdb.disable", "0", "Do not look up names in UDEV's HWDB if non-zero");
 #endif
@@ -472,8 +503,8 @@ pci_alloc(void)
   return a;
 }
 
-int
-pci_init_internal(struct pci_access *a, int skip_method)
+void
+pci_init_handlers(struct pci_access *a)
 {
   if (!a->error)
     a->error = pci_generic_error;
@@ -483,7 +514,18 @@ pci_init_internal(struct pci_access *a, int skip_method)
     a->debug = pci_generic_debug;
   if (!a->debugging)
     a->debug = pci_null_debug;
+}
+
+int
+pci_init_internal(struct pci_access *a, int skip_method)
+{
+  pci_init_handlers(a);
 
+#ifdef PCI_FIXED_METHOD
+  /* There is nothing to choose from, so skip detection */
+  if (a->method == PCI_ACCESS_AUTO && skip_method != PCI_FIXED_ACCESS)
+    a->method = PCI_FIXED_ACCESS;
+#endif
   if (a->method != PCI_ACCESS_AUTO)
     {
       if (a->method >= PCI_ACCESS_MAX || !pci_methods[a->method])
@@ -495,7 +537,7 @@ pci_init_internal(struct pci_access *a, int skip_method)
       unsigned int i;
       for (i=0; probe_sequence[i] >= 0; i++)
 	{
-	  struct pci_methods *m = pci_methods[probe_sequence[i]];
+	  const struct pci_methods *m = pci_methods[probe_sequence[i]];
 	  if (!m)
 	    continue;
 	  if (skip_method == probe_sequence[i])
@@ -514,6 +556,11 @@ pci_init_internal(struct pci_access *a, int skip_method)
 	return 0;
     }
   a->debug("Decided to use %s\n", a->methods->name);
+  if (atoi(pci_get_param(a, "stats")))
+    pci_enable_stats(a, 1);
+  /* Names may be looked up from multiple threads later, so settle this now */
+  pci_id_memo_enabled(a);
+  pci_id_builtin_enabled(a);
   a->methods->init(a);
   return 1;
 }
@@ -550,6 +597,7 @@ pci_cleanup(struct pci_access *a)
 {
   struct pci_dev *d, *e;
 
+  pci_free_dev_index(a);
   for (d=a->devices; d; d=e)
     {
       e = d->next;
@@ -557,8 +605,10 @@ pci_cleanup(struct pci_access *a)
     }
   if (a->methods)
     a->methods->cleanup(a);
+  pci_free_vf_families(a);
   pci_free_name_list(a);
   pci_free_params(a);
+  pci_free_stats(a);
   pci_set_name_list_path(a, NULL, 0);
   pci_mfree(a);
 }
@@ -56,6 +56,21 @@
 #define _PCI_STRINGIFY(x) #x
 #define PCI_STRINGIFY(x) _PCI_STRINGIFY(x)
 
+struct pci_monitor_event {
+  int action;				/* PCI_RESCAN_xxx */
+  int domain, bus, dev, func;
+};
+
+/* A mapped BAR, see bars.c */
+struct pci_bar_map {
+  u64 addr;				/* Set by pci_map_bar() before calling the back-end */
+  u64 size;
+  int flags;
+  void *ptr;				/* Set by the back-end: start of the BAR */
+  void *map;				/* The whole mapping, for unmapping */
+  u64 map_len;
+};
+
 struct pci_methods {
   char *name;
   char *help;
@@ -70,32 +85,56 @@ struct pci_methods {
   int (*read_vpd)(struct pci_dev *, int pos, byte *buf, int len);
   void (*init_dev)(struct pci_dev *);
   void (*cleanup_dev)(struct pci_dev *);
+  void (*reset_dev)(struct pci_dev *);	/* Optional: forget the address before pci_set_probe_addr(), else cleanup_dev + init_dev */
+  void (*fill_info_batch)(struct pci_access *, unsigned int flags);	/* Optional prefill of all devices, see pci_fill_info_batch() */
+  void (*read_multi)(struct pci_access *, struct pci_read_req *reqs, int n);	/* Optional, see pci_read_multi() */
+  int (*monitor_open)(struct pci_access *);	/* Optional, see pci_monitor_fd() */
+  int (*monitor_read)(struct pci_access *, struct pci_monitor_event *);	/* Next pending event; 0 if there is none */
+  int (*probe_dev)(struct pci_dev *);	/* Optional: does the device exist? See pci_probe_dev() */
+  int (*get_domains)(struct pci_access *, struct pci_bus_range *ranges, int max);	/* Optional, see pci_get_domains() */
+  int (*map_bar)(struct pci_dev *, int bar, int flags, struct pci_bar_map *);	/* Optional, see pci_map_bar() */
+  void (*unmap_bar)(struct pci_dev *, struct pci_bar_map *);
+  int reentrant;			/* read, write and read_vpd can run in multiple threads at once */
 };
 
 /* generic.c */
 void pci_generic_scan_bus(struct pci_access *, byte *busmap, int domain, int bus);
 void pci_generic_scan_domain(struct pci_access *, int domain);
+void pci_generic_scan_domains(struct pci_access *, struct pci_bus_range *ranges, int num_domains, int threads);
 void pci_generic_scan(struct pci_access *);
+int pci_generic_domains(int *domains, int n, struct pci_bus_range *ranges, int max);
 void pci_generic_fill_info(struct pci_dev *, unsigned int flags);
 int pci_generic_block_read(struct pci_dev *, int pos, byte *buf, int len);
 int pci_generic_block_write(struct pci_dev *, int pos, byte *buf, int len);
 
 /* emulated.c */
 int pci_emulated_read(struct pci_dev *d, int pos, byte *buf, int len);
+void pci_free_emulated(struct pci_dev *d);
 
 /* init.c */
 void *pci_malloc(struct pci_access *, int);
+void *pci_realloc(struct pci_access *, void *, int);
 void pci_mfree(void *);
 char *pci_strdup(struct pci_access *a, const char *s);
 struct pci_access *pci_clone_access(struct pci_access *a);
+void pci_init_handlers(struct pci_access *a);
 int pci_init_internal(struct pci_access *a, int skip_method);
 
 void pci_init_v30(struct pci_access *a) VERSIONED_ABI;
 void pci_init_v35(struct pci_access *a) VERSIONED_ABI;
 
+/* filter.c: tests against the filter of pci_scan_bus_filtered(), -1 matches anything */
+int pci_scan_wants_addr(struct pci_access *a, int domain, int bus, int dev, int func);
+int pci_scan_wants_buses(struct pci_access *a, int domain, int start_bus, int end_bus);
+int pci_scan_wants_ids(struct pci_access *a, int vendor, int device, int device_class, int prog_if);
+unsigned int pci_scan_wants_fill(struct pci_access *a);
+
 /* access.c */
 struct pci_dev *pci_alloc_dev(struct pci_access *);
 int pci_link_dev(struct pci_access *, struct pci_dev *);
+void pci_free_config_cache(struct pci_dev *);
+void pci_free_dev_index(struct pci_access *);
+void *pci_dev_alloc(struct pci_dev *, unsigned int size);
 
 int pci_fill_info_v30(struct pci_dev *, int flags) VERSIONED_ABI;
 int pci_fill_info_v31(struct pci_dev *, int flags) VERSIONED_ABI;
@@ -105,6 +144,7 @@ int pci_fill_info_v34(struct pci_dev *, int flags) VERSIONED_ABI;
 int pci_fill_info_v35(struct pci_dev *, int flags) VERSIONED_ABI;
 int pci_fill_info_v38(struct pci_dev *, int flags) VERSIONED_ABI;
 int pci_fill_info_v313(struct pci_dev *, int flags) VERSIONED_ABI;
+int pci_fill_info_v314(struct pci_dev *, int flags) VERSIONED_ABI;
 
 static inline int want_fill(struct pci_dev *d, unsigned want_fields, unsigned int try_fields)
 {
@@ -131,19 +171,123 @@ struct pci_property {
 
 char *pci_set_property(struct pci_dev *d, u32 key, char *value);
 
+/* bars.c */
+void pci_free_bar_maps(struct pci_dev *);
+
+/* doe.c */
+void pci_free_doe(struct pci_dev *);
+
+/* vpd.c */
+void pci_fill_vpd(struct pci_dev *);
+
+/* stats.c */
+void pci_free_stats(struct pci_access *);
+u64 pci_stats_start(void);
+void pci_stats_end(struct pci_access *a, int op, u64 start, int bytes, int ok);
+
+static inline void
+pci_stat_add(u64 *counter, u64 n)
+{
+  __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+#define PCI_STAT(a, field, n) do { if ((a)->stats) pci_stat_add(&(a)->stats->field, n); } while (0)
+
+/* trace.c */
+#ifdef PCI_HAVE_USDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+extern unsigned short libpci_read_semaphore, libpci_write_semaphore, libpci_method_read_semaphore, libpci_method_write_semaphore;
+#define PCI_USDT_ACTIVE (libpci_read_semaphore | libpci_write_semaphore | libpci_method_read_semaphore | libpci_method_write_semaphore)
+#else
+#define PCI_USDT_ACTIVE 0
+#endif
+
+void pci_trace(struct pci_dev *d, enum pci_trace_event event, int pos, byte *buf, int len, int ok, u64 start);
+
+/* Is anybody interested in the events? If not, the caller skips timing, too. */
+static inline int
+pci_tracing(struct pci_access *a)
+{
+  return a->trace || PCI_USDT_ACTIVE;
+}
+
 /* params.c */
 struct pci_param *pci_define_param(struct pci_access *acc, char *param, char *val, char *help);
 int pci_set_param_internal(struct pci_access *acc, char *param, char *val, int copy);
 void pci_free_params(struct pci_access *acc);
 
+/* threads.c */
+void pci_run_parallel(struct pci_access *a, int threads, int num_jobs, void (*worker)(void *data, int job), void *data);
+void pci_run_parallel_nodes(struct pci_access *a, int threads, int num_jobs, void (*worker)(void *data, int job),
+			    int (*job_node)(void *data, int job), void *data);
+
+enum pci_lock {
+  PCI_LOCK_FILL,			/* Filling of device properties */
+  PCI_LOCK_METHOD,			/* Calls of access methods which are not reentrant */
+  PCI_LOCK_BACKEND,			/* Short critical sections inside back-ends */
+  PCI_LOCK_NAMES_READ,			/* The ID hash */
+  PCI_LOCK_NAMES_WRITE
+};
+
+void pci_lock_internal(struct pci_access *a, enum pci_lock which);
+void pci_unlock_internal(struct pci_access *a, enum pci_lock which);
+void pci_lock_dev_internal(struct pci_dev *d);
+void pci_unlock_dev_internal(struct pci_dev *d);
+
+/* All locks are no-ops unless pci_enable_thread_safety() was called */
+
+static inline void
+pci_lock(struct pci_access *a, enum pci_lock which)
+{
+  if (a->locks)
+    pci_lock_internal(a, which);
+}
+
+static inline void
+pci_unlock(struct pci_access *a, enum pci_lock which)
+{
+  if (a->locks)
+    pci_unlock_internal(a, which);
+}
+
+/* Per-device state, like the config cache */
+static inline void
+pci_lock_dev(struct pci_dev *d)
+{
+  if (d->access->locks)
+    pci_lock_dev_internal(d);
+}
+
+static inline void
+pci_unlock_dev(struct pci_dev *d)
+{
+  if (d->access->locks)
+    pci_unlock_dev_internal(d);
+}
+
 /* caps.c */
 void pci_scan_caps(struct pci_dev *, unsigned int want_fields);
 void pci_free_caps(struct pci_dev *);
+void pci_free_vf_families(struct pci_access *);
+void pci_forget_vf_family(struct pci_dev *);
 
-extern struct pci_methods pm_intel_conf1, pm_intel_conf2, pm_linux_proc,
+extern const struct pci_methods pm_intel_conf1, pm_intel_conf2, pm_linux_proc,
 	pm_fbsd_device, pm_aix_device, pm_nbsd_libpci, pm_obsd_device,
 	pm_dump, pm_linux_sysfs, pm_darwin, pm_sylixos_device, pm_hurd,
 	pm_mmio_conf1, pm_mmio_conf1_ext, pm_ecam,
-	pm_win32_cfgmgr32, pm_win32_kldbg, pm_win32_sysdbg, pm_aos_expansion;
+	pm_win32_cfgmgr32, pm_win32_kldbg, pm_win32_sysdbg, pm_aos_expansion,
+	pm_dump_archive, pm_remote;
+
+/*
+ *  If the library is built for a single access method (see METHOD in the
+ *  top-level Makefile), PCI_FIXED_METHOD is its pm_* structure and hooks
+ *  are called through it directly, so the compiler knows their targets.
+ */
+#ifdef PCI_FIXED_METHOD
+#define PCI_METHODS(d) (&PCI_FIXED_METHOD)
+#else
+#define PCI_METHODS(d) ((d)->methods)
+#endif
 
 #endif
@@ -17,93 +17,108 @@
 #include <stdlib.h>
 #include <string.h>
 
-struct mmio_cache {
-  u64 addr_page;
-  u64 data_page;
-  void *addr_map;
-  void *data_map;
+/*
+ * Register pairs of all domains listed in the addrs parameter are mapped by
+ * conf1_init() and kept for the whole life of the access, so that interleaved
+ * accesses to multiple domains do not have to remap them. Domains can share
+ * pages, so each page is mapped only once.
+ */
+struct mmio_domain {
+  volatile void *addr;                  /* NULL if the registers could not be mapped */
+  volatile void *data;
+};
+
+struct mmio_map {
+  u64 page;
+  void *map;
 };
 
 struct mmio_access {
-  struct mmio_cache *cache;
   struct physmem *physmem;
   long pagesize;
+  int domain_count;
+  struct mmio_domain *domains;
+  int map_count;
+  struct mmio_map *maps;
 };
 
-static void
-munmap_regs(struct pci_access *a)
+static void *
+map_page(struct pci_access *a, u64 page)
 {
   struct mmio_access *macc = a->backend_data;
-  struct mmio_cache *cache = macc->cache;
-  struct physmem *physmem = macc->physmem;
-  long pagesize = macc->pagesize;
+  void *map;
+  int i;
 
-  if (!cache)
-    return;
+  for (i = 0; i < macc->map_count; i++)
+    if (macc->maps[i].page == page)
+      return macc->maps[i].map;
 
-  physmem_unmap(physmem, cache->addr_map, pagesize);
-  if (cache->addr_page != cache->data_page)
-    physmem_unmap(physmem, cache->data_map, pagesize);
+  map = physmem_map(macc->physmem, page, macc->pagesize, 1);
+  if (map == (void *)-1)
+    return map;
 
-  pci_mfree(macc->cache);
-  macc->cache = NULL;
+  macc->maps[macc->map_count].page = page;
+  macc->maps[macc->map_count].map = map;
+  macc->map_count++;
+  return map;
 }
 
-static int
-mmap_regs(struct pci_access *a, u64 addr_reg, u64 data_reg, int data_off, volatile void **addr, volatile void **data)
+static void
+mmap_regs(struct pci_access *a, int domain, u64 addr_reg, u64 data_reg)
 {
   struct mmio_access *macc = a->backend_data;
-  struct mmio_cache *cache = macc->cache;
-  struct physmem *physmem = macc->physmem;
+  struct mmio_domain *dom = &macc->domains[domain];
   long pagesize = macc->pagesize;
-  u64 addr_page = addr_reg & ~(pagesize-1);
-  u64 data_page = data_reg & ~(pagesize-1);
-  void *addr_map = (void *)-1;
-  void *data_map = (void *)-1;
-
-  if (cache && cache->addr_page == addr_page)
-    addr_map = cache->addr_map;
+  void *addr_map, *data_map;
 
-  if (cache && cache->data_page == data_page)
-    data_map = cache->data_map;
+  dom->addr = dom->data = NULL;
 
+  addr_map = map_page(a, addr_reg & ~(pagesize-1));
   if (addr_map == (void *)-1)
-    addr_map = physmem_map(physmem, addr_page, pagesize, 1);
-
-  if (addr_map == (void *)-1)
-    return 0;
-
-  if (data_map == (void *)-1)
     {
-      if (data_page == addr_page)
-        data_map = addr_map;
-      else
-        data_map = physmem_map(physmem, data_page, pagesize, 1);
+      a->debug("cannot map address register of domain %d: %s", domain, strerror(errno));
+      return;
     }
 
+  data_map = map_page(a, data_reg & ~(pagesize-1));
   if (data_map == (void *)-1)
     {
-      if (!cache || cache->addr_map != addr_map)
-        physmem_unmap(physmem, addr_map, pagesize);
-      return 0;
+      a->debug("cannot map data register of domain %d: %s", domain, strerror(errno));
+      return;
     }
 
-  if (cache && cache->addr_page != addr_page)
-    physmem_unmap(physmem, cache->addr_map, pagesize);
+  dom->addr = (unsigned char *)addr_map + (addr_reg & (pagesize-1));
+  dom->data = (unsigned char *)data_map + (data_reg & (pagesize-1));
+}
 
-  if (cache && cache->data_page != data_page && cache->data_page != cache->addr_page)
-    physmem_unmap(physmem, cache->data_map, pagesize);
+static void
+munmap_regs(struct pci_access *a)
+{
+  struct mmio_access *macc = a->backend_data;
+  int i;
+
+  for (i = 0; i < macc->map_count; i++)
+    physmem_unmap(macc->physmem, macc->maps[i].map, macc->pagesize);
+
+  pci_mfree(macc->maps);
+  pci_mfree(macc->domains);
+}
 
-  if (!cache)
-    cache = macc->cache = pci_malloc(a, sizeof(*cache));
+static int
+get_regs(struct pci_dev *d, volatile void **addr, volatile void **data)
+{
+  struct mmio_access *macc = d->access->backend_data;
+  struct mmio_domain *dom;
 
-  cache->addr_page = addr_page;
-  cache->data_page = data_page;
-  cache->addr_map = addr_map;
-  cache->data_map = data_map;
+  if (d->domain < 0 || d->domain >= macc->domain_count)
+    return 0;
+
+  dom = &macc->domains[d->domain];
+  if (!dom->addr)
+    return 0;
 
-  *addr = (unsigned char *)addr_map + (addr_reg & (pagesize-1));
-  *data = (unsigned char *)data_map + (data_reg & (pagesize-1)) + data_off;
+  *addr = dom->addr;
+  *data = dom->data;
   return 1;
 }
 
@@ -247,7 +262,9 @@ conf1_init(struct pci_access *a)
   char *addrs = pci_get_param(a, addrs_param_name);
   struct mmio_access *macc;
   struct physmem *physmem;
+  u64 addr_reg, data_reg;
   long pagesize;
+  int domain;
 
   if (!*addrs)
     a->error("Option %s was not specified.", addrs_param_name);
@@ -264,10 +281,21 @@ conf1_init(struct pci_access *a)
     a->error("Cannot get page size: %s.", strerror(errno));
 
   macc = pci_malloc(a, sizeof(*macc));
-  macc->cache = NULL;
   macc->physmem = physmem;
   macc->pagesize = pagesize;
+  macc->domain_count = get_domain_count(addrs);
+  macc->domains = pci_malloc(a, macc->domain_count * sizeof(*macc->domains));
+  macc->map_count = 0;
+  macc->maps = pci_malloc(a, 2 * macc->domain_count * sizeof(*macc->maps));
   a->backend_data = macc;
+
+  for (domain = 0; domain < macc->domain_count; domain++)
+    {
+      if (get_domain_addr(addrs, domain, &addr_reg, &data_reg))
+        mmap_regs(a, domain, addr_reg, data_reg);
+      else
+        macc->domains[domain].addr = NULL;
+    }
 }
 
 static void
@@ -283,34 +311,98 @@ conf1_cleanup(struct pci_access *a)
 static void
 conf1_scan(struct pci_access *a)
 {
-  char *addrs_param_name = get_addrs_param_name(a);
-  char *addrs = pci_get_param(a, addrs_param_name);
-  int domain_count = get_domain_count(addrs);
+  struct mmio_access *macc = a->backend_data;
   int domain;
 
-  for (domain = 0; domain < domain_count; domain++)
+  for (domain = 0; domain < macc->domain_count; domain++)
     pci_generic_scan_domain(a, domain);
 }
 
+static int
+conf1_get_domains(struct pci_access *a, struct pci_bus_range *ranges, int max)
+{
+  struct mmio_access *macc = a->backend_data;
+  int domain, n = 0;
+
+  for (domain = 0; domain < macc->domain_count; domain++)
+    if (macc->domains[domain].addr)
+      {
+        if (n < max)
+          {
+            ranges[n].domain = domain;
+            ranges[n].start_bus = 0;
+            ranges[n].end_bus = 255;
+          }
+        n++;
+      }
+  return n;
+}
+
+/*
+ * Reads a block by a series of the widest aligned cycles, writing the address
+ * register only when moving to the next dword.
+ */
+static int
+conf1_ext_block_read(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  volatile void *addr, *data;
+  int last = -1, n;
+  u16 w;
+  u32 l;
+
+  if (pos + len > 4096)
+    return 0;
+
+  if (!get_regs(d, &addr, &data))
+    return 0;
+
+  while (len > 0)
+    {
+      if ((pos & ~3) != last)
+        {
+          last = pos & ~3;
+          physmem_writel(0x80000000 | ((pos & 0xf00) << 16) | ((d->bus & 0xff) << 16) | (PCI_DEVFN(d->dev, d->func) << 8) | (pos & 0xfc), addr);
+          physmem_readl(addr); /* write barrier for address */
+        }
+      if ((pos & 1) || len < 2)
+        {
+          buf[0] = physmem_readb((volatile unsigned char *)data + (pos & 3));
+          n = 1;
+        }
+      else if ((pos & 2) || len < 4)
+        {
+          w = physmem_readw((volatile unsigned char *)data + (pos & 3));
+          memcpy(buf, &w, 2);
+          n = 2;
+        }
+      else
+        {
+          l = physmem_readl(data);
+          memcpy(buf, &l, 4);
+          n = 4;
+        }
+      pos += n;
+      buf += n;
+      len -= n;
+    }
+
+  return 1;
+}
+
 static int
 conf1_ext_read(struct pci_dev *d, int pos, byte *buf, int len)
 {
-  char *addrs_param_name = get_addrs_param_name(d->access);
-  char *addrs = pci_get_param(d->access, addrs_param_name);
   volatile void *addr, *data;
-  u64 addr_reg, data_reg;
 
   if (pos >= 4096)
     return 0;
 
   if (len != 1 && len != 2 && len != 4)
-    return pci_generic_block_read(d, pos, buf, len);
-
-  if (!get_domain_addr(addrs, d->domain, &addr_reg, &data_reg))
-    return 0;
+    return conf1_ext_block_read(d, pos, buf, len);
 
-  if (!mmap_regs(d->access, addr_reg, data_reg, pos&3, &addr, &data))
+  if (!get_regs(d, &addr, &data))
     return 0;
+  data = (volatile unsigned char *)data + (pos & 3);
 
   physmem_writel(0x80000000 | ((pos & 0xf00) << 16) | ((d->bus & 0xff) << 16) | (PCI_DEVFN(d->dev, d->func) << 8) | (pos & 0xfc), addr);
   physmem_readl(addr); /* write barrier for address */
@@ -334,7 +426,7 @@ conf1_ext_read(struct pci_dev *d, int pos, byte *buf, int len)
 static int
 conf1_read(struct pci_dev *d, int pos, byte *buf, int len)
 {
-  if (pos >= 256)
+  if (pos + len > 256)
     return 0;
 
   return conf1_ext_read(d, pos, buf, len);
@@ -343,10 +435,7 @@ conf1_read(struct pci_dev *d, int pos, byte *buf, int len)
 static int
 conf1_ext_write(struct pci_dev *d, int pos, byte *buf, int len)
 {
-  char *addrs_param_name = get_addrs_param_name(d->access);
-  char *addrs = pci_get_param(d->access, addrs_param_name);
   volatile void *addr, *data;
-  u64 addr_reg, data_reg;
 
   if (pos >= 4096)
     return 0;
@@ -354,11 +443,9 @@ conf1_ext_write(struct pci_dev *d, int pos, byte *buf, int len)
   if (len != 1 && len != 2 && len != 4)
     return pci_generic_block_write(d, pos, buf, len);
 
-  if (!get_domain_addr(addrs, d->domain, &addr_reg, &data_reg))
-    return 0;
-
-  if (!mmap_regs(d->access, addr_reg, data_reg, pos&3, &addr, &data))
+  if (!get_regs(d, &addr, &data))
     return 0;
+  data = (volatile unsigned char *)data + (pos & 3);
 
   physmem_writel(0x80000000 | ((pos & 0xf00) << 16) | ((d->bus & 0xff) << 16) | (PCI_DEVFN(d->dev, d->func) << 8) | (pos & 0xfc), addr);
   physmem_readl(addr); /* write barrier for address */
@@ -399,7 +486,23 @@ conf1_write(struct pci_dev *d, int pos, byte *buf, int len)
   return conf1_ext_write(d, pos, buf, len);
 }
 
-struct pci_methods pm_mmio_conf1 = {
+static int
+conf1_map_bar(struct pci_dev *d, int bar UNUSED, int flags UNUSED, struct pci_bar_map *m)
+{
+  struct mmio_access *macc = d->access->backend_data;
+
+  return physmem_map_bar(macc->physmem, d, m);
+}
+
+static void
+conf1_unmap_bar(struct pci_dev *d, struct pci_bar_map *m)
+{
+  struct mmio_access *macc = d->access->backend_data;
+
+  physmem_unmap_bar(macc->physmem, m);
+}
+
+const struct pci_methods pm_mmio_conf1 = {
   .name = "mmio-conf1",
   .help = "Raw memory mapped I/O port access using Intel conf1 interface",
   .config = conf1_config,
@@ -410,9 +513,12 @@ struct pci_methods pm_mmio_conf1 = {
   .fill_info = pci_generic_fill_info,
   .read = conf1_read,
   .write = conf1_write,
+  .get_domains = conf1_get_domains,
+  .map_bar = conf1_map_bar,
+  .unmap_bar = conf1_unmap_bar,
 };
 
-struct pci_methods pm_mmio_conf1_ext = {
+const struct pci_methods pm_mmio_conf1_ext = {
   .name = "mmio-conf1-ext",
   .help = "Raw memory mapped I/O port access using Intel conf1 extended interface",
   .config = conf1_ext_config,
@@ -423,4 +529,7 @@ struct pci_methods pm_mmio_conf1_ext = {
   .fill_info = pci_generic_fill_info,
   .read = conf1_ext_read,
   .write = conf1_ext_write,
+  .get_domains = conf1_get_domains,
+  .map_bar = conf1_map_bar,
+  .unmap_bar = conf1_unmap_bar,
 };
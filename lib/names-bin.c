@@ -0,0 +1,388 @@
+/*
+ *	The PCI Library -- Compiled ID Database
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "internal.h"
+#include "names.h"
+
+#ifdef PCI_HAVE_MMAP
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ *  Compiled ID tables are used for the binary ID database (pci.ids.bin)
+ *  and for the cache of ID's resolved via DNS. A table contains a header,
+ *  an array of entries sorted by (category, id12, id34) and a table of
+ *  NUL-terminated names. It is mapped to memory and searched in place.
+ *
+ *  All numbers are stored in the byte order of the machine which created
+ *  the file; files with a different byte order are rejected by the magic.
+ *  The header also records size and modification time of the pci.ids file
+ *  the table was created with; its meaning is up to the user of the table.
+ */
+
+#define ID_BIN_VERSION 2
+
+struct id_bin_header {
+  u32 magic;
+  u32 version;
+  u32 num_entries;
+  u32 strings_size;
+  u64 src_size;
+  u64 src_mtime;
+};
+
+struct id_bin_entry {
+  u32 id12, id34;
+  u32 info;				/* Category in the top 8 bits, offset of the name in the rest */
+};
+
+#define ID_BIN_CAT(e) ((e)->info >> 24)
+#define ID_BIN_NAME(e) ((e)->info & 0xffffff)
+
+struct id_bin {
+  void *data;
+  size_t size;
+  int mapped;
+  struct id_bin_entry *entries;
+  u32 num_entries;
+  char *strings;
+  u32 strings_size;
+  u64 src_size, src_mtime;
+};
+
+static int
+id_bin_cmp(u32 cat1, u32 id12_1, u32 id34_1, u32 cat2, u32 id12_2, u32 id34_2)
+{
+  if (cat1 != cat2)
+    return (cat1 < cat2) ? -1 : 1;
+  if (id12_1 != id12_2)
+    return (id12_1 < id12_2) ? -1 : 1;
+  if (id34_1 != id34_2)
+    return (id34_1 < id34_2) ? -1 : 1;
+  return 0;
+}
+
+static int
+id_bin_read(struct pci_access *a, struct id_bin *b, char *name)
+{
+  struct stat st;
+
+#ifdef PCI_HAVE_MMAP
+  int fd = open(name, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &st) < 0 || !st.st_size)
+    {
+      close(fd);
+      return 0;
+    }
+  b->size = st.st_size;
+  b->data = mmap(NULL, b->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (b->data == MAP_FAILED)
+    {
+      a->warning("Cannot map %s: %s", name, strerror(errno));
+      return 0;
+    }
+  b->mapped = 1;
+#else
+  FILE *f;
+  if (stat(name, &st) < 0 || !st.st_size || !(f = fopen(name, "rb")))
+    return 0;
+  b->size = st.st_size;
+  b->data = pci_malloc(a, b->size);
+  if (fread(b->data, 1, b->size, f) != b->size)
+    {
+      a->warning("Error reading %s", name);
+      fclose(f);
+      pci_mfree(b->data);
+      return 0;
+    }
+  fclose(f);
+#endif
+  return 1;
+}
+
+void
+pci_id_bin_close(struct id_bin *b)
+{
+#ifdef PCI_HAVE_MMAP
+  if (b->mapped)
+    munmap(b->data, b->size);
+  else
+#endif
+    pci_mfree(b->data);
+  pci_mfree(b);
+}
+
+struct id_bin *
+pci_id_bin_open(struct pci_access *a, char *name, u32 magic)
+{
+  struct id_bin *b;
+  struct id_bin_header *h;
+
+  b = pci_malloc(a, sizeof(*b));
+  memset(b, 0, sizeof(*b));
+  if (!id_bin_read(a, b, name))
+    {
+      pci_mfree(b);
+      return NULL;
+    }
+
+  h = b->data;
+  if (b->size < sizeof(*h) || h->magic != magic || h->version != ID_BIN_VERSION)
+    {
+      a->debug("%s has an unsupported format, ignoring\n", name);
+      pci_id_bin_close(b);
+      return NULL;
+    }
+  if (h->num_entries > (b->size - sizeof(*h)) / sizeof(struct id_bin_entry) ||
+      sizeof(*h) + h->num_entries * sizeof(struct id_bin_entry) + h->strings_size != b->size ||
+      !h->strings_size ||
+      ((char *) b->data)[b->size - 1])
+    {
+      a->warning("%s is corrupted, ignoring", name);
+      pci_id_bin_close(b);
+      return NULL;
+    }
+
+  b->entries = (struct id_bin_entry *)(h + 1);
+  b->num_entries = h->num_entries;
+  b->strings = (char *)(b->entries + b->num_entries);
+  b->strings_size = h->strings_size;
+  b->src_size = h->src_size;
+  b->src_mtime = h->src_mtime;
+  return b;
+}
+
+char *
+pci_id_bin_lookup(struct id_bin *b, int cat, u32 id12, u32 id34)
+{
+  u32 lo = 0, hi = b->num_entries;
+
+  while (lo < hi)
+    {
+      u32 mid = lo + (hi - lo) / 2;
+      struct id_bin_entry *e = &b->entries[mid];
+      int c = id_bin_cmp(ID_BIN_CAT(e), e->id12, e->id34, cat, id12, id34);
+      if (!c)
+	return (ID_BIN_NAME(e) < b->strings_size) ? b->strings + ID_BIN_NAME(e) : NULL;
+      if (c < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return NULL;
+}
+
+int
+pci_id_bin_src_matches(struct id_bin *b, u64 src_size, u64 src_mtime)
+{
+  return b->src_size == src_size && b->src_mtime == src_mtime;
+}
+
+void
+pci_id_bin_insert_all(struct pci_access *a, struct id_bin *b, enum id_entry_src src)
+{
+  u32 i;
+
+  for (i=0; i<b->num_entries; i++)
+    {
+      struct id_bin_entry *e = &b->entries[i];
+      if (ID_BIN_NAME(e) < b->strings_size)
+	pci_id_insert(a, ID_BIN_CAT(e),
+		      pair_first(e->id12), pair_second(e->id12),
+		      pair_first(e->id34), pair_second(e->id34),
+		      b->strings + ID_BIN_NAME(e), src);
+    }
+}
+
+static int
+id_bin_compare_entries(const void *A, const void *B)
+{
+  const struct id_entry *a = *(const struct id_entry **) A;
+  const struct id_entry *b = *(const struct id_entry **) B;
+  return id_bin_cmp(a->cat, a->id12, a->id34, b->cat, b->id12, b->id34);
+}
+
+/*
+ *  Write all entries of the ID hash accepted by want() to a new table.
+ *  The table is written to tmpname first and then renamed to name.
+ */
+int
+pci_id_bin_write(struct pci_access *a, char *name, char *tmpname, u32 magic, u64 src_size, u64 src_mtime, int (*want)(struct id_entry *e))
+{
+  struct id_bin_header h;
+  struct id_entry **list, *e;
+  unsigned int i, n, iter;
+  u32 pos;
+  FILE *f;
+  int ok;
+
+  n = 0;
+  iter = 0;
+  while (e = pci_id_next(a, &iter))
+    if (want(e))
+      n++;
+  list = pci_malloc(a, (n ? n : 1) * sizeof(*list));
+  n = 0;
+  iter = 0;
+  while (e = pci_id_next(a, &iter))
+    if (want(e))
+      list[n++] = e;
+  qsort(list, n, sizeof(*list), id_bin_compare_entries);
+
+  memset(&h, 0, sizeof(h));
+  h.magic = magic;
+  h.version = ID_BIN_VERSION;
+  h.num_entries = n;
+  h.strings_size = 1;			/* Offset 0 is the empty string */
+  h.src_size = src_size;
+  h.src_mtime = src_mtime;
+  for (i=0; i<n; i++)
+    h.strings_size += strlen(list[i]->name) + 1;
+  if (h.strings_size > 0xffffff)
+    {
+      a->warning("Too many ID's to be written to %s", name);
+      pci_mfree(list);
+      return 0;
+    }
+
+  f = fopen(tmpname, "wb");
+  if (!f)
+    {
+      a->warning("Cannot write to %s: %s", tmpname, strerror(errno));
+      pci_mfree(list);
+      return 0;
+    }
+
+  fwrite(&h, sizeof(h), 1, f);
+
+  pos = 1;
+  for (i=0; i<n; i++)
+    {
+      struct id_bin_entry be;
+      be.id12 = list[i]->id12;
+      be.id34 = list[i]->id34;
+      be.info = ((u32) list[i]->cat << 24) | pos;
+      fwrite(&be, sizeof(be), 1, f);
+      pos += strlen(list[i]->name) + 1;
+    }
+
+  fputc(0, f);
+  for (i=0; i<n; i++)
+    fwrite(list[i]->name, strlen(list[i]->name) + 1, 1, f);
+
+  fflush(f);
+  ok = !ferror(f);
+  if (fclose(f))
+    ok = 0;
+  if (ok && rename(tmpname, name) < 0)
+    {
+      a->warning("Cannot rename %s to %s: %s", tmpname, name, strerror(errno));
+      ok = 0;
+    }
+  else if (!ok)
+    a->warning("Error writing %s", tmpname);
+  if (ok)
+    a->debug("Written %u entries to %s\n", n, name);
+  else
+    remove(tmpname);
+
+  pci_mfree(list);
+  return ok;
+}
+
+/*
+ *  The compiled ID database (pci.ids.bin) lives next to the text one.
+ *  It is used only if it is not older than its text source, so both
+ *  update-pciids and manual edits of pci.ids do the right thing.
+ */
+
+#define ID_DB_MAGIC 0x50434944		/* "PCID" */
+
+static char *
+id_db_name(struct pci_access *a)
+{
+  char *src = a->id_file_name;
+  size_t len = strlen(src);
+  char *name;
+
+  if (len >= 3 && !strcmp(src + len - 3, ".gz"))
+    len -= 3;
+  name = pci_malloc(a, len + 5);
+  memcpy(name, src, len);
+  strcpy(name + len, ".bin");
+  return name;
+}
+
+int
+pci_id_db_load(struct pci_access *a)
+{
+  char *name = id_db_name(a);
+  struct stat st, src_st;
+
+  if (stat(name, &st) < 0)
+    {
+      pci_mfree(name);
+      return 0;
+    }
+  if (stat(a->id_file_name, &src_st) >= 0 && src_st.st_mtime > st.st_mtime)
+    {
+      a->debug("Ignoring %s, it is older than %s\n", name, a->id_file_name);
+      pci_mfree(name);
+      return 0;
+    }
+
+  a->id_bin = pci_id_bin_open(a, name, ID_DB_MAGIC);
+  if (a->id_bin)
+    a->debug("Using compiled ID database %s\n", name);
+  pci_mfree(name);
+  return !!a->id_bin;
+}
+
+void
+pci_id_db_free(struct pci_access *a)
+{
+  if (a->id_bin)
+    {
+      pci_id_bin_close(a->id_bin);
+      a->id_bin = NULL;
+    }
+}
+
+static int
+id_db_want(struct id_entry *e)
+{
+  return e->src == SRC_LOCAL;
+}
+
+int
+pci_id_db_write(struct pci_access *a, char *name)
+{
+  struct stat st;
+  char *tmpname;
+  int ok;
+
+  if (stat(a->id_file_name, &st) < 0)
+    st.st_size = st.st_mtime = 0;
+  tmpname = pci_malloc(a, strlen(name) + 5);
+  sprintf(tmpname, "%s.new", name);
+  ok = pci_id_bin_write(a, name, tmpname, ID_DB_MAGIC, st.st_size, st.st_mtime, id_db_want);
+  pci_mfree(tmpname);
+  return ok;
+}
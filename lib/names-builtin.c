@@ -0,0 +1,99 @@
+/*
+ *	The PCI Library -- Built-in ID Table
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdlib.h>
+
+#include "internal.h"
+#include "names.h"
+
+/*
+ *  If the library is built with BUILTIN_IDS set, gen-ids.pl compiles the
+ *  selected vendors and all classes of pci.ids to ids-builtin.h: a perfect
+ *  hash table in read-only data, which is searched before anything else,
+ *  so names of these ID's are found without any I/O or allocation.
+ *
+ *  Missing entries of the selected vendors (and of classes) are known not
+ *  to exist in pci.ids, so looking them up does not load it either; the
+ *  HWDB, the cache and the network are still consulted as usual.
+ */
+
+#ifdef PCI_HAVE_BUILTIN_IDS
+
+struct builtin_id {
+  u32 id12, id34;
+  u32 info;				/* Category in the top 8 bits, offset of the name in the rest */
+};
+
+#include "ids-builtin.h"
+
+/* Must match builtin_hash in gen-ids.pl */
+static inline u32
+builtin_hash(u32 seed, u32 cat, u32 id12, u32 id34)
+{
+  u32 h = seed * 0x9e3779b1 + cat;
+  h = (h ^ id12) * 0x85ebca6b;
+  h ^= h >> 15;
+  h = (h ^ id34) * 0xc2b2ae35;
+  h ^= h >> 13;
+  return h;
+}
+
+static char *
+builtin_find(u32 cat, u32 id12, u32 id34)
+{
+  u32 seed = builtin_id_seeds[builtin_hash(0, cat, id12, id34) % BUILTIN_IDS_BUCKETS];
+  const struct builtin_id *e = &builtin_ids[builtin_hash(seed, cat, id12, id34) % BUILTIN_IDS_SIZE];
+
+  if (e->id12 == id12 && e->id34 == id34 && (e->info >> 24) == cat)
+    return (char *) builtin_id_strings + (e->info & 0xffffff);
+  return NULL;
+}
+
+int
+pci_id_builtin_enabled(struct pci_access *a)
+{
+  if (!a->id_builtin_enabled)
+    {
+      char *builtin = pci_get_param(a, "names.builtin");
+      a->id_builtin_enabled = (builtin && atoi(builtin) > 0) ? 1 : -1;
+    }
+  return a->id_builtin_enabled > 0;
+}
+
+char *
+pci_id_builtin_lookup(int cat, int id1, int id2, int id3, int id4, int *complete)
+{
+  char *name = builtin_find(cat, id_pair(id1, id2), id_pair(id3, id4));
+
+  if (name)
+    *complete = 1;
+  else if (cat == ID_VENDOR)
+    *complete = BUILTIN_IDS_ALL_VENDORS;
+  else if (cat == ID_DEVICE || cat == ID_SUBSYSTEM || cat == ID_GEN_SUBSYSTEM)
+    *complete = BUILTIN_IDS_ALL_VENDORS || builtin_find(ID_VENDOR, id_pair(id1, 0), 0);
+  else
+    *complete = 1;
+  return name;
+}
+
+#else
+
+int
+pci_id_builtin_enabled(struct pci_access *a UNUSED)
+{
+  return 0;
+}
+
+char *
+pci_id_builtin_lookup(int cat UNUSED, int id1 UNUSED, int id2 UNUSED, int id3 UNUSED, int id4 UNUSED, int *complete)
+{
+  *complete = 0;
+  return NULL;
+}
+
+#endif
@@ -22,7 +22,7 @@
 #include <pwd.h>
 #include <unistd.h>
 
-static const char cache_version[] = "#PCI-CACHE-1.0";
+#define ID_CACHE_MAGIC 0x50434943		/* "PCIC" */
 
 static char *get_cache_name(struct pci_access *a)
 {
@@ -97,13 +97,33 @@ static void create_parent_dirs(struct pci_access *a, char *name)
     }
 }
 
+/*
+ *  The cache is a compiled ID table (see names-bin.c), which is mapped
+ *  to memory and searched in place. It remembers size and modification
+ *  time of the ID list it was created with and it is discarded when the
+ *  list changes, since ID's resolved before may be known locally now
+ *  or the names may have been updated.
+ */
+
+static void id_cache_src_stat(struct pci_access *a, u64 *size, u64 *mtime)
+{
+  struct stat st;
+
+  if (a->id_file_name && stat(a->id_file_name, &st) >= 0)
+    {
+      *size = st.st_size;
+      *mtime = st.st_mtime;
+    }
+  else
+    *size = *mtime = 0;
+}
+
 int
 pci_id_cache_load(struct pci_access *a, int flags)
 {
   char *name;
-  char line[MAX_LINE];
-  FILE *f;
-  int lino;
+  struct id_bin *b;
+  u64 src_size, src_mtime;
 
   if (a->id_cache_status > 0)
     return 0;
@@ -121,70 +141,70 @@ pci_id_cache_load(struct pci_access *a, int flags)
       return 0;
     }
 
-  f = fopen(name, "rb");
-  if (!f)
+  b = pci_id_bin_open(a, name, ID_CACHE_MAGIC);
+  if (!b)
     {
-      a->debug("Cache file does not exist\n");
+      a->debug("Cache file does not exist or it is not valid\n");
       return 0;
     }
-  /* FIXME: Compare timestamp with the pci.ids file? */
 
-  lino = 0;
-  while (fgets(line, sizeof(line), f))
+  id_cache_src_stat(a, &src_size, &src_mtime);
+  if (!pci_id_bin_src_matches(b, src_size, src_mtime))
     {
-      char *p = strchr(line, '\n');
-      lino++;
-      if (p)
-        {
-	  *p = 0;
-	  if (lino == 1)
-	    {
-	      if (strcmp(line, cache_version))
-	        {
-		  a->debug("Unrecognized cache version %s, ignoring\n", line);
-		  break;
-		}
-	      continue;
-	    }
-	  else
-	    {
-	      int cat, id1, id2, id3, id4, cnt;
-	      if (sscanf(line, "%d%x%x%x%x%n", &cat, &id1, &id2, &id3, &id4, &cnt) >= 5)
-	        {
-		  p = line + cnt;
-		  while (*p && *p == ' ')
-		    p++;
-		  pci_id_insert(a, cat, id1, id2, id3, id4, p, SRC_CACHE);
-		  continue;
-		}
-	    }
-	}
-      a->warning("Malformed cache file %s (line %d), ignoring", name, lino);
-      break;
+      a->debug("Cache was created with a different %s, ignoring\n", a->id_file_name);
+      pci_id_bin_close(b);
+      a->id_cache_status = 2;
+      return 0;
     }
 
-  if (ferror(f))
-    a->warning("Error while reading %s", name);
-  fclose(f);
+  a->id_cache = b;
   return 1;
 }
 
+static int
+id_cache_want(struct id_entry *e)
+{
+  /* Negative entries are not written */
+  return (e->src == SRC_CACHE || e->src == SRC_NET) && e->name[0];
+}
+
+static void
+id_cache_close(struct pci_access *a)
+{
+  if (a->id_cache)
+    {
+      pci_id_bin_close(a->id_cache);
+      a->id_cache = NULL;
+    }
+}
+
 void
 pci_id_cache_flush(struct pci_access *a)
 {
   int orig_status = a->id_cache_status;
-  FILE *f;
-  unsigned int h;
-  struct id_entry *e, *e2;
   char hostname[256], *tmpname, *name;
+  u64 src_size, src_mtime;
   int this_pid;
 
   a->id_cache_status = 0;
   if (orig_status < 2)
-    return;
+    {
+      id_cache_close(a);
+      return;
+    }
   name = get_cache_name(a);
   if (!name)
-    return;
+    {
+      id_cache_close(a);
+      return;
+    }
+
+  /* Entries of the current cache are carried over to the new one */
+  if (a->id_cache)
+    {
+      pci_id_bin_insert_all(a, a->id_cache, SRC_CACHE);
+      id_cache_close(a);
+    }
 
   create_parent_dirs(a, name);
 
@@ -196,48 +216,9 @@ pci_id_cache_flush(struct pci_access *a)
   tmpname = pci_malloc(a, strlen(name) + strlen(hostname) + 64);
   sprintf(tmpname, "%s.tmp-%s-%d", name, hostname, this_pid);
 
-  f = fopen(tmpname, "wb");
-  if (!f)
-    {
-      a->warning("Cannot write to %s: %s", name, strerror(errno));
-      pci_mfree(tmpname);
-      return;
-    }
   a->debug("Writing cache to %s\n", name);
-  fprintf(f, "%s\n", cache_version);
-
-  for (h=0; h<HASH_SIZE; h++)
-    for (e=a->id_hash[h]; e; e=e->next)
-      if (e->src == SRC_CACHE || e->src == SRC_NET)
-	{
-	  /* Negative entries are not written */
-	  if (!e->name[0])
-	    continue;
-
-	  /* Verify that every entry is written at most once */
-	  for (e2=a->id_hash[h]; e2 != e; e2=e2->next)
-	    if ((e2->src == SRC_CACHE || e2->src == SRC_NET) &&
-	        e2->cat == e->cat &&
-		e2->id12 == e->id12 && e2->id34 == e->id34)
-	    break;
-	  if (e2 == e)
-	    fprintf(f, "%d %x %x %x %x %s\n",
-	            e->cat,
-		    pair_first(e->id12), pair_second(e->id12),
-		    pair_first(e->id34), pair_second(e->id34),
-		    e->name);
-	}
-
-  fflush(f);
-  if (ferror(f))
-    a->warning("Error writing %s", name);
-  fclose(f);
-
-  if (rename(tmpname, name) < 0)
-    {
-      a->warning("Cannot rename %s to %s: %s", tmpname, name, strerror(errno));
-      unlink(tmpname);
-    }
+  id_cache_src_stat(a, &src_size, &src_mtime);
+  pci_id_bin_write(a, name, tmpname, ID_CACHE_MAGIC, src_size, src_mtime, id_cache_want);
   pci_mfree(tmpname);
 }
 
@@ -29,17 +29,31 @@ union id_align {
 #endif
 #define BUCKET_ALIGN(n) ((n)+BUCKET_ALIGNMENT-(n)%BUCKET_ALIGNMENT)
 
+/*
+ *  The entries themselves live in the bucket arena. The hash table is an
+ *  open-addressing table of (tag, pointer) slots with linear probing, so
+ *  most probes stay within a single cache line and entries are touched
+ *  only when the tag matches. There is at most one entry per key.
+ */
+
+struct id_slot {
+  u32 tag;
+  struct id_entry *entry;
+};
+
+struct id_hash {
+  struct id_slot *slots;
+  unsigned int size;			/* Always a power of two */
+  unsigned int count;
+};
+
+#define ID_HASH_INIT_SIZE 1024
+
 static void *id_alloc(struct pci_access *a, unsigned int size)
 {
   struct id_bucket *buck = a->current_id_bucket;
   unsigned int pos;
 
-  if (!a->id_hash)
-    {
-      a->id_hash = pci_malloc(a, sizeof(struct id_entry *) * HASH_SIZE);
-      memset(a->id_hash, 0, sizeof(struct id_entry *) * HASH_SIZE);
-    }
-
   if (!buck || buck->full + size > BUCKET_SIZE)
     {
       buck = pci_malloc(a, BUCKET_SIZE);
@@ -52,12 +66,60 @@ static void *id_alloc(struct pci_access *a, unsigned int size)
   return (byte *)buck + pos;
 }
 
-static inline unsigned int id_hash(int cat, u32 id12, u32 id34)
+static inline u64 id_hash(int cat, u32 id12, u32 id34)
+{
+  u64 h = ((u64) id12 << 32) | id34;
+
+  /* IDs are dense in the low bits, so mix everything well (MurmurHash3 finalizer) */
+  h ^= (u64) cat << 29;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  return h ^ (h >> 33);
+}
+
+static inline int id_key_equal(struct id_entry *e, int cat, u32 id12, u32 id34)
+{
+  return e->id12 == id12 && e->id34 == id34 && e->cat == cat;
+}
+
+/* Returns the slot containing the given key, or the empty slot where it belongs */
+static struct id_slot *
+id_find_slot(struct id_hash *t, u64 h, int cat, u32 id12, u32 id34)
+{
+  u32 tag = h >> 32;
+  unsigned int i = h & (t->size - 1);
+
+  for (;;)
+    {
+      struct id_slot *s = &t->slots[i];
+      if (!s->entry || (s->tag == tag && id_key_equal(s->entry, cat, id12, id34)))
+	return s;
+      i = (i + 1) & (t->size - 1);
+    }
+}
+
+static void
+id_hash_resize(struct pci_access *a, struct id_hash *t, unsigned int size)
 {
-  unsigned int h;
+  struct id_slot *old = t->slots;
+  unsigned int old_size = t->size;
+  unsigned int i;
 
-  h = id12 ^ (id34 << 3) ^ (cat << 5);
-  return h % HASH_SIZE;
+  t->slots = pci_malloc(a, size * sizeof(struct id_slot));
+  memset(t->slots, 0, size * sizeof(struct id_slot));
+  t->size = size;
+  for (i=0; i<old_size; i++)
+    if (old[i].entry)
+      {
+	struct id_entry *e = old[i].entry;
+	u64 h = id_hash(e->cat, e->id12, e->id34);
+	struct id_slot *s = id_find_slot(t, h, e->cat, e->id12, e->id34);
+	s->tag = h >> 32;
+	s->entry = e;
+      }
+  pci_mfree(old);
 }
 
 int
@@ -65,13 +127,23 @@ pci_id_insert(struct pci_access *a, int cat, int id1, int id2, int id3, int id4,
 {
   u32 id12 = id_pair(id1, id2);
   u32 id34 = id_pair(id3, id4);
-  unsigned int h = id_hash(cat, id12, id34);
-  struct id_entry *n = a->id_hash ? a->id_hash[h] : NULL;
+  u64 h = id_hash(cat, id12, id34);
+  struct id_hash *t = a->id_hash;
+  struct id_slot *s;
+  struct id_entry *n;
   int len = strlen(text);
 
-  while (n && (n->id12 != id12 || n->id34 != id34 || n->cat != cat))
-    n = n->next;
-  if (n)
+  if (!t)
+    {
+      t = a->id_hash = pci_malloc(a, sizeof(struct id_hash));
+      memset(t, 0, sizeof(*t));
+      id_hash_resize(a, t, ID_HASH_INIT_SIZE);
+    }
+  else if (4*(t->count+1) > 3*t->size)
+    id_hash_resize(a, t, 2*t->size);
+
+  s = id_find_slot(t, h, cat, id12, id34);
+  if (s->entry)
     return 1;
   n = id_alloc(a, sizeof(struct id_entry) + len);
   n->id12 = id12;
@@ -79,39 +151,60 @@ pci_id_insert(struct pci_access *a, int cat, int id1, int id2, int id3, int id4,
   n->cat = cat;
   n->src = src;
   memcpy(n->name, text, len+1);
-  n->next = a->id_hash[h];
-  a->id_hash[h] = n;
+  s->tag = h >> 32;
+  s->entry = n;
+  t->count++;
   return 0;
 }
 
 char
-*pci_id_lookup(struct pci_access *a, int flags, int cat, int id1, int id2, int id3, int id4)
+*pci_id_lookup(struct pci_access *a, int flags, int cat, int id1, int id2, int id3, int id4, int *src)
 {
-  struct id_entry *n, *best;
+  struct id_entry *n;
+  char *name;
   u32 id12 = id_pair(id1, id2);
   u32 id34 = id_pair(id3, id4);
 
-  if (a->id_hash)
+  /* Entries of the compiled database have the highest priority as SRC_LOCAL */
+  if (a->id_bin && !(flags & PCI_LOOKUP_SKIP_LOCAL) && (name = pci_id_bin_lookup(a->id_bin, cat, id12, id34)))
     {
-      n = a->id_hash[id_hash(cat, id12, id34)];
-      best = NULL;
-      for (; n; n=n->next)
-        {
-	  if (n->id12 != id12 || n->id34 != id34 || n->cat != cat)
-	    continue;
-	  if (n->src == SRC_LOCAL && (flags & PCI_LOOKUP_SKIP_LOCAL))
-	    continue;
-	  if (n->src == SRC_NET && !(flags & PCI_LOOKUP_NETWORK))
-	    continue;
-	  if (n->src == SRC_CACHE && !(flags & PCI_LOOKUP_CACHE))
-	    continue;
-	  if (n->src == SRC_HWDB && (flags & (PCI_LOOKUP_SKIP_LOCAL | PCI_LOOKUP_NO_HWDB)))
-	    continue;
-	  if (!best || best->src < n->src)
-	    best = n;
-	}
-      if (best)
-	return best->name;
+      if (src)
+	*src = SRC_LOCAL;
+      return name;
+    }
+
+  n = a->id_hash ? id_find_slot(a->id_hash, id_hash(cat, id12, id34), cat, id12, id34)->entry : NULL;
+  if (n &&
+      !(n->src == SRC_LOCAL && (flags & PCI_LOOKUP_SKIP_LOCAL)) &&
+      !(n->src == SRC_NET && !(flags & PCI_LOOKUP_NETWORK)) &&
+      !(n->src == SRC_CACHE && !(flags & PCI_LOOKUP_CACHE)) &&
+      !(n->src == SRC_HWDB && (flags & (PCI_LOOKUP_SKIP_LOCAL | PCI_LOOKUP_NO_HWDB))))
+    {
+      if (src)
+	*src = n->src;
+      return n->name;
+    }
+
+  /* Entries of the ID cache have the lowest priority as SRC_CACHE */
+  if (src)
+    *src = SRC_CACHE;
+  if (a->id_cache && (flags & PCI_LOOKUP_CACHE))
+    return pci_id_bin_lookup(a->id_cache, cat, id12, id34);
+  return NULL;
+}
+
+struct id_entry *
+pci_id_next(struct pci_access *a, unsigned int *iter)
+{
+  struct id_hash *t = a->id_hash;
+
+  if (!t)
+    return NULL;
+  while (*iter < t->size)
+    {
+      struct id_entry *e = t->slots[(*iter)++].entry;
+      if (e)
+	return e;
     }
   return NULL;
 }
@@ -119,8 +212,12 @@ char
 void
 pci_id_hash_free(struct pci_access *a)
 {
-  pci_mfree(a->id_hash);
-  a->id_hash = NULL;
+  if (a->id_hash)
+    {
+      pci_mfree(a->id_hash->slots);
+      pci_mfree(a->id_hash);
+      a->id_hash = NULL;
+    }
   while (a->current_id_bucket)
     {
       struct id_bucket *buck = a->current_id_bucket;
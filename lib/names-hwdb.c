@@ -20,11 +20,111 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef PCI_HAVE_PTHREAD
+#include <pthread.h>
+static pthread_mutex_t hwdb_lock = PTHREAD_MUTEX_INITIALIZER;
+#define HWDB_LOCK() pthread_mutex_lock(&hwdb_lock)
+#define HWDB_UNLOCK() pthread_mutex_unlock(&hwdb_lock)
+#else
+#define HWDB_LOCK() do { } while (0)
+#define HWDB_UNLOCK() do { } while (0)
+#endif
+
+/*
+ *  All pci_access instances share a single HWDB handle, which is released
+ *  when the last of them is freed. Results of lookups (including negative
+ *  ones) are remembered as long as the handle lives, so repeated queries
+ *  for the same ID's (e.g., many identical virtual functions) are cheap.
+ */
+
+struct hwdb_memo {
+  struct hwdb_memo *next;
+  int cat, id1, id2, id3;
+  char *value;				/* NULL if not found */
+};
+
+#define HWDB_MEMO_SIZE 256
+
+static struct udev *hwdb_udev;
+static struct udev_hwdb *hwdb;
+static int hwdb_refs;
+static struct hwdb_memo *hwdb_memo[HWDB_MEMO_SIZE];
+
+static unsigned int
+hwdb_memo_hash(int cat, int id1, int id2, int id3)
+{
+  unsigned int h = cat;
+  h = h*0x9e3779b1 + id1;
+  h = h*0x9e3779b1 + id2;
+  h = h*0x9e3779b1 + id3;
+  return (h ^ (h >> 16)) % HWDB_MEMO_SIZE;
+}
+
+static void
+hwdb_get(struct pci_access *a)
+{
+  if (!hwdb_refs++)
+    {
+      a->debug("Initializing UDEV HWDB\n");
+      hwdb_udev = udev_new();
+      hwdb = hwdb_udev ? udev_hwdb_new(hwdb_udev) : NULL;
+    }
+  a->id_hwdb_ref = 1;
+  a->id_udev = hwdb_udev;
+  a->id_udev_hwdb = hwdb;
+}
+
+static void
+hwdb_put(void)
+{
+  unsigned int i;
+
+  if (--hwdb_refs)
+    return;
+  for (i=0; i<HWDB_MEMO_SIZE; i++)
+    while (hwdb_memo[i])
+      {
+	struct hwdb_memo *m = hwdb_memo[i];
+	hwdb_memo[i] = m->next;
+	pci_mfree(m->value);
+	pci_mfree(m);
+      }
+  if (hwdb)
+    udev_hwdb_unref(hwdb);
+  if (hwdb_udev)
+    udev_unref(hwdb_udev);
+  hwdb = NULL;
+  hwdb_udev = NULL;
+}
+
+static char *
+hwdb_query(struct pci_access *a, char *modalias, const char *key)
+{
+  struct udev_list_entry *entry;
+
+  if (!hwdb)
+    return NULL;
+  udev_list_entry_foreach(entry, udev_hwdb_get_properties_list_entry(hwdb, modalias, 0))
+    {
+      const char *entry_name = udev_list_entry_get_name(entry);
+      if (entry_name && !strcmp(entry_name, key))
+	{
+	  const char *entry_value = udev_list_entry_get_value(entry);
+	  if (entry_value)
+	    return pci_strdup(a, entry_value);
+	}
+    }
+  return NULL;
+}
+
 char *
 pci_id_hwdb_lookup(struct pci_access *a, int cat, int id1, int id2, int id3, int id4 UNUSED)
 {
   char modalias[64];
   const char *key = NULL;
+  struct hwdb_memo *m;
+  unsigned int h;
+  char *result;
 
   const char *disabled = pci_get_param(a, "hwdb.disable");
   if (disabled && atoi(disabled))
@@ -65,44 +165,46 @@ pci_id_hwdb_lookup(struct pci_access *a, int cat, int id1, int id2, int id3, int
       break;
     }
 
-  if (key)
-    {
-      if (!a->id_udev_hwdb)
-	{
-	  a->debug("Initializing UDEV HWDB\n");
-	  a->id_udev = udev_new();
-	  a->id_udev_hwdb = udev_hwdb_new(a->id_udev);
-	}
+  if (!key)
+    return NULL;
 
-      struct udev_list_entry *entry;
-      udev_list_entry_foreach(entry, udev_hwdb_get_properties_list_entry(a->id_udev_hwdb, modalias, 0))
-	{
-	  const char *entry_name = udev_list_entry_get_name(entry);
-	  if (entry_name && !strcmp(entry_name, key))
-	    {
-	      const char *entry_value = udev_list_entry_get_value(entry);
-	      if (entry_value)
-		return pci_strdup(a, entry_value);
-	    }
-	}
+  HWDB_LOCK();
+  if (!a->id_hwdb_ref)
+    hwdb_get(a);
+
+  h = hwdb_memo_hash(cat, id1, id2, id3);
+  for (m = hwdb_memo[h]; m; m = m->next)
+    if (m->cat == cat && m->id1 == id1 && m->id2 == id2 && m->id3 == id3)
+      break;
+  if (!m)
+    {
+      m = pci_malloc(a, sizeof(*m));
+      m->cat = cat;
+      m->id1 = id1;
+      m->id2 = id2;
+      m->id3 = id3;
+      m->value = hwdb_query(a, modalias, key);
+      m->next = hwdb_memo[h];
+      hwdb_memo[h] = m;
     }
+  result = m->value ? pci_strdup(a, m->value) : NULL;
+  HWDB_UNLOCK();
 
-  return NULL;
+  return result;
 }
 
 void
 pci_id_hwdb_free(struct pci_access *a)
 {
-  if (a->id_udev_hwdb)
+  HWDB_LOCK();
+  if (a->id_hwdb_ref)
     {
-      udev_hwdb_unref(a->id_udev_hwdb);
+      a->id_hwdb_ref = 0;
       a->id_udev_hwdb = NULL;
-    }
-  if (a->id_udev)
-    {
-      udev_unref(a->id_udev);
       a->id_udev = NULL;
+      hwdb_put();
     }
+  HWDB_UNLOCK();
 }
 
 #else
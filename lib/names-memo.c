@@ -0,0 +1,134 @@
+/*
+ *	The PCI Library -- Memo of Formatted Names
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "names.h"
+
+/*
+ *  If the names.memo parameter is set, pci_lookup_name() remembers its
+ *  results keyed by the final lookup flags and the arguments, so that
+ *  repeated lookups of the same names skip the ID hash, HWDB and DNS as
+ *  well as formatting. Misses are remembered, too. The results are stored
+ *  untruncated and shortened to the size of the caller's buffer on every hit.
+ *  The memo is flushed whenever the set of known names changes.
+ */
+
+#define MEMO_HASH_SIZE 1024
+
+struct id_memo_entry {
+  struct id_memo_entry *next;
+  int flags;
+  int args[4];
+  int is_null;				/* pci_lookup_name() returned NULL */
+  char name[1];
+};
+
+struct id_memo {
+  struct id_memo_entry *hash[MEMO_HASH_SIZE];
+};
+
+static unsigned int
+memo_hash(int flags, int *args)
+{
+  unsigned int h = flags;
+  int i;
+
+  for (i=0; i<4; i++)
+    h = h * 0x9e3779b1 + args[i];
+  return (h ^ (h >> 16)) % MEMO_HASH_SIZE;
+}
+
+int
+pci_id_memo_enabled(struct pci_access *a)
+{
+  if (!a->id_memo_enabled)
+    {
+      char *memo = pci_get_param(a, "names.memo");
+      a->id_memo_enabled = (memo && atoi(memo) > 0) ? 1 : -1;
+    }
+  return a->id_memo_enabled > 0;
+}
+
+int
+pci_id_memo_get(struct pci_access *a, int flags, int *args, char *buf, int size, char **result)
+{
+  struct id_memo_entry *e;
+  int found = 0;
+  size_t len;
+
+  pci_lock(a, PCI_LOCK_NAMES_READ);
+  if (a->id_memo)
+    for (e = a->id_memo->hash[memo_hash(flags, args)]; e; e = e->next)
+      if (e->flags == flags && !memcmp(e->args, args, sizeof(e->args)))
+	{
+	  found = 1;
+	  len = strlen(e->name);
+	  if (e->is_null)
+	    *result = NULL;
+	  else if (len < (size_t) size)
+	    *result = memcpy(buf, e->name, len + 1);
+	  else if (size >= 4)
+	    {
+	      /* The same truncation as done by format_name() */
+	      memcpy(buf, e->name, size - 1);
+	      buf[size-1] = 0;
+	      buf[size-2] = buf[size-3] = buf[size-4] = '.';
+	      *result = buf;
+	    }
+	  else
+	    *result = "<pci_lookup_name: buffer too small>";
+	  break;
+	}
+  pci_unlock(a, PCI_LOCK_NAMES_READ);
+  return found;
+}
+
+void
+pci_id_memo_put(struct pci_access *a, int flags, int *args, char *name)
+{
+  struct id_memo_entry *e;
+  unsigned int h = memo_hash(flags, args);
+
+  pci_lock(a, PCI_LOCK_NAMES_WRITE);
+  if (!a->id_memo)
+    {
+      a->id_memo = pci_malloc(a, sizeof(struct id_memo));
+      memset(a->id_memo, 0, sizeof(struct id_memo));
+    }
+  e = pci_malloc(a, sizeof(*e) + (name ? strlen(name) : 0));
+  e->flags = flags;
+  memcpy(e->args, args, sizeof(e->args));
+  e->is_null = !name;
+  strcpy(e->name, name ? name : "");
+  e->next = a->id_memo->hash[h];
+  a->id_memo->hash[h] = e;
+  pci_unlock(a, PCI_LOCK_NAMES_WRITE);
+}
+
+/* Called with PCI_LOCK_NAMES_WRITE held, or when no other thread can look up names */
+void
+pci_id_memo_flush(struct pci_access *a)
+{
+  struct id_memo *m = a->id_memo;
+  struct id_memo_entry *e;
+  int i;
+
+  if (!m)
+    return;
+  for (i=0; i<MEMO_HASH_SIZE; i++)
+    while (e = m->hash[i])
+      {
+	m->hash[i] = e->next;
+	pci_mfree(e);
+      }
+  pci_mfree(m);
+  a->id_memo = NULL;
+}
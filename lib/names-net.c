@@ -158,10 +158,19 @@ err:
   return -1;
 }
 
+/*
+ * The resolver state is per-thread (at least in glibc) and pci_lookup_prefetch()
+ * issues queries from multiple threads, so each of them initializes its own.
+ */
+#ifdef PCI_HAVE_PTHREAD
+static __thread int resolver_inited;
+#else
+static int resolver_inited;
+#endif
+
 char
 *pci_id_net_lookup(struct pci_access *a, int cat, int id1, int id2, int id3, int id4)
 {
-  static int resolver_inited;
   char name[256], dnsname[256], txt[256], *domain;
   byte answer[4096];
   const byte *data;
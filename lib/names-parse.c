@@ -16,11 +16,17 @@
 #include "internal.h"
 #include "names.h"
 
+/*
+ *  The whole list is read (and decompressed) to memory in large chunks first,
+ *  which is much faster than reading it line by line. Lines are then parsed
+ *  in place: every newline is replaced by a zero byte.
+ */
+#define ID_READ_CHUNK 65536
+
 #ifdef PCI_COMPRESSED_IDS
 #include <zlib.h>
 typedef gzFile pci_file;
-#define pci_gets(f, l, s)	gzgets(f, l, s)
-#define pci_eof(f)		gzeof(f)
+#define pci_read(f, buf, len)	gzread(f, buf, len)
 
 static pci_file pci_open(struct pci_access *a)
 {
@@ -30,7 +36,10 @@ static pci_file pci_open(struct pci_access *a)
 
   result = gzopen(a->id_file_name, "rb");
   if (result)
-    return result;
+    {
+      gzbuffer(result, ID_READ_CHUNK);
+      return result;
+    }
   len = strlen(a->id_file_name);
   if (len < 3 || memcmp(a->id_file_name + len - 3, ".gz", 3) != 0)
     return result;
@@ -52,8 +61,7 @@ static pci_file pci_open(struct pci_access *a)
 	}
 #else
 typedef FILE * pci_file;
-#define pci_gets(f, l, s)	fgets(l, s, f)
-#define pci_eof(f)		feof(f)
+#define pci_read(f, buf, len)	fread(buf, 1, len, f)
 #define pci_open(a)		fopen(a->id_file_name, "r")
 #define pci_close(f)		fclose(f)
 #define PCI_ERROR(f, err)	if (!err && ferror(f))	err = "I/O error";
@@ -84,32 +92,67 @@ static inline int id_white_p(int c)
 }
 
 
-static const char *id_parse_list(struct pci_access *a, pci_file f, int *lino)
+static const char parse_error[] = "Parse error";
+
+struct id_text {
+  char *buf;					/* Lines terminated by zero bytes */
+  size_t len;
+};
+
+static const char *
+id_read_text(struct pci_access *a, pci_file f, struct id_text *t)
 {
-  char line[MAX_LINE];
+  size_t size = 0, pos;
+  const char *err = NULL;
   char *p;
+  int n;
+
+  t->buf = NULL;
+  t->len = 0;
+  for (;;)
+    {
+      if (size - t->len < ID_READ_CHUNK + 1)
+	{
+	  size = 2*size + ID_READ_CHUNK + 1;
+	  t->buf = pci_realloc(a, t->buf, size);
+	}
+      n = pci_read(f, t->buf + t->len, ID_READ_CHUNK);
+      if (n <= 0)
+	break;
+      t->len += n;
+    }
+  PCI_ERROR(f, err);
+  t->buf[t->len] = 0;
+
+  for (pos = 0; pos < t->len && (p = memchr(t->buf + pos, '\n', t->len - pos)); pos = p + 1 - t->buf)
+    *p = 0;
+  return err;
+}
+
+/*
+ *  Parse the ID list starting at the given position of the text. If block
+ *  is set, stop at the second top-level entry, so that only a single vendor
+ *  or class gets parsed. The stopping line is left intact, so that it can
+ *  start another block later.
+ */
+static const char *id_parse_list(struct pci_access *a, struct id_text *t, size_t pos, int *lino, int block)
+{
+  char *line, *end, *p;
   int id1=0, id2=0, id3=0, id4=0;
   int cat = -1;
   int nest;
-  static const char parse_error[] = "Parse error";
+  int top_seen = 0;
 
-  *lino = 0;
-  while (pci_gets(f, line, sizeof(line)))
+  for (; pos < t->len; pos = end + 1 - t->buf)
     {
       (*lino)++;
-      p = line;
-      while (*p && *p != '\n' && *p != '\r')
-	p++;
-      if (!*p && !pci_eof(f))
-	return "Line too long";
-      *p = 0;
-      if (p > line && (p[-1] == ' ' || p[-1] == '\t'))
-	*--p = 0;
+      line = t->buf + pos;
+      end = line + strlen(line);
 
       p = line;
       while (id_white_p(*p))
 	p++;
-      if (!*p || *p == '#')
+      if (!*p || *p == '#' || *p == '\r')
 	continue;
 
       p = line;
@@ -117,6 +160,16 @@ static const char *id_parse_list(struct pci_access *a, pci_file f, int *lino)
 	p++;
       nest = p - line;
 
+      if (!nest && block && top_seen++)
+	break;
+
+      p = end;
+      if (p > line && p[-1] == '\r')
+	*--p = 0;
+      if (p > line && (p[-1] == ' ' || p[-1] == '\t'))
+	*--p = 0;
+      p = line + nest;
+
       if (!nest)					/* Top-level entries */
 	{
 	  if (p[0] == 'C' && p[1] == ' ')		/* Class block */
@@ -130,7 +183,7 @@ static const char *id_parse_list(struct pci_access *a, pci_file f, int *lino)
 	    {						/* Generic subsystem block */
 	      if ((id1 = id_hex(p+2, 4)) < 0 || p[6])
 		return parse_error;
-	      if (!pci_id_lookup(a, 0, ID_VENDOR, id1, 0, 0, 0))
+	      if (!block && !pci_id_lookup(a, 0, ID_VENDOR, id1, 0, 0, 0, NULL))
 		return "Vendor does not exist";
 	      cat = ID_GEN_SUBSYSTEM;
 	      continue;
@@ -215,31 +268,234 @@ static const char *id_parse_list(struct pci_access *a, pci_file f, int *lino)
   return NULL;
 }
 
-int
-pci_load_name_list(struct pci_access *a)
+static int
+id_load_text(struct pci_access *a)
 {
+  struct id_text t;
   pci_file f;
   int lino;
   const char *err;
 
-  pci_free_name_list(a);
-  a->id_load_attempted = 1;
   if (!(f = pci_open(a)))
     return 0;
-  err = id_parse_list(a, f, &lino);
-  PCI_ERROR(f, err);
+  err = id_read_text(a, f, &t);
   pci_close(f);
+  lino = 0;
+  if (!err)
+    err = id_parse_list(a, &t, 0, &lino, 0);
+  pci_mfree(t.buf);
   if (err)
     a->error("%s at %s, line %d\n", err, a->id_file_name, lino);
   return 1;
 }
 
+/*
+ *  In the lazy mode, we only remember positions of top-level entries
+ *  (vendors, classes and generic subsystem blocks) in the text and parse
+ *  each of them when it is asked for for the first time.
+ */
+
+struct id_block {
+  byte cat;					/* ID_VENDOR, ID_GEN_SUBSYSTEM or ID_CLASS */
+  byte loaded;
+  u16 id;
+  int lino;
+  size_t pos;
+};
+
+struct id_lazy {
+  struct id_text text;
+  struct id_block *blocks;
+  int num_blocks, max_blocks;
+};
+
+static int id_compare_blocks(const void *A, const void *B)
+{
+  const struct id_block *a = A, *b = B;
+  if (a->cat != b->cat)
+    return (a->cat < b->cat) ? -1 : 1;
+  if (a->id != b->id)
+    return (a->id < b->id) ? -1 : 1;
+  return (a->lino < b->lino) ? -1 : (a->lino > b->lino);
+}
+
+static const char *id_index_list(struct pci_access *a, struct id_lazy *l, int *lino)
+{
+  struct id_text *t = &l->text;
+  size_t pos;
+  char *p;
+  int cat, id;
+
+  for (pos = 0; pos < t->len; pos += strlen(p) + 1)
+    {
+      (*lino)++;
+      p = t->buf + pos;
+      if (!id_white_p(*p) && *p && *p != '#' && *p != '\r')
+	{
+	  if (p[0] == 'C' && p[1] == ' ')
+	    {
+	      cat = ID_CLASS;
+	      id = id_hex(p+2, 2);
+	    }
+	  else if (p[0] == 'S' && p[1] == ' ')
+	    {
+	      cat = ID_GEN_SUBSYSTEM;
+	      id = id_hex(p+2, 4);
+	    }
+	  else if (p[0] >= 'A' && p[0] <= 'Z' && p[1] == ' ')
+	    cat = ID_UNKNOWN;
+	  else
+	    {
+	      cat = ID_VENDOR;
+	      id = id_hex(p, 4);
+	    }
+	  if (cat != ID_UNKNOWN)
+	    {
+	      struct id_block *b;
+	      if (id < 0)
+		return parse_error;
+	      if (l->num_blocks >= l->max_blocks)
+		{
+		  l->max_blocks = 2*l->max_blocks + 64;
+		  l->blocks = pci_realloc(a, l->blocks, l->max_blocks * sizeof(struct id_block));
+		}
+	      b = &l->blocks[l->num_blocks++];
+	      b->cat = cat;
+	      b->loaded = 0;
+	      b->id = id;
+	      b->lino = *lino;
+	      b->pos = pos;
+	    }
+	}
+    }
+  return NULL;
+}
+
+static int
+id_load_lazy(struct pci_access *a)
+{
+  struct id_lazy *l;
+  pci_file f;
+  int lino = 0;
+  const char *err;
+
+  if (!(f = pci_open(a)))
+    return 0;
+  l = pci_malloc(a, sizeof(*l));
+  memset(l, 0, sizeof(*l));
+  err = id_read_text(a, f, &l->text);
+  pci_close(f);
+  if (!err)
+    err = id_index_list(a, l, &lino);
+  if (err)
+    a->error("%s at %s, line %d\n", err, a->id_file_name, lino);
+  qsort(l->blocks, l->num_blocks, sizeof(struct id_block), id_compare_blocks);
+  a->id_lazy = l;
+  a->debug("Indexed %d blocks of %s\n", l->num_blocks, a->id_file_name);
+  return 1;
+}
+
+int
+pci_id_lazy_load(struct pci_access *a, int cat, int id1)
+{
+  struct id_lazy *l = a->id_lazy;
+  struct id_block *b, key;
+  const char *err;
+  int lino, lo, hi;
+
+  switch (cat)
+    {
+    case ID_VENDOR:
+    case ID_DEVICE:
+    case ID_SUBSYSTEM:
+      key.cat = ID_VENDOR;
+      break;
+    case ID_GEN_SUBSYSTEM:
+      key.cat = ID_GEN_SUBSYSTEM;
+      break;
+    case ID_CLASS:
+    case ID_SUBCLASS:
+    case ID_PROGIF:
+      key.cat = ID_CLASS;
+      break;
+    default:
+      return 0;
+    }
+  key.id = id1;
+  key.lino = 0;
+
+  /* Find the first block with the given category and ID */
+  lo = 0;
+  hi = l->num_blocks;
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (id_compare_blocks(&l->blocks[mid], &key) < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (lo >= l->num_blocks || l->blocks[lo].cat != key.cat || l->blocks[lo].id != key.id)
+    return 0;
+  b = &l->blocks[lo];
+  if (b->loaded)
+    return 0;
+  b->loaded = 1;
+
+  lino = b->lino - 1;
+  err = id_parse_list(a, &l->text, b->pos, &lino, 1);
+  if (err)
+    a->error("%s at %s, line %d\n", err, a->id_file_name, lino);
+  return 1;
+}
+
+static void
+pci_id_lazy_free(struct pci_access *a)
+{
+  struct id_lazy *l = a->id_lazy;
+
+  if (l)
+    {
+      pci_mfree(l->text.buf);
+      pci_mfree(l->blocks);
+      pci_mfree(l);
+      a->id_lazy = NULL;
+    }
+}
+
+int
+pci_load_name_list(struct pci_access *a)
+{
+  pci_free_name_list(a);
+  a->id_load_attempted = 1;
+  if (pci_id_db_load(a))
+    return 1;
+  if (atoi(pci_get_param(a, "names.lazy")) > 0)
+    return id_load_lazy(a);
+  return id_load_text(a);
+}
+
+int
+pci_compile_name_list(struct pci_access *a, char *bin_name)
+{
+  /* This does not need any access method, so it can be called before pci_init() */
+  pci_init_handlers(a);
+  pci_free_name_list(a);
+  a->id_load_attempted = 1;
+  if (!id_load_text(a))
+    return 0;
+  return pci_id_db_write(a, bin_name);
+}
+
 void
 pci_free_name_list(struct pci_access *a)
 {
   pci_id_cache_flush(a);
   pci_id_hash_free(a);
+  pci_id_db_free(a);
+  pci_id_lazy_free(a);
   pci_id_hwdb_free(a);
+  pci_id_memo_flush(a);
   a->id_load_attempted = 0;
 }
 
@@ -9,19 +9,45 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 
 #include "internal.h"
 #include "names.h"
 
-static char *id_lookup(struct pci_access *a, int flags, int cat, int id1, int id2, int id3, int id4)
+static void
+load_name_list_once(struct pci_access *a)
+{
+  int attempted;
+
+  /* The flag is set under the write lock, so a read lock is enough to check it */
+  pci_lock(a, PCI_LOCK_NAMES_READ);
+  attempted = a->id_load_attempted;
+  pci_unlock(a, PCI_LOCK_NAMES_READ);
+  if (attempted)
+    return;
+  pci_lock(a, PCI_LOCK_NAMES_WRITE);
+  if (!a->id_load_attempted)
+    pci_load_name_list(a);
+  pci_unlock(a, PCI_LOCK_NAMES_WRITE);
+}
+
+/*
+ *  With thread safety enabled, the ID hash is protected by a read-write lock:
+ *  lookups of known IDs run in parallel, only loading and inserting of new
+ *  entries is exclusive. Entries are never freed before the whole hash,
+ *  so the returned names stay valid.
+ */
+static char *id_lookup_locked(struct pci_access *a, int flags, int cat, int id1, int id2, int id3, int id4, int *src)
 {
   char *name;
   int tried_hwdb = 0;
 
-  while (!(name = pci_id_lookup(a, flags, cat, id1, id2, id3, id4)))
+  while (!(name = pci_id_lookup(a, flags, cat, id1, id2, id3, id4, src)))
     {
+      if (a->id_lazy && !(flags & PCI_LOOKUP_SKIP_LOCAL) && pci_id_lazy_load(a, cat, id1))
+	continue;
       if ((flags & PCI_LOOKUP_CACHE) && !a->id_cache_status)
 	{
 	  if (pci_id_cache_load(a, flags))
@@ -52,6 +78,52 @@ static char *id_lookup(struct pci_access *a, int flags, int cat, int id1, int id
 	}
       return NULL;
     }
+  return name;
+}
+
+static char *id_lookup(struct pci_access *a, int flags, int cat, int id1, int id2, int id3, int id4)
+{
+  char *name;
+  int src = SRC_UNKNOWN;
+  int complete;
+
+  /* The built-in table is read-only, so it needs no locking */
+  if (!(flags & PCI_LOOKUP_SKIP_LOCAL) && pci_id_builtin_enabled(a))
+    {
+      if (name = pci_id_builtin_lookup(cat, id1, id2, id3, id4, &complete))
+	{
+	  PCI_STAT(a, names[PCI_STATS_NAME_LOCAL], 1);
+	  return name;
+	}
+      if (!complete && !(flags & PCI_LOOKUP_NUMERIC))
+	load_name_list_once(a);
+    }
+
+  pci_lock(a, PCI_LOCK_NAMES_READ);
+  name = pci_id_lookup(a, flags, cat, id1, id2, id3, id4, &src);
+  pci_unlock(a, PCI_LOCK_NAMES_READ);
+  if (!name)
+    {
+      pci_lock(a, PCI_LOCK_NAMES_WRITE);
+      name = id_lookup_locked(a, flags, cat, id1, id2, id3, id4, &src);
+      pci_unlock(a, PCI_LOCK_NAMES_WRITE);
+    }
+  if (!name)
+    {
+      PCI_STAT(a, names[PCI_STATS_NAME_UNKNOWN], 1);
+      return NULL;
+    }
+  if (a->stats)
+    {
+      static const byte src_stats[] = {
+	[SRC_UNKNOWN] = PCI_STATS_NAME_LOCAL,
+	[SRC_CACHE] = PCI_STATS_NAME_CACHE,
+	[SRC_NET] = PCI_STATS_NAME_NET,
+	[SRC_HWDB] = PCI_STATS_NAME_HWDB,
+	[SRC_LOCAL] = PCI_STATS_NAME_LOCAL,
+      };
+      pci_stat_add(&a->stats->names[name[0] ? src_stats[src] : PCI_STATS_NAME_UNKNOWN], 1);
+    }
   return (name[0] ? name : NULL);
 }
 
@@ -68,6 +140,149 @@ id_lookup_subsys(struct pci_access *a, int flags, int iv, int id, int isv, int i
   return d;
 }
 
+#ifdef PCI_USE_DNS
+
+/*
+ *  Prefetching of names via DNS: collect all ID's of the given devices
+ *  which are not known locally, resolve them concurrently and insert the
+ *  results (including negative ones) to the hash, so that subsequent
+ *  calls of pci_lookup_name() find them without any further queries.
+ */
+
+struct id_query {
+  int cat, id1, id2, id3, id4;
+  char *result;
+};
+
+struct id_prefetch {
+  struct pci_access *access;
+  struct id_query *queries;
+  int num_queries, max_queries;
+  int flags;
+};
+
+static void
+id_prefetch_add(struct id_prefetch *p, int cat, int id1, int id2, int id3, int id4)
+{
+  struct pci_access *a = p->access;
+  struct id_query *q;
+  int i, known;
+
+  /* Consult everything except the network first (this also loads the cache and asks the HWDB) */
+  id_lookup(a, p->flags & ~PCI_LOOKUP_NETWORK, cat, id1, id2, id3, id4);
+  pci_lock(a, PCI_LOCK_NAMES_READ);
+  known = !!pci_id_lookup(a, p->flags, cat, id1, id2, id3, id4, NULL);
+  pci_unlock(a, PCI_LOCK_NAMES_READ);
+  if (known)
+    return;
+
+  for (i=0; i<p->num_queries; i++)
+    {
+      q = &p->queries[i];
+      if (q->cat == cat && q->id1 == id1 && q->id2 == id2 && q->id3 == id3 && q->id4 == id4)
+	return;
+    }
+  if (p->num_queries >= p->max_queries)
+    {
+      p->max_queries = 2*p->max_queries + 16;
+      p->queries = pci_realloc(a, p->queries, p->max_queries * sizeof(struct id_query));
+    }
+  q = &p->queries[p->num_queries++];
+  q->cat = cat;
+  q->id1 = id1;
+  q->id2 = id2;
+  q->id3 = id3;
+  q->id4 = id4;
+  q->result = NULL;
+}
+
+static void
+id_prefetch_job(void *data, int job)
+{
+  struct id_prefetch *p = data;
+  struct id_query *q = &p->queries[job];
+
+  q->result = pci_id_net_lookup(p->access, q->cat, q->id1, q->id2, q->id3, q->id4);
+}
+
+void
+pci_lookup_prefetch(struct pci_access *a, struct pci_dev **devs, int n, int flags)
+{
+  struct id_prefetch p;
+  int i, found;
+
+  /* Nothing to resolve if pci_lookup_name() would print just numbers */
+  flags |= a->id_lookup_mode;
+  if (!(flags & PCI_LOOKUP_NO_NUMBERS) && a->numeric_ids == 1)
+    flags |= PCI_LOOKUP_NUMERIC;
+  if (flags & PCI_LOOKUP_MIXED)
+    flags &= ~PCI_LOOKUP_NUMERIC;
+  if (!(flags & PCI_LOOKUP_NETWORK) || (flags & PCI_LOOKUP_NUMERIC))
+    return;
+  if (!(flags & PCI_LOOKUP_SKIP_LOCAL))
+    load_name_list_once(a);
+
+  memset(&p, 0, sizeof(p));
+  p.access = a;
+  p.flags = flags;
+  for (i=0; i<n; i++)
+    {
+      struct pci_dev *d = devs[i];
+      int known = pci_fill_info(d, PCI_FILL_IDENT | PCI_FILL_CLASS | PCI_FILL_CLASS_EXT | PCI_FILL_SUBSYS);
+      if (known & PCI_FILL_IDENT)
+	{
+	  id_prefetch_add(&p, ID_VENDOR, d->vendor_id, 0, 0, 0);
+	  id_prefetch_add(&p, ID_DEVICE, d->vendor_id, d->device_id, 0, 0);
+	}
+      if (known & PCI_FILL_CLASS)
+	{
+	  id_prefetch_add(&p, ID_SUBCLASS, d->device_class >> 8, d->device_class & 0xff, 0, 0);
+	  if (known & PCI_FILL_CLASS_EXT)
+	    id_prefetch_add(&p, ID_PROGIF, d->device_class >> 8, d->device_class & 0xff, d->prog_if, 0);
+	}
+      if ((known & PCI_FILL_SUBSYS) && d->subsys_vendor_id && d->subsys_vendor_id != 0xffff)
+	{
+	  id_prefetch_add(&p, ID_VENDOR, d->subsys_vendor_id, 0, 0, 0);
+	  if (known & PCI_FILL_IDENT)
+	    id_prefetch_add(&p, ID_SUBSYSTEM, d->vendor_id, d->device_id, d->subsys_vendor_id, d->subsys_id);
+	}
+    }
+
+  if (p.num_queries)
+    {
+      a->debug("Resolving %d ID's via DNS\n", p.num_queries);
+      pci_run_parallel(a, atoi(pci_get_param(a, "net.threads")), p.num_queries, id_prefetch_job, &p);
+    }
+
+  found = 0;
+  pci_lock(a, PCI_LOCK_NAMES_WRITE);
+  for (i=0; i<p.num_queries; i++)
+    {
+      struct id_query *q = &p.queries[i];
+      pci_id_insert(a, q->cat, q->id1, q->id2, q->id3, q->id4, q->result ? q->result : "", SRC_NET);
+      if (q->result)
+	{
+	  pci_mfree(q->result);
+	  found = 1;
+	}
+    }
+  if (found)
+    pci_id_cache_dirty(a);
+  if (p.num_queries)
+    pci_id_memo_flush(a);
+  pci_unlock(a, PCI_LOCK_NAMES_WRITE);
+  pci_mfree(p.queries);
+}
+
+#else
+
+void
+pci_lookup_prefetch(struct pci_access *a UNUSED, struct pci_dev **devs UNUSED, int n UNUSED, int flags UNUSED)
+{
+}
+
+#endif
+
 static char *
 format_name(char *buf, int size, int flags, char *name, char *num, char *unknown)
 {
@@ -122,77 +337,54 @@ format_name_pair(char *buf, int size, int flags, char *v, char *d, char *num)
   return buf;
 }
 
-char *
-pci_lookup_name(struct pci_access *a, char *buf, int size, int flags, ...)
+static char *
+lookup_name(struct pci_access *a, char *buf, int size, int flags, int *arg)
 {
-  va_list args;
   char *v, *d, *cls, *pif;
   int iv, id, isv, isd, icls, ipif;
   char numbuf[16], pifbuf[32];
 
-  va_start(args, flags);
-
-  flags |= a->id_lookup_mode;
-  if (!(flags & PCI_LOOKUP_NO_NUMBERS))
-    {
-      if (a->numeric_ids > 1)
-	flags |= PCI_LOOKUP_MIXED;
-      else if (a->numeric_ids)
-	flags |= PCI_LOOKUP_NUMERIC;
-    }
-  if (flags & PCI_LOOKUP_MIXED)
-    flags &= ~PCI_LOOKUP_NUMERIC;
-
-  if (!a->id_load_attempted && !(flags & (PCI_LOOKUP_NUMERIC | PCI_LOOKUP_SKIP_LOCAL)))
-    pci_load_name_list(a);
-
   switch (flags & 0xffff)
     {
     case PCI_LOOKUP_VENDOR:
-      iv = va_arg(args, int);
+      iv = arg[0];
       sprintf(numbuf, "%04x", iv);
-      va_end(args);
       return format_name(buf, size, flags, id_lookup(a, flags, ID_VENDOR, iv, 0, 0, 0), numbuf, "Vendor");
     case PCI_LOOKUP_DEVICE:
-      iv = va_arg(args, int);
-      id = va_arg(args, int);
+      iv = arg[0];
+      id = arg[1];
       sprintf(numbuf, "%04x", id);
-      va_end(args);
       return format_name(buf, size, flags, id_lookup(a, flags, ID_DEVICE, iv, id, 0, 0), numbuf, "Device");
     case PCI_LOOKUP_VENDOR | PCI_LOOKUP_DEVICE:
-      iv = va_arg(args, int);
-      id = va_arg(args, int);
+      iv = arg[0];
+      id = arg[1];
       sprintf(numbuf, "%04x:%04x", iv, id);
       v = id_lookup(a, flags, ID_VENDOR, iv, 0, 0, 0);
       d = id_lookup(a, flags, ID_DEVICE, iv, id, 0, 0);
-      va_end(args);
       return format_name_pair(buf, size, flags, v, d, numbuf);
     case PCI_LOOKUP_SUBSYSTEM | PCI_LOOKUP_VENDOR:
-      isv = va_arg(args, int);
+      isv = arg[0];
       sprintf(numbuf, "%04x", isv);
       v = id_lookup(a, flags, ID_VENDOR, isv, 0, 0, 0);
-      va_end(args);
       return format_name(buf, size, flags, v, numbuf, "Unknown vendor");
     case PCI_LOOKUP_SUBSYSTEM | PCI_LOOKUP_DEVICE:
-      iv = va_arg(args, int);
-      id = va_arg(args, int);
-      isv = va_arg(args, int);
-      isd = va_arg(args, int);
+      iv = arg[0];
+      id = arg[1];
+      isv = arg[2];
+      isd = arg[3];
       sprintf(numbuf, "%04x", isd);
-      va_end(args);
       return format_name(buf, size, flags, id_lookup_subsys(a, flags, iv, id, isv, isd), numbuf, "Device");
     case PCI_LOOKUP_VENDOR | PCI_LOOKUP_DEVICE | PCI_LOOKUP_SUBSYSTEM:
-      iv = va_arg(args, int);
-      id = va_arg(args, int);
-      isv = va_arg(args, int);
-      isd = va_arg(args, int);
+      iv = arg[0];
+      id = arg[1];
+      isv = arg[2];
+      isd = arg[3];
       v = id_lookup(a, flags, ID_VENDOR, isv, 0, 0, 0);
       d = id_lookup_subsys(a, flags, iv, id, isv, isd);
       sprintf(numbuf, "%04x:%04x", isv, isd);
-      va_end(args);
       return format_name_pair(buf, size, flags, v, d, numbuf);
     case PCI_LOOKUP_CLASS:
-      icls = va_arg(args, int);
+      icls = arg[0];
       sprintf(numbuf, "%04x", icls);
       cls = id_lookup(a, flags, ID_SUBCLASS, icls >> 8, icls & 0xff, 0, 0);
       if (!cls && (cls = id_lookup(a, flags, ID_CLASS, icls >> 8, 0, 0, 0)))
@@ -200,11 +392,10 @@ pci_lookup_name(struct pci_access *a, char *buf, int size, int flags, ...)
 	  if (!(flags & PCI_LOOKUP_NUMERIC)) /* Include full class number */
 	    flags |= PCI_LOOKUP_MIXED;
 	}
-      va_end(args);
       return format_name(buf, size, flags, cls, numbuf, "Class");
     case PCI_LOOKUP_PROGIF:
-      icls = va_arg(args, int);
-      ipif = va_arg(args, int);
+      icls = arg[0];
+      ipif = arg[1];
       sprintf(numbuf, "%02x", ipif);
       pif = id_lookup(a, flags, ID_PROGIF, icls >> 8, icls & 0xff, ipif, 0);
       if (!pif && icls == 0x0101 && !(ipif & 0x70))
@@ -220,10 +411,70 @@ pci_lookup_name(struct pci_access *a, char *buf, int size, int flags, ...)
 	  if (*pif)
 	    pif++;
 	}
-      va_end(args);
       return format_name(buf, size, flags, pif, numbuf, "ProgIf");
     default:
-      va_end(args);
       return "<pci_lookup_name: invalid request>";
     }
 }
+
+char *
+pci_lookup_name(struct pci_access *a, char *buf, int size, int flags, ...)
+{
+  va_list args;
+  int arg[4] = { 0, 0, 0, 0 };
+  int i, n;
+  char mbuf[1024], *res;
+
+  flags |= a->id_lookup_mode;
+  if (!(flags & PCI_LOOKUP_NO_NUMBERS))
+    {
+      if (a->numeric_ids > 1)
+	flags |= PCI_LOOKUP_MIXED;
+      else if (a->numeric_ids)
+	flags |= PCI_LOOKUP_NUMERIC;
+    }
+  if (flags & PCI_LOOKUP_MIXED)
+    flags &= ~PCI_LOOKUP_NUMERIC;
+  if (flags & PCI_LOOKUP_NUMERIC)
+    flags &= ~PCI_LOOKUP_NETWORK;	/* Names are not printed, so do not ask the DNS for them */
+
+  switch (flags & 0xffff)
+    {
+    case PCI_LOOKUP_VENDOR:
+    case PCI_LOOKUP_SUBSYSTEM | PCI_LOOKUP_VENDOR:
+    case PCI_LOOKUP_CLASS:
+      n = 1;
+      break;
+    case PCI_LOOKUP_DEVICE:
+    case PCI_LOOKUP_VENDOR | PCI_LOOKUP_DEVICE:
+    case PCI_LOOKUP_PROGIF:
+      n = 2;
+      break;
+    case PCI_LOOKUP_SUBSYSTEM | PCI_LOOKUP_DEVICE:
+    case PCI_LOOKUP_VENDOR | PCI_LOOKUP_DEVICE | PCI_LOOKUP_SUBSYSTEM:
+      n = 4;
+      break;
+    default:
+      return "<pci_lookup_name: invalid request>";
+    }
+  va_start(args, flags);
+  for (i=0; i<n; i++)
+    arg[i] = va_arg(args, int);
+  va_end(args);
+
+  /* With the built-in table, the ID list is loaded only when the table does not know the answer */
+  if (!(flags & (PCI_LOOKUP_NUMERIC | PCI_LOOKUP_SKIP_LOCAL)) && !pci_id_builtin_enabled(a))
+    load_name_list_once(a);
+
+  if (!pci_id_memo_enabled(a))
+    return lookup_name(a, buf, size, flags, arg);
+  if (pci_id_memo_get(a, flags, arg, buf, size, &res))
+    return res;
+
+  /* Format the full name, the memo truncates it to the caller's buffer */
+  res = lookup_name(a, mbuf, sizeof(mbuf), flags, arg);
+  pci_id_memo_put(a, flags, arg, res);
+  if (!pci_id_memo_get(a, flags, arg, buf, size, &res))
+    res = lookup_name(a, buf, size, flags, arg);
+  return res;
+}
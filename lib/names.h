@@ -13,7 +13,6 @@
 /* names-hash.c */
 
 struct id_entry {
-  struct id_entry *next;
   u32 id12, id34;
   byte cat;
   byte src;
@@ -40,7 +39,6 @@ enum id_entry_src {
 };
 
 #define BUCKET_SIZE 8192
-#define HASH_SIZE 4099
 
 static inline u32 id_pair(unsigned int x, unsigned int y)
 {
@@ -58,7 +56,37 @@ static inline unsigned int pair_second(unsigned int x)
 }
 
 int pci_id_insert(struct pci_access *a, int cat, int id1, int id2, int id3, int id4, char *text, enum id_entry_src src);
-char *pci_id_lookup(struct pci_access *a, int flags, int cat, int id1, int id2, int id3, int id4);
+char *pci_id_lookup(struct pci_access *a, int flags, int cat, int id1, int id2, int id3, int id4, int *src);
+struct id_entry *pci_id_next(struct pci_access *a, unsigned int *iter);	/* Iterate over all entries, start with *iter=0 */
+
+/* names-bin.c */
+
+struct id_bin *pci_id_bin_open(struct pci_access *a, char *name, u32 magic);
+void pci_id_bin_close(struct id_bin *b);
+char *pci_id_bin_lookup(struct id_bin *b, int cat, u32 id12, u32 id34);
+int pci_id_bin_src_matches(struct id_bin *b, u64 src_size, u64 src_mtime);
+void pci_id_bin_insert_all(struct pci_access *a, struct id_bin *b, enum id_entry_src src);
+int pci_id_bin_write(struct pci_access *a, char *name, char *tmpname, u32 magic, u64 src_size, u64 src_mtime, int (*want)(struct id_entry *e));
+
+int pci_id_db_load(struct pci_access *a);
+int pci_id_db_write(struct pci_access *a, char *name);
+void pci_id_db_free(struct pci_access *a);
+
+/* names-builtin.c */
+
+int pci_id_builtin_enabled(struct pci_access *a);
+char *pci_id_builtin_lookup(int cat, int id1, int id2, int id3, int id4, int *complete);
+
+/* names-parse.c */
+
+int pci_id_lazy_load(struct pci_access *a, int cat, int id1);
+
+/* names-memo.c */
+
+int pci_id_memo_enabled(struct pci_access *a);
+int pci_id_memo_get(struct pci_access *a, int flags, int *args, char *buf, int size, char **result);
+void pci_id_memo_put(struct pci_access *a, int flags, int *args, char *name);
+void pci_id_memo_flush(struct pci_access *a);
 
 /* names-cache.c */
 
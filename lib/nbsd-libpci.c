@@ -142,7 +142,7 @@ nbsd_write(struct pci_dev *d, int pos, byte *buf, int len)
   return 1;
 }
 
-struct pci_methods pm_nbsd_libpci = {
+const struct pci_methods pm_nbsd_libpci = {
   .name = "nbsd-libpci",
   .help = "NetBSD libpci",
   .config = nbsd_config,
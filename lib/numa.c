@@ -0,0 +1,136 @@
+/*
+ *	The PCI Library -- NUMA Nodes
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "internal.h"
+
+#ifdef PCI_OS_LINUX
+#include <sched.h>
+#endif
+
+/*
+ *  Devices are grouped by the NUMA node reported by the back-end
+ *  (-1 if unknown). The groups are not stored anywhere: listing the nodes
+ *  and iterating over a group just walk the list of devices, filling
+ *  PCI_FILL_NUMA_NODE on the way, which is cheap once it is known.
+ */
+
+int
+pci_get_numa_nodes(struct pci_access *a, int *nodes, int max)
+{
+  struct pci_dev *d;
+  int *all, n = 0, i, j;
+
+  for (d = a->devices; d; d = d->next)
+    n++;
+  all = pci_malloc(a, (n ? n : 1) * sizeof(int));
+
+  n = 0;
+  for (d = a->devices; d; d = d->next)
+    {
+      pci_fill_info_v314(d, PCI_FILL_NUMA_NODE);
+      for (i = 0; i < n && all[i] < d->numa_node; i++)
+	;
+      if (i < n && all[i] == d->numa_node)
+	continue;
+      for (j = n++; j > i; j--)
+	all[j] = all[j-1];
+      all[i] = d->numa_node;
+    }
+
+  for (i = 0; i < n && i < max; i++)
+    nodes[i] = all[i];
+  pci_mfree(all);
+  return n;
+}
+
+struct pci_dev *
+pci_next_on_node(struct pci_access *a, struct pci_dev *d, int node)
+{
+  for (d = (d ? d->next : a->devices); d; d = d->next)
+    {
+      pci_fill_info_v314(d, PCI_FILL_NUMA_NODE);
+      if (d->numa_node == node)
+	return d;
+    }
+  return NULL;
+}
+
+#if defined(PCI_OS_LINUX) && defined(CPU_SETSIZE)
+
+/* Parse a list of CPUs like "0-7,16-23" as printed by the kernel */
+static int
+parse_cpu_list(char *s, cpu_set_t *set)
+{
+  CPU_ZERO(set);
+  while (*s && *s != '\n')
+    {
+      char *end;
+      long first = strtol(s, &end, 10), last = first;
+      if (end == s)
+	return 0;
+      if (*end == '-')
+	{
+	  s = end + 1;
+	  last = strtol(s, &end, 10);
+	  if (end == s)
+	    return 0;
+	}
+      for (; first <= last && first < CPU_SETSIZE; first++)
+	CPU_SET(first, set);
+      s = end;
+      if (*s == ',')
+	s++;
+    }
+  return CPU_COUNT(set) > 0;
+}
+
+int
+pci_bind_to_node(struct pci_access *a, int node)
+{
+  char name[64], buf[4096];
+  cpu_set_t set;
+  FILE *f;
+  int ok;
+
+  if (node < 0)
+    return 0;
+  snprintf(name, sizeof(name), "/sys/devices/system/node/node%d/cpulist", node);
+  if (!(f = fopen(name, "r")))
+    {
+      a->debug("Cannot open %s\n", name);
+      return 0;
+    }
+  ok = fgets(buf, sizeof(buf), f) && parse_cpu_list(buf, &set);
+  fclose(f);
+  if (!ok)
+    {
+      a->debug("Node %d has no CPUs\n", node);
+      return 0;
+    }
+  if (sched_setaffinity(0, sizeof(set), &set) < 0)
+    {
+      a->debug("Cannot bind to the CPUs of node %d\n", node);
+      return 0;
+    }
+  return 1;
+}
+
+#else
+
+int
+pci_bind_to_node(struct pci_access *a UNUSED, int node UNUSED)
+{
+  return 0;
+}
+
+#endif
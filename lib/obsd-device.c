@@ -137,7 +137,7 @@ obsd_write(struct pci_dev *d, int pos, byte *buf, int len)
   return 1;
 }
 
-struct pci_methods pm_obsd_device = {
+const struct pci_methods pm_obsd_device = {
   .name = "obsd-device",
   .help = "/dev/pci on OpenBSD",
   .config = obsd_config,
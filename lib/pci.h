@@ -18,7 +18,7 @@
 #include "header.h"
 #include "types.h"
 
-#define PCI_LIB_VERSION 0x030d00
+#define PCI_LIB_VERSION 0x030e00
 
 #ifndef PCI_ABI
 #define PCI_ABI
@@ -52,9 +52,14 @@ enum pci_access_type {
   PCI_ACCESS_MMIO_TYPE1_EXT,		/* MMIO ports, type 1 extended */
   PCI_ACCESS_ECAM,			/* PCIe ECAM via /dev/mem */
   PCI_ACCESS_AOS_EXPANSION,		/* AmigaOS Expansion library */
+  PCI_ACCESS_DUMP_ARCHIVE,		/* Archive of dumps of many hosts */
+  PCI_ACCESS_REMOTE,			/* Remote host via pciagent */
   PCI_ACCESS_MAX
 };
 
+struct pci_trace_record;
+struct pci_filter;
+
 struct pci_access {
   /* Options you can change: */
   unsigned int method;			/* Access method */
@@ -78,20 +83,36 @@ struct pci_access {
   struct pci_dev *devices;		/* Devices found on this bus */
 
   /* Fields used internally: */
-  struct pci_methods *methods;
+  const struct pci_methods *methods;
   struct pci_param *params;
-  struct id_entry **id_hash;		/* names.c */
+  struct id_hash *id_hash;		/* names.c */
   struct id_bucket *current_id_bucket;
   int id_load_attempted;
   int id_cache_status;			/* 0=not read, 1=read, 2=dirty */
   char *id_cache_name;
   struct udev *id_udev;			/* names-hwdb.c */
   struct udev_hwdb *id_udev_hwdb;
-  int fd;				/* proc/sys: fd for config space */
-  int fd_rw;				/* proc/sys: fd opened read-write */
-  int fd_vpd;				/* sys: fd for VPD */
-  struct pci_dev *cached_dev;		/* proc/sys: device the fds are for */
+  int id_hwdb_ref;			/* names-hwdb.c: holds a reference to the shared HWDB */
+  int fd;				/* proc: fd for config space */
+  int fd_rw;				/* proc: fd opened read-write */
+  int fd_vpd;				/* unused */
+  struct pci_dev *cached_dev;		/* proc: device the fds are for */
   void *backend_data;			/* Private data of the back end */
+  struct id_bin *id_bin;		/* names-bin.c: compiled ID database */
+  struct id_bin *id_cache;		/* names-cache.c: mapped cache of ID's resolved via DNS */
+  struct id_lazy *id_lazy;		/* names-parse.c: index of the ID list in the lazy mode */
+  struct id_memo *id_memo;		/* names-memo.c: memo of formatted names */
+  int id_memo_enabled;			/* 0=not known yet, 1=enabled, -1=disabled */
+  int id_builtin_enabled;		/* names-builtin.c: 0=not known yet, 1=enabled, -1=disabled */
+  int config_cache;			/* access.c: cache config space of all devices */
+  struct pci_vf_family *vf_families;	/* caps.c: SR-IOV virtual functions sharing capabilities */
+  struct pci_dev_index *dev_index;	/* access.c: index of devices by address */
+  struct pci_stats *stats;		/* stats.c: statistics if enabled */
+  void (*trace)(struct pci_access *, struct pci_trace_record *, void *);	/* trace.c: see pci_set_trace() */
+  void *trace_data;
+  struct pci_locks *locks;		/* threads.c: see pci_enable_thread_safety() */
+  struct pci_filter *scan_filter;	/* filter.c: see pci_scan_bus_filtered() */
+  struct pci_topology *topology;	/* topology.c: graph of buses and bridges */
 };
 
 /* Initialize PCI access */
@@ -101,9 +122,73 @@ void pci_cleanup(struct pci_access *) PCI_ABI;
 
 /* Scanning of devices */
 void pci_scan_bus(struct pci_access *acc) PCI_ABI;
+/* Like pci_scan_bus(), but only devices matching the filter (NULL=all) end up in the list */
+void pci_scan_bus_filtered(struct pci_access *acc, struct pci_filter *f) PCI_ABI;
 struct pci_dev *pci_get_dev(struct pci_access *acc, int domain, int bus, int dev, int func) PCI_ABI; /* Raw access to specified device */
 void pci_free_dev(struct pci_dev *) PCI_ABI;
 
+/*
+ * A probe handle is a pci_dev which can be moved to any address by
+ * pci_set_probe_addr() to probe for presence of devices, without allocating
+ * a new pci_dev for every address. It starts at 0000:00:00.0. Accesses through
+ * it bypass the config space cache and everything filled is forgotten when it
+ * is moved. It must not be linked to the list of devices and it is freed by
+ * pci_free_dev().
+ */
+struct pci_dev *pci_alloc_probe(struct pci_access *acc) PCI_ABI;
+void pci_set_probe_addr(struct pci_dev *d, int domain, int bus, int dev, int func) PCI_ABI;
+
+/*
+ * Domains (PCI segments) known to the access method together with ranges
+ * of their bus numbers: pci_get_domains() stores up to max of them in
+ * ascending order of domains and returns their total number. Methods
+ * which cannot tell report domain 0 with all buses.
+ */
+struct pci_bus_range {
+  int domain;
+  int start_bus, end_bus;
+};
+
+int pci_get_domains(struct pci_access *acc, struct pci_bus_range *ranges, int max) PCI_ABI;
+struct pci_dev *pci_find_dev(struct pci_access *acc, int domain, int bus, int dev, int func) PCI_ABI; /* Find a scanned device by its address */
+
+/*
+ *	Look up a single device without scanning the whole bus if the back-end
+ *	can check for its presence directly (otherwise, the bus is scanned unless
+ *	it has been already). The device is linked to the list of devices;
+ *	returns NULL if it does not exist.
+ */
+struct pci_dev *pci_probe_dev(struct pci_access *acc, int domain, int bus, int dev, int func) PCI_ABI;
+
+/*
+ *	The same, followed by pci_fill_info() with the given flags. If they include
+ *	PCI_FILL_PARENT, all ancestors of the device which the back-end can find
+ *	are probed and filled, too.
+ */
+struct pci_dev *pci_get_dev_filled(struct pci_access *acc, int domain, int bus, int dev, int func, unsigned int flags) PCI_ABI;
+
+/*
+ *	Incremental rescanning: pci_rescan() scans the bus again and updates the list
+ *	of devices, keeping the pci_dev structures (and everything filled in and cached)
+ *	of devices which are still present. If the access method supports monitoring
+ *	of hot-plug events (Linux sysfs does via kernel uevents), pci_monitor_fd() returns
+ *	a file descriptor, which becomes readable when events are pending, and
+ *	pci_monitor_process() applies them to the list of devices without rescanning
+ *	the whole bus. Both functions return the number of changes and call the callback
+ *	for devices which were added (after linking), removed (before freeing them)
+ *	or changed (their driver was bound or unbound).
+ */
+
+#define PCI_RESCAN_ADDED	1
+#define PCI_RESCAN_REMOVED	2
+#define PCI_RESCAN_CHANGED	3
+
+typedef void pci_rescan_callback(struct pci_dev *d, int event, void *data);
+
+int pci_rescan(struct pci_access *acc, pci_rescan_callback *cb, void *data) PCI_ABI;
+int pci_monitor_fd(struct pci_access *acc) PCI_ABI;	/* Returns -1 if not supported */
+int pci_monitor_process(struct pci_access *acc, pci_rescan_callback *cb, void *data) PCI_ABI;
+
 /* Names of access methods */
 int pci_lookup_method(char *name) PCI_ABI;	/* Returns -1 if not found */
 char *pci_get_method_name(int index) PCI_ABI;	/* Returns "" if unavailable, NULL if index out of range */
@@ -165,13 +250,24 @@ struct pci_dev {
 
   /* Fields used internally */
   struct pci_access *access;
-  struct pci_methods *methods;
+  const struct pci_methods *methods;
   u8 *cache;				/* Cached config registers */
   int cache_len;
   int hdrtype;				/* Cached low 7 bits of header type, -1 if unknown */
   void *backend_data;			/* Private data for of the back end */
   struct pci_property *properties;	/* A linked list of extra properties */
   struct pci_cap *last_cap;		/* Last capability in the list */
+  struct pci_config_cache *config_cache;	/* Cached config space, see pci_enable_config_cache() */
+  struct pci_cap_index *cap_index;	/* caps.c: index of the list of capabilities */
+  struct pci_dev *index_next;		/* access.c: next device in the same bucket of the device index */
+  struct pci_dev_arena *arena;		/* access.c: memory for properties and capabilities */
+  struct pci_vpd *vpd;			/* vpd.c: Vital Product Data read by PCI_FILL_VPD */
+  int probe_handle;			/* access.c: see pci_alloc_probe() */
+  struct pci_topo_bus *topo_bus;	/* topology.c: bus the device is on */
+  struct pci_topo_bus *topo_secondary;	/* topology.c: bus behind the bridge */
+  struct pci_doe *doe;			/* doe.c: protocols of DOE mailboxes */
+  u32 *emulated;			/* emulated.c: synthesized standard header */
+  struct pci_bar_map *bar_maps;		/* bars.c: mapped memory BARs */
 };
 
 #define PCI_ADDR_IO_MASK (~(pciaddr_t) 0x3)
@@ -191,6 +287,23 @@ int pci_write_long(struct pci_dev *, int pos, u32 data) PCI_ABI;
 int pci_read_block(struct pci_dev *, int pos, u8 *buf, int len) PCI_ABI;
 int pci_write_block(struct pci_dev *, int pos, u8 *buf, int len) PCI_ABI;
 
+/*
+ * Several reads at once, possibly from different devices. Back-ends which can
+ * service them more efficiently than one by one (e.g., by merging adjacent ranges
+ * of the same device to a single system call) do so; others fall back to reading
+ * each block separately. Like pci_read_block(), this bypasses the cache set by
+ * pci_setup_cache(), but it uses the config space cache if it is enabled. Sets
+ * the ok field of each request and returns the number of successful requests.
+ */
+struct pci_read_req {
+  struct pci_dev *dev;
+  int pos, len;
+  u8 *buf;
+  int ok;				/* Filled by pci_read_multi() */
+};
+
+int pci_read_multi(struct pci_access *acc, struct pci_read_req *reqs, int n) PCI_ABI;
+
 /*
  * Most device properties take some effort to obtain, so libpci does not
  * initialize them during default bus scan. Instead, you have to call
@@ -211,6 +324,15 @@ int pci_write_block(struct pci_dev *, int pos, u8 *buf, int len) PCI_ABI;
  */
 
 int pci_fill_info(struct pci_dev *, int flags) PCI_ABI;
+
+/*
+ * pci_fill_info_batch() is equivalent to calling pci_fill_info() on all
+ * devices in the list, but some back-ends can do it faster. For example,
+ * linux-sysfs can read the per-device attributes using multiple threads
+ * (see the sysfs.threads parameter). The order of devices is not changed.
+ */
+void pci_fill_info_batch(struct pci_access *acc, int flags) PCI_ABI;
+
 char *pci_get_string_property(struct pci_dev *d, u32 prop) PCI_ABI;
 
 #define PCI_FILL_IDENT		0x0001		/* vendor and device ID */
@@ -235,9 +357,208 @@ char *pci_get_string_property(struct pci_dev *d, u32 prop) PCI_ABI;
 #define PCI_FILL_PARENT		0x00080000
 #define PCI_FILL_DRIVER		0x00100000      /* OS driver currently in use (string property) */
 #define PCI_FILL_RCD_LNK	0x00200000      /* CXL RCD Link status properties (rcd_*) */
+#define PCI_FILL_VPD		0x00400000	/* Vital Product Data, see pci_get_vpd() */
+
+/*
+ * Vital Product Data are read by pci_fill_info(PCI_FILL_VPD) at once and kept
+ * with the device, so the functions below never access the hardware. pci_get_vpd()
+ * returns the raw image up to the end tag (or as far as it could be read),
+ * pci_find_vpd_keyword() the value of the first read-only or read-write field
+ * with the given two-character keyword (e.g., "SN"). Both return NULL if the
+ * data are not available.
+ */
+u8 *pci_get_vpd(struct pci_dev *d, int *len) PCI_ABI;
+u8 *pci_find_vpd_keyword(struct pci_dev *d, char *keyword, int *len) PCI_ABI;
+
+/*
+ * Statistics of operations, collected after pci_enable_stats() or if the "stats"
+ * parameter is set when pci_init() is called. Enabling resets all counters.
+ * pci_get_stats() returns NULL if statistics are disabled. Calls of the access
+ * method are timed including everything they do, so a pci_fill_info() also counts
+ * the config space reads it issues. A batch of pci_read_multi() counts as a single
+ * read call.
+ */
+enum pci_stats_op {
+  PCI_STATS_SCAN,
+  PCI_STATS_FILL_INFO,
+  PCI_STATS_READ,
+  PCI_STATS_WRITE,
+  PCI_STATS_READ_VPD,
+  PCI_STATS_OPS
+};
+
+#define PCI_STATS_BUCKETS 32		/* Bucket i counts calls which took 2^i to 2^(i+1)-1 ns */
+
+struct pci_op_stats {
+  u64 calls, failed;
+  u64 bytes;				/* Transferred by successful calls */
+  u64 ns;				/* Total time */
+  u64 histogram[PCI_STATS_BUCKETS];
+};
+
+enum pci_stats_name_src {
+  PCI_STATS_NAME_LOCAL,			/* The ID database */
+  PCI_STATS_NAME_HWDB,			/* UDEV's HWDB */
+  PCI_STATS_NAME_NET,			/* DNS query */
+  PCI_STATS_NAME_CACHE,			/* Cache of DNS queries */
+  PCI_STATS_NAME_UNKNOWN,		/* Not found anywhere */
+  PCI_STATS_NAME_SOURCES
+};
+
+struct pci_stats {
+  struct pci_op_stats ops[PCI_STATS_OPS];
+  u64 cache_hits, cache_misses;		/* Config space reads served by pci_setup_cache() or the config cache, or not */
+  u64 fd_hits, fd_opens, fd_evictions;	/* Files kept open by the back-end */
+  u64 names[PCI_STATS_NAME_SOURCES];	/* Name lookups by the source of the answer */
+};
+
+void pci_enable_stats(struct pci_access *acc, int enable) PCI_ABI;
+struct pci_stats *pci_get_stats(struct pci_access *acc) PCI_ABI;
+
+/*
+ * Tracing of config space accesses: the callback set by pci_set_trace() is called
+ * after every read or write requested by the application (PCI_TRACE_READ and
+ * PCI_TRACE_WRITE, including those served from caches) and after every read or
+ * write of the access method (PCI_TRACE_METHOD_*). All requests of a batched
+ * pci_read_multi() report the duration of the whole batch. The callback can be
+ * called from multiple threads if the application or the library uses them.
+ * If libpci was built with USDT support, the same events are also available as
+ * static probes of provider "libpci", see the pcilib(7) man page.
+ */
+enum pci_trace_event {
+  PCI_TRACE_READ,
+  PCI_TRACE_WRITE,
+  PCI_TRACE_METHOD_READ,
+  PCI_TRACE_METHOD_WRITE
+};
+
+struct pci_trace_record {
+  enum pci_trace_event event;
+  struct pci_dev *dev;
+  int pos, len;
+  u8 *buf;				/* Data read or written */
+  int ok;				/* Non-zero if the access succeeded */
+  u64 ns;				/* Duration in nanoseconds (0 if no clock is available) */
+};
+
+typedef void pci_trace_fn(struct pci_access *acc, struct pci_trace_record *rec, void *data);
+
+void pci_set_trace(struct pci_access *acc, pci_trace_fn *fn, void *data) PCI_ABI;
+
+/*
+ * After pci_enable_thread_safety(), a single pci_access with its list of
+ * devices can be used by multiple threads at once: reading and writing
+ * of config space (including pci_read_multi() and pci_read_vpd()), filling
+ * of device properties, looking up capabilities and names are protected by
+ * internal locks. Scanning, rescanning, pci_get_dev(), pci_free_dev() and
+ * pci_cleanup() still must not run concurrently with anything else.
+ * Back-ends which can handle parallel accesses (like linux-sysfs) are called
+ * concurrently, others are serialized. Returns 0 if the library was built
+ * without thread support.
+ */
+int pci_enable_thread_safety(struct pci_access *acc, int enable) PCI_ABI;
+
+/*
+ * Grouping of devices by NUMA nodes: pci_get_numa_nodes() stores up to max
+ * distinct nodes of the scanned devices in ascending order (-1 stands for
+ * devices whose node is unknown) and returns their total number.
+ * pci_next_on_node() returns the first device on the given node after d
+ * (or the first one at all if d is NULL). pci_bind_to_node() restricts the
+ * calling thread to the CPUs of the node; it returns 0 if it is not possible.
+ * Setting the numa.bind parameter makes the library's own worker threads
+ * bind themselves to the nodes of the devices they work with.
+ */
+int pci_get_numa_nodes(struct pci_access *acc, int *nodes, int max) PCI_ABI;
+struct pci_dev *pci_next_on_node(struct pci_access *acc, struct pci_dev *d, int node) PCI_ABI;
+int pci_bind_to_node(struct pci_access *acc, int node) PCI_ABI;
+
+/*
+ * Topology of buses and bridges: the library builds a graph of all buses
+ * which have a device on them or are behind a bridge when it is first needed
+ * and keeps it until a device is added or removed (or pci_topo_free() is called,
+ * which is needed after bus numbers of bridges are reprogrammed). All pointers
+ * returned are valid only as long as the graph is kept.
+ *
+ * pci_topo_get_bus() finds a bus by its number, pci_topo_dev_bus() returns
+ * the bus of a device and pci_topo_secondary_bus() the bus behind a bridge
+ * (NULL if there is none). pci_topo_upstream() returns the bridge the device
+ * is behind (NULL for devices on root buses or if the bridge is not known).
+ * pci_topo_link_partner() returns the device on the other end of the PCIe
+ * link of a port: function 0 below a root or downstream port, the port above
+ * an endpoint or upstream port.
+ */
+struct pci_topo_bus {
+  int domain;
+  int number;
+  int subordinate;			/* Highest bus number behind the bridge */
+  struct pci_dev *bridge;		/* Bridge in front of the bus, NULL for root buses */
+  struct pci_topo_bus *parent;		/* Bus the bridge is on */
+  struct pci_dev **devices;		/* Devices on the bus in the order of the device list */
+  int num_devices;
+};
+
+struct pci_topo_bus *pci_topo_get_bus(struct pci_access *acc, int domain, int bus) PCI_ABI;
+struct pci_topo_bus *pci_topo_dev_bus(struct pci_dev *d) PCI_ABI;
+struct pci_topo_bus *pci_topo_secondary_bus(struct pci_dev *d) PCI_ABI;
+struct pci_dev *pci_topo_upstream(struct pci_dev *d) PCI_ABI;
+struct pci_dev *pci_topo_link_partner(struct pci_dev *d) PCI_ABI;
+void pci_topo_free(struct pci_access *acc) PCI_ABI;
+
+/*
+ * Data Object Exchange mailboxes: pci_doe_get_protocols() returns the number
+ * of protocols supported by the mailbox whose DOE capability is at the given
+ * address (or -1 if the discovery failed) and sets *protocols to their list.
+ * The result of the discovery is kept as long as the device is. Calling
+ * pci_doe_discover() first runs the discoveries of all devices in parallel
+ * with up to the given number of threads (0 or 1 runs them serially). Threads
+ * are used only if pci_enable_thread_safety() has been called.
+ * pci_doe_find_mailbox() returns the address of the first mailbox of the
+ * device supporting the protocol or 0 if there is none.
+ *
+ * pci_doe_exchange() sends a request of req_len dwords (without the header)
+ * and stores up to resp_max dwords of the response payload. It returns the
+ * full length of the payload in dwords or -1 on failure. A mailbox must not
+ * be used by multiple threads at once.
+ */
+struct pci_doe_protocol {
+  u16 vendor_id;
+  u8 type;
+};
+
+int pci_doe_get_protocols(struct pci_dev *d, int where, struct pci_doe_protocol **protocols) PCI_ABI;
+int pci_doe_find_mailbox(struct pci_dev *d, int vendor_id, int type) PCI_ABI;
+int pci_doe_exchange(struct pci_dev *d, int where, int vendor_id, int type, u32 *req, int req_len, u32 *resp, int resp_max) PCI_ABI;
+void pci_doe_discover(struct pci_access *acc, int threads) PCI_ABI;
+
+/*
+ * Mapping of memory BARs: pci_map_bar() maps the whole memory BAR with the given
+ * index and returns a pointer to its start (and its size in *size if size is
+ * not NULL), or NULL if the BAR is not a memory BAR or the back-end cannot map it.
+ * The mapping is kept and returned by later calls until pci_unmap_bar() is called
+ * or the device is freed or re-filled with PCI_FILL_RESCAN. A later call asking
+ * for a writable mapping of a read-only one, or for a different write-combining
+ * setting, fails until the BAR is unmapped. The registers have to be accessed
+ * with the width they are defined with, preferably by volatile pointers.
+ */
+#define PCI_MAP_WRITE		1	/* Writable mapping */
+#define PCI_MAP_WC		2	/* Write-combining mapping if supported and the BAR is prefetchable */
+
+void *pci_map_bar(struct pci_dev *d, int bar, int flags, pciaddr_t *size) PCI_ABI;
+void pci_unmap_bar(struct pci_dev *d, int bar) PCI_ABI;
 
 void pci_setup_cache(struct pci_dev *, u8 *cache, int len) PCI_ABI;
 
+/*
+ * Cache of the config space maintained by the library: when enabled, every dword
+ * read from the config space of any device is remembered and later reads are
+ * served from memory. Writes drop the written dwords from the cache. Registers
+ * which change on their own (e.g., status bits) can be re-read after calling
+ * pci_invalidate_config_cache() on them (PCI_FILL_RESCAN invalidates everything).
+ * Disabling the cache frees it. The cache is disabled by default.
+ */
+void pci_enable_config_cache(struct pci_access *, int enable) PCI_ABI;
+void pci_invalidate_config_cache(struct pci_dev *, int pos, int len) PCI_ABI;
+
 /*
  *	Capabilities
  */
@@ -274,6 +595,37 @@ char *pci_filter_parse_slot(struct pci_filter *, char *) PCI_ABI;
 char *pci_filter_parse_id(struct pci_filter *, char *) PCI_ABI;
 int pci_filter_match(struct pci_filter *, struct pci_dev *) PCI_ABI;
 
+/*
+ *	Compiled filters: a device matches if it matches any of the given filters
+ *	(an empty set matches all devices). The set keeps its own copy of the filters.
+ *	pci_filter_select() walks the device list once and returns a NULL-terminated
+ *	array of matching devices, which is owned by the set and valid until the next
+ *	call of pci_filter_select() or pci_filter_free().
+ */
+
+struct pci_filter_set;
+
+struct pci_filter_set *pci_filter_compile(struct pci_access *, struct pci_filter *filters, int n) PCI_ABI;
+int pci_filter_set_match(struct pci_filter_set *, struct pci_dev *) PCI_ABI;
+struct pci_dev **pci_filter_select(struct pci_filter_set *, int *count) PCI_ABI;
+void pci_filter_free(struct pci_filter_set *) PCI_ABI;
+
+/*
+ *	Binary dumps: write config space of the given devices to a file, which can be
+ *	read by the dump method much faster than a text dump. Returns 1 on success,
+ *	0 if the dump could not be written.
+ */
+
+int pci_write_dump(struct pci_access *a, char *name, struct pci_dev **devs, int n) PCI_ABI;
+
+/*
+ *	Dump archives: write dumps of many hosts (in any format accepted by the dump
+ *	method) to a single file, which can be read by the archive method. Returns 1
+ *	on success, 0 if the archive could not be written.
+ */
+
+int pci_write_dump_archive(struct pci_access *a, char *name, char **hosts, char **dumps, int n) PCI_ABI;
+
 /*
  *	Conversion of PCI ID's to names (according to the pci.ids file)
  *
@@ -292,10 +644,18 @@ int pci_filter_match(struct pci_filter *, struct pci_dev *) PCI_ABI;
 
 char *pci_lookup_name(struct pci_access *a, char *buf, int size, int flags, ...) PCI_ABI;
 
+/*
+ *	Resolve all ID's of the given devices, which are not known locally, via DNS
+ *	at once and in parallel. Does nothing unless PCI_LOOKUP_NETWORK is enabled.
+ *	The results are then returned by pci_lookup_name() without further queries.
+ */
+void pci_lookup_prefetch(struct pci_access *a, struct pci_dev **devs, int n, int flags) PCI_ABI;
+
 int pci_load_name_list(struct pci_access *a) PCI_ABI;	/* Called automatically by pci_lookup_*() when needed; returns success */
 void pci_free_name_list(struct pci_access *a) PCI_ABI;	/* Called automatically by pci_cleanup() */
 void pci_set_name_list_path(struct pci_access *a, char *name, int to_be_freed) PCI_ABI;
 void pci_id_cache_flush(struct pci_access *a) PCI_ABI;
+int pci_compile_name_list(struct pci_access *a, char *bin_name) PCI_ABI;	/* Write the ID list in the compiled format, can be called before pci_init(); returns success */
 
 enum pci_lookup_mode {
   PCI_LOOKUP_VENDOR = 1,		/* Vendor name (args: vendorID) */
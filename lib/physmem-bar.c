@@ -0,0 +1,41 @@
+/*
+ *	The PCI Library -- Mapping of Memory BARs via the Physical Memory Device
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "internal.h"
+#include "physmem.h"
+
+/*
+ *  Used by back-ends which access the config space through physical memory,
+ *  so the physical memory device is already open. Such mappings are never
+ *  write-combining, PCI_MAP_WC is ignored.
+ */
+
+int
+physmem_map_bar(struct physmem *physmem, struct pci_dev *d, struct pci_bar_map *m)
+{
+  long pagesize = physmem_get_pagesize(physmem);
+  u64 offset = m->addr & (pagesize - 1);
+  void *map;
+
+  m->map_len = (offset + m->size + pagesize - 1) & ~(u64) (pagesize - 1);
+  map = physmem_map(physmem, m->addr - offset, m->map_len, !!(m->flags & PCI_MAP_WRITE));
+  if (map == (void *) -1)
+    {
+      d->access->debug("map_bar: Cannot map %" PCI_U64_FMT_X " from physical memory\n", m->addr);
+      return 0;
+    }
+  m->map = map;
+  m->ptr = (byte *) map + offset;
+  return 1;
+}
+
+void
+physmem_unmap_bar(struct physmem *physmem, struct pci_bar_map *m)
+{
+  physmem_unmap(physmem, m->map, m->map_len);
+}
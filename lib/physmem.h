@@ -38,3 +38,7 @@ void *physmem_map(struct physmem *physmem, u64 addr, size_t length, int w);
  * - EACCES - generic unknown error for djgpp and windows
  */
 int physmem_unmap(struct physmem *physmem, void *ptr, size_t length);
+
+/* Implementation of the map_bar and unmap_bar methods by physmem mappings, see physmem-bar.c */
+int physmem_map_bar(struct physmem *physmem, struct pci_dev *d, struct pci_bar_map *m);
+void physmem_unmap_bar(struct physmem *physmem, struct pci_bar_map *m);
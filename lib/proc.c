@@ -11,6 +11,7 @@
 #define _GNU_SOURCE
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
@@ -19,11 +20,13 @@
 #include <sys/types.h>
 
 #include "internal.h"
+#include "fd-lru.h"
 
 static void
 proc_config(struct pci_access *a)
 {
   pci_define_param(a, "proc.path", PCI_PATH_PROC_BUS_PCI, "Path to the procfs bus tree");
+  pci_define_param(a, "proc.fd_cache", "16", "Number of devices whose config files are kept open");
 }
 
 static int
@@ -40,20 +43,56 @@ proc_detect(struct pci_access *a)
   return 1;
 }
 
+/* Config files of recently used devices are kept open, see fd-lru.h */
+
+struct proc_dev {
+  struct pci_fd_lru_entry lru;		/* Must be first */
+  int fd;
+  int fd_rw;				/* fd opened read-write */
+  int tried;				/* Opening has been tried (fd < 0 if it failed) */
+};
+
+struct proc_access {
+  struct pci_fd_lru lru;
+};
+
+static void
+proc_close_dev(struct pci_access *a, struct proc_dev *pd)
+{
+  struct proc_access *pa = a->backend_data;
+
+  if (pd->fd >= 0)
+    {
+      close(pd->fd);
+      pd->fd = -1;
+    }
+  pd->tried = 0;
+  pci_fd_lru_remove(&pa->lru, &pd->lru);
+}
+
+static void
+proc_evict_dev(struct pci_access *a, struct pci_fd_lru_entry *e)
+{
+  proc_close_dev(a, (struct proc_dev *) e);
+}
+
 static void
 proc_init(struct pci_access *a)
 {
-  a->fd = -1;
+  struct proc_access *pa = pci_malloc(a, sizeof(*pa));
+
+  pci_fd_lru_init(&pa->lru, atoi(pci_get_param(a, "proc.fd_cache")), proc_evict_dev);
+  a->backend_data = pa;
 }
 
 static void
 proc_cleanup(struct pci_access *a)
 {
-  if (a->fd >= 0)
-    {
-      close(a->fd);
-      a->fd = -1;
-    }
+  struct proc_access *pa = a->backend_data;
+
+  pci_fd_lru_evict_all(a, &pa->lru);
+  pci_mfree(pa);
+  a->backend_data = NULL;
 }
 
 static void
@@ -102,6 +141,12 @@ proc_scan(struct pci_access *a)
       d->func = PCI_FUNC(dfn & 0xff);
       d->vendor_id = vend >> 16U;
       d->device_id = vend & 0xffff;
+      if (!pci_scan_wants_addr(a, 0, d->bus, d->dev, d->func) ||
+	  (!a->buscentric && !pci_scan_wants_ids(a, d->vendor_id, d->device_id, -1, -1)))
+	{
+	  pci_free_dev(d);
+	  continue;
+	}
       known = 0;
       if (!a->buscentric)
 	{
@@ -135,34 +180,52 @@ static int
 proc_setup(struct pci_dev *d, int rw)
 {
   struct pci_access *a = d->access;
+  struct proc_access *pa = a->backend_data;
+  struct proc_dev *pd = d->backend_data;
 
-  if (a->cached_dev != d || a->fd_rw < rw)
+  if (!pd)
+    {
+      pd = pci_malloc(a, sizeof(*pd));
+      memset(pd, 0, sizeof(*pd));
+      pd->fd = -1;
+      d->backend_data = pd;
+    }
+  pci_fd_lru_use(a, &pa->lru, &pd->lru);
+
+  if (!pd->tried || pd->fd_rw < rw)
     {
       char buf[1024];
       int e;
-      if (a->fd >= 0)
-	close(a->fd);
+      if (pd->fd >= 0)
+	{
+	  close(pd->fd);
+	  pd->fd = -1;
+	}
       e = snprintf(buf, sizeof(buf), "%s/%02x/%02x.%d",
 		   pci_get_param(a, "proc.path"),
 		   d->bus, d->dev, d->func);
       if (e < 0 || e >= (int) sizeof(buf))
 	a->error("File name too long");
-      a->fd_rw = a->writeable || rw;
-      a->fd = open(buf, a->fd_rw ? O_RDWR : O_RDONLY);
-      if (a->fd < 0)
+      pd->fd_rw = a->writeable || rw;
+      pd->fd = open(buf, (pd->fd_rw ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+      if (pd->fd < 0)
 	{
 	  e = snprintf(buf, sizeof(buf), "%s/%04x:%02x/%02x.%d",
 		       pci_get_param(a, "proc.path"),
 		       d->domain, d->bus, d->dev, d->func);
 	  if (e < 0 || e >= (int) sizeof(buf))
 	    a->error("File name too long");
-	  a->fd = open(buf, a->fd_rw ? O_RDWR : O_RDONLY);
+	  pd->fd = open(buf, (pd->fd_rw ? O_RDWR : O_RDONLY) | O_CLOEXEC);
 	}
-      if (a->fd < 0)
+      if (pd->fd < 0)
 	a->warning("Cannot open %s", buf);
-      a->cached_dev = d;
+      else
+	PCI_STAT(a, fd_opens, 1);
+      pd->tried = 1;
     }
-  return a->fd;
+  else
+    PCI_STAT(a, fd_hits, 1);
+  return pd->fd;
 }
 
 static int
@@ -209,11 +272,17 @@ proc_write(struct pci_dev *d, int pos, byte *buf, int len)
 static void
 proc_cleanup_dev(struct pci_dev *d)
 {
-  if (d->access->cached_dev == d)
-    d->access->cached_dev = NULL;
+  struct proc_dev *pd = d->backend_data;
+
+  if (pd)
+    {
+      proc_close_dev(d->access, pd);
+      pci_mfree(pd);
+      d->backend_data = NULL;
+    }
 }
 
-struct pci_methods pm_linux_proc = {
+const struct pci_methods pm_linux_proc = {
   .name = "linux-proc",
   .help = "The proc file system on Linux",
   .config = proc_config,
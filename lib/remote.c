@@ -0,0 +1,659 @@
+/*
+ *	The PCI Library -- Remote Access via pciagent
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "internal.h"
+#include "remote.h"
+
+/*
+ *  The agent is started by running the remote.command through the shell,
+ *  connected by a socket pair to its standard input and output. The whole
+ *  device list is fetched by a single request. Properties and config space
+ *  of a device are fetched when they are first needed; unless remote.prefetch
+ *  is disabled, this fetches them for all devices at once by pipelined
+ *  requests, so listing all devices takes three round-trips in total.
+ *  Replies are kept per device and decoded when the device is filled,
+ *  reads are then served from the local copy of the config space.
+ */
+
+struct remote_dev {
+  int index;
+  struct pci_dev *pdev;			/* Device created by the scan */
+  int domain;
+  byte bus, dev, func;
+  unsigned int fill_flags;		/* Fields requested by the last REMOTE_FILL */
+  struct remote_buf fill;		/* Its reply, data==NULL if not fetched yet */
+  byte *config;				/* Copy of the config space, NULL if not fetched yet */
+  unsigned int config_len;
+};
+
+struct remote_access {
+  int fd;
+  pid_t pid;
+  int prefetch;
+  struct remote_dev *devs;
+  int num_devs;
+  struct remote_buf out, in;
+  unsigned int num_requests;
+};
+
+static void
+remote_config(struct pci_access *a)
+{
+  pci_define_param(a, "remote.command", "", "Command starting pciagent on the remote host (e.g., \"ssh <host> pciagent\")");
+  pci_define_param(a, "remote.prefetch", "1", "Fetch properties and config space of all devices at once");
+}
+
+static int
+remote_detect(struct pci_access *a)
+{
+  char *cmd = pci_get_param(a, "remote.command");
+
+  if (!cmd || !cmd[0])
+    {
+      a->debug("remote.command not set\n");
+      return 0;
+    }
+  return 1;
+}
+
+/*** Sending and receiving of messages ***/
+
+static void
+remote_reserve(struct pci_access *a, struct remote_buf *b, unsigned int n)
+{
+  if (b->len + n > b->max)
+    {
+      while (b->len + n > b->max)
+	b->max = b->max ? 2*b->max : 4096;
+      b->data = pci_realloc(a, b->data, b->max);
+    }
+}
+
+static void
+remote_put(struct pci_access *a, u64 x, unsigned int n)
+{
+  struct remote_access *ra = a->backend_data;
+
+  remote_reserve(a, &ra->out, n);
+  remote_store(ra->out.data + ra->out.len, x, n);
+  ra->out.len += n;
+}
+
+static unsigned int
+remote_begin(struct pci_access *a, int op)
+{
+  struct remote_access *ra = a->backend_data;
+  unsigned int start = ra->out.len;
+
+  remote_put(a, (u32) op << 24, 4);
+  ra->num_requests++;
+  return start;
+}
+
+static void
+remote_end(struct pci_access *a, unsigned int start)
+{
+  struct remote_access *ra = a->backend_data;
+  byte *hdr = ra->out.data + start;
+
+  remote_store(hdr, (remote_get_u32(hdr) & 0xff000000) | (ra->out.len - start - 4), 4);
+}
+
+typedef void remote_handler(struct pci_access *a, void *data, unsigned int seq, int status, struct remote_buf *reply);
+
+/*
+ *  Send all queued requests and call the handler for each reply. Writing and
+ *  reading are interleaved, so that the agent never blocks on a full socket
+ *  while we are still sending.
+ */
+static void
+remote_transact(struct pci_access *a, remote_handler *handler, void *data)
+{
+  struct remote_access *ra = a->backend_data;
+  unsigned int sent = 0, seq = 0;
+  struct pollfd pfd;
+  ssize_t n;
+
+  while (sent < ra->out.len || seq < ra->num_requests)
+    {
+      pfd.fd = ra->fd;
+      pfd.events = POLLIN | ((sent < ra->out.len) ? POLLOUT : 0);
+      if (poll(&pfd, 1, -1) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  a->error("remote: poll: %s", strerror(errno));
+	}
+      if (pfd.revents & POLLOUT)
+	{
+	  n = send(ra->fd, ra->out.data + sent, ra->out.len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+	  if (n < 0 && errno != EAGAIN && errno != EINTR)
+	    a->error("remote: Error sending to the agent: %s", strerror(errno));
+	  if (n > 0)
+	    sent += n;
+	}
+      if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+	{
+	  remote_reserve(a, &ra->in, 65536);
+	  n = recv(ra->fd, ra->in.data + ra->in.len, ra->in.max - ra->in.len, MSG_DONTWAIT);
+	  if (!n)
+	    a->error("remote: Connection to the agent closed");
+	  if (n < 0 && errno != EAGAIN && errno != EINTR)
+	    a->error("remote: Error receiving from the agent: %s", strerror(errno));
+	  if (n > 0)
+	    ra->in.len += n;
+
+	  /* Process all complete replies */
+	  while (ra->in.len - ra->in.pos >= 4)
+	    {
+	      u32 hdr = remote_get_u32(ra->in.data + ra->in.pos);
+	      unsigned int len = hdr & REMOTE_MAX_PAYLOAD;
+	      struct remote_buf reply;
+	      if (ra->in.len - ra->in.pos - 4 < len)
+		break;
+	      if (seq >= ra->num_requests)
+		a->error("remote: Unexpected reply from the agent");
+	      memset(&reply, 0, sizeof(reply));
+	      reply.data = ra->in.data + ra->in.pos + 4;
+	      reply.len = len;
+	      handler(a, data, seq++, hdr >> 24, &reply);
+	      ra->in.pos += 4 + len;
+	    }
+	  memmove(ra->in.data, ra->in.data + ra->in.pos, ra->in.len - ra->in.pos);
+	  ra->in.len -= ra->in.pos;
+	  ra->in.pos = 0;
+	}
+    }
+  ra->out.len = 0;
+  ra->num_requests = 0;
+}
+
+/*** Start and stop ***/
+
+static void
+remote_hello_reply(struct pci_access *a, void *data UNUSED, unsigned int seq UNUSED, int status, struct remote_buf *reply)
+{
+  u32 magic = remote_get_int(reply, 4);
+  u32 version = remote_get_int(reply, 4);
+
+  if (status != REMOTE_OK || reply->error || magic != REMOTE_MAGIC)
+    a->error("remote: The agent does not speak our protocol");
+  if (version != REMOTE_VERSION)
+    a->error("remote: Unsupported protocol version %u of the agent", version);
+}
+
+static void
+remote_init(struct pci_access *a)
+{
+  char *cmd = pci_get_param(a, "remote.command");
+  char *prefetch = pci_get_param(a, "remote.prefetch");
+  struct remote_access *ra;
+  unsigned int start;
+  int sv[2];
+  pid_t pid;
+
+  if (!cmd || !cmd[0])
+    a->error("remote: remote.command not set");
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    a->error("remote: Cannot create a socket pair: %s", strerror(errno));
+  a->debug("remote: starting %s\n", cmd);
+  pid = fork();
+  if (pid < 0)
+    a->error("remote: Cannot fork: %s", strerror(errno));
+  if (!pid)
+    {
+      close(sv[0]);
+      if (dup2(sv[1], 0) < 0 || dup2(sv[1], 1) < 0)
+	_exit(127);
+      close(sv[1]);
+      execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+      _exit(127);
+    }
+  close(sv[1]);
+  fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+
+  ra = pci_malloc(a, sizeof(*ra));
+  memset(ra, 0, sizeof(*ra));
+  ra->fd = sv[0];
+  ra->pid = pid;
+  ra->prefetch = prefetch && atoi(prefetch);
+  a->backend_data = ra;
+
+  start = remote_begin(a, REMOTE_HELLO);
+  remote_put(a, REMOTE_MAGIC, 4);
+  remote_put(a, REMOTE_VERSION, 4);
+  remote_end(a, start);
+  remote_transact(a, remote_hello_reply, NULL);
+}
+
+static void
+remote_cleanup(struct pci_access *a)
+{
+  struct remote_access *ra = a->backend_data;
+  int i;
+
+  if (!ra)
+    return;
+  close(ra->fd);
+  waitpid(ra->pid, NULL, 0);
+  for (i = 0; i < ra->num_devs; i++)
+    {
+      pci_mfree(ra->devs[i].fill.data);
+      pci_mfree(ra->devs[i].config);
+    }
+  pci_mfree(ra->devs);
+  pci_mfree(ra->out.data);
+  pci_mfree(ra->in.data);
+  pci_mfree(ra);
+  a->backend_data = NULL;
+}
+
+/*** Scanning ***/
+
+static void
+remote_scan_reply(struct pci_access *a, void *data UNUSED, unsigned int seq UNUSED, int status, struct remote_buf *reply)
+{
+  struct remote_access *ra = a->backend_data;
+  struct pci_dev *d;
+  int i;
+
+  if (status != REMOTE_OK)
+    a->error("remote: The agent failed to scan the bus");
+  ra->num_devs = reply->len / REMOTE_SCAN_RECORD;
+  ra->devs = pci_malloc(a, (ra->num_devs + 1) * sizeof(struct remote_dev));
+  memset(ra->devs, 0, (ra->num_devs + 1) * sizeof(struct remote_dev));
+  for (i = 0; i < ra->num_devs; i++)
+    {
+      struct remote_dev *rd = &ra->devs[i];
+      rd->index = i;
+      rd->domain = remote_get_int(reply, 4);
+      rd->bus = remote_get_int(reply, 1);
+      rd->dev = remote_get_int(reply, 1);
+      rd->func = remote_get_int(reply, 1);
+      d = pci_alloc_dev(a);
+      d->domain = rd->domain;
+      d->bus = rd->bus;
+      d->dev = rd->dev;
+      d->func = rd->func;
+      d->hdrtype = remote_get_int(reply, 1);
+      d->vendor_id = remote_get_int(reply, 2);
+      d->device_id = remote_get_int(reply, 2);
+      d->known_fields = PCI_FILL_IDENT;
+      d->backend_data = rd;
+      rd->pdev = d;
+      pci_link_dev(a, d);
+    }
+}
+
+static void
+remote_scan(struct pci_access *a)
+{
+  remote_begin(a, REMOTE_SCAN);
+  remote_transact(a, remote_scan_reply, NULL);
+}
+
+/* Devices created by pci_get_dev() are found by their address */
+static struct remote_dev *
+remote_get_dev(struct pci_dev *d)
+{
+  struct remote_access *ra = d->access->backend_data;
+  int i;
+
+  if (d->backend_data)
+    return d->backend_data;
+  for (i = 0; i < ra->num_devs; i++)
+    {
+      struct remote_dev *rd = &ra->devs[i];
+      if (rd->domain == d->domain && rd->bus == d->bus && rd->dev == d->dev && rd->func == d->func)
+	return d->backend_data = rd;
+    }
+  return NULL;
+}
+
+/*** Fetching of properties and config space ***/
+
+struct remote_job {
+  struct remote_dev *rd;
+  int op;
+  unsigned int flags;
+};
+
+static void
+remote_fetch_reply(struct pci_access *a, void *data, unsigned int seq, int status, struct remote_buf *reply)
+{
+  struct remote_job *job = (struct remote_job *) data + seq;
+  struct remote_dev *rd = job->rd;
+
+  if (job->op == REMOTE_FILL)
+    {
+      /* A failed fill is remembered as empty, the device is then filled from its config space */
+      pci_mfree(rd->fill.data);
+      memset(&rd->fill, 0, sizeof(rd->fill));
+      rd->fill.data = pci_malloc(a, reply->len + 1);
+      if (status == REMOTE_OK)
+	{
+	  memcpy(rd->fill.data, reply->data, reply->len);
+	  rd->fill.len = reply->len;
+	}
+      rd->fill_flags = job->flags;
+    }
+  else
+    {
+      rd->config = pci_malloc(a, reply->len + 1);
+      if (status == REMOTE_OK)
+	{
+	  memcpy(rd->config, reply->data, reply->len);
+	  rd->config_len = reply->len;
+	}
+    }
+}
+
+static void
+remote_queue(struct pci_access *a, struct remote_job *job, struct remote_dev *rd, int op, unsigned int flags)
+{
+  unsigned int start = remote_begin(a, op);
+
+  remote_put(a, rd->index, 4);
+  if (op == REMOTE_FILL)
+    remote_put(a, flags, 4);
+  else
+    {
+      remote_put(a, 0, 4);
+      remote_put(a, 4096, 4);
+    }
+  remote_end(a, start);
+  job->rd = rd;
+  job->op = op;
+  job->flags = flags;
+}
+
+/*
+ *  Fetch the given fields and/or the config space of the device rd, with
+ *  prefetching also everything missing of all other devices. If rd is NULL,
+ *  only the prefetch is done. The caller holds the back-end lock.
+ */
+static void
+remote_fetch(struct pci_access *a, struct remote_dev *want, unsigned int fill_flags, int config)
+{
+  struct remote_access *ra = a->backend_data;
+  struct remote_job *jobs = pci_malloc(a, (2*ra->num_devs + 1) * sizeof(struct remote_job));
+  int i, n = 0;
+
+  if (ra->prefetch)
+    {
+      for (i = 0; i < ra->num_devs; i++)
+	{
+	  struct remote_dev *rd = &ra->devs[i];
+	  if (!rd->fill.data || (rd == want && (fill_flags & ~rd->fill_flags)))
+	    remote_queue(a, &jobs[n++], rd, REMOTE_FILL, REMOTE_FILL_FIELDS);
+	  if (!rd->config)
+	    remote_queue(a, &jobs[n++], rd, REMOTE_READ, 0);
+	}
+    }
+  else if (want)
+    {
+      if (fill_flags && (!want->fill.data || (fill_flags & ~want->fill_flags)))
+	remote_queue(a, &jobs[n++], want, REMOTE_FILL, fill_flags | want->fill_flags);
+      if (config && !want->config)
+	remote_queue(a, &jobs[n++], want, REMOTE_READ, 0);
+    }
+  if (n)
+    {
+      a->debug("remote: sending %d requests\n", n);
+      remote_transact(a, remote_fetch_reply, jobs);
+    }
+  pci_mfree(jobs);
+}
+
+static void
+remote_set_string(struct pci_dev *d, u32 key, byte *p, unsigned int len)
+{
+  char *val = pci_malloc(d->access, len + 1);
+  char *prop;
+
+  memcpy(val, p, len);
+  val[len] = 0;
+  prop = pci_set_property(d, key, val);
+  if (key == PCI_FILL_PHYS_SLOT)
+    d->phy_slot = prop;
+  else if (key == PCI_FILL_MODULE_ALIAS)
+    d->module_alias = prop;
+  else if (key == PCI_FILL_LABEL)
+    d->label = prop;
+  pci_mfree(val);
+}
+
+/* Decode the reply to REMOTE_FILL, see remote_put_dev() in pciagent.c for the layout */
+static void
+remote_apply_fill(struct pci_dev *d, struct remote_dev *rd)
+{
+  struct remote_access *ra = d->access->backend_data;
+  struct remote_buf b = rd->fill;
+  unsigned int known, new, parent, len;
+  u64 base[6], size[6], flags[6], rom[3], bridge[3][4];
+  int i, j;
+  byte *p;
+
+  if (!b.len)
+    return;
+  b.pos = 0;
+  b.error = 0;
+  known = remote_get_int(&b, 4);
+  new = known & ~d->known_fields;
+
+  if (new & PCI_FILL_IDENT)
+    {
+      d->vendor_id = remote_get_int(&b, 2);
+      d->device_id = remote_get_int(&b, 2);
+    }
+  else
+    remote_get_int(&b, 4);
+  i = remote_get_int(&b, 4);
+  if (new & PCI_FILL_CLASS)
+    d->device_class = i & 0xffff;
+  if (new & PCI_FILL_CLASS_EXT)
+    {
+      d->prog_if = (i >> 16) & 0xff;
+      d->rev_id = i >> 24;
+    }
+  i = remote_get_int(&b, 4);
+  if (new & PCI_FILL_SUBSYS)
+    {
+      d->subsys_vendor_id = i & 0xffff;
+      d->subsys_id = (i >> 16) & 0xffff;
+    }
+  i = remote_get_int(&b, 4);
+  if (new & PCI_FILL_IRQ)
+    d->irq = i;
+  i = remote_get_int(&b, 4);
+  if (new & PCI_FILL_NUMA_NODE)
+    d->numa_node = i;
+  parent = remote_get_int(&b, 4);
+  if (new & PCI_FILL_PARENT)
+    d->parent = (parent < (unsigned int) ra->num_devs) ? ra->devs[parent].pdev : NULL;
+  i = remote_get_int(&b, 4);
+  j = remote_get_int(&b, 4);
+  if (new & PCI_FILL_RCD_LNK)
+    {
+      d->rcd_link_cap = i;
+      d->rcd_link_status = j & 0xffff;
+      d->rcd_link_ctrl = (j >> 16) & 0xffff;
+    }
+
+  for (i = 0; i < 6; i++)
+    {
+      base[i] = remote_get_u64(&b);
+      size[i] = remote_get_u64(&b);
+      flags[i] = remote_get_u64(&b);
+    }
+  for (i = 0; i < 3; i++)
+    rom[i] = remote_get_u64(&b);
+  for (i = 0; i < 4; i++)
+    for (j = 0; j < 3; j++)
+      bridge[j][i] = remote_get_u64(&b);
+  for (i = 0; i < 6; i++)
+    {
+      if (new & PCI_FILL_BASES)
+	d->base_addr[i] = base[i];
+      if (new & PCI_FILL_SIZES)
+	d->size[i] = size[i];
+      if (new & PCI_FILL_IO_FLAGS)
+	d->flags[i] = flags[i];
+    }
+  if (new & PCI_FILL_ROM_BASE)
+    d->rom_base_addr = rom[0];
+  if (new & PCI_FILL_SIZES)
+    d->rom_size = rom[1];
+  if (new & PCI_FILL_IO_FLAGS)
+    d->rom_flags = rom[2];
+  if (new & PCI_FILL_BRIDGE_BASES)
+    for (i = 0; i < 4; i++)
+      {
+	d->bridge_base_addr[i] = bridge[0][i];
+	d->bridge_size[i] = bridge[1][i];
+	d->bridge_flags[i] = bridge[2][i];
+      }
+
+  while (b.pos < b.len && !b.error)
+    {
+      u32 key = remote_get_int(&b, 4);
+      len = remote_get_int(&b, 2);
+      if (remote_get(&b, len, &p) && (new & key))
+	remote_set_string(d, key, p, len);
+    }
+
+  if (b.error)
+    d->access->warning("remote: Malformed properties of device %04x:%02x:%02x.%d", d->domain, d->bus, d->dev, d->func);
+  d->known_fields |= new;
+}
+
+static void
+remote_fill_info(struct pci_dev *d, unsigned int flags)
+{
+  struct pci_access *a = d->access;
+  unsigned int want = flags & REMOTE_FILL_FIELDS & ~d->known_fields;
+  struct remote_dev *rd;
+
+  if (want)
+    {
+      pci_lock(a, PCI_LOCK_BACKEND);
+      if (rd = remote_get_dev(d))
+	{
+	  if (!rd->fill.data || (want & ~rd->fill_flags))
+	    remote_fetch(a, rd, want, 0);
+	  remote_apply_fill(d, rd);
+	}
+      pci_unlock(a, PCI_LOCK_BACKEND);
+    }
+  pci_generic_fill_info(d, flags);
+}
+
+static void
+remote_fill_info_batch(struct pci_access *a, unsigned int flags UNUSED)
+{
+  struct remote_access *ra = a->backend_data;
+
+  if (!ra->prefetch)
+    return;
+  pci_lock(a, PCI_LOCK_BACKEND);
+  remote_fetch(a, NULL, 0, 0);
+  pci_unlock(a, PCI_LOCK_BACKEND);
+}
+
+/*** Config space access ***/
+
+static int
+remote_read(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  struct pci_access *a = d->access;
+  struct remote_dev *rd;
+  int ok = 0;
+
+  pci_lock(a, PCI_LOCK_BACKEND);
+  if (rd = remote_get_dev(d))
+    {
+      if (!rd->config)
+	remote_fetch(a, rd, 0, 1);
+      if (pos >= 0 && (unsigned int) (pos + len) <= rd->config_len)
+	{
+	  memcpy(buf, rd->config + pos, len);
+	  ok = 1;
+	}
+    }
+  pci_unlock(a, PCI_LOCK_BACKEND);
+  return ok;
+}
+
+static void
+remote_write_reply(struct pci_access *a UNUSED, void *data, unsigned int seq UNUSED, int status, struct remote_buf *reply UNUSED)
+{
+  *(int *) data = (status == REMOTE_OK);
+}
+
+static int
+remote_write(struct pci_dev *d, int pos, byte *buf, int len)
+{
+  struct pci_access *a = d->access;
+  struct remote_access *ra = a->backend_data;
+  struct remote_dev *rd;
+  unsigned int start;
+  int ok = 0;
+
+  pci_lock(a, PCI_LOCK_BACKEND);
+  if (rd = remote_get_dev(d))
+    {
+      start = remote_begin(a, REMOTE_WRITE);
+      remote_put(a, rd->index, 4);
+      remote_put(a, pos, 4);
+      remote_reserve(a, &ra->out, len);
+      memcpy(ra->out.data + ra->out.len, buf, len);
+      ra->out.len += len;
+      remote_end(a, start);
+      remote_transact(a, remote_write_reply, &ok);
+      /* Registers do not always read back what was written, so fetch the config space again */
+      if (ok && rd->config)
+	{
+	  pci_mfree(rd->config);
+	  rd->config = NULL;
+	  rd->config_len = 0;
+	}
+    }
+  pci_unlock(a, PCI_LOCK_BACKEND);
+  return ok;
+}
+
+static void
+remote_cleanup_dev(struct pci_dev *d)
+{
+  d->backend_data = NULL;
+}
+
+const struct pci_methods pm_remote = {
+  .name = "remote",
+  .help = "Access to a remote host via pciagent",
+  .config = remote_config,
+  .detect = remote_detect,
+  .init = remote_init,
+  .cleanup = remote_cleanup,
+  .scan = remote_scan,
+  .fill_info = remote_fill_info,
+  .read = remote_read,
+  .write = remote_write,
+  .cleanup_dev = remote_cleanup_dev,
+  .fill_info_batch = remote_fill_info_batch,
+};
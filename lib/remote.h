@@ -0,0 +1,108 @@
+/*
+ *	The PCI Library -- Protocol of the Remote Access Method
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*
+ *  The remote method talks to pciagent(8) over a pair of pipes, usually
+ *  through ssh. Every message starts with a little-endian 32-bit word
+ *  holding the operation (in requests) or the status (in replies) in the
+ *  top 8 bits and the length of the payload in bytes in the remaining 24 bits.
+ *  The agent processes requests in order and sends exactly one reply to each,
+ *  so the client can send many requests before reading the replies.
+ *
+ *  All numbers in payloads are little-endian. Devices are referred to by
+ *  their index in the list returned by REMOTE_SCAN.
+ */
+
+#define REMOTE_MAGIC		0x52494350	/* "PCIR" */
+#define REMOTE_VERSION		1
+#define REMOTE_MAX_PAYLOAD	0xffffff
+
+enum remote_op {
+  REMOTE_HELLO = 1,	/* u32 magic, u32 version -> the same */
+  REMOTE_SCAN,		/* -> per device: u32 domain, u8 bus, dev, func, hdrtype, u16 vendor, device */
+  REMOTE_FILL,		/* u32 index, u32 flags -> see remote_put_dev() in pciagent.c */
+  REMOTE_READ,		/* u32 index, u32 pos, u32 len -> data, possibly shorter */
+  REMOTE_WRITE,		/* u32 index, u32 pos, data -> nothing */
+};
+
+#define REMOTE_OK		0
+#define REMOTE_ERROR		1
+
+#define REMOTE_SCAN_RECORD	12
+
+/* Fields which are filled by the agent, the rest is derived from the config space */
+#define REMOTE_FILL_FIELDS (PCI_FILL_IDENT | PCI_FILL_IRQ | PCI_FILL_BASES | PCI_FILL_ROM_BASE | PCI_FILL_SIZES | \
+	PCI_FILL_CLASS | PCI_FILL_PHYS_SLOT | PCI_FILL_MODULE_ALIAS | PCI_FILL_LABEL | PCI_FILL_NUMA_NODE | \
+	PCI_FILL_IO_FLAGS | PCI_FILL_DT_NODE | PCI_FILL_IOMMU_GROUP | PCI_FILL_BRIDGE_BASES | PCI_FILL_CLASS_EXT | \
+	PCI_FILL_SUBSYS | PCI_FILL_PARENT | PCI_FILL_DRIVER | PCI_FILL_RCD_LNK)
+
+/* String properties sent by the agent */
+static const u32 remote_string_props[] = {
+  PCI_FILL_PHYS_SLOT, PCI_FILL_MODULE_ALIAS, PCI_FILL_LABEL, PCI_FILL_DT_NODE,
+  PCI_FILL_IOMMU_GROUP, PCI_FILL_DRIVER, 0
+};
+
+/* Building and parsing of messages */
+
+struct remote_buf {
+  byte *data;
+  unsigned int len, max;			/* Used and allocated size of data */
+  unsigned int pos;			/* Position of parsing */
+  int error;				/* Parsing ran past the end */
+};
+
+/* Store n bytes of x at p, the caller makes sure that there is enough space */
+static inline void
+remote_store(byte *p, u64 x, unsigned int n)
+{
+  while (n--)
+    {
+      *p++ = x;
+      x >>= 8;
+    }
+}
+
+static inline u32
+remote_get_u32(byte *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32) p[3] << 24);
+}
+
+static inline unsigned int
+remote_get(struct remote_buf *b, unsigned int n, byte **p)
+{
+  if (b->pos + n > b->len)
+    {
+      b->error = 1;
+      b->pos = b->len;
+      return 0;
+    }
+  *p = b->data + b->pos;
+  b->pos += n;
+  return 1;
+}
+
+static inline u32
+remote_get_int(struct remote_buf *b, unsigned int n)
+{
+  byte *p;
+  u32 x = 0;
+
+  if (!remote_get(b, n, &p))
+    return 0;
+  while (n--)
+    x = (x << 8) | p[n];
+  return x;
+}
+
+static inline u64
+remote_get_u64(struct remote_buf *b)
+{
+  u64 lo = remote_get_int(b, 4);
+  return lo | ((u64) remote_get_int(b, 4) << 32);
+}
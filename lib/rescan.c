@@ -0,0 +1,211 @@
+/*
+ *	The PCI Library -- Incremental Rescanning of Devices
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/*
+ *  Both pci_rescan() and pci_monitor_process() keep the pci_dev structures
+ *  of devices which are still present, so all information filled in and
+ *  cached for them survives. Removed devices are passed to the callback
+ *  before they are freed, added devices after they are linked.
+ */
+
+static void
+rescan_forget(struct pci_access *a, struct pci_dev *d)
+{
+  struct pci_dev *e;
+
+  /* Other devices must not refer to the removed one */
+  for (e = a->devices; e; e = e->next)
+    if (e->parent == d)
+      {
+	e->parent = NULL;
+	clear_fill(e, PCI_FILL_PARENT);
+      }
+  pci_forget_vf_family(d);
+}
+
+static void
+rescan_remove(struct pci_access *a, struct pci_dev *d, pci_rescan_callback *cb, void *data)
+{
+  struct pci_dev **pp;
+
+  for (pp = &a->devices; *pp; pp = &(*pp)->next)
+    if (*pp == d)
+      {
+	*pp = d->next;
+	break;
+      }
+  if (cb)
+    cb(d, PCI_RESCAN_REMOVED, data);
+  rescan_forget(a, d);
+  pci_free_dev(d);
+}
+
+static int
+rescan_cmp(const void *A, const void *B)
+{
+  const struct pci_dev *a = *(const struct pci_dev **) A, *b = *(const struct pci_dev **) B;
+
+  if (a->domain != b->domain)
+    return (a->domain < b->domain) ? -1 : 1;
+  if (a->bus != b->bus)
+    return (a->bus < b->bus) ? -1 : 1;
+  if (a->dev != b->dev)
+    return (a->dev < b->dev) ? -1 : 1;
+  if (a->func != b->func)
+    return (a->func < b->func) ? -1 : 1;
+  return 0;
+}
+
+int
+pci_rescan(struct pci_access *a, pci_rescan_callback *cb, void *data)
+{
+  struct pci_dev *old = a->devices, *removed = NULL, *copies = NULL;
+  struct pci_dev *d, *e, **last, **sorted, **repl, **added;
+  int n, i, num_added, changes = 0;
+
+  /* Scan the bus to a new list */
+  a->devices = NULL;
+  pci_scan_bus(a);
+  n = 0;
+  for (d = a->devices; d; d = d->next)
+    n++;
+
+  /* Find which new devices correspond to the old ones */
+  sorted = pci_malloc(a, (n + 1) * sizeof(struct pci_dev *));
+  repl = pci_malloc(a, (n + 1) * sizeof(struct pci_dev *));
+  memset(repl, 0, (n + 1) * sizeof(struct pci_dev *));
+  added = pci_malloc(a, (n + 1) * sizeof(struct pci_dev *));
+  for (d = a->devices, i = 0; d; d = d->next, i++)
+    sorted[i] = d;
+  qsort(sorted, n, sizeof(struct pci_dev *), rescan_cmp);
+  for (d = old; d; d = e)
+    {
+      struct pci_dev **s = bsearch(&d, sorted, n, sizeof(struct pci_dev *), rescan_cmp);
+      e = d->next;
+      if (s && !repl[s - sorted])
+	repl[s - sorted] = d;
+      else
+	{
+	  d->next = removed;
+	  removed = d;
+	}
+    }
+
+  /* Build the new list in the order of the scan, keeping the old structures */
+  d = a->devices;
+  a->devices = NULL;
+  last = &a->devices;
+  num_added = 0;
+  for (; d; d = e)
+    {
+      struct pci_dev **s = bsearch(&d, sorted, n, sizeof(struct pci_dev *), rescan_cmp);
+      struct pci_dev *o = repl[s - sorted];
+      e = d->next;
+      if (o)
+	{
+	  d->next = copies;
+	  copies = d;
+	  d = o;
+	}
+      else
+	added[num_added++] = d;
+      *last = d;
+      last = &d->next;
+    }
+  *last = NULL;
+
+  while (d = copies)
+    {
+      copies = d->next;
+      pci_free_dev(d);
+    }
+  while (d = removed)
+    {
+      removed = d->next;
+      if (cb)
+	cb(d, PCI_RESCAN_REMOVED, data);
+      rescan_forget(a, d);
+      pci_free_dev(d);
+      changes++;
+    }
+  for (i=0; i<num_added; i++)
+    {
+      if (cb)
+	cb(added[i], PCI_RESCAN_ADDED, data);
+      changes++;
+    }
+
+  a->debug("Rescan: %d devices, %d changes\n", n, changes);
+  pci_mfree(added);
+  pci_mfree(repl);
+  pci_mfree(sorted);
+  return changes;
+}
+
+int
+pci_monitor_fd(struct pci_access *a)
+{
+  if (!a->methods->monitor_open)
+    return -1;
+  return a->methods->monitor_open(a);
+}
+
+int
+pci_monitor_process(struct pci_access *a, pci_rescan_callback *cb, void *data)
+{
+  struct pci_monitor_event ev;
+  struct pci_dev *d;
+  int changes = 0;
+
+  if (!a->methods->monitor_read)
+    return 0;
+
+  while (a->methods->monitor_read(a, &ev))
+    {
+      d = pci_find_dev(a, ev.domain, ev.bus, ev.dev, ev.func);
+      switch (ev.action)
+	{
+	case PCI_RESCAN_ADDED:
+	  if (d)
+	    {
+	      /* We have missed its removal, so the old structure describes a different device */
+	      rescan_remove(a, d, cb, data);
+	      changes++;
+	    }
+	  d = pci_get_dev(a, ev.domain, ev.bus, ev.dev, ev.func);
+	  pci_link_dev(a, d);
+	  if (cb)
+	    cb(d, PCI_RESCAN_ADDED, data);
+	  changes++;
+	  break;
+	case PCI_RESCAN_REMOVED:
+	  if (d)
+	    {
+	      rescan_remove(a, d, cb, data);
+	      changes++;
+	    }
+	  break;
+	case PCI_RESCAN_CHANGED:
+	  if (d)
+	    {
+	      pci_set_property(d, PCI_FILL_DRIVER, NULL);
+	      clear_fill(d, PCI_FILL_DRIVER);
+	      if (cb)
+		cb(d, PCI_RESCAN_CHANGED, data);
+	      changes++;
+	    }
+	  break;
+	}
+    }
+  return changes;
+}
@@ -0,0 +1,74 @@
+/*
+ *	The PCI Library -- Statistics of Operations
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "internal.h"
+
+/*
+ *  When statistics are disabled (the default), a->stats is NULL and every
+ *  hook costs a single test. Counters are updated atomically, because back-ends
+ *  and applications may access devices from multiple threads.
+ */
+
+void
+pci_enable_stats(struct pci_access *a, int enable)
+{
+  if (enable)
+    {
+      if (!a->stats)
+	a->stats = pci_malloc(a, sizeof(struct pci_stats));
+      memset(a->stats, 0, sizeof(struct pci_stats));
+    }
+  else
+    pci_free_stats(a);
+}
+
+struct pci_stats *
+pci_get_stats(struct pci_access *a)
+{
+  return a->stats;
+}
+
+void
+pci_free_stats(struct pci_access *a)
+{
+  pci_mfree(a->stats);
+  a->stats = NULL;
+}
+
+u64
+pci_stats_start(void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+    return (u64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+  return 0;
+}
+
+void
+pci_stats_end(struct pci_access *a, int op, u64 start, int bytes, int ok)
+{
+  struct pci_op_stats *s = &a->stats->ops[op];
+  u64 ns = pci_stats_start() - start;
+  int bucket = 0;
+
+  while (bucket < PCI_STATS_BUCKETS - 1 && (ns >> (bucket + 1)))
+    bucket++;
+  pci_stat_add(&s->calls, 1);
+  if (!ok)
+    pci_stat_add(&s->failed, 1);
+  if (ok && bytes > 0)
+    pci_stat_add(&s->bytes, bytes);
+  pci_stat_add(&s->ns, ns);
+  pci_stat_add(&s->histogram[bucket], 1);
+}
@@ -143,7 +143,7 @@ sylixos_write(struct pci_dev *d, int pos, byte *buf, int len)
   return 1;
 }
 
-struct pci_methods pm_sylixos_device = {
+const struct pci_methods pm_sylixos_device = {
   .name = "sylixos-device",
   .help = "SylixOS /proc/pci device",
   .config = sylixos_config,
@@ -19,15 +19,25 @@
 #include <errno.h>
 #include <dirent.h>
 #include <fcntl.h>
-#include <libgen.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
 
 #include "internal.h"
+#include "fd-lru.h"
+#include "uring.h"
 
 static void
 sysfs_config(struct pci_access *a)
 {
   pci_define_param(a, "sysfs.path", PCI_PATH_SYS_BUS_PCI, "Path to the sysfs device tree");
+  pci_define_param(a, "sysfs.threads", "1", "Number of threads used by pci_fill_info_batch()");
+  pci_define_param(a, "sysfs.fd_cache", "16", "Number of devices whose config and VPD files are kept open");
+#ifdef PCI_HAVE_LINUX_IO_URING
+  pci_define_param(a, "sysfs.io_uring", "1", "Use io_uring for batched reads if supported by the kernel");
+#endif
 }
 
 static inline char *
@@ -48,33 +58,135 @@ sysfs_detect(struct pci_access *a)
   return 1;
 }
 
+/*
+ *  We keep the directories and the config space and VPD files of recently
+ *  used devices open in an LRU list (see fd-lru.h), whose length is limited
+ *  by the sysfs.fd_cache parameter.
+ *
+ *  With thread safety enabled, multiple threads can read at once: the list
+ *  and opening of files are protected by the back-end lock and every user of
+ *  the descriptors holds a reference, so that they are not closed under its
+ *  hands. Devices in use are skipped when choosing which ones to close.
+ */
+
+struct sysfs_dev {
+  struct pci_fd_lru_entry lru;		/* Must be first; lru.users counts references from sysfs_setup() */
+  int fd;				/* fd for config space */
+  int fd_rw;				/* fd opened read-write */
+  int fd_vpd;				/* fd for VPD */
+  int fd_dir;				/* O_PATH fd for the device's directory */
+  int fd_old;				/* Read-only fd replaced by a read-write one while in use */
+  char *link;				/* Target of the device's symlink, see sysfs_dev_link() */
+};
+
+struct sysfs_access {
+  struct pci_fd_lru lru;
+#ifdef PCI_HAVE_LINUX_IO_URING
+  struct pci_uring *uring;			/* Used by pci_read_multi() */
+  int uring_state;				/* 0=not tried yet, 1=available, -1=unavailable */
+#endif
+  int uevent_fd;				/* Netlink socket receiving kernel uevents, see pci_monitor_fd() */
+};
+
+static void sysfs_evict_dev(struct pci_access *a, struct pci_fd_lru_entry *e);
+
 static void
 sysfs_init(struct pci_access *a)
 {
-  a->fd = -1;
-  a->fd_vpd = -1;
+  struct sysfs_access *sa = pci_malloc(a, sizeof(*sa));
+
+  memset(sa, 0, sizeof(*sa));
+  sa->uevent_fd = -1;
+  pci_fd_lru_init(&sa->lru, atoi(pci_get_param(a, "sysfs.fd_cache")), sysfs_evict_dev);
+  a->backend_data = sa;
 }
 
 static void
-sysfs_flush_cache(struct pci_access *a)
+sysfs_close_dev(struct pci_access *a, struct sysfs_dev *sd)
 {
-  if (a->fd >= 0)
+  struct sysfs_access *sa = a->backend_data;
+
+  if (sd->fd >= 0)
+    {
+      close(sd->fd);
+      sd->fd = -1;
+    }
+  if (sd->fd_vpd >= 0)
     {
-      close(a->fd);
-      a->fd = -1;
+      close(sd->fd_vpd);
+      sd->fd_vpd = -1;
     }
-  if (a->fd_vpd >= 0)
+  if (sd->fd_dir >= 0)
     {
-      close(a->fd_vpd);
-      a->fd_vpd = -1;
+      close(sd->fd_dir);
+      sd->fd_dir = -1;
     }
-  a->cached_dev = NULL;
+  if (sd->fd_old >= 0)
+    {
+      close(sd->fd_old);
+      sd->fd_old = -1;
+    }
+  pci_fd_lru_remove(&sa->lru, &sd->lru);
+}
+
+static void
+sysfs_evict_dev(struct pci_access *a, struct pci_fd_lru_entry *e)
+{
+  sysfs_close_dev(a, (struct sysfs_dev *) e);
 }
 
 static void
 sysfs_cleanup(struct pci_access *a)
 {
-  sysfs_flush_cache(a);
+  struct sysfs_access *sa = a->backend_data;
+
+  pci_fd_lru_evict_all(a, &sa->lru);
+#ifdef PCI_HAVE_LINUX_IO_URING
+  if (sa->uring)
+    pci_uring_close(sa->uring);
+#endif
+  if (sa->uevent_fd >= 0)
+    close(sa->uevent_fd);
+  pci_mfree(sa);
+  a->backend_data = NULL;
+}
+
+/* The caller must hold the back-end lock */
+static struct sysfs_dev *
+sysfs_dev_data(struct pci_dev *d)
+{
+  struct sysfs_dev *sd = d->backend_data;
+
+  if (!sd)
+    {
+      sd = pci_malloc(d->access, sizeof(*sd));
+      memset(sd, 0, sizeof(*sd));
+      sd->fd = sd->fd_vpd = sd->fd_dir = sd->fd_old = -1;
+      d->backend_data = sd;
+    }
+  return sd;
+}
+
+/* The caller must hold the back-end lock */
+static struct sysfs_dev *
+sysfs_get_dev(struct pci_dev *d)
+{
+  struct pci_access *a = d->access;
+  struct sysfs_access *sa = a->backend_data;
+  struct sysfs_dev *sd = sysfs_dev_data(d);
+
+  pci_fd_lru_use(a, &sa->lru, &sd->lru);
+  return sd;
+}
+
+static void
+sysfs_put_dev(struct pci_dev *d)
+{
+  struct sysfs_dev *sd = d->backend_data;
+
+  pci_lock(d->access, PCI_LOCK_BACKEND);
+  sd->lru.users--;
+  pci_unlock(d->access, PCI_LOCK_BACKEND);
 }
 
 #define OBJNAMELEN 1024
@@ -89,48 +201,83 @@ sysfs_obj_name(struct pci_dev *d, char *object, char *buf)
 
 #define OBJBUFSIZE 1024
 
+/*
+ *  Attributes are opened relative to a descriptor of the device's directory,
+ *  which is opened when the first attribute is needed. It is cached in the
+ *  sysfs_dev, except for worker threads, which keep their own one during
+ *  sysfs_fill_attrs(). This saves the kernel from walking the whole path
+ *  for every attribute. File names are built only for error messages.
+ */
+
+static int
+sysfs_dir(struct pci_dev *d, int *dir)
+{
+  char namebuf[OBJNAMELEN];
+
+  if (*dir < 0)
+    {
+      sysfs_obj_name(d, "", namebuf);
+      *dir = open(namebuf, O_PATH | O_DIRECTORY | O_CLOEXEC);
+      if (*dir >= 0)
+	PCI_STAT(d->access, fd_opens, 1);
+    }
+  else
+    PCI_STAT(d->access, fd_hits, 1);
+  return *dir;
+}
+
 static int
-sysfs_get_string(struct pci_dev *d, char *object, char *buf, int mandatory)
+sysfs_read_attr(struct pci_dev *d, int *dir, char *object, char *buf, int size, int mandatory)
 {
   struct pci_access *a = d->access;
-  int fd, n;
+  int fd, n, err;
   char namebuf[OBJNAMELEN];
   void (*warn)(char *msg, ...) = (mandatory ? a->error : a->warning);
 
-  sysfs_obj_name(d, object, namebuf);
-  fd = open(namebuf, O_RDONLY);
-  if (fd < 0)
+  if (sysfs_dir(d, dir) < 0 || (fd = openat(*dir, object, O_RDONLY | O_CLOEXEC)) < 0)
     {
       if (mandatory || errno != ENOENT)
-	warn("Cannot open %s: %s", namebuf, strerror(errno));
-      return 0;
+	{
+	  err = errno;
+	  sysfs_obj_name(d, object, namebuf);
+	  warn("Cannot open %s: %s", namebuf, strerror(err));
+	}
+      return -1;
     }
-  n = read(fd, buf, OBJBUFSIZE);
-  int read_errno = errno;
+
+  /* Attributes are generated at once, so a single read() gets all of them */
+  n = read(fd, buf, size);
+  err = errno;
   close(fd);
   if (n < 0)
     {
-      warn("Error reading %s: %s", namebuf, strerror(read_errno));
-      return 0;
+      sysfs_obj_name(d, object, namebuf);
+      warn("Error reading %s: %s", namebuf, strerror(err));
+      return -1;
     }
-  if (n >= OBJBUFSIZE)
+  if (n >= size)
     {
+      sysfs_obj_name(d, object, namebuf);
       warn("Value in %s too long", namebuf);
-      return 0;
+      return -1;
     }
   buf[n] = 0;
-  return 1;
+  return n;
+}
+
+static int
+sysfs_get_string(struct pci_dev *d, int *dir, char *object, char *buf, int mandatory)
+{
+  return sysfs_read_attr(d, dir, object, buf, OBJBUFSIZE, mandatory) >= 0;
 }
 
 static char *
-sysfs_deref_link(struct pci_dev *d, char *link_name)
+sysfs_deref_link(struct pci_dev *d, int *dir, char *link_name)
 {
   char path[2*OBJNAMELEN], rel_path[OBJNAMELEN];
 
-  sysfs_obj_name(d, link_name, path);
   memset(rel_path, 0, sizeof(rel_path));
-
-  if (readlink(path, rel_path, sizeof(rel_path)) < 0)
+  if (sysfs_dir(d, dir) < 0 || readlinkat(*dir, link_name, rel_path, sizeof(rel_path) - 1) < 0)
     return NULL;
 
   sysfs_obj_name(d, "", path);
@@ -140,39 +287,180 @@ sysfs_deref_link(struct pci_dev *d, char *link_name)
   return realpath(path, NULL);
 }
 
+/* Returns the last component of the target of a symlink, e.g., the name of the driver */
+static int
+sysfs_link_name(struct pci_dev *d, int *dir, char *link_name, char *buf)
+{
+  char *name;
+  int n;
+
+  if (sysfs_dir(d, dir) < 0 || (n = readlinkat(*dir, link_name, buf, OBJNAMELEN - 1)) <= 0)
+    return 0;
+  buf[n] = 0;
+  while (n > 1 && buf[n-1] == '/')
+    buf[--n] = 0;
+  name = strrchr(buf, '/');
+  if (name)
+    memmove(buf, name+1, strlen(name));
+  return buf[0] != 0;
+}
+
+/*
+ *  Entries of the devices directory are symlinks to the directories of the
+ *  devices in the device hierarchy, e.g. "../../../devices/pci0000:00/0000:00:1c.0/0000:02:00.0",
+ *  so the parent of a device is named by the last but one component of its link.
+ *  The link is read once per device and kept as long as the device exists.
+ *  If the entry is not a symlink, its canonical path is used instead.
+ *  A copy of the link is stored to buf of OBJNAMELEN bytes under the back-end
+ *  lock, since the kept link can be freed when the device is reset. Returns
+ *  NULL if no link is available or if it does not fit in the buffer.
+ */
+static char *
+sysfs_dev_link(struct pci_dev *d, char *buf)
+{
+  struct pci_access *a = d->access;
+  struct sysfs_dev *sd;
+
+  pci_lock(a, PCI_LOCK_BACKEND);
+  sd = sysfs_dev_data(d);
+  if (!sd->link)
+    {
+      char name[OBJNAMELEN];
+      char *abs;
+      int n = snprintf(name, sizeof(name), "%s/devices/%04x:%02x:%02x.%d",
+		       sysfs_name(a), d->domain, d->bus, d->dev, d->func);
+
+      if (n < 0 || n >= (int) sizeof(name))
+	a->error("File name too long");
+      /* If readlink() fills the whole buffer, the link was truncated */
+      if ((n = readlink(name, buf, OBJNAMELEN)) > 0 && n < OBJNAMELEN)
+	{
+	  buf[n] = 0;
+	  sd->link = pci_strdup(a, buf);
+	}
+      else if (n <= 0 && (abs = realpath(name, NULL)))
+	{
+	  sd->link = pci_strdup(a, (strlen(abs) < OBJNAMELEN) ? abs : "");
+	  free(abs);
+	}
+      else
+	sd->link = pci_strdup(a, "");
+    }
+  strcpy(buf, sd->link);
+  pci_unlock(a, PCI_LOCK_BACKEND);
+  return buf[0] ? buf : NULL;
+}
+
+static void
+sysfs_fill_parent(struct pci_dev *d, int may_probe)
+{
+  struct pci_access *a = d->access;
+  unsigned int domain, bus, dev, func;
+  struct pci_dev *parent = NULL;
+  char link_buf[OBJNAMELEN], parent_buf[OBJNAMELEN];
+  char *link, *last, *name;
+
+  link = sysfs_dev_link(d, link_buf);
+
+  last = link ? strrchr(link, '/') : NULL;
+  if (last)
+    {
+      for (name = last; name > link && name[-1] != '/'; name--)
+	;
+      if (sscanf(name, "%x:%x:%x.%d", &domain, &bus, &dev, &func) == 4 && domain <= 0x7fffffff)
+	{
+	  /*
+	   *  If the device was probed alone, its parent might not have been seen yet.
+	   *  Worker threads (!may_probe) must not modify the list of devices.
+	   */
+	  if (may_probe)
+	    parent = pci_probe_dev(a, domain, bus, dev, func);
+	  else
+	    parent = pci_find_dev(a, domain, bus, dev, func);
+	}
+    }
+
+  if (parent)
+    {
+      /* Check that the device with the parsed address is really the parent */
+      char *parent_link = sysfs_dev_link(parent, parent_buf);
+      if (!parent_link || strlen(parent_link) != (size_t)(last - link) || strncmp(parent_link, link, last - link))
+	parent = NULL;
+    }
+
+  if (parent)
+    d->parent = parent;
+  else
+    clear_fill(d, PCI_FILL_PARENT);
+}
+
 static int
-sysfs_get_value(struct pci_dev *d, char *object, int mandatory)
+sysfs_get_value(struct pci_dev *d, int *dir, char *object, int mandatory)
 {
   char buf[OBJBUFSIZE];
 
-  if (sysfs_get_string(d, object, buf, mandatory))
+  if (sysfs_get_string(d, dir, object, buf, mandatory))
     return strtol(buf, NULL, 0);
   else
     return -1;
 }
 
+static int
+sysfs_parse_hex(char **pp, unsigned long long *val)
+{
+  char *p = *pp;
+  unsigned long long x = 0;
+  int digits = 0;
+
+  while (*p == ' ' || *p == '\t')
+    p++;
+  if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+    p += 2;
+  for (;;)
+    {
+      int c = *p;
+      if (c >= '0' && c <= '9')
+	c -= '0';
+      else if (c >= 'a' && c <= 'f')
+	c -= 'a' - 10;
+      else if (c >= 'A' && c <= 'F')
+	c -= 'A' - 10;
+      else
+	break;
+      x = (x << 4) | c;
+      digits++;
+      p++;
+    }
+  *pp = p;
+  *val = x;
+  return digits > 0;
+}
+
 static void
-sysfs_get_resources(struct pci_dev *d)
+sysfs_get_resources(struct pci_dev *d, int *dir)
 {
   struct pci_access *a = d->access;
-  char namebuf[OBJNAMELEN], buf[256];
+  char namebuf[OBJNAMELEN], buf[4096], *p;
   struct { pciaddr_t flags, base_addr, size; } lines[10];
   int have_bar_bases, have_rom_base, have_bridge_bases;
-  FILE *file;
   int i;
 
   have_bar_bases = have_rom_base = have_bridge_bases = 0;
-  sysfs_obj_name(d, "resource", namebuf);
-  file = fopen(namebuf, "r");
-  if (!file)
-    a->error("Cannot open %s: %s", namebuf, strerror(errno));
+  if (sysfs_read_attr(d, dir, "resource", buf, sizeof(buf), 1) < 0)
+    buf[0] = 0;
+  p = buf;
   for (i = 0; i < 7+6+4+1; i++)
     {
       unsigned long long start, end, size, flags;
-      if (!fgets(buf, sizeof(buf), file))
+      if (!*p)
 	break;
-      if (sscanf(buf, "%llx %llx %llx", &start, &end, &flags) != 3)
-	a->error("Syntax error in %s", namebuf);
+      if (!sysfs_parse_hex(&p, &start) || !sysfs_parse_hex(&p, &end) || !sysfs_parse_hex(&p, &flags))
+	{
+	  sysfs_obj_name(d, "resource", namebuf);
+	  a->error("Syntax error in %s", namebuf);
+	}
+      p = strchr(p, '\n');
+      p = p ? p+1 : buf + strlen(buf);
       if (end > start)
 	size = end - start + 1;
       else
@@ -225,7 +513,6 @@ sysfs_get_resources(struct pci_dev *d)
         }
       have_bridge_bases = 1;
     }
-  fclose(file);
   if (!have_bar_bases)
     clear_fill(d, PCI_FILL_BASES | PCI_FILL_SIZES | PCI_FILL_IO_FLAGS);
   if (!have_rom_base)
@@ -234,6 +521,77 @@ sysfs_get_resources(struct pci_dev *d)
     clear_fill(d, PCI_FILL_BRIDGE_BASES);
 }
 
+static int sysfs_get_domains(struct pci_access *a, struct pci_bus_range *ranges, int max)
+{
+  char dirname[1024];
+  DIR *dir;
+  struct dirent *entry;
+  int *domains = NULL;
+  int n = 0, size = 0;
+  unsigned int dom;
+
+  n = snprintf(dirname, sizeof(dirname), "%s/devices", sysfs_name(a));
+  if (n < 0 || n >= (int) sizeof(dirname))
+    a->error("Directory name too long");
+  if (!(dir = opendir(dirname)))
+    return 0;
+  n = 0;
+  while ((entry = readdir(dir)))
+    if (entry->d_name[0] != '.' && sscanf(entry->d_name, "%x:", &dom) == 1 && dom <= 0x7fffffff)
+      {
+	if (n >= size)
+	  {
+	    size = 2*size + 16;
+	    domains = pci_realloc(a, domains, size * sizeof(int));
+	  }
+	domains[n++] = dom;
+      }
+  closedir(dir);
+  n = pci_generic_domains(domains, n, ranges, max);
+  pci_mfree(domains);
+  return n;
+}
+
+/* Test the IDs of a device in the devices directory against the filter of the scan */
+static int
+sysfs_scan_wants_ids(struct pci_access *a, char *name)
+{
+  char path[OBJNAMELEN], buf[OBJBUFSIZE];
+  unsigned int vendor, device, cls;
+  int v = -1, dv = -1, c = -1, p = -1;
+  int fd, n;
+  char *s;
+
+  if (!pci_scan_wants_fill(a))
+    return 1;
+
+  /* A single read of uevent tells both the IDs and the class */
+  n = snprintf(path, sizeof(path), "%s/devices/%s/uevent", sysfs_name(a), name);
+  if (n < 0 || n >= (int) sizeof(path))
+    a->error("File name too long");
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 1;
+  PCI_STAT(a, fd_opens, 1);
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return 1;
+  buf[n] = 0;
+
+  if ((s = strstr(buf, "PCI_ID=")) && sscanf(s + 7, "%x:%x", &vendor, &device) == 2)
+    {
+      v = vendor;
+      dv = device;
+    }
+  if ((s = strstr(buf, "PCI_CLASS=")) && sscanf(s + 10, "%x", &cls) == 1)
+    {
+      c = cls >> 8;
+      p = cls & 0xff;
+    }
+  return pci_scan_wants_ids(a, v, dv, c, p);
+}
+
 static void sysfs_scan(struct pci_access *a)
 {
   char dirname[1024];
@@ -256,7 +614,6 @@ static void sysfs_scan(struct pci_access *a)
       if (entry->d_name[0] == '.')
 	continue;
 
-      d = pci_alloc_dev(a);
       if (sscanf(entry->d_name, "%x:%x:%x.%d", &dom, &bus, &dev, &func) < 4)
 	a->error("sysfs_scan: Couldn't parse entry name %s", entry->d_name);
 
@@ -264,6 +621,10 @@ static void sysfs_scan(struct pci_access *a)
       if (dom > 0x7fffffff)
 	a->error("sysfs_scan: Invalid domain %x", dom);
 
+      if (!pci_scan_wants_addr(a, dom, bus, dev, func) || !sysfs_scan_wants_ids(a, entry->d_name))
+	continue;
+
+      d = pci_alloc_dev(a);
       d->domain = dom;
       d->bus = bus;
       d->dev = dev;
@@ -273,6 +634,18 @@ static void sysfs_scan(struct pci_access *a)
   closedir(dir);
 }
 
+static int
+sysfs_probe_dev(struct pci_dev *d)
+{
+  int ok;
+
+  /* The directory descriptor is kept for reading of the attributes later */
+  pci_lock(d->access, PCI_LOCK_BACKEND);
+  ok = sysfs_dir(d, &sysfs_get_dev(d)->fd_dir) >= 0;
+  pci_unlock(d->access, PCI_LOCK_BACKEND);
+  return ok;
+}
+
 static void
 sysfs_fill_slots(struct pci_access *a)
 {
@@ -292,7 +665,7 @@ sysfs_fill_slots(struct pci_access *a)
     {
       char namebuf[OBJNAMELEN], buf[16];
       FILE *file;
-      unsigned int dom, bus, dev;
+      unsigned int dom, bus, dev, func;
       int res = 0;
       struct pci_dev *d;
 
@@ -324,8 +697,8 @@ sysfs_fill_slots(struct pci_access *a)
 	}
       else
 	{
-	  for (d = a->devices; d; d = d->next)
-	    if (dom == (unsigned)d->domain && bus == d->bus && dev == d->dev && !d->phy_slot)
+	  for (func = 0; func < 8; func++)
+	    if ((d = pci_find_dev(a, dom, bus, dev, func)) && !d->phy_slot)
 	      d->phy_slot = pci_set_property(d, PCI_FILL_PHYS_SLOT, entry->d_name);
 	}
       fclose(file);
@@ -333,11 +706,85 @@ sysfs_fill_slots(struct pci_access *a)
   closedir(dir);
 }
 
+/*
+ *  The uevent attribute tells the IDs, the class, the module alias and the
+ *  driver of a device at once, so a single read replaces up to 8 others.
+ *  Missing keys are left NULL and their fields read from separate attributes;
+ *  only DRIVER is omitted on purpose, if no driver is bound.
+ */
+struct sysfs_uevent {
+  int valid;
+  char *pci_id, *pci_class, *pci_subsys_id, *modalias, *driver;
+  char buf[OBJBUFSIZE];
+};
+
+#define SYSFS_UEVENT_FIELDS (PCI_FILL_IDENT | PCI_FILL_CLASS | PCI_FILL_CLASS_EXT | PCI_FILL_SUBSYS | PCI_FILL_MODULE_ALIAS | PCI_FILL_DRIVER)
+
 static void
-sysfs_fill_info(struct pci_dev *d, unsigned int flags)
+sysfs_read_uevent(struct pci_dev *d, int *dir, struct sysfs_uevent *u)
+{
+  char *line, *next, *val;
+
+  u->valid = (sysfs_read_attr(d, dir, "uevent", u->buf, sizeof(u->buf), 0) >= 0);
+  if (!u->valid)
+    return;
+
+  for (line = u->buf; *line; line = next)
+    {
+      if (next = strchr(line, '\n'))
+	*next++ = 0;
+      else
+	next = line + strlen(line);
+      if (!(val = strchr(line, '=')))
+	continue;
+      *val++ = 0;
+      if (!strcmp(line, "PCI_ID"))
+	u->pci_id = val;
+      else if (!strcmp(line, "PCI_CLASS"))
+	u->pci_class = val;
+      else if (!strcmp(line, "PCI_SUBSYS_ID"))
+	u->pci_subsys_id = val;
+      else if (!strcmp(line, "MODALIAS"))
+	u->modalias = val;
+      else if (!strcmp(line, "DRIVER"))
+	u->driver = val;
+    }
+}
+
+/* Parse "xxxx:yyyy" from uevent */
+static int
+sysfs_uevent_pair(char *val, u16 *x, u16 *y)
+{
+  char *end;
+
+  if (!val)
+    return 0;
+  *x = strtol(val, &end, 16);
+  if (end == val || *end != ':')
+    return 0;
+  val = end + 1;
+  *y = strtol(val, &end, 16);
+  return end != val && !*end;
+}
+
+/*
+ *  Fill in all fields which come from sysfs attributes. When called from
+ *  worker threads (see sysfs_fill_info_batch()), config space must not be
+ *  touched, because the LRU list of open files is shared by all devices.
+ *  The directory descriptor is passed in *dir (see sysfs_dir()).
+ */
+static void
+sysfs_fill_attrs(struct pci_dev *d, unsigned int flags, int *dir, int config_ok)
 {
+  unsigned int uevent_fields = d->access->buscentric ? PCI_FILL_MODULE_ALIAS | PCI_FILL_DRIVER : SYSFS_UEVENT_FIELDS;
+  struct sysfs_uevent u;
   int value, want_class, want_class_ext;
 
+  u.valid = 0;
+  u.pci_id = u.pci_class = u.pci_subsys_id = u.modalias = u.driver = NULL;
+  if (flags & ~d->known_fields & uevent_fields)
+    sysfs_read_uevent(d, dir, &u);
+
   if (!d->access->buscentric)
     {
       /*
@@ -345,35 +792,37 @@ sysfs_fill_info(struct pci_dev *d, unsigned int flags)
        *  the kernel's view, which has regions and IRQs remapped and other fields
        *  (most importantly classes) possibly fixed if the device is known broken.
        */
-      if (want_fill(d, flags, PCI_FILL_IDENT))
+      if (want_fill(d, flags, PCI_FILL_IDENT) && !sysfs_uevent_pair(u.pci_id, &d->vendor_id, &d->device_id))
 	{
-	  d->vendor_id = sysfs_get_value(d, "vendor", 1);
-	  d->device_id = sysfs_get_value(d, "device", 1);
+	  d->vendor_id = sysfs_get_value(d, dir, "vendor", 1);
+	  d->device_id = sysfs_get_value(d, dir, "device", 1);
 	}
       want_class = want_fill(d, flags, PCI_FILL_CLASS);
       want_class_ext = want_fill(d, flags, PCI_FILL_CLASS_EXT);
       if (want_class || want_class_ext)
         {
-	  value = sysfs_get_value(d, "class", 1);
+	  value = u.pci_class ? (int) strtol(u.pci_class, NULL, 16) : sysfs_get_value(d, dir, "class", 1);
 	  if (want_class)
 	    d->device_class = value >> 8;
 	  if (want_class_ext)
 	    {
 	      d->prog_if = value & 0xff;
-	      value = sysfs_get_value(d, "revision", 0);
-	      if (value < 0)
+	      value = sysfs_get_value(d, dir, "revision", 0);
+	      if (value < 0 && !config_ok)
+		clear_fill(d, PCI_FILL_CLASS_EXT);	/* Leave it for the non-threaded pass */
+	      else if (value < 0)
 	        value = pci_read_byte(d, PCI_REVISION_ID);
 	      if (value >= 0)
 	        d->rev_id = value;
 	    }
 	}
-      if (want_fill(d, flags, PCI_FILL_SUBSYS))
+      if (want_fill(d, flags, PCI_FILL_SUBSYS) && !sysfs_uevent_pair(u.pci_subsys_id, &d->subsys_vendor_id, &d->subsys_id))
 	{
-	  value = sysfs_get_value(d, "subsystem_vendor", 0);
+	  value = sysfs_get_value(d, dir, "subsystem_vendor", 0);
 	  if (value >= 0)
 	    {
 	      d->subsys_vendor_id = value;
-	      value = sysfs_get_value(d, "subsystem_device", 0);
+	      value = sysfs_get_value(d, dir, "subsystem_device", 0);
 	      if (value >= 0)
 	        d->subsys_id = value;
 	    }
@@ -381,88 +830,46 @@ sysfs_fill_info(struct pci_dev *d, unsigned int flags)
 	    clear_fill(d, PCI_FILL_SUBSYS);
 	}
       if (want_fill(d, flags, PCI_FILL_IRQ))
-	  d->irq = sysfs_get_value(d, "irq", 1);
+	  d->irq = sysfs_get_value(d, dir, "irq", 1);
       if (want_fill(d, flags, PCI_FILL_BASES | PCI_FILL_ROM_BASE | PCI_FILL_SIZES | PCI_FILL_IO_FLAGS | PCI_FILL_BRIDGE_BASES))
-	  sysfs_get_resources(d);
+	  sysfs_get_resources(d, dir);
       if (want_fill(d, flags, PCI_FILL_PARENT))
-	{
-	  unsigned int domain, bus, dev, func;
-	  char *path_abs, *path_canon, *name;
-	  char path_rel[OBJNAMELEN];
-	  struct pci_dev *parent;
-
-	  /* Construct sysfs path for parent device */
-	  sysfs_obj_name(d, "..", path_rel);
-	  path_abs = realpath(path_rel, NULL);
-	  name = path_abs ? strrchr(path_abs, '/') : NULL;
-	  name = name ? name+1 : name;
-	  parent = NULL;
-
-	  if (name && sscanf(name, "%x:%x:%x.%d", &domain, &bus, &dev, &func) == 4 && domain <= 0x7fffffff)
-	    for (parent = d->access->devices; parent; parent = parent->next)
-	      if (parent->domain == (int)domain && parent->bus == bus && parent->dev == dev && parent->func == func)
-	        break;
-
-	  if (parent)
-	    {
-	      /* Check if parsed BDF address from parent sysfs device is really expected PCI device */
-	      sysfs_obj_name(parent, ".", path_rel);
-	      path_canon = realpath(path_rel, NULL);
-	      if (!path_canon || strcmp(path_canon, path_abs) != 0)
-	        parent = NULL;
-
-	      if (path_canon)
-		free(path_canon);
-	    }
-
-	  if (parent)
-	    d->parent = parent;
-	  else
-	    clear_fill(d, PCI_FILL_PARENT);
-
-	  if (path_abs)
-	    free(path_abs);
-	}
-    }
-
-  if (want_fill(d, flags, PCI_FILL_PHYS_SLOT))
-    {
-      struct pci_dev *pd;
-      sysfs_fill_slots(d->access);
-      for (pd = d->access->devices; pd; pd = pd->next)
-	pd->known_fields |= PCI_FILL_PHYS_SLOT;
+	sysfs_fill_parent(d, config_ok);
     }
 
   if (want_fill(d, flags, PCI_FILL_MODULE_ALIAS))
     {
       char buf[OBJBUFSIZE];
-      if (sysfs_get_string(d, "modalias", buf, 0))
+      /* Keep the trailing newline of the modalias attribute in both cases */
+      if (u.modalias)
+	{
+	  snprintf(buf, sizeof(buf), "%s\n", u.modalias);
+	  d->module_alias = pci_set_property(d, PCI_FILL_MODULE_ALIAS, buf);
+	}
+      else if (sysfs_get_string(d, dir, "modalias", buf, 0))
 	d->module_alias = pci_set_property(d, PCI_FILL_MODULE_ALIAS, buf);
     }
 
   if (want_fill(d, flags, PCI_FILL_LABEL))
     {
       char buf[OBJBUFSIZE];
-      if (sysfs_get_string(d, "label", buf, 0))
+      if (sysfs_get_string(d, dir, "label", buf, 0))
 	d->label = pci_set_property(d, PCI_FILL_LABEL, buf);
     }
 
   if (want_fill(d, flags, PCI_FILL_NUMA_NODE))
-    d->numa_node = sysfs_get_value(d, "numa_node", 0);
+    d->numa_node = sysfs_get_value(d, dir, "numa_node", 0);
 
   if (want_fill(d, flags, PCI_FILL_IOMMU_GROUP))
     {
-      char *group_link = sysfs_deref_link(d, "iommu_group");
-      if (group_link)
-        {
-          pci_set_property(d, PCI_FILL_IOMMU_GROUP, basename(group_link));
-          free(group_link);
-        }
+      char buf[OBJNAMELEN];
+      if (sysfs_link_name(d, dir, "iommu_group", buf))
+	pci_set_property(d, PCI_FILL_IOMMU_GROUP, buf);
     }
 
   if (want_fill(d, flags, PCI_FILL_DT_NODE))
     {
-      char *node = sysfs_deref_link(d, "of_node");
+      char *node = sysfs_deref_link(d, dir, "of_node");
       if (node)
 	{
 	  pci_set_property(d, PCI_FILL_DT_NODE, node);
@@ -472,14 +879,11 @@ sysfs_fill_info(struct pci_dev *d, unsigned int flags)
 
   if (want_fill(d, flags, PCI_FILL_DRIVER))
     {
-      char *driver_path = sysfs_deref_link(d, "driver");
-      if (driver_path)
-        {
-          char *driver = strrchr(driver_path, '/');
-          driver = driver ? driver+1 : driver_path;
-          pci_set_property(d, PCI_FILL_DRIVER, driver);
-          free(driver_path);
-        }
+      char buf[OBJNAMELEN];
+      if (u.driver)
+	pci_set_property(d, PCI_FILL_DRIVER, u.driver);
+      else if (!u.valid && sysfs_link_name(d, dir, "driver", buf))
+	pci_set_property(d, PCI_FILL_DRIVER, buf);
       else
         clear_fill(d, PCI_FILL_DRIVER);
     }
@@ -487,17 +891,104 @@ sysfs_fill_info(struct pci_dev *d, unsigned int flags)
   if (want_fill(d, flags, PCI_FILL_RCD_LNK))
     {
       char buf[OBJBUFSIZE];
-      if (sysfs_get_string(d, "rcd_link_cap", buf, 0))
+      if (sysfs_get_string(d, dir, "rcd_link_cap", buf, 0))
         d->rcd_link_cap = strtoul(buf, NULL, 16);
-      if (sysfs_get_string(d, "rcd_link_ctrl", buf, 0))
+      if (sysfs_get_string(d, dir, "rcd_link_ctrl", buf, 0))
         d->rcd_link_ctrl = strtoul(buf, NULL, 16);
-      if (sysfs_get_string(d, "rcd_link_status", buf, 0))
+      if (sysfs_get_string(d, dir, "rcd_link_status", buf, 0))
         d->rcd_link_status = strtoul(buf, NULL, 16);
     }
+}
+
+static void
+sysfs_fill_info(struct pci_dev *d, unsigned int flags)
+{
+  struct sysfs_dev *sd;
+  int dir;
+
+  pci_lock(d->access, PCI_LOCK_BACKEND);
+  sd = sysfs_get_dev(d);
+  dir = sysfs_dir(d, &sd->fd_dir);
+  sd->lru.users++;
+  pci_unlock(d->access, PCI_LOCK_BACKEND);
+
+  sysfs_fill_attrs(d, flags, &dir, 1);
+  if (dir != sd->fd_dir)
+    close(dir);
+  sysfs_put_dev(d);
+
+  if (want_fill(d, flags, PCI_FILL_PHYS_SLOT))
+    {
+      struct pci_dev *pd;
+      sysfs_fill_slots(d->access);
+      for (pd = d->access->devices; pd; pd = pd->next)
+	pd->known_fields |= PCI_FILL_PHYS_SLOT;
+    }
 
   pci_generic_fill_info(d, flags);
 }
 
+struct sysfs_batch {
+  struct pci_dev **devs;
+  int *dirs;				/* Directories opened by sysfs_fill_batch_node() */
+  unsigned int flags;
+};
+
+static int
+sysfs_fill_batch_node(void *data, int job)
+{
+  struct sysfs_batch *b = data;
+  struct pci_dev *d = b->devs[job];
+
+  sysfs_fill_attrs(d, PCI_FILL_NUMA_NODE, &b->dirs[job], 0);
+  return d->numa_node;
+}
+
+static void
+sysfs_fill_batch_job(void *data, int job)
+{
+  struct sysfs_batch *b = data;
+
+  sysfs_fill_attrs(b->devs[job], b->flags, &b->dirs[job], 0);
+  if (b->dirs[job] >= 0)
+    close(b->dirs[job]);
+}
+
+static void
+sysfs_fill_info_batch(struct pci_access *a, unsigned int flags)
+{
+  int threads = atoi(pci_get_param(a, "sysfs.threads"));
+  struct sysfs_batch b;
+  struct pci_dev *d;
+  int n = 0;
+
+  for (d = a->devices; d; d = d->next)
+    n++;
+  if (threads <= 1 || n <= 1)
+    return;
+
+  b.devs = pci_malloc(a, n * sizeof(struct pci_dev *));
+  b.dirs = pci_malloc(a, n * sizeof(int));
+  b.flags = flags;
+  n = 0;
+  for (d = a->devices; d; d = d->next)
+    {
+      b.dirs[n] = -1;
+      b.devs[n++] = d;
+    }
+
+  /*
+   *  The threads fill only the attributes; everything which needs access
+   *  to the config space is left for pci_fill_info() called afterwards.
+   *  When binding to NUMA nodes is requested, the node of each device is
+   *  read first, so that the rest of its attributes is read on the node.
+   */
+  a->debug("Filling %d devices using %d threads\n", n, threads);
+  pci_run_parallel_nodes(a, threads, n, sysfs_fill_batch_job, sysfs_fill_batch_node, &b);
+  pci_mfree(b.dirs);
+  pci_mfree(b.devs);
+}
+
 /* Intent of the sysfs_setup() caller */
 enum
   {
@@ -506,38 +997,63 @@ enum
     SETUP_READ_VPD = 2
   };
 
+/* Returns the descriptor with a reference to it, which must be dropped by sysfs_put_dev() */
 static int
 sysfs_setup(struct pci_dev *d, int intent)
 {
   struct pci_access *a = d->access;
+  struct sysfs_dev *sd;
   char namebuf[OBJNAMELEN];
+  int fd;
+
+  pci_lock(a, PCI_LOCK_BACKEND);
+  sd = sysfs_get_dev(d);
+  sd->lru.users++;
 
-  if (a->cached_dev != d || (intent == SETUP_WRITE_CONFIG && !a->fd_rw))
+  if (intent == SETUP_WRITE_CONFIG && sd->fd >= 0 && !sd->fd_rw)
     {
-      sysfs_flush_cache(a);
-      a->cached_dev = d;
+      if (sd->lru.users > 1)
+	sd->fd_old = sd->fd;
+      else
+	close(sd->fd);
+      sd->fd = -1;
     }
 
   if (intent == SETUP_READ_VPD)
     {
-      if (a->fd_vpd < 0)
+      if (sd->fd_vpd < 0)
 	{
-	  sysfs_obj_name(d, "vpd", namebuf);
-	  a->fd_vpd = open(namebuf, O_RDONLY);
+	  if (sysfs_dir(d, &sd->fd_dir) >= 0)
+	    sd->fd_vpd = openat(sd->fd_dir, "vpd", O_RDONLY | O_CLOEXEC);
 	  /* No warning on error; vpd may be absent or accessible only to root */
+	  if (sd->fd_vpd >= 0)
+	    PCI_STAT(a, fd_opens, 1);
 	}
-      return a->fd_vpd;
+      else
+	PCI_STAT(a, fd_hits, 1);
+      fd = sd->fd_vpd;
+      pci_unlock(a, PCI_LOCK_BACKEND);
+      return fd;
     }
 
-  if (a->fd < 0)
+  if (sd->fd < 0)
     {
-      sysfs_obj_name(d, "config", namebuf);
-      a->fd_rw = a->writeable || intent == SETUP_WRITE_CONFIG;
-      a->fd = open(namebuf, a->fd_rw ? O_RDWR : O_RDONLY);
-      if (a->fd < 0)
-	a->warning("Cannot open %s", namebuf);
+      sd->fd_rw = a->writeable || intent == SETUP_WRITE_CONFIG;
+      if (sysfs_dir(d, &sd->fd_dir) >= 0)
+	sd->fd = openat(sd->fd_dir, "config", (sd->fd_rw ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+      if (sd->fd < 0)
+	{
+	  sysfs_obj_name(d, "config", namebuf);
+	  a->warning("Cannot open %s", namebuf);
+	}
+      else
+	PCI_STAT(a, fd_opens, 1);
     }
-  return a->fd;
+  else
+    PCI_STAT(a, fd_hits, 1);
+  fd = sd->fd;
+  pci_unlock(a, PCI_LOCK_BACKEND);
+  return fd;
 }
 
 static int sysfs_read(struct pci_dev *d, int pos, byte *buf, int len)
@@ -546,8 +1062,12 @@ static int sysfs_read(struct pci_dev *d, int pos, byte *buf, int len)
   int res;
 
   if (fd < 0)
-    return 0;
+    {
+      sysfs_put_dev(d);
+      return 0;
+    }
   res = pread(fd, buf, len, pos);
+  sysfs_put_dev(d);
   if (res < 0)
     {
       d->access->warning("sysfs_read: read failed: %s", strerror(errno));
@@ -564,8 +1084,12 @@ static int sysfs_write(struct pci_dev *d, int pos, byte *buf, int len)
   int res;
 
   if (fd < 0)
-    return 0;
+    {
+      sysfs_put_dev(d);
+      return 0;
+    }
   res = pwrite(fd, buf, len, pos);
+  sysfs_put_dev(d);
   if (res < 0)
     {
       d->access->warning("sysfs_write: write failed: %s", strerror(errno));
@@ -579,14 +1103,210 @@ static int sysfs_write(struct pci_dev *d, int pos, byte *buf, int len)
   return 1;
 }
 
+/*
+ *  Batched reads: requests are sorted by device and position and each run
+ *  of adjacent or overlapping ranges of the same device is read by a single
+ *  readv operation. Adjacent ranges go directly to the callers' buffers,
+ *  overlapping ones through a bounce buffer. If the kernel supports io_uring,
+ *  whole batches of runs are submitted at once.
+ */
+
+#define SYSFS_MAX_RUN 64
+#define SYSFS_MAX_BATCH 64
+
+struct sysfs_run {
+  struct pci_read_req **reqs;
+  int cnt;
+  int start, end;
+  byte *bounce;
+  struct iovec iov[SYSFS_MAX_RUN];
+  struct pci_uring_io io;
+};
+
+static int
+sysfs_compare_reqs(const void *A, const void *B)
+{
+  const struct pci_read_req *a = *(const struct pci_read_req **) A;
+  const struct pci_read_req *b = *(const struct pci_read_req **) B;
+
+  if (a->dev != b->dev)
+    return (a->dev < b->dev) ? -1 : 1;
+  if (a->pos != b->pos)
+    return (a->pos < b->pos) ? -1 : 1;
+  return (a->len < b->len) ? -1 : (a->len > b->len);
+}
+
+static void
+sysfs_prepare_run(struct sysfs_run *run)
+{
+  struct pci_dev *d = run->reqs[0]->dev;
+  int adjacent = 1;
+  int i;
+
+  run->start = run->end = run->reqs[0]->pos;
+  for (i = 0; i < run->cnt; i++)
+    {
+      if (run->reqs[i]->pos != run->end)
+	adjacent = 0;
+      if (run->reqs[i]->pos + run->reqs[i]->len > run->end)
+	run->end = run->reqs[i]->pos + run->reqs[i]->len;
+    }
+
+  if (adjacent)
+    {
+      run->bounce = NULL;
+      for (i = 0; i < run->cnt; i++)
+	{
+	  run->iov[i].iov_base = run->reqs[i]->buf;
+	  run->iov[i].iov_len = run->reqs[i]->len;
+	}
+      run->io.iovcnt = run->cnt;
+    }
+  else
+    {
+      run->bounce = pci_malloc(d->access, run->end - run->start);
+      run->iov[0].iov_base = run->bounce;
+      run->iov[0].iov_len = run->end - run->start;
+      run->io.iovcnt = 1;
+    }
+  run->io.fd = sysfs_setup(d, SETUP_READ_CONFIG);
+  run->io.offset = run->start;
+  run->io.iov = run->iov;
+  run->io.res = 0;
+}
+
+static void
+sysfs_finish_run(struct sysfs_run *run)
+{
+  struct pci_dev *d = run->reqs[0]->dev;
+  int res = run->io.res;
+  int i;
+
+  sysfs_put_dev(d);
+  if (res < 0)
+    {
+      d->access->warning("sysfs_read_multi: read failed: %s", strerror(-res));
+      res = 0;
+    }
+  for (i = 0; i < run->cnt; i++)
+    {
+      struct pci_read_req *r = run->reqs[i];
+      r->ok = (r->pos + r->len - run->start <= res);
+      if (run->bounce && r->ok)
+	memcpy(r->buf, run->bounce + r->pos - run->start, r->len);
+    }
+  pci_mfree(run->bounce);
+}
+
+static void
+sysfs_exec_runs(struct pci_access *a UNUSED, struct sysfs_run *runs, int n)
+{
+  int i;
+
+#ifdef PCI_HAVE_LINUX_IO_URING
+  struct sysfs_access *sa = a->backend_data;
+
+  if (sa->uring_state == 0)
+    {
+      sa->uring_state = -1;
+      if (atoi(pci_get_param(a, "sysfs.io_uring")) > 0 && (sa->uring = pci_uring_open(a, SYSFS_MAX_BATCH)))
+	sa->uring_state = 1;
+    }
+  if (sa->uring_state > 0)
+    {
+      struct pci_uring_io io[SYSFS_MAX_BATCH];
+      int m = 0;
+
+      for (i = 0; i < n; i++)
+	if (runs[i].io.fd >= 0)
+	  io[m++] = runs[i].io;
+      if (pci_uring_readv(sa->uring, io, m) >= 0)
+	{
+	  for (i = m = 0; i < n; i++)
+	    if (runs[i].io.fd >= 0)
+	      runs[i].io.res = io[m++].res;
+	  return;
+	}
+      /* The ring is broken, do not use it any longer */
+      pci_uring_close(sa->uring);
+      sa->uring = NULL;
+      sa->uring_state = -1;
+    }
+#endif
+
+  for (i = 0; i < n; i++)
+    if (runs[i].io.fd >= 0)
+      {
+	runs[i].io.res = preadv(runs[i].io.fd, runs[i].io.iov, runs[i].io.iovcnt, runs[i].io.offset);
+	if (runs[i].io.res < 0)
+	  runs[i].io.res = -errno;
+      }
+}
+
+static void
+sysfs_read_multi(struct pci_access *a, struct pci_read_req *reqs, int n)
+{
+  struct sysfs_access *sa = a->backend_data;
+  struct pci_read_req **sorted;
+  struct sysfs_run *runs;
+  int i, j, k, nruns, ndevs;
+
+  if (n <= 0)
+    return;
+
+  sorted = pci_malloc(a, n * sizeof(*sorted));
+  for (i = 0; i < n; i++)
+    sorted[i] = &reqs[i];
+  qsort(sorted, n, sizeof(*sorted), sysfs_compare_reqs);
+  runs = pci_malloc(a, SYSFS_MAX_BATCH * sizeof(*runs));
+
+  /*
+   *  Collect batches of runs. A single batch must not span more devices
+   *  than we are able to keep open at once.
+   */
+  nruns = ndevs = 0;
+  for (i = 0; i < n; i = j)
+    {
+      int end = sorted[i]->pos + sorted[i]->len;
+      for (j = i+1; j < n && j-i < SYSFS_MAX_RUN && sorted[j]->dev == sorted[i]->dev && sorted[j]->pos <= end; j++)
+	if (sorted[j]->pos + sorted[j]->len > end)
+	  end = sorted[j]->pos + sorted[j]->len;
+
+      if (!nruns || runs[nruns-1].reqs[0]->dev != sorted[i]->dev)
+	ndevs++;
+      if (nruns == SYSFS_MAX_BATCH || ndevs > sa->lru.max)
+	{
+	  sysfs_exec_runs(a, runs, nruns);
+	  for (k = 0; k < nruns; k++)
+	    sysfs_finish_run(&runs[k]);
+	  nruns = 0;
+	  ndevs = 1;
+	}
+      runs[nruns].reqs = sorted + i;
+      runs[nruns].cnt = j - i;
+      sysfs_prepare_run(&runs[nruns]);
+      nruns++;
+    }
+  sysfs_exec_runs(a, runs, nruns);
+  for (k = 0; k < nruns; k++)
+    sysfs_finish_run(&runs[k]);
+
+  pci_mfree(runs);
+  pci_mfree(sorted);
+}
+
 static int sysfs_read_vpd(struct pci_dev *d, int pos, byte *buf, int len)
 {
   int fd = sysfs_setup(d, SETUP_READ_VPD);
   int res;
 
   if (fd < 0)
-    return 0;
+    {
+      sysfs_put_dev(d);
+      return 0;
+    }
   res = pread(fd, buf, len, pos);
+  sysfs_put_dev(d);
   if (res < 0)
     {
       d->access->warning("sysfs_read_vpd: read failed: %s", strerror(errno));
@@ -597,15 +1317,180 @@ static int sysfs_read_vpd(struct pci_dev *d, int pos, byte *buf, int len)
   return 1;
 }
 
-static void sysfs_cleanup_dev(struct pci_dev *d)
+/*
+ *  BARs are mapped through the resourceN files, which the kernel lets map
+ *  from their start, so the mapping needs no page alignment of the BAR.
+ *  Write-combining mappings use resourceN_wc, which exists only
+ *  for prefetchable BARs; others fall back to the normal file.
+ */
+static int
+sysfs_map_bar(struct pci_dev *d, int bar, int flags, struct pci_bar_map *m)
 {
   struct pci_access *a = d->access;
+  char namebuf[OBJNAMELEN], object[16];
+  long pagesize = sysconf(_SC_PAGESIZE);
+  int w = flags & PCI_MAP_WRITE;
+  int fd = -1;
+  void *map;
+
+  if (flags & PCI_MAP_WC)
+    {
+      sprintf(object, "resource%d_wc", bar);
+      sysfs_obj_name(d, object, namebuf);
+      fd = open(namebuf, (w ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    }
+  if (fd < 0)
+    {
+      sprintf(object, "resource%d", bar);
+      sysfs_obj_name(d, object, namebuf);
+      fd = open(namebuf, (w ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    }
+  if (fd < 0)
+    {
+      a->debug("map_bar: Cannot open %s: %s\n", namebuf, strerror(errno));
+      return 0;
+    }
 
-  if (a->cached_dev == d)
-    sysfs_flush_cache(a);
+  m->map_len = (m->size + pagesize - 1) & ~(u64) (pagesize - 1);
+  map = mmap(NULL, m->map_len, PROT_READ | (w ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    a->debug("map_bar: Cannot map %s: %s\n", namebuf, strerror(errno));
+  close(fd);
+  if (map == MAP_FAILED)
+    return 0;
+  m->map = m->ptr = map;
+  return 1;
+}
+
+static void
+sysfs_unmap_bar(struct pci_dev *d UNUSED, struct pci_bar_map *m)
+{
+  munmap(m->map, m->map_len);
+}
+
+static void sysfs_cleanup_dev(struct pci_dev *d)
+{
+  struct sysfs_dev *sd = d->backend_data;
+
+  if (sd)
+    {
+      sysfs_close_dev(d->access, sd);
+      pci_mfree(sd->link);
+      pci_mfree(sd);
+      d->backend_data = NULL;
+    }
+}
+
+/* A probe handle is moving to another address, keep only the structure */
+static void sysfs_reset_dev(struct pci_dev *d)
+{
+  struct sysfs_dev *sd = d->backend_data;
+
+  if (sd)
+    {
+      pci_lock(d->access, PCI_LOCK_BACKEND);
+      sysfs_close_dev(d->access, sd);
+      pci_mfree(sd->link);
+      sd->link = NULL;
+      pci_unlock(d->access, PCI_LOCK_BACKEND);
+    }
+}
+
+/*
+ *  Hot-plug monitoring: the kernel broadcasts uevents to netlink group 1.
+ *  Each of them consists of NUL-terminated strings "action@devpath"
+ *  and KEY=VALUE; we are interested only in those of PCI devices.
+ */
+
+static int
+sysfs_monitor_open(struct pci_access *a)
+{
+  struct sysfs_access *sa = a->backend_data;
+  struct sockaddr_nl addr;
+
+  if (sa->uevent_fd >= 0)
+    return sa->uevent_fd;
+
+  sa->uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+  if (sa->uevent_fd < 0)
+    {
+      a->debug("sysfs: Cannot open uevent socket: %s\n", strerror(errno));
+      return -1;
+    }
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = 1;
+  if (bind(sa->uevent_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    {
+      a->debug("sysfs: Cannot bind uevent socket: %s\n", strerror(errno));
+      close(sa->uevent_fd);
+      sa->uevent_fd = -1;
+    }
+  return sa->uevent_fd;
+}
+
+static int
+sysfs_monitor_read(struct pci_access *a, struct pci_monitor_event *ev)
+{
+  struct sysfs_access *sa = a->backend_data;
+  char buf[8192];
+
+  if (sa->uevent_fd < 0)
+    return 0;
+
+  for (;;)
+    {
+      struct sockaddr_nl addr;
+      socklen_t addr_len = sizeof(addr);
+      char *action = NULL, *subsystem = NULL, *slot = NULL;
+      unsigned int dom, bus, dev, func;
+      int len, pos;
+
+      len = recvfrom(sa->uevent_fd, buf, sizeof(buf) - 1, MSG_DONTWAIT, (struct sockaddr *) &addr, &addr_len);
+      if (len < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (errno == ENOBUFS)
+	    a->warning("sysfs: Lost some uevents, call pci_rescan() to catch up");
+	  return 0;
+	}
+      if (addr.nl_pid)			/* Not sent by the kernel */
+	continue;
+      buf[len] = 0;
+
+      for (pos = 0; pos < len; pos += strlen(buf + pos) + 1)
+	{
+	  char *s = buf + pos;
+	  if (!strncmp(s, "ACTION=", 7))
+	    action = s + 7;
+	  else if (!strncmp(s, "SUBSYSTEM=", 10))
+	    subsystem = s + 10;
+	  else if (!strncmp(s, "PCI_SLOT_NAME=", 14))
+	    slot = s + 14;
+	}
+      if (!action || !subsystem || !slot || strcmp(subsystem, "pci") ||
+	  sscanf(slot, "%x:%x:%x.%d", &dom, &bus, &dev, &func) != 4 || dom > 0x7fffffff)
+	continue;
+
+      if (!strcmp(action, "add"))
+	ev->action = PCI_RESCAN_ADDED;
+      else if (!strcmp(action, "remove"))
+	ev->action = PCI_RESCAN_REMOVED;
+      else if (!strcmp(action, "bind") || !strcmp(action, "unbind"))
+	ev->action = PCI_RESCAN_CHANGED;
+      else
+	continue;
+      ev->domain = dom;
+      ev->bus = bus;
+      ev->dev = dev;
+      ev->func = func;
+      a->debug("sysfs: uevent %s %s\n", action, slot);
+      return 1;
+    }
 }
 
-struct pci_methods pm_linux_sysfs = {
+const struct pci_methods pm_linux_sysfs = {
   .name = "linux-sysfs",
   .help = "The sys filesystem on Linux",
   .config = sysfs_config,
@@ -618,4 +1503,14 @@ struct pci_methods pm_linux_sysfs = {
   .write = sysfs_write,
   .read_vpd = sysfs_read_vpd,
   .cleanup_dev = sysfs_cleanup_dev,
+  .reset_dev = sysfs_reset_dev,
+  .fill_info_batch = sysfs_fill_info_batch,
+  .read_multi = sysfs_read_multi,
+  .monitor_open = sysfs_monitor_open,
+  .monitor_read = sysfs_monitor_read,
+  .probe_dev = sysfs_probe_dev,
+  .reentrant = 1,
+  .get_domains = sysfs_get_domains,
+  .map_bar = sysfs_map_bar,
+  .unmap_bar = sysfs_unmap_bar,
 };
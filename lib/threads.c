@@ -0,0 +1,272 @@
+/*
+ *	The PCI Library -- Running Jobs in Parallel
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdlib.h>
+
+#include "internal.h"
+
+#ifdef PCI_HAVE_PTHREAD
+
+#include <pthread.h>
+
+struct parallel_ctx {
+  struct pci_access *access;
+  pthread_mutex_t lock;
+  int next_job, num_jobs;
+  void (*worker)(void *data, int job);
+  int (*job_node)(void *data, int job);	/* NULL if the threads are not bound */
+  void *data;
+};
+
+static void
+parallel_loop(struct parallel_ctx *ctx, int may_bind)
+{
+  int bound = -1;
+
+  for (;;)
+    {
+      int job, node;
+
+      pthread_mutex_lock(&ctx->lock);
+      job = ctx->next_job++;
+      pthread_mutex_unlock(&ctx->lock);
+      if (job >= ctx->num_jobs)
+	break;
+      if (may_bind && ctx->job_node)
+	{
+	  node = ctx->job_node(ctx->data, job);
+	  if (node >= 0 && node != bound && pci_bind_to_node(ctx->access, node))
+	    bound = node;
+	}
+      ctx->worker(ctx->data, job);
+    }
+}
+
+static void *
+parallel_thread(void *arg)
+{
+  parallel_loop(arg, 1);
+  return NULL;
+}
+
+/*
+ *  Call worker(data, job) for every job in 0..num_jobs-1, using up to
+ *  the given number of threads (including the calling one). Jobs are
+ *  handed out in ascending order, but they may complete in any order.
+ *  If threads are not available, all jobs are run by the caller.
+ *
+ *  If job_node is given and the numa.bind parameter is set, it is called
+ *  before each job to tell the NUMA node of the device the job works with
+ *  (or -1). The worker threads then move to the CPUs of that node, so that
+ *  the job's accesses and allocations stay local. The calling thread is never
+ *  re-bound, as it would stay so after we return.
+ */
+void
+pci_run_parallel_nodes(struct pci_access *a, int threads, int num_jobs, void (*worker)(void *data, int job),
+		       int (*job_node)(void *data, int job), void *data)
+{
+  struct parallel_ctx ctx;
+  pthread_t *tids;
+  int i, started;
+
+  if (threads > num_jobs)
+    threads = num_jobs;
+  if (threads <= 1)
+    {
+      for (i = 0; i < num_jobs; i++)
+	worker(data, i);
+      return;
+    }
+
+  pthread_mutex_init(&ctx.lock, NULL);
+  ctx.access = a;
+  ctx.next_job = 0;
+  ctx.num_jobs = num_jobs;
+  ctx.worker = worker;
+  ctx.job_node = atoi(pci_get_param(a, "numa.bind")) ? job_node : NULL;
+  ctx.data = data;
+
+  tids = pci_malloc(a, (threads - 1) * sizeof(pthread_t));
+  for (started = 0; started < threads - 1; started++)
+    if (pthread_create(&tids[started], NULL, parallel_thread, &ctx))
+      {
+	a->debug("Cannot start more than %d worker threads\n", started);
+	break;
+      }
+  parallel_loop(&ctx, 0);
+  for (i = 0; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  pci_mfree(tids);
+  pthread_mutex_destroy(&ctx.lock);
+}
+
+void
+pci_run_parallel(struct pci_access *a, int threads, int num_jobs, void (*worker)(void *data, int job), void *data)
+{
+  pci_run_parallel_nodes(a, threads, num_jobs, worker, NULL, data);
+}
+
+/*
+ *  Locks protecting the shared state of a pci_access, allocated only when
+ *  the application enables thread safety. The fill lock is recursive, since
+ *  filling of one device can trigger filling of another one (e.g., its parent).
+ *  Locks are always taken in this order: fill, device, method and backend;
+ *  the name lock is independent of the others.
+ */
+
+#define PCI_DEV_LOCKS 16
+
+struct pci_locks {
+  pthread_mutex_t fill;
+  pthread_mutex_t method;
+  pthread_mutex_t backend;
+  pthread_rwlock_t names;
+  pthread_mutex_t dev[PCI_DEV_LOCKS];
+};
+
+int
+pci_enable_thread_safety(struct pci_access *a, int enable)
+{
+  struct pci_locks *l = a->locks;
+  pthread_mutexattr_t attr;
+  int i;
+
+  if (enable && !l)
+    {
+      l = pci_malloc(a, sizeof(*l));
+      pthread_mutexattr_init(&attr);
+      pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+      pthread_mutex_init(&l->fill, &attr);
+      pthread_mutexattr_destroy(&attr);
+      pthread_mutex_init(&l->method, NULL);
+      pthread_mutex_init(&l->backend, NULL);
+      pthread_rwlock_init(&l->names, NULL);
+      for (i = 0; i < PCI_DEV_LOCKS; i++)
+	pthread_mutex_init(&l->dev[i], NULL);
+      a->locks = l;
+    }
+  else if (!enable && l)
+    {
+      pthread_mutex_destroy(&l->fill);
+      pthread_mutex_destroy(&l->method);
+      pthread_mutex_destroy(&l->backend);
+      pthread_rwlock_destroy(&l->names);
+      for (i = 0; i < PCI_DEV_LOCKS; i++)
+	pthread_mutex_destroy(&l->dev[i]);
+      pci_mfree(l);
+      a->locks = NULL;
+    }
+  return 1;
+}
+
+static pthread_mutex_t *
+pci_get_mutex(struct pci_locks *l, enum pci_lock which)
+{
+  switch (which)
+    {
+    case PCI_LOCK_FILL:
+      return &l->fill;
+    case PCI_LOCK_METHOD:
+      return &l->method;
+    default:
+      return &l->backend;
+    }
+}
+
+void
+pci_lock_internal(struct pci_access *a, enum pci_lock which)
+{
+  struct pci_locks *l = a->locks;
+
+  if (which == PCI_LOCK_NAMES_READ)
+    pthread_rwlock_rdlock(&l->names);
+  else if (which == PCI_LOCK_NAMES_WRITE)
+    pthread_rwlock_wrlock(&l->names);
+  else
+    pthread_mutex_lock(pci_get_mutex(l, which));
+}
+
+void
+pci_unlock_internal(struct pci_access *a, enum pci_lock which)
+{
+  struct pci_locks *l = a->locks;
+
+  if (which == PCI_LOCK_NAMES_READ || which == PCI_LOCK_NAMES_WRITE)
+    pthread_rwlock_unlock(&l->names);
+  else
+    pthread_mutex_unlock(pci_get_mutex(l, which));
+}
+
+static pthread_mutex_t *
+pci_dev_mutex(struct pci_dev *d)
+{
+  unsigned long h = (unsigned long) d / sizeof(struct pci_dev);
+
+  return &d->access->locks->dev[h % PCI_DEV_LOCKS];
+}
+
+void
+pci_lock_dev_internal(struct pci_dev *d)
+{
+  pthread_mutex_lock(pci_dev_mutex(d));
+}
+
+void
+pci_unlock_dev_internal(struct pci_dev *d)
+{
+  pthread_mutex_unlock(pci_dev_mutex(d));
+}
+
+#else
+
+int
+pci_enable_thread_safety(struct pci_access *a UNUSED, int enable)
+{
+  return !enable;
+}
+
+/* Never called, as a->locks is always NULL */
+
+void
+pci_lock_internal(struct pci_access *a UNUSED, enum pci_lock which UNUSED)
+{
+}
+
+void
+pci_unlock_internal(struct pci_access *a UNUSED, enum pci_lock which UNUSED)
+{
+}
+
+void
+pci_lock_dev_internal(struct pci_dev *d UNUSED)
+{
+}
+
+void
+pci_unlock_dev_internal(struct pci_dev *d UNUSED)
+{
+}
+
+void
+pci_run_parallel(struct pci_access *a UNUSED, int threads UNUSED, int num_jobs, void (*worker)(void *data, int job), void *data)
+{
+  int i;
+
+  for (i = 0; i < num_jobs; i++)
+    worker(data, i);
+}
+
+void
+pci_run_parallel_nodes(struct pci_access *a, int threads, int num_jobs, void (*worker)(void *data, int job),
+		       int (*job_node)(void *data, int job) UNUSED, void *data)
+{
+  pci_run_parallel(a, threads, num_jobs, worker, data);
+}
+
+#endif
@@ -0,0 +1,251 @@
+/*
+ *	The PCI Library -- Topology of Buses and Bridges
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/*
+ *  The graph is built by a single pass over the list of devices: every bus
+ *  with a device on it and every secondary bus of a bridge gets a node,
+ *  the nodes are kept sorted by their address and every device points to the
+ *  node of its bus and, if it is a bridge, to the node of its secondary bus.
+ *  Secondary bus numbers are read from the config space. If a bus is not
+ *  claimed by any bridge (typically because the bridge is not accessible),
+ *  the parent reported by the back-end is used if it is already known.
+ *  The graph is dropped whenever a device is linked or freed.
+ */
+
+struct pci_topology {
+  struct pci_topo_bus *buses;
+  int num_buses;
+  struct pci_dev **devs;		/* Storage for the lists of devices on buses */
+};
+
+static int
+topo_bus_cmp(const void *A, const void *B)
+{
+  const struct pci_topo_bus *a = A, *b = B;
+
+  if (a->domain != b->domain)
+    return (a->domain < b->domain) ? -1 : 1;
+  return a->number - b->number;
+}
+
+static struct pci_topo_bus *
+topo_find_bus(struct pci_topology *t, int domain, int bus)
+{
+  struct pci_topo_bus key;
+
+  key.domain = domain;
+  key.number = bus;
+  return bsearch(&key, t->buses, t->num_buses, sizeof(key), topo_bus_cmp);
+}
+
+static int
+topo_secondary(struct pci_dev *d, int *sub)
+{
+  int ht, sec;
+
+  if (d->no_config_access)
+    return -1;
+  if (d->hdrtype < 0)
+    d->hdrtype = pci_read_byte(d, PCI_HEADER_TYPE) & 0x7f;
+  ht = d->hdrtype;
+  if (ht == PCI_HEADER_TYPE_BRIDGE)
+    {
+      sec = pci_read_byte(d, PCI_SECONDARY_BUS);
+      *sub = pci_read_byte(d, PCI_SUBORDINATE_BUS);
+    }
+  else if (ht == PCI_HEADER_TYPE_CARDBUS)
+    {
+      sec = pci_read_byte(d, PCI_CB_CARD_BUS);
+      *sub = pci_read_byte(d, PCI_CB_SUBORDINATE_BUS);
+    }
+  else
+    return -1;
+  /* Unconfigured bridges have zeros there, broken ones could form loops */
+  if (sec <= d->bus)
+    return -1;
+  if (*sub < sec)
+    *sub = sec;
+  return sec;
+}
+
+static struct pci_topology *
+topo_build(struct pci_access *a)
+{
+  struct pci_topology *t = pci_malloc(a, sizeof(*t));
+  struct pci_topo_bus *b;
+  struct pci_dev *d, **devs;
+  int n = 0, i, j, sec, sub;
+
+  for (d = a->devices; d; d = d->next)
+    n++;
+  t->buses = pci_malloc(a, (2*n + 1) * sizeof(struct pci_topo_bus));
+  t->devs = pci_malloc(a, (n + 1) * sizeof(struct pci_dev *));
+  memset(t->buses, 0, (2*n + 1) * sizeof(struct pci_topo_bus));
+
+  /* Collect all buses, possibly with duplicates */
+  n = 0;
+  for (d = a->devices; d; d = d->next)
+    {
+      d->topo_bus = d->topo_secondary = NULL;
+      t->buses[n].domain = d->domain;
+      t->buses[n++].number = d->bus;
+      if ((sec = topo_secondary(d, &sub)) >= 0)
+	{
+	  t->buses[n].domain = d->domain;
+	  t->buses[n++].number = sec;
+	}
+    }
+  qsort(t->buses, n, sizeof(struct pci_topo_bus), topo_bus_cmp);
+  for (i = j = 0; i < n; i++)
+    if (!j || topo_bus_cmp(&t->buses[j-1], &t->buses[i]))
+      t->buses[j++] = t->buses[i];
+  t->num_buses = j;
+  for (i = 0; i < t->num_buses; i++)
+    t->buses[i].subordinate = t->buses[i].number;
+
+  /* Bridges in front of the buses */
+  for (d = a->devices; d; d = d->next)
+    if ((sec = topo_secondary(d, &sub)) >= 0)
+      {
+	b = topo_find_bus(t, d->domain, sec);
+	if (!b->bridge)
+	  {
+	    b->bridge = d;
+	    b->subordinate = sub;
+	    d->topo_secondary = b;
+	  }
+	else
+	  a->debug("topology: bus %04x:%02x claimed by two bridges\n", d->domain, sec);
+      }
+
+  /* Devices on the buses */
+  for (d = a->devices; d; d = d->next)
+    {
+      b = d->topo_bus = topo_find_bus(t, d->domain, d->bus);
+      b->num_devices++;
+      if (!b->bridge && (d->known_fields & PCI_FILL_PARENT) && d->parent && !d->parent->topo_secondary)
+	{
+	  b->bridge = d->parent;
+	  d->parent->topo_secondary = b;
+	}
+    }
+  devs = t->devs;
+  for (i = 0; i < t->num_buses; i++)
+    {
+      b = &t->buses[i];
+      b->devices = devs;
+      devs += b->num_devices;
+      b->num_devices = 0;
+      if (b->bridge)
+	b->parent = b->bridge->topo_bus;
+    }
+  for (d = a->devices; d; d = d->next)
+    {
+      b = d->topo_bus;
+      b->devices[b->num_devices++] = d;
+    }
+
+  a->debug("topology: %d buses\n", t->num_buses);
+  return t;
+}
+
+static struct pci_topology *
+topo_get(struct pci_access *a)
+{
+  pci_lock(a, PCI_LOCK_FILL);
+  if (!a->topology)
+    a->topology = topo_build(a);
+  pci_unlock(a, PCI_LOCK_FILL);
+  return a->topology;
+}
+
+struct pci_topo_bus *
+pci_topo_get_bus(struct pci_access *a, int domain, int bus)
+{
+  return topo_find_bus(topo_get(a), domain, bus);
+}
+
+struct pci_topo_bus *
+pci_topo_dev_bus(struct pci_dev *d)
+{
+  topo_get(d->access);
+  return d->topo_bus;
+}
+
+struct pci_topo_bus *
+pci_topo_secondary_bus(struct pci_dev *d)
+{
+  topo_get(d->access);
+  return d->topo_secondary;
+}
+
+struct pci_dev *
+pci_topo_upstream(struct pci_dev *d)
+{
+  struct pci_topo_bus *b = pci_topo_dev_bus(d);
+
+  return b ? b->bridge : NULL;
+}
+
+struct pci_dev *
+pci_topo_link_partner(struct pci_dev *d)
+{
+  struct pci_cap *cap = pci_find_cap(d, PCI_CAP_ID_EXP, PCI_CAP_NORMAL);
+  struct pci_topo_bus *b;
+  int type, i;
+
+  if (!cap)
+    return NULL;
+  type = (pci_read_word(d, cap->addr + PCI_EXP_FLAGS) & PCI_EXP_FLAGS_TYPE) >> 4;
+  switch (type)
+    {
+    case PCI_EXP_TYPE_ROOT_PORT:
+    case PCI_EXP_TYPE_DOWNSTREAM:
+      /* Function 0 of the device on the other end of the link */
+      if (!(b = pci_topo_secondary_bus(d)))
+	return NULL;
+      for (i = 0; i < b->num_devices; i++)
+	if (!b->devices[i]->func)
+	  return b->devices[i];
+      return NULL;
+    case PCI_EXP_TYPE_ROOT_INT_EP:
+    case PCI_EXP_TYPE_ROOT_EC:
+      return NULL;
+    default:
+      return pci_topo_upstream(d);
+    }
+}
+
+/*
+ *  Called whenever the list of devices changes, so it takes the same lock
+ *  as topo_get(). The devices forget their buses, so that freeing a device
+ *  which is not a part of the graph (e.g., a probe handle) keeps it.
+ */
+void
+pci_topo_free(struct pci_access *a)
+{
+  struct pci_topology *t;
+  struct pci_dev *d;
+
+  pci_lock(a, PCI_LOCK_FILL);
+  if (t = a->topology)
+    {
+      for (d = a->devices; d; d = d->next)
+	d->topo_bus = d->topo_secondary = NULL;
+      pci_mfree(t->buses);
+      pci_mfree(t->devs);
+      pci_mfree(t);
+      a->topology = NULL;
+    }
+  pci_unlock(a, PCI_LOCK_FILL);
+}
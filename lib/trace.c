@@ -0,0 +1,66 @@
+/*
+ *	The PCI Library -- Tracing of Config Space Accesses
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "internal.h"
+
+#ifdef PCI_HAVE_USDT
+/*
+ *  The semaphores are incremented by the tracer when it attaches to a probe,
+ *  so that we measure time only if somebody listens.
+ */
+#define USDT_SEMAPHORE(name) unsigned short libpci_##name##_semaphore __attribute__((unused, section(".probes")))
+USDT_SEMAPHORE(read);
+USDT_SEMAPHORE(write);
+USDT_SEMAPHORE(method_read);
+USDT_SEMAPHORE(method_write);
+#endif
+
+void
+pci_set_trace(struct pci_access *a, pci_trace_fn *fn, void *data)
+{
+  a->trace = fn;
+  a->trace_data = data;
+}
+
+void
+pci_trace(struct pci_dev *d, enum pci_trace_event event, int pos, byte *buf, int len, int ok, u64 start)
+{
+  struct pci_access *a = d->access;
+  struct pci_trace_record rec = {
+    .event = event,
+    .dev = d,
+    .pos = pos,
+    .len = len,
+    .buf = buf,
+    .ok = ok,
+  };
+
+  if (start)
+    rec.ns = pci_stats_start() - start;
+  if (a->trace)
+    a->trace(a, &rec, a->trace_data);
+
+#ifdef PCI_HAVE_USDT
+#define USDT_PROBE(name) DTRACE_PROBE8(libpci, name, d->domain, d->bus, d->dev, d->func, pos, len, ok, rec.ns)
+  switch (event)
+    {
+    case PCI_TRACE_READ:
+      USDT_PROBE(read);
+      break;
+    case PCI_TRACE_WRITE:
+      USDT_PROBE(write);
+      break;
+    case PCI_TRACE_METHOD_READ:
+      USDT_PROBE(method_read);
+      break;
+    case PCI_TRACE_METHOD_WRITE:
+      USDT_PROBE(method_write);
+      break;
+    }
+#endif
+}
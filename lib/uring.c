@@ -0,0 +1,182 @@
+/*
+ *	The PCI Library -- Batched reads via Linux io_uring
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*
+ *  We talk to the kernel directly, so that we do not need liburing.
+ *  Only the subset needed for submitting a batch of IORING_OP_READV
+ *  requests and waiting for all of them is implemented.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "internal.h"
+#include "uring.h"
+
+struct pci_uring {
+  struct pci_access *access;
+  int fd;
+  unsigned int entries;
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_size, cq_ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned int *sq_tail, *sq_mask, *sq_array;
+  unsigned int *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+struct pci_uring *
+pci_uring_open(struct pci_access *a, unsigned int entries)
+{
+  struct io_uring_params p;
+  struct pci_uring *r;
+  int fd, single_mmap = 0;
+
+  memset(&p, 0, sizeof(p));
+  fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (fd < 0)
+    {
+      a->debug("io_uring not available: %s\n", strerror(errno));
+      return NULL;
+    }
+
+  r = pci_malloc(a, sizeof(*r));
+  memset(r, 0, sizeof(*r));
+  r->access = a;
+  r->fd = fd;
+  r->entries = p.sq_entries;
+  r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      single_mmap = 1;
+      if (r->cq_ring_size > r->sq_ring_size)
+	r->sq_ring_size = r->cq_ring_size;
+      r->cq_ring_size = 0;
+    }
+#endif
+
+  r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (r->sq_ring == MAP_FAILED)
+    goto fail_sq;
+  if (single_mmap)
+    r->cq_ring = r->sq_ring;
+  else
+    {
+      r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (r->cq_ring == MAP_FAILED)
+	goto fail_cq;
+    }
+  r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED)
+    goto fail_sqes;
+
+  r->sq_tail = (unsigned int *)((char *) r->sq_ring + p.sq_off.tail);
+  r->sq_mask = (unsigned int *)((char *) r->sq_ring + p.sq_off.ring_mask);
+  r->sq_array = (unsigned int *)((char *) r->sq_ring + p.sq_off.array);
+  r->cq_head = (unsigned int *)((char *) r->cq_ring + p.cq_off.head);
+  r->cq_tail = (unsigned int *)((char *) r->cq_ring + p.cq_off.tail);
+  r->cq_mask = (unsigned int *)((char *) r->cq_ring + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)((char *) r->cq_ring + p.cq_off.cqes);
+  a->debug("io_uring: using ring with %u entries\n", r->entries);
+  return r;
+
+fail_sqes:
+  if (!single_mmap)
+    munmap(r->cq_ring, r->cq_ring_size);
+fail_cq:
+  munmap(r->sq_ring, r->sq_ring_size);
+fail_sq:
+  a->debug("io_uring: cannot map rings: %s\n", strerror(errno));
+  close(fd);
+  pci_mfree(r);
+  return NULL;
+}
+
+void
+pci_uring_close(struct pci_uring *r)
+{
+  munmap(r->sqes, r->sqes_size);
+  if (r->cq_ring != r->sq_ring)
+    munmap(r->cq_ring, r->cq_ring_size);
+  munmap(r->sq_ring, r->sq_ring_size);
+  close(r->fd);
+  pci_mfree(r);
+}
+
+static int
+pci_uring_batch(struct pci_uring *r, struct pci_uring_io *io, int n)
+{
+  unsigned int tail = *r->sq_tail;
+  unsigned int head;
+  int i, pending, unsubmitted;
+
+  for (i = 0; i < n; i++)
+    {
+      unsigned int idx = tail & *r->sq_mask;
+      struct io_uring_sqe *sqe = &r->sqes[idx];
+
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READV;
+      sqe->fd = io[i].fd;
+      sqe->off = io[i].offset;
+      sqe->addr = (unsigned long) io[i].iov;
+      sqe->len = io[i].iovcnt;
+      sqe->user_data = i;
+      r->sq_array[idx] = idx;
+      tail++;
+    }
+  __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+  unsubmitted = pending = n;
+  while (pending)
+    {
+      int ret = syscall(__NR_io_uring_enter, r->fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+      if (ret < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  r->access->warning("io_uring_enter failed: %s", strerror(errno));
+	  return -1;
+	}
+      unsubmitted -= ret;
+
+      head = *r->cq_head;
+      while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+	{
+	  struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+	  if (cqe->user_data < (unsigned long) n)
+	    io[cqe->user_data].res = cqe->res;
+	  head++;
+	  pending--;
+	}
+      __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+  return 0;
+}
+
+int
+pci_uring_readv(struct pci_uring *r, struct pci_uring_io *io, int n)
+{
+  while (n > 0)
+    {
+      int batch = (n > (int) r->entries) ? (int) r->entries : n;
+      if (pci_uring_batch(r, io, batch) < 0)
+	return -1;
+      io += batch;
+      n -= batch;
+    }
+  return 0;
+}
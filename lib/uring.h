@@ -0,0 +1,30 @@
+/*
+ *	The PCI Library -- Batched reads via Linux io_uring
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <sys/uio.h>
+
+struct pci_uring;
+
+struct pci_uring_io {
+  int fd;
+  long long offset;
+  struct iovec *iov;
+  int iovcnt;
+  int res;				/* Filled by pci_uring_readv(): bytes read or -errno */
+};
+
+/* Returns NULL if io_uring is not supported by the kernel or forbidden */
+struct pci_uring *pci_uring_open(struct pci_access *a, unsigned int entries);
+void pci_uring_close(struct pci_uring *r);
+
+/*
+ * Submit all requests and wait for their completion. Returns 0 on success,
+ * -1 if the ring itself failed (then the results are undefined and the caller
+ * should fall back to synchronous reads).
+ */
+int pci_uring_readv(struct pci_uring *r, struct pci_uring_io *io, int n);
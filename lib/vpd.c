@@ -0,0 +1,177 @@
+/*
+ *	The PCI Library -- Vital Product Data
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <string.h>
+
+#include "internal.h"
+
+/*
+ *  Every access to the VPD is a slow transaction polled by the kernel, so we
+ *  read the image once when PCI_FILL_VPD is requested and keep it (together
+ *  with a table of keywords) in the device's arena. Each resource is read by
+ *  a single call, which also fetches the header of the next resource; only
+ *  if the hardware refuses to give us a whole resource, we fall back to reading
+ *  byte by byte. The image ends where the walk stopped: after the end tag,
+ *  after the header of an unknown resource, or at the first unreadable byte.
+ */
+
+#define VPD_SIZE (PCI_VPD_ADDR_MASK + 1)
+
+struct vpd_keyword {
+  char id[2];
+  u8 tag;				/* 0x90 for read-only fields, 0x91 for read-write */
+  u8 len;
+  u16 pos;				/* Position of the value in the image */
+};
+
+struct pci_vpd {
+  int len;				/* Length of the image */
+  int num_keywords;
+  byte *image;
+  struct vpd_keyword keywords[];
+};
+
+struct vpd_reader {
+  struct pci_dev *dev;
+  byte *buf;
+  int have;				/* Number of bytes read so far */
+  struct vpd_keyword *kw;
+  int num_kw, max_kw;
+};
+
+/* Try to read the image up to the given end, without retrying */
+static int
+vpd_try(struct vpd_reader *r, int end)
+{
+  if (end <= r->have)
+    return 1;
+  if (end > VPD_SIZE)
+    return 0;
+  r->buf = pci_realloc(r->dev->access, r->buf, end);
+  if (!pci_read_vpd(r->dev, r->have, r->buf + r->have, end - r->have))
+    return 0;
+  r->have = end;
+  return 1;
+}
+
+/* The same, but if it fails, salvage as many bytes as possible */
+static int
+vpd_need(struct vpd_reader *r, int end)
+{
+  if (vpd_try(r, end))
+    return 1;
+  if (end > VPD_SIZE)
+    return 0;
+  while (r->have < end && r->have < VPD_SIZE && pci_read_vpd(r->dev, r->have, r->buf + r->have, 1))
+    r->have++;
+  return 0;
+}
+
+static void
+vpd_scan_keywords(struct vpd_reader *r, int pos, int end, u8 tag)
+{
+  while (pos + 3 <= end && r->buf[pos+2] <= end - pos - 3)
+    {
+      struct vpd_keyword *k;
+      if (r->num_kw >= r->max_kw)
+	{
+	  r->max_kw = 2*r->max_kw + 16;
+	  r->kw = pci_realloc(r->dev->access, r->kw, r->max_kw * sizeof(struct vpd_keyword));
+	}
+      k = &r->kw[r->num_kw++];
+      k->id[0] = r->buf[pos];
+      k->id[1] = r->buf[pos+1];
+      k->tag = tag;
+      k->len = r->buf[pos+2];
+      k->pos = pos + 3;
+      pos += 3 + k->len;
+    }
+}
+
+void
+pci_fill_vpd(struct pci_dev *d)
+{
+  struct vpd_reader r = { .dev = d };
+  struct pci_vpd *vpd;
+  int pos = 0, res_len, ok;
+  byte tag;
+
+  d->vpd = NULL;
+  if (vpd_try(&r, 3) || vpd_need(&r, 1))
+    while (pos < r.have)
+      {
+	tag = r.buf[pos];
+	if (tag & 0x80)
+	  {
+	    if (!vpd_need(&r, pos + 3))
+	      break;
+	    res_len = r.buf[pos+1] + (r.buf[pos+2] << 8);
+	    pos += 3;
+	  }
+	else
+	  {
+	    res_len = tag & 7;
+	    tag >>= 3;
+	    pos++;
+	  }
+	if (res_len > VPD_SIZE - pos || tag == 0x0f)
+	  break;
+	if (tag != 0x82 && tag != 0x90 && tag != 0x91)
+	  break;
+	/* Read the resource together with the header of the next one */
+	ok = vpd_try(&r, pos + res_len + 3) || vpd_try(&r, pos + res_len + 1) || vpd_need(&r, pos + res_len);
+	if (tag != 0x82)
+	  vpd_scan_keywords(&r, pos, (ok ? pos + res_len : r.have), tag);
+	if (!ok)
+	  break;
+	pos += res_len;
+      }
+
+  if (r.have)
+    {
+      vpd = pci_dev_alloc(d, sizeof(*vpd) + r.num_kw * sizeof(struct vpd_keyword) + r.have);
+      vpd->len = r.have;
+      vpd->num_keywords = r.num_kw;
+      vpd->image = (byte *) &vpd->keywords[r.num_kw];
+      memcpy(vpd->keywords, r.kw, r.num_kw * sizeof(struct vpd_keyword));
+      memcpy(vpd->image, r.buf, r.have);
+      d->vpd = vpd;
+      d->access->debug("%04x:%02x:%02x.%d: Read %d bytes of VPD with %d keywords\n",
+	d->domain, d->bus, d->dev, d->func, vpd->len, vpd->num_keywords);
+    }
+  pci_mfree(r.kw);
+  pci_mfree(r.buf);
+}
+
+u8 *
+pci_get_vpd(struct pci_dev *d, int *len)
+{
+  if (!d->vpd)
+    return NULL;
+  if (len)
+    *len = d->vpd->len;
+  return d->vpd->image;
+}
+
+u8 *
+pci_find_vpd_keyword(struct pci_dev *d, char *keyword, int *len)
+{
+  struct pci_vpd *vpd = d->vpd;
+  int i;
+
+  if (!vpd)
+    return NULL;
+  for (i = 0; i < vpd->num_keywords; i++)
+    if (vpd->keywords[i].id[0] == keyword[0] && vpd->keywords[i].id[1] == keyword[1])
+      {
+	if (len)
+	  *len = vpd->keywords[i].len;
+	return vpd->image + vpd->keywords[i].pos;
+      }
+  return NULL;
+}
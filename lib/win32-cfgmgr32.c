@@ -515,6 +515,53 @@ out:
   return driver_path;
 }
 
+/*
+ * Many devices (e.g., SR-IOV virtual functions) share one driver service, so
+ * fill_drivers() remembers the driver path of every service it has queried.
+ * Failures are remembered too, which also avoids repeating their warnings.
+ */
+struct service_driver {
+  struct service_driver *next;
+  char *driver_path;                    /* NULL if the service has no usable driver */
+  WCHAR service_name[];
+};
+
+static char *
+get_driver_path_for_service_cached(struct pci_access *a, LPCWSTR service_name, SC_HANDLE manager, struct service_driver **cache)
+{
+  struct service_driver *s;
+
+  for (s = *cache; s; s = s->next)
+    if (wcscmp(s->service_name, service_name) == 0)
+      break;
+
+  if (!s)
+    {
+      s = pci_malloc(a, sizeof(*s) + sizeof(WCHAR) * (wcslen(service_name) + 1));
+      wcscpy(s->service_name, service_name);
+      s->driver_path = get_driver_path_for_service(a, service_name, manager);
+      s->next = *cache;
+      *cache = s;
+    }
+
+  return s->driver_path ? pci_strdup(a, s->driver_path) : NULL;
+}
+
+static void
+free_service_drivers(struct service_driver *cache)
+{
+  struct service_driver *s;
+
+  while (cache)
+    {
+      s = cache;
+      cache = s->next;
+      if (s->driver_path)
+        pci_mfree(s->driver_path);
+      pci_mfree(s);
+    }
+}
+
 static HKEY
 get_device_driver_devreg(struct pci_access *a, DEVINST devinst, DEVINSTID_A devinst_id)
 {
@@ -759,7 +806,7 @@ retry_subname:
 }
 
 static char *
-get_device_driver_path(struct pci_dev *d, SC_HANDLE manager, BOOL manager_supported)
+get_device_driver_path(struct pci_dev *d, SC_HANDLE manager, BOOL manager_supported, struct service_driver **service_cache)
 {
   struct pci_access *a = d->access;
   BOOL service_supported = TRUE;
@@ -792,7 +839,7 @@ get_device_driver_path(struct pci_dev *d, SC_HANDLE manager, BOOL manager_suppor
     goto out;
   else if (service_name && manager)
     {
-      driver_path = get_driver_path_for_service(d->access, service_name, manager);
+      driver_path = get_driver_path_for_service_cached(d->access, service_name, manager, service_cache);
       goto out;
     }
 
@@ -815,6 +862,7 @@ out:
 static void
 fill_drivers(struct pci_access *a)
 {
+  struct service_driver *service_cache = NULL;
   BOOL manager_supported;
   SC_HANDLE manager;
   struct pci_dev *d;
@@ -835,7 +883,7 @@ fill_drivers(struct pci_access *a)
 
   for (d = a->devices; d; d = d->next)
     {
-      driver = get_device_driver_path(d, manager, manager_supported);
+      driver = get_device_driver_path(d, manager, manager_supported, &service_cache);
       if (driver)
         {
           pci_set_property(d, PCI_FILL_DRIVER, driver);
@@ -844,6 +892,7 @@ fill_drivers(struct pci_access *a)
       d->known_fields |= PCI_FILL_DRIVER;
     }
 
+  free_service_drivers(service_cache);
   if (manager)
     CloseServiceHandle(manager);
 }
@@ -1531,6 +1580,53 @@ scan_devinst_id(struct pci_access *a, DEVINSTID_A devinst_id)
     }
 }
 
+/*
+ * Switch parent fields from cfgmgr32 devinst handles to pci_dev. The handles
+ * of all devices are put to an open-addressing hash table first, so that
+ * the whole pass takes linear time.
+ */
+static void
+resolve_parents(struct pci_access *a)
+{
+  struct pci_dev **table, *d;
+  unsigned int size, mask, i, n;
+  DEVINST devinst;
+
+  n = 0;
+  for (d = a->devices; d; d = d->next)
+    n++;
+  for (size = 16; size < 2*n; size *= 2)
+    ;
+  mask = size - 1;
+  table = pci_malloc(a, size * sizeof(*table));
+  memset(table, 0, size * sizeof(*table));
+
+  for (d = a->devices; d; d = d->next)
+    {
+      i = ((DWORD)(DEVINST)d->backend_data * 0x9e3779b1U) & mask;
+      while (table[i])
+        i = (i + 1) & mask;
+      table[i] = d;
+    }
+
+  for (d = a->devices; d; d = d->next)
+    {
+      devinst = (DEVINST)d->parent;
+      d->parent = NULL;
+      if (devinst)
+        {
+          i = ((DWORD)devinst * 0x9e3779b1U) & mask;
+          while (table[i] && (DEVINST)table[i]->backend_data != devinst)
+            i = (i + 1) & mask;
+          d->parent = table[i];
+        }
+      if (d->parent)
+        d->known_fields |= PCI_FILL_PARENT;
+    }
+
+  pci_mfree(table);
+}
+
 static void
 win32_cfgmgr32_scan(struct pci_access *a)
 {
@@ -1584,18 +1680,7 @@ win32_cfgmgr32_scan(struct pci_access *a)
 
   /* Switch parent fields from cfgmgr32 devinst handle to pci_dev. */
   if (!a->buscentric)
-    {
-      struct pci_dev *d1, *d2;
-      for (d1 = a->devices; d1; d1 = d1->next)
-        {
-          for (d2 = a->devices; d2; d2 = d2->next)
-            if ((DEVINST)d1->parent == (DEVINST)d2->backend_data)
-              break;
-          d1->parent = d2;
-          if (d1->parent)
-            d1->known_fields |= PCI_FILL_PARENT;
-        }
-    }
+    resolve_parents(a);
 
   /* devinst stored in ->backend_data is not needed anymore, clear it. */
   for (d = a->devices; d; d = d->next)
@@ -1696,6 +1781,7 @@ win32_cfgmgr32_cleanup_dev(struct pci_dev *d)
 
   if (dcfg)
     pci_free_dev(dcfg);
+  pci_free_emulated(d);
 }
 
 static void
@@ -1748,7 +1834,7 @@ win32_cfgmgr32_cleanup(struct pci_access *a)
     pci_cleanup(acfg);
 }
 
-struct pci_methods pm_win32_cfgmgr32 = {
+const struct pci_methods pm_win32_cfgmgr32 = {
   .name = "win32-cfgmgr32",
   .help = "Win32 device listing via Configuration Manager",
   .config = win32_cfgmgr32_config,
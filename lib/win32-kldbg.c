@@ -714,7 +714,7 @@ win32_kldbg_write(struct pci_dev *d, int pos, byte *buf, int len)
   return 1;
 }
 
-struct pci_methods pm_win32_kldbg = {
+const struct pci_methods pm_win32_kldbg = {
   .name = "win32-kldbg",
   .help = "Win32 PCI config space access using Kernel Local Debugging Driver",
   .detect = win32_kldbg_detect,
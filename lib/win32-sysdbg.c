@@ -289,7 +289,7 @@ win32_sysdbg_write(struct pci_dev *d, int pos, byte *buf, int len)
   return 1;
 }
 
-struct pci_methods pm_win32_sysdbg = {
+const struct pci_methods pm_win32_sysdbg = {
   .name = "win32-sysdbg",
   .help = "Win32 PCI config space access using NT SysDbg Bus Data interface",
   .detect = win32_sysdbg_detect,
@@ -12,6 +12,7 @@
 #define _LMR_H
 
 #include <stdbool.h>
+#include <stdio.h>
 
 #include "pciutils.h"
 
@@ -119,6 +120,13 @@ struct margin_com_args {
   bool save_csv;
   char *dir_for_csv;
   u8 dwell_time;
+  u8 threads;        // Max number of links margined concurrently
+  bool numa_bind;    // Bind margining threads to NUMA nodes of the links
+  bool fast_search;  // Bisection with adaptive dwell time instead of linear stepping
+  FILE *stream;      // Results of lanes are written there as soon as they are known
+  bool stream_json;  // NDJSON instead of CSV
+  u16 runs;          // Number of repeated runs, aggregated if more than 1
+  u16 run;           // Current run, from 1
 };
 
 struct margin_recv_args {
@@ -134,7 +142,7 @@ struct margin_link_args {
   struct margin_com_args *common;
   u8 steps_t;        // 0 == use NumTimingSteps
   u8 steps_v;        // 0 == use NumVoltageSteps
-  u8 parallel_lanes; // [1; MaxLanes + 1]
+  u8 parallel_lanes; // [1; MaxLanes + 1], 0 == as many as the Receiver supports
   u8 recvs[6];       // Receivers Numbers
   u8 recvs_n;        // 0 == margin all available receivers
   struct margin_recv_args recv_args[6];
@@ -146,6 +154,13 @@ struct margin_link {
   struct margin_dev down_port;
   struct margin_dev up_port;
   struct margin_link_args args;
+
+  /* Receiver parameters already read from the hardware, indexed by Receiver Number.
+     They stay valid as long as margin_prep_link() finds the devices in the same state. */
+  struct margin_params recv_params[7];
+  bool recv_lane_reversal[7];
+  u8 recv_params_valid; // Bit mask by Receiver Number
+  bool prepared;        // Saved Device settings are from an earlier preparation
 };
 
 /* Receiver structure */
@@ -216,12 +231,34 @@ void margin_restore_link(struct margin_link *link);
 bool margin_read_params(struct pci_access *pacc, struct pci_dev *dev, u8 recvn,
                         struct margin_params *params);
 
+/* The same for a Receiver of a filled link, remembering the parameters in the link */
+bool margin_read_link_params(struct margin_link *link, u8 recvn, struct margin_params *params);
+
+/* Number of lanes of the Receiver to margin simultaneously */
+u8 margin_recv_parallel_lanes(struct margin_link_args *args, struct margin_params *params);
+
+/* Maximum number of margining steps needed to test the selected lanes of the Receiver
+   when parallel_lanes of them are margined simultaneously */
+u64 margin_recv_steps(struct margin_link_args *args, struct margin_params *params,
+                      u8 parallel_lanes);
+
 enum margin_test_status margin_process_args(struct margin_link *link);
 
 /* Awaits that links are prepared through process_args.
    Returns number of margined Receivers through recvs_n */
 struct margin_results *margin_test_link(struct margin_link *link, u8 *recvs_n);
 
+/* Called in link order after the link has been margined (if tested) and its log printed */
+typedef void margin_link_done_fn(struct margin_link *link, bool tested,
+                                 struct margin_results *results);
+
+/* Run margin_test_link() on links with tested[i] set, up to threads of them concurrently.
+   Logs of the links are printed in whole and in link order. With numa_bind, each thread
+   moves to the NUMA node of the Downstream Port of the link it is margining. */
+void margin_test_links(struct margin_link *links, u8 links_n, bool *tested, u8 threads,
+                       bool numa_bind, struct margin_results **results, u8 *results_n,
+                       margin_link_done_fn *done);
+
 void margin_free_results(struct margin_results *results, u8 results_n);
 
 /* margin_log */
@@ -231,6 +268,9 @@ extern bool margin_print_domain;
 
 void margin_log(char *format, ...);
 
+/* Send log of the calling thread to the given file (NULL = stdout) */
+void margin_log_redirect(FILE *file);
+
 /* b:d.f -> b:d.f */
 void margin_log_bdfs(struct pci_dev *down_port, struct pci_dev *up_port);
 void margin_gen_bdfs(struct pci_dev *down_port, struct pci_dev *up_port, char *dest, size_t maxlen);
@@ -269,4 +309,36 @@ void margin_results_print_brief(struct margin_results *results, u8 recvs_n,
 
 void margin_results_save_csv(struct margin_results *results, u8 recvs_n, struct margin_link *link);
 
+/* Write results of lanes just margined in one direction to the stream */
+void margin_results_stream(struct margin_link *link, struct margin_results *results,
+                           struct margin_lanes_data *data);
+
+/* Open the stream and write the CSV header */
+void margin_results_stream_open(struct margin_com_args *args, char *path, char *format);
+
+/* Statistics of results of one Receiver over repeated runs. Steps reached in each direction
+   are counted in histograms, so individual runs need not be kept. */
+struct margin_agg_lane {
+  u8 lane;
+  u8 min[4];
+  u16 hist[4][128]; // Number of runs by steps reached, by direction
+};
+
+struct margin_agg_recv {
+  struct margin_results res; // Of the first successful run, without lanes
+  u16 runs;
+  struct margin_agg_lane *lanes;
+};
+
+struct margin_agg {
+  u8 recvs_n;
+  struct margin_agg_recv recvs[6];
+};
+
+void margin_agg_add(struct margin_agg *agg, struct margin_results *results, u8 recvs_n);
+
+void margin_agg_print(struct margin_agg *agg);
+
+void margin_agg_free(struct margin_agg *agg);
+
 #endif
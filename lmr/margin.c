@@ -10,6 +10,7 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "lmr.h"
@@ -18,6 +19,10 @@
 #include <unistd.h>
 #endif
 
+#ifdef PCI_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 /* Macro helpers for Margining command parsing */
 
 typedef u16 margin_cmd;
@@ -116,6 +121,34 @@ msleep(long msec)
 #endif
 }
 
+/*
+ *  When links are margined concurrently (see margin_test_links()), all work
+ *  (including accesses to the PCI library, which is not thread-safe) is done
+ *  under a global lock, which is released only while waiting for the hardware.
+ *  Since margining spends almost all its time waiting, this is enough.
+ */
+
+#ifdef PCI_HAVE_PTHREAD
+
+static pthread_mutex_t margin_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool margin_threaded;
+
+static void
+margin_wait(long msec)
+{
+  if (margin_threaded)
+    pthread_mutex_unlock(&margin_lock);
+  msleep(msec);
+  if (margin_threaded)
+    pthread_mutex_lock(&margin_lock);
+}
+
+#else
+
+#define margin_wait(msec) msleep(msec)
+
+#endif
+
 static margin_cmd
 margin_make_cmd(u8 payload, u8 type, u8 recvn)
 {
@@ -123,23 +156,82 @@ margin_make_cmd(u8 payload, u8 type, u8 recvn)
          | SET_REG_MASK(0, LMR_CMD_RECVN, recvn);
 }
 
+/*
+ *  The receiver acknowledges a command by reflecting it in the Lane Status
+ *  register within 10 ms. Instead of always sleeping for the whole time,
+ *  we poll the register every millisecond.
+ */
+
+#define MARGIN_CMD_TIMEOUT_MS 10
+
+static margin_cmd
+margin_read_status(struct margin_dev *dev, u8 lane)
+{
+  return pci_read_word(dev->dev, LMR_LANE_STATUS(dev->lmr_cap_addr, lane));
+}
+
+static bool
+margin_report_matches(margin_cmd status, margin_cmd cmd)
+{
+  return GET_REG_MASK(status, LMR_CMD_TYPE) == GET_REG_MASK(cmd, LMR_CMD_TYPE)
+         && GET_REG_MASK(status, LMR_CMD_RECVN) == GET_REG_MASK(cmd, LMR_CMD_RECVN);
+}
+
 static bool
 margin_set_cmd(struct margin_dev *dev, u8 lane, margin_cmd cmd)
 {
   pci_write_word(dev->dev, LMR_LANE_CTRL(dev->lmr_cap_addr, lane), cmd);
-  msleep(10);
-  return pci_read_word(dev->dev, LMR_LANE_STATUS(dev->lmr_cap_addr, lane)) == cmd;
+  for (int waited = 0; margin_read_status(dev, lane) != cmd; waited++)
+    {
+      if (waited >= MARGIN_CMD_TIMEOUT_MS)
+        return false;
+      margin_wait(1);
+    }
+  return true;
+}
+
+/* Send the same command to multiple lanes at once (only to those with which[i] set if given) */
+static void
+margin_set_cmd_lanes(struct margin_lanes_data *arg, bool *which, margin_cmd cmd)
+{
+  struct margin_dev *dev = arg->recv->dev;
+  bool pending[32] = { 0 };
+  bool any = false;
+
+  for (int i = 0; i < arg->lanes_n; i++)
+    if (!which || which[i])
+      {
+        pci_write_word(dev->dev, LMR_LANE_CTRL(dev->lmr_cap_addr, arg->results[i].lane), cmd);
+        pending[i] = any = true;
+      }
+
+  for (int waited = 0; any && waited <= MARGIN_CMD_TIMEOUT_MS; waited++)
+    {
+      if (waited)
+        margin_wait(1);
+      any = false;
+      for (int i = 0; i < arg->lanes_n; i++)
+        if (pending[i])
+          {
+            pending[i] = margin_read_status(dev, arg->results[i].lane) != cmd;
+            any |= pending[i];
+          }
+    }
 }
 
 static bool
 margin_report_cmd(struct margin_dev *dev, u8 lane, margin_cmd cmd, margin_cmd *result)
 {
+  /* The status shows NO_COMMAND before, so it cannot contain a stale response */
   pci_write_word(dev->dev, LMR_LANE_CTRL(dev->lmr_cap_addr, lane), cmd);
-  msleep(10);
-  *result = pci_read_word(dev->dev, LMR_LANE_STATUS(dev->lmr_cap_addr, lane));
-  return GET_REG_MASK(*result, LMR_CMD_TYPE) == GET_REG_MASK(cmd, LMR_CMD_TYPE)
-         && GET_REG_MASK(*result, LMR_CMD_RECVN) == GET_REG_MASK(cmd, LMR_CMD_RECVN)
-         && margin_set_cmd(dev, lane, NO_COMMAND);
+  for (int waited = 0; !margin_report_matches(*result = margin_read_status(dev, lane), cmd);
+       waited++)
+    {
+      if (waited >= MARGIN_CMD_TIMEOUT_MS)
+        return false;
+      margin_wait(1);
+    }
+  return margin_set_cmd(dev, lane, NO_COMMAND);
 }
 
 static void
@@ -212,6 +304,46 @@ read_params_internal(struct margin_dev *dev, u8 recvn, bool lane_reversal,
   return status;
 }
 
+/* Read parameters of a Receiver of the prepared link unless they are known already */
+static bool
+read_link_params(struct margin_link *link, u8 recvn, struct margin_params *params,
+                 bool *lane_reversal)
+{
+  struct margin_dev *dev = recvn == 6 ? &link->up_port : &link->down_port;
+
+  if (!(link->recv_params_valid & (1 << recvn)))
+    {
+      if (read_params_internal(dev, recvn, false, &link->recv_params[recvn]))
+        link->recv_lane_reversal[recvn] = false;
+      else if (read_params_internal(dev, recvn, true, &link->recv_params[recvn]))
+        link->recv_lane_reversal[recvn] = true;
+      else
+        return false;
+      link->recv_params_valid |= 1 << recvn;
+    }
+  *params = link->recv_params[recvn];
+  *lane_reversal = link->recv_lane_reversal[recvn];
+  return true;
+}
+
+static void
+margin_setup_lanes(struct margin_lanes_data *arg)
+{
+  margin_set_cmd_lanes(arg, NULL, NO_COMMAND);
+  margin_set_cmd_lanes(arg, NULL, SET_ERROR_LIMIT(arg->recv->error_limit, arg->recv->recvn));
+  margin_set_cmd_lanes(arg, NULL, NO_COMMAND);
+}
+
+static void
+margin_reset_lanes(struct margin_lanes_data *arg, bool *which)
+{
+  margin_set_cmd_lanes(arg, which, NO_COMMAND);
+  margin_set_cmd_lanes(arg, which, CLEAR_ERROR_LOG(arg->recv->recvn));
+  margin_set_cmd_lanes(arg, which, NO_COMMAND);
+  margin_set_cmd_lanes(arg, which, GO_TO_NORMAL_SETTINGS(arg->recv->recvn));
+  margin_set_cmd_lanes(arg, which, NO_COMMAND);
+}
+
 /* Margin all lanes_n lanes simultaneously */
 static void
 margin_test_lanes(struct margin_lanes_data arg)
@@ -236,12 +368,9 @@ margin_test_lanes(struct margin_lanes_data arg)
   bool failed_lanes[32] = { 0 };
   u8 alive_lanes = arg.lanes_n;
 
+  margin_setup_lanes(&arg);
   for (int i = 0; i < arg.lanes_n; i++)
     {
-      margin_set_cmd(arg.recv->dev, arg.results[i].lane, NO_COMMAND);
-      margin_set_cmd(arg.recv->dev, arg.results[i].lane,
-                     SET_ERROR_LIMIT(arg.recv->error_limit, arg.recv->recvn));
-      margin_set_cmd(arg.recv->dev, arg.results[i].lane, NO_COMMAND);
       arg.results[i].steps[arg.dir] = arg.steps_lane_total;
       arg.results[i].statuses[arg.dir] = MARGIN_THR;
     }
@@ -264,7 +393,7 @@ margin_test_lanes(struct margin_lanes_data arg)
               pci_write_word(arg.recv->dev->dev, ctrl_addr, step_cmd);
             }
         }
-      msleep(arg.recv->dwell_time * 1000);
+      margin_wait(arg.recv->dwell_time * 1000);
 
       for (int i = 0; i < arg.lanes_n; i++)
         {
@@ -292,21 +421,192 @@ margin_test_lanes(struct margin_lanes_data arg)
       margin_log_margining(arg);
     }
 
+  margin_reset_lanes(&arg, NULL);
+}
+
+/*
+ *  Fast search for the margin of all lanes_n lanes (see -a). Each lane is
+ *  searched for its last passing step by bisection, using a shortened dwell
+ *  time, as far from the eye edge the error counter stays at zero anyway.
+ *  If any errors are seen at the end of the short dwell, the step is dwelt
+ *  on for the full time. Once the lanes fail, waiting is cut short. Finally,
+ *  the found steps are confirmed with the full dwell time, stepping back
+ *  if the confirmation fails. For receivers with monotonic behavior the
+ *  results are the same as of the linear search.
+ */
+
+#define MARGIN_POLL_MS 100
+
+struct margin_fast_lane {
+  u8 pass;                          // Last step known to pass
+  u8 fail;                          // First step known to fail (steps_lane_total + 1 if none)
+  bool confirmed;                   // pass was measured with the full dwell time
+  enum margin_step_exec_sts status; // Status of the failure at fail
+  u8 probe;                         // Step being probed, 0 if none
+};
+
+static margin_cmd
+margin_step_cmd(struct margin_lanes_data *arg, u8 step)
+{
+  if (arg->dir == TIM_LEFT || arg->dir == TIM_RIGHT)
+    return MARG_TIM(arg->dir == TIM_LEFT, step, arg->recv->recvn);
+  else
+    return MARG_VOLT(arg->dir == VOLT_DOWN, step, arg->recv->recvn);
+}
+
+/* Probe all lanes with non-zero probe steps at once, update pass/fail */
+static void
+margin_probe_lanes(struct margin_lanes_data *arg, struct margin_fast_lane *fl, long short_ms,
+                   long full_ms)
+{
+  struct margin_recv *recv = arg->recv;
+  u8 marg_type = (arg->dir == TIM_LEFT || arg->dir == TIM_RIGHT) ? 3 : 4;
+  bool failed[32] = { 0 };
+  long dwell_ms = short_ms, waited = 0;
+
+  for (int i = 0; i < arg->lanes_n; i++)
+    if (fl[i].probe)
+      pci_write_word(recv->dev->dev, LMR_LANE_CTRL(recv->dev->lmr_cap_addr, arg->results[i].lane),
+                     margin_step_cmd(arg, fl[i].probe));
+
+  for (;;)
+    {
+      long slice = dwell_ms - waited < MARGIN_POLL_MS ? dwell_ms - waited : MARGIN_POLL_MS;
+      if (slice > 0)
+        {
+          margin_wait(slice);
+          waited += slice;
+        }
+
+      bool alive = false, errors = false;
+      for (int i = 0; i < arg->lanes_n; i++)
+        if (fl[i].probe && !failed[i])
+          {
+            margin_cmd lane_status = pci_read_word(
+              recv->dev->dev, LMR_LANE_STATUS(recv->dev->lmr_cap_addr, arg->results[i].lane));
+            u8 step_status = GET_REG_MASK(lane_status, LMR_PLD_MARGIN_STS);
+            u8 err_cnt = GET_REG_MASK(lane_status, LMR_PLD_ERR_CNT);
+            bool valid = GET_REG_MASK(lane_status, LMR_CMD_TYPE) == marg_type
+                         && GET_REG_MASK(lane_status, LMR_CMD_RECVN) == recv->recvn;
+            if (waited < dwell_ms && !(valid && (step_status == 0 || step_status == 3
+                                                 || err_cnt > recv->error_limit)))
+              {
+                alive = true;
+                errors |= valid && err_cnt > 0;
+                continue;
+              }
+            if (valid && step_status == 2 && err_cnt <= recv->error_limit)
+              {
+                alive = true;
+                errors |= err_cnt > 0;
+                continue;
+              }
+            failed[i] = true;
+            fl[i].status = (step_status == 3 || step_status == 1 ? MARGIN_NAK : MARGIN_LIM);
+          }
+
+      if (!alive)
+        break;
+      if (waited >= dwell_ms)
+        {
+          if (!errors || dwell_ms >= full_ms)
+            break;
+          /* Errors seen: this is close to the edge, so give it the full dwell time */
+          dwell_ms = full_ms;
+        }
+    }
+
+  for (int i = 0; i < arg->lanes_n; i++)
+    if (fl[i].probe)
+      {
+        if (!failed[i] && !margin_set_cmd(recv->dev, arg->results[i].lane, NO_COMMAND))
+          {
+            failed[i] = true;
+            fl[i].status = MARGIN_LIM;
+          }
+        if (failed[i])
+          fl[i].fail = fl[i].probe;
+        else
+          {
+            fl[i].pass = fl[i].probe;
+            fl[i].confirmed = dwell_ms >= full_ms;
+          }
+        fl[i].probe = 0;
+      }
+  margin_reset_lanes(arg, failed);
+
+  arg->steps_lane_done++;
+  if (arg->steps_lane_done > arg->steps_lane_total)
+    arg->steps_lane_done = arg->steps_lane_total;
+  margin_log_margining(*arg);
+}
+
+static void
+margin_test_lanes_fast(struct margin_lanes_data arg)
+{
+  struct margin_fast_lane fl[32];
+  long full_ms = arg.recv->dwell_time * 1000;
+  long short_ms = full_ms / 4;
+  bool more;
+
+  margin_setup_lanes(&arg);
+  for (int i = 0; i < arg.lanes_n; i++)
+    {
+      fl[i] = (struct margin_fast_lane){ .pass = 0,
+                                         .fail = arg.steps_lane_total + 1,
+                                         .confirmed = true,
+                                         .status = MARGIN_THR,
+                                         .probe = 0 };
+    }
+  arg.steps_lane_done = 0;
+
+  /* Bisection with the short dwell time */
+  do
+    {
+      more = false;
+      for (int i = 0; i < arg.lanes_n; i++)
+        if (fl[i].fail - fl[i].pass > 1)
+          {
+            fl[i].probe = (fl[i].pass + fl[i].fail) / 2;
+            more = true;
+          }
+      if (more)
+        margin_probe_lanes(&arg, fl, short_ms, full_ms);
+    }
+  while (more);
+
+  /* Confirmation with the full dwell time */
+  do
+    {
+      more = false;
+      for (int i = 0; i < arg.lanes_n; i++)
+        if (!fl[i].confirmed)
+          {
+            fl[i].probe = fl[i].pass;
+            fl[i].pass = fl[i].pass - 1;
+            more = true;
+          }
+      if (more)
+        margin_probe_lanes(&arg, fl, full_ms, full_ms);
+      for (int i = 0; i < arg.lanes_n; i++)
+        if (!fl[i].confirmed && !fl[i].pass)
+          fl[i].confirmed = true;
+    }
+  while (more);
+
   for (int i = 0; i < arg.lanes_n; i++)
     {
-      margin_set_cmd(arg.recv->dev, arg.results[i].lane, NO_COMMAND);
-      margin_set_cmd(arg.recv->dev, arg.results[i].lane, CLEAR_ERROR_LOG(arg.recv->recvn));
-      margin_set_cmd(arg.recv->dev, arg.results[i].lane, NO_COMMAND);
-      margin_set_cmd(arg.recv->dev, arg.results[i].lane, GO_TO_NORMAL_SETTINGS(arg.recv->recvn));
-      margin_set_cmd(arg.recv->dev, arg.results[i].lane, NO_COMMAND);
+      arg.results[i].steps[arg.dir] = fl[i].pass;
+      arg.results[i].statuses[arg.dir] = fl[i].status;
     }
 }
 
 /* Awaits that Receiver is prepared through prep_dev function */
 static bool
-margin_test_receiver(struct margin_dev *dev, u8 recvn, struct margin_link_args *args,
-                     struct margin_results *results)
+margin_test_receiver(struct margin_link *link, u8 recvn, struct margin_results *results)
 {
+  struct margin_dev *dev = recvn == 6 ? &link->up_port : &link->down_port;
+  struct margin_link_args *args = &link->args;
   u8 *lanes_to_margin = args->lanes;
   u8 lanes_n = args->lanes_n;
 
@@ -315,7 +615,6 @@ margin_test_receiver(struct margin_dev *dev, u8 recvn, struct margin_link_args *
                               .recvn = recvn,
                               .lane_reversal = false,
                               .params = &params,
-                              .parallel_lanes = args->parallel_lanes ? args->parallel_lanes : 1,
                               .error_limit = args->common->error_limit,
                               .dwell_time = args->common->dwell_time };
 
@@ -330,21 +629,16 @@ margin_test_receiver(struct margin_dev *dev, u8 recvn, struct margin_link_args *
       return false;
     }
 
-  if (!read_params_internal(dev, recvn, recv.lane_reversal, &params))
+  if (!read_link_params(link, recvn, &params, &recv.lane_reversal))
     {
-      recv.lane_reversal = true;
-      if (!read_params_internal(dev, recvn, recv.lane_reversal, &params))
-        {
-          margin_log("\nError during caps reading.\n");
-          results->test_status = MARGIN_TEST_CAPS;
-          return false;
-        }
+      margin_log("\nError during caps reading.\n");
+      results->test_status = MARGIN_TEST_CAPS;
+      return false;
     }
 
   results->params = params;
 
-  if (recv.parallel_lanes > params.max_lanes + 1)
-    recv.parallel_lanes = params.max_lanes + 1;
+  recv.parallel_lanes = margin_recv_parallel_lanes(args, &params);
   margin_apply_hw_quirks(&recv, args);
   margin_log_hw_quirks(&recv);
 
@@ -371,6 +665,11 @@ margin_test_receiver(struct margin_dev *dev, u8 recvn, struct margin_link_args *
 
   if (args->common->run_margin)
     {
+      u64 predicted_s = margin_recv_steps(args, &params, recv.parallel_lanes) * recv.dwell_time;
+      time_t start = time(NULL);
+      margin_log("Predicted margining time: at most %um %us\n", (unsigned int)(predicted_s / 60),
+                 (unsigned int)(predicted_s % 60));
+
       if (args->common->verbosity > 0)
         margin_log("\n");
       struct margin_lanes_data lanes_data = { .recv = &recv,
@@ -409,12 +708,22 @@ margin_test_receiver(struct margin_dev *dev, u8 recvn, struct margin_link_args *
                 args->common->steps_utility -= lanes_data.steps_lane_total;
               else
                 args->common->steps_utility = 0;
-              margin_test_lanes(lanes_data);
+              if (args->common->fast_search)
+                margin_test_lanes_fast(lanes_data);
+              else
+                margin_test_lanes(lanes_data);
+              if (args->common->stream)
+                margin_results_stream(link, results, &lanes_data);
             }
           lanes_done += use_lanes;
         }
       if (args->common->verbosity > 0)
         margin_log("\n");
+
+      u64 took_s = time(NULL) - start;
+      margin_log("Margining took %um %us (predicted at most %um %us)\n",
+                 (unsigned int)(took_s / 60), (unsigned int)(took_s % 60),
+                 (unsigned int)(predicted_s / 60), (unsigned int)(predicted_s % 60));
       if (recv.lane_reversal)
         {
           for (int i = 0; i < lanes_n; i++)
@@ -425,6 +734,36 @@ margin_test_receiver(struct margin_dev *dev, u8 recvn, struct margin_link_args *
   return true;
 }
 
+u8
+margin_recv_parallel_lanes(struct margin_link_args *args, struct margin_params *params)
+{
+  u8 max = params->max_lanes + 1;
+
+  if (!args->parallel_lanes || args->parallel_lanes > max)
+    return max;
+  return args->parallel_lanes;
+}
+
+u64
+margin_recv_steps(struct margin_link_args *args, struct margin_params *params, u8 parallel_lanes)
+{
+  u8 steps_t = args->steps_t ? args->steps_t : params->timing_steps;
+  u8 steps_v = args->steps_v ? args->steps_v : params->volt_steps;
+  u64 groups = args->lanes_n / parallel_lanes + ((args->lanes_n % parallel_lanes) > 0);
+
+  /* Directions are margined one after another, all lanes of a group at once */
+  u64 steps = steps_t;
+  if (params->ind_left_right_tim)
+    steps += steps_t;
+  if (params->volt_support)
+    {
+      steps += steps_v;
+      if (params->ind_up_down_volt)
+        steps += steps_v;
+    }
+  return groups * steps;
+}
+
 bool
 margin_read_params(struct pci_access *pacc, struct pci_dev *dev, u8 recvn,
                    struct margin_params *params)
@@ -460,23 +799,27 @@ margin_read_params(struct pci_access *pacc, struct pci_dev *dev, u8 recvn,
   if (!margin_fill_link(down, up, &link))
     return false;
 
-  struct margin_dev *dut = (dev_down ? &link.down_port : &link.up_port);
+  return margin_read_link_params(&link, recvn, params);
+}
+
+bool
+margin_read_link_params(struct margin_link *link, u8 recvn, struct margin_params *params)
+{
+  bool lane_reversal;
+
+  if (link->recv_params_valid & (1 << recvn))
+    return read_link_params(link, recvn, params, &lane_reversal);
+
+  struct margin_dev *dut = recvn == 6 ? &link->up_port : &link->down_port;
   if (!margin_check_ready_bit(dut->dev))
     return false;
 
-  if (!margin_prep_link(&link))
+  if (!margin_prep_link(link))
     return false;
 
-  bool status;
-  bool lane_reversal = false;
-  status = read_params_internal(dut, recvn, lane_reversal, params);
-  if (!status)
-    {
-      lane_reversal = true;
-      status = read_params_internal(dut, recvn, lane_reversal, params);
-    }
+  bool status = read_link_params(link, recvn, params, &lane_reversal);
 
-  margin_restore_link(&link);
+  margin_restore_link(link);
 
   return status;
 }
@@ -550,12 +893,8 @@ margin_test_link(struct margin_link *link, u8 *recvs_n)
 
   if (status)
     {
-      struct margin_dev *dut;
       for (int i = 0; i < receivers_n; i++)
-        {
-          dut = receivers[i] == 6 ? &link->up_port : &link->down_port;
-          margin_test_receiver(dut, receivers[i], args, &results[i]);
-        }
+        margin_test_receiver(link, receivers[i], &results[i]);
 
       margin_restore_link(link);
     }
@@ -564,6 +903,182 @@ margin_test_link(struct margin_link *link, u8 *recvs_n)
   return results;
 }
 
+static void
+margin_test_links_serial(struct margin_link *links, u8 links_n, bool *tested,
+                         struct margin_results **results, u8 *results_n,
+                         margin_link_done_fn *done)
+{
+  for (int i = 0; i < links_n; i++)
+    {
+      if (tested[i])
+        results[i] = margin_test_link(&links[i], &results_n[i]);
+      done(&links[i], tested[i], results[i]);
+    }
+}
+
+#ifdef PCI_HAVE_PTHREAD
+
+struct margin_pool {
+  struct margin_link *links;
+  u8 links_n;
+  bool *tested;
+  bool numa_bind;
+  struct margin_results **results;
+  u8 *results_n;
+  FILE **logs;
+  bool *running;
+  bool *finished;
+  int next;
+  pthread_cond_t finished_cond;
+};
+
+/* The same Link can be specified multiple times, but it must not be margined concurrently */
+static bool
+margin_link_busy(struct margin_pool *pool, int i)
+{
+  for (int j = 0; j < pool->links_n; j++)
+    if (pool->running[j] && (pool->links[j].down_port.dev == pool->links[i].down_port.dev
+                             || pool->links[j].up_port.dev == pool->links[i].up_port.dev))
+      return true;
+  return false;
+}
+
+static void *
+margin_worker(void *arg)
+{
+  struct margin_pool *pool = arg;
+  int bound = -1;
+
+  pthread_mutex_lock(&margin_lock);
+  for (;;)
+    {
+      while (pool->next < pool->links_n && !pool->tested[pool->next])
+        pool->next++;
+      if (pool->next >= pool->links_n)
+        break;
+      int i = pool->next++;
+      while (margin_link_busy(pool, i))
+        pthread_cond_wait(&pool->finished_cond, &margin_lock);
+      pool->running[i] = true;
+      if (pool->numa_bind)
+        {
+          struct pci_dev *down = pool->links[i].down_port.dev;
+          if (down->numa_node >= 0 && down->numa_node != bound
+              && pci_bind_to_node(down->access, down->numa_node))
+            bound = down->numa_node;
+        }
+      margin_log_redirect(pool->logs[i]);
+      pool->results[i] = margin_test_link(&pool->links[i], &pool->results_n[i]);
+      fflush(pool->logs[i]);
+      pool->running[i] = false;
+      pool->finished[i] = true;
+      pthread_cond_broadcast(&pool->finished_cond);
+    }
+  pthread_mutex_unlock(&margin_lock);
+  return NULL;
+}
+
+static void
+margin_copy_log(FILE *log)
+{
+  char buf[1024];
+  size_t n;
+
+  rewind(log);
+  while ((n = fread(buf, 1, sizeof(buf), log)) > 0)
+    fwrite(buf, 1, n, stdout);
+  fclose(log);
+}
+
+void
+margin_test_links(struct margin_link *links, u8 links_n, bool *tested, u8 threads,
+                  bool numa_bind, struct margin_results **results, u8 *results_n,
+                  margin_link_done_fn *done)
+{
+  struct margin_pool pool = { .links = links,
+                              .links_n = links_n,
+                              .tested = tested,
+                              .numa_bind = numa_bind,
+                              .results = results,
+                              .results_n = results_n };
+  pthread_t *workers;
+  int tested_n = 0, workers_n;
+
+  for (int i = 0; i < links_n; i++)
+    tested_n += tested[i];
+  workers_n = threads < tested_n ? threads : tested_n;
+
+  if (workers_n < 2)
+    {
+      margin_test_links_serial(links, links_n, tested, results, results_n, done);
+      return;
+    }
+
+  pool.logs = xmalloc(links_n * sizeof(*pool.logs));
+  for (int i = 0; i < links_n; i++)
+    if (tested[i] && !(pool.logs[i] = tmpfile()))
+      die("Cannot create temporary file for the log: %m");
+
+  /* Nodes are filled now, the workers must not fill devices concurrently */
+  if (numa_bind)
+    for (int i = 0; i < links_n; i++)
+      if (tested[i])
+        pci_fill_info(links[i].down_port.dev, PCI_FILL_NUMA_NODE);
+
+  pool.running = xmalloc(links_n * sizeof(*pool.running));
+  memset(pool.running, 0, links_n * sizeof(*pool.running));
+  pool.finished = xmalloc(links_n * sizeof(*pool.finished));
+  memset(pool.finished, 0, links_n * sizeof(*pool.finished));
+  pthread_cond_init(&pool.finished_cond, NULL);
+  workers = xmalloc(workers_n * sizeof(*workers));
+
+  margin_threaded = true;
+  pthread_mutex_lock(&margin_lock);
+  for (int i = 0; i < workers_n; i++)
+    if (pthread_create(&workers[i], NULL, margin_worker, &pool))
+      {
+        if (!i)
+          die("Cannot start margining threads");
+        workers_n = i;
+        break;
+      }
+
+  for (int i = 0; i < links_n; i++)
+    {
+      if (tested[i])
+        {
+          while (!pool.finished[i])
+            pthread_cond_wait(&pool.finished_cond, &margin_lock);
+          margin_copy_log(pool.logs[i]);
+        }
+      done(&links[i], tested[i], results[i]);
+      fflush(stdout);
+    }
+  pthread_mutex_unlock(&margin_lock);
+
+  for (int i = 0; i < workers_n; i++)
+    pthread_join(workers[i], NULL);
+  margin_threaded = false;
+
+  pthread_cond_destroy(&pool.finished_cond);
+  free(workers);
+  free(pool.running);
+  free(pool.finished);
+  free(pool.logs);
+}
+
+#else
+
+void
+margin_test_links(struct margin_link *links, u8 links_n, bool *tested, u8 threads UNUSED,
+                  bool numa_bind UNUSED, struct margin_results **results, u8 *results_n,
+                  margin_link_done_fn *done)
+{
+  margin_test_links_serial(links, links_n, tested, results, results_n, done);
+}
+
+#endif
+
 void
 margin_free_results(struct margin_results *results, u8 results_n)
 {
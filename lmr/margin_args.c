@@ -29,7 +29,13 @@ const char *usage
     "--scan\t\t\tScan for Links available for margining\n\n"
     "Margining options (see man for all options):\n\n"
     "Common (for all specified links) options:\n"
-    "-c\t\t\tPrint Device Lane Margining Capabilities only. Do not run margining.\n\n"
+    "-c\t\t\tPrint Device Lane Margining Capabilities only. Do not run margining.\n"
+    "-j <links>\t\tMargin up to <links> Links concurrently.\n"
+    "-N\t\t\tBind the concurrent margining threads to NUMA nodes of the Links.\n"
+    "-a\t\t\tFind margins by bisection with adaptive dwell time.\n"
+    "-s <file>\t\tWrite results of lanes to the file as soon as they are known.\n"
+    "-f csv|json\t\tFormat of the results written by -s (default: csv).\n"
+    "-n <runs>\t\tRepeat margining and print minimum and median of the results.\n\n"
     "Link specific options:\n"
     "-r <recvn>[,<recvn>...]\tSpecify Receivers to select margining targets.\n"
     "\t\t\tDefault: all available Receivers (including Retimers).\n"
@@ -128,7 +134,10 @@ parse_dev_args(int argc, char **argv, struct margin_link_args *args, u8 link_spe
             args->steps_v = 127;
             break;
           case 'p':
-            args->parallel_lanes = atoi(optarg);
+            if (!strcmp(optarg, "auto"))
+              args->parallel_lanes = 0;
+            else
+              args->parallel_lanes = atoi(optarg);
             break;
           case 'l':
             args->lanes_n = parse_csv_arg(optarg, args->lanes);
@@ -211,9 +220,18 @@ margin_parse_util_args(struct pci_access *pacc, int argc, char **argv, enum marg
   com_args->dir_for_csv = NULL;
   com_args->save_csv = false;
   com_args->dwell_time = 1;
+  com_args->threads = 1;
+  com_args->numa_bind = false;
+  com_args->fast_search = false;
+  com_args->stream = NULL;
+  com_args->stream_json = false;
+  com_args->runs = 1;
+  com_args->run = 1;
 
+  char *stream_path = NULL;
+  char *stream_format = "csv";
   int c;
-  while ((c = getopt(argc, argv, "+e:co:d:")) != -1)
+  while ((c = getopt(argc, argv, "+e:co:d:j:aNs:f:n:")) != -1)
     {
       switch (c)
         {
@@ -230,11 +248,43 @@ margin_parse_util_args(struct pci_access *pacc, int argc, char **argv, enum marg
           case 'd':
             com_args->dwell_time = atoi(optarg);
             break;
+          case 'a':
+            com_args->fast_search = true;
+            break;
+          case 'N':
+            com_args->numa_bind = true;
+            break;
+          case 'j':
+            com_args->threads = atoi(optarg);
+            if (!com_args->threads)
+              die("Invalid arguments\n\n%s", usage);
+            break;
+          case 's':
+            stream_path = optarg;
+            break;
+          case 'f':
+            stream_format = optarg;
+            break;
+          case 'n':
+            {
+              int runs = atoi(optarg);
+              if (runs < 1 || runs > 0xffff)
+                die("Invalid arguments\n\n%s", usage);
+              com_args->runs = runs;
+            }
+            break;
           default:
             die("Invalid arguments\n\n%s", usage);
         }
     }
 
+  if (!com_args->run_margin)
+    com_args->runs = 1;
+  if (com_args->save_csv && com_args->runs > 1)
+    die("-o cannot be combined with -n, use -s to save the results of repeated runs\n");
+  if (stream_path)
+    margin_results_stream_open(com_args, stream_path, stream_format);
+
   bool status = true;
   if (mode == FULL && optind != argc)
     status = false;
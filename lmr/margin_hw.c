@@ -50,32 +50,24 @@ margin_port_is_down(struct pci_dev *dev)
 }
 
 bool
-margin_find_pair(struct pci_access *pacc, struct pci_dev *dev, struct pci_dev **down_port,
+margin_find_pair(struct pci_access *pacc UNUSED, struct pci_dev *dev, struct pci_dev **down_port,
                  struct pci_dev **up_port)
 {
-  struct pci_cap *cap = pci_find_cap(dev, PCI_CAP_ID_EXP, PCI_CAP_NORMAL);
-  if (!cap)
+  struct pci_dev *p = pci_topo_link_partner(dev);
+  if (!p)
     return false;
-  bool given_down = margin_port_is_down(dev);
 
-  for (struct pci_dev *p = pacc->devices; p; p = p->next)
+  if (margin_port_is_down(dev))
+    {
+      *down_port = dev;
+      *up_port = p;
+    }
+  else
     {
-      if (given_down && pci_read_byte(dev, PCI_SECONDARY_BUS) == p->bus && dev->domain == p->domain
-          && p->func == 0)
-        {
-          *down_port = dev;
-          *up_port = p;
-          return true;
-        }
-      else if (!given_down && pci_read_byte(p, PCI_SECONDARY_BUS) == dev->bus
-               && dev->domain == p->domain)
-        {
-          *down_port = p;
-          *up_port = dev;
-          return true;
-        }
+      *down_port = p;
+      *up_port = dev;
     }
-  return false;
+  return true;
 }
 
 bool
@@ -182,18 +174,38 @@ margin_restore_dev(struct margin_dev *dev)
   pci_write_word(dev->dev, pcie->addr + PCI_EXP_LNKCTL2, lnk_ctl2);
 }
 
+static bool
+margin_same_state(struct margin_dev *a, struct margin_dev *b)
+{
+  return a->aspm == b->aspm && a->hasd == b->hasd && a->hawd == b->hawd;
+}
+
 bool
 margin_prep_link(struct margin_link *link)
 {
   if (!link)
     return false;
+
+  struct margin_dev down = link->down_port;
+  struct margin_dev up = link->up_port;
+
   if (!margin_prep_dev(&link->down_port))
-    return false;
+    {
+      link->recv_params_valid = 0;
+      return false;
+    }
   if (!margin_prep_dev(&link->up_port))
     {
       margin_restore_dev(&link->down_port);
+      link->recv_params_valid = 0;
       return false;
     }
+
+  /* Someone changed the settings since the Receiver parameters were read */
+  if (link->prepared
+      && !(margin_same_state(&down, &link->down_port) && margin_same_state(&up, &link->up_port)))
+    link->recv_params_valid = 0;
+  link->prepared = true;
   return true;
 }
 
@@ -16,13 +16,64 @@
 bool margin_global_logging = false;
 bool margin_print_domain = true;
 
+/*
+ *  Each thread can redirect its log to a separate file, so that logs
+ *  of links margined concurrently do not get mixed.
+ */
+
+#ifdef PCI_HAVE_PTHREAD
+
+#include <pthread.h>
+
+static pthread_key_t margin_log_key;
+static pthread_once_t margin_log_once = PTHREAD_ONCE_INIT;
+
+static void
+margin_log_key_init(void)
+{
+  pthread_key_create(&margin_log_key, NULL);
+}
+
+void
+margin_log_redirect(FILE *file)
+{
+  pthread_once(&margin_log_once, margin_log_key_init);
+  pthread_setspecific(margin_log_key, file);
+}
+
+static FILE *
+margin_log_file(void)
+{
+  pthread_once(&margin_log_once, margin_log_key_init);
+  FILE *file = pthread_getspecific(margin_log_key);
+  return file ? file : stdout;
+}
+
+#else
+
+static FILE *margin_log_output;
+
+void
+margin_log_redirect(FILE *file)
+{
+  margin_log_output = file;
+}
+
+static FILE *
+margin_log_file(void)
+{
+  return margin_log_output ? margin_log_output : stdout;
+}
+
+#endif
+
 void
 margin_log(char *format, ...)
 {
   va_list arg;
   va_start(arg, format);
   if (margin_global_logging)
-    vprintf(format, arg);
+    vfprintf(margin_log_file(), format, arg);
   va_end(arg);
 }
 
@@ -149,7 +200,7 @@ margin_log_margining(struct margin_lanes_data arg)
       margin_log(" - ETA: %3ds Steps: %3d Total ETA: %3dm %2ds", lane_eta_s, arg.steps_lane_done,
                  total_eta_s / 60, total_eta_s % 60);
 
-      fflush(stdout);
+      fflush(margin_log_file());
     }
 }
 
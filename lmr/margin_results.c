@@ -8,6 +8,7 @@
  *	SPDX-License-Identifier: GPL-2.0-or-later
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,6 +16,10 @@
 
 #include "lmr.h"
 
+#ifdef PCI_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 enum lane_rating {
   FAIL = 0,
   PASS,
@@ -381,3 +386,191 @@ margin_results_save_csv(struct margin_results *results, u8 recvs_n, struct margi
     }
   free(path);
 }
+
+/* Physical value of the margin in ps (timing) or mV (voltage) */
+static double
+step_value(struct margin_results *res, enum margin_dir dir, u8 steps)
+{
+  if (dir == TIM_LEFT || dir == TIM_RIGHT)
+    return steps * res->tim_coef / 100.0 * margin_ui[res->link_speed - 4];
+  return steps * res->volt_coef;
+}
+
+static bool
+dir_tested(struct margin_params *params, enum margin_dir dir)
+{
+  switch (dir)
+    {
+      case TIM_LEFT:
+        return true;
+      case TIM_RIGHT:
+        return params->ind_left_right_tim;
+      case VOLT_UP:
+        return params->volt_support;
+      default:
+        return params->volt_support && params->ind_up_down_volt;
+    }
+}
+
+static char *const dir_names[] = { "up", "down", "left", "right" };
+
+#ifdef PCI_HAVE_PTHREAD
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void
+margin_results_stream_open(struct margin_com_args *args, char *path, char *format)
+{
+  if (!strcmp(format, "json"))
+    args->stream_json = true;
+  else if (strcmp(format, "csv"))
+    die("Unknown format of results: %s\n", format);
+
+  args->stream = fopen(path, "w");
+  if (!args->stream)
+    die("Cannot open %s: %s\n", path, strerror(errno));
+  if (!args->stream_json)
+    {
+      fprintf(args->stream, "run,time,link,receiver,lane,direction,steps,status,value,unit\n");
+      fflush(args->stream);
+    }
+}
+
+void
+margin_results_stream(struct margin_link *link, struct margin_results *results,
+                      struct margin_lanes_data *data)
+{
+  struct margin_com_args *args = link->args.common;
+  struct pci_dev *port = link->down_port.dev;
+  bool timing = data->dir == TIM_LEFT || data->dir == TIM_RIGHT;
+  FILE *f = args->stream;
+  char timestamp[64];
+
+#ifdef PCI_HAVE_PTHREAD
+  pthread_mutex_lock(&stream_lock);
+#endif
+  time_t tim = time(NULL);
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&tim));
+
+  for (int i = 0; i < data->lanes_n; i++)
+    {
+      struct margin_res_lane *lane = &data->results[i];
+      u8 steps = lane->steps[data->dir];
+      char *fmt = args->stream_json ?
+                    "{\"run\":%u,\"time\":\"%s\",\"link\":\"%04x:%02x:%02x.%x\",\"receiver\":%u,"
+                    "\"lane\":%u,\"direction\":\"%s\",\"steps\":%u,\"status\":\"%s\","
+                    "\"value\":%.3f,\"unit\":\"%s\"}\n" :
+                    "%u,%s,%04x:%02x:%02x.%x,%u,%u,%s,%u,%s,%.3f,%s\n";
+
+      /* Logical lane numbers are used everywhere in the output */
+      fprintf(f, fmt, args->run, timestamp, port->domain, port->bus, port->dev, port->func,
+              results->recvn, data->lanes_numbers[i], dir_names[data->dir], steps,
+              sts_strings[lane->statuses[data->dir]], step_value(results, data->dir, steps),
+              timing ? "ps" : "mV");
+    }
+  fflush(f);
+#ifdef PCI_HAVE_PTHREAD
+  pthread_mutex_unlock(&stream_lock);
+#endif
+}
+
+void
+margin_agg_add(struct margin_agg *agg, struct margin_results *results, u8 recvs_n)
+{
+  for (int i = 0; i < recvs_n; i++)
+    {
+      struct margin_results *res = &results[i];
+      struct margin_agg_recv *r = NULL;
+
+      if (res->test_status != MARGIN_TEST_OK)
+        continue;
+      for (int j = 0; j < agg->recvs_n; j++)
+        if (agg->recvs[j].res.recvn == res->recvn)
+          r = &agg->recvs[j];
+      if (!r)
+        {
+          r = &agg->recvs[agg->recvs_n++];
+          r->res = *res;
+          r->res.lanes = NULL;
+          r->runs = 0;
+          r->lanes = xmalloc(res->lanes_n * sizeof(*r->lanes));
+          memset(r->lanes, 0, res->lanes_n * sizeof(*r->lanes));
+          for (int j = 0; j < res->lanes_n; j++)
+            {
+              r->lanes[j].lane = res->lanes[j].lane;
+              memset(r->lanes[j].min, 0xff, sizeof(r->lanes[j].min));
+            }
+        }
+
+      r->runs++;
+      for (int j = 0; j < res->lanes_n && j < r->res.lanes_n; j++)
+        for (int dir = 0; dir < 4; dir++)
+          if (dir_tested(&r->res.params, dir))
+            {
+              struct margin_agg_lane *lane = &r->lanes[j];
+              u8 steps = res->lanes[j].steps[dir] & 0x7f;
+              lane->hist[dir][steps]++;
+              if (steps < lane->min[dir])
+                lane->min[dir] = steps;
+            }
+    }
+}
+
+/* Lower median of the steps reached */
+static u8
+agg_median(struct margin_agg_lane *lane, enum margin_dir dir, u16 runs)
+{
+  unsigned int seen = 0;
+
+  for (int i = 0; i < 128; i++)
+    if ((seen += lane->hist[dir][i]) >= (runs + 1u) / 2)
+      return i;
+  return 0;
+}
+
+void
+margin_agg_print(struct margin_agg *agg)
+{
+  for (int i = 0; i < agg->recvs_n; i++)
+    {
+      struct margin_agg_recv *r = &agg->recvs[i];
+      struct margin_params *params = &r->res.params;
+      u8 recv = 10 + r->res.recvn - 1;
+
+      printf("Rx(%X) - %d successful runs\n", recv, r->runs);
+      for (int j = 0; j < r->res.lanes_n; j++)
+        {
+          struct margin_agg_lane *lane = &r->lanes[j];
+          printf("Rx(%X) Lane %2d:", recv, lane->lane);
+          for (int dir = 0; dir < 4; dir++)
+            {
+              /* The same order and notation as in the brief results */
+              static const u8 order[] = { TIM_LEFT, TIM_RIGHT, VOLT_UP, VOLT_DOWN };
+              u8 d = order[dir];
+              bool timing = d == TIM_LEFT || d == TIM_RIGHT;
+              char name;
+              if (!dir_tested(params, d))
+                continue;
+              if (timing)
+                name = params->ind_left_right_tim ? (d == TIM_LEFT ? 'L' : 'R') : 'T';
+              else
+                name = params->ind_up_down_volt ? (d == VOLT_UP ? 'U' : 'D') : 'V';
+              u8 min = lane->min[d];
+              u8 med = agg_median(lane, d, r->runs);
+              printf(timing ? "  (%c min %5.2fps - %2dst, med %5.2fps - %2dst)" :
+                              "  (%c min %5.1f mV - %3dst, med %5.1f mV - %3dst)",
+                     name, step_value(&r->res, d, min), min, step_value(&r->res, d, med), med);
+            }
+          printf("\n");
+        }
+      printf("\n");
+    }
+}
+
+void
+margin_agg_free(struct margin_agg *agg)
+{
+  for (int i = 0; i < agg->recvs_n; i++)
+    free(agg->recvs[i].lanes);
+  agg->recvs_n = 0;
+}
@@ -122,6 +122,53 @@ cap_dsn(struct device *d, int where)
 	t1 >> 24, (t1 >> 16) & 0xff, (t1 >> 8) & 0xff, t1 & 0xff);
 }
 
+static const struct field_desc aer_uncor_fields[] = {
+  { "DLP", PCI_ERR_UNC_DLP, 0, 0 },
+  { "SDES", PCI_ERR_UNC_SDES, 0, 0 },
+  { "TLP", PCI_ERR_UNC_POISON_TLP, 0, 0 },
+  { "FCP", PCI_ERR_UNC_FCP, 0, 0 },
+  { "CmpltTO", PCI_ERR_UNC_COMP_TIME, 0, 0 },
+  { "CmpltAbrt", PCI_ERR_UNC_COMP_ABORT, 0, 0 },
+  { "UnxCmplt", PCI_ERR_UNC_UNX_COMP, 0, 0 },
+  { "RxOF", PCI_ERR_UNC_RX_OVER, 0, 0 },
+  { "MalfTLP", PCI_ERR_UNC_MALF_TLP, 0, 0 },
+  { "ECRC", PCI_ERR_UNC_ECRC, 0, 1 },
+  { "UnsupReq", PCI_ERR_UNC_UNSUP, 0, 0 },
+  { "ACSViol", PCI_ERR_UNC_ACS_VIOL, 0, 0 },
+  { "UncorrIntErr", PCI_ERR_UNC_INTERNAL, 0, 0 },
+  { "BlockedTLP", PCI_ERR_UNC_MC_BLOCKED_TLP, 0, 0 },
+  { "AtomicOpBlocked", PCI_ERR_UNC_ATOMICOP_EGRESS_BLOCKED, 0, 0 },
+  { "TLPBlockedErr", PCI_ERR_UNC_TLP_PREFIX_BLOCKED, 0, 0 },
+  { "PoisonTLPBlocked", PCI_ERR_UNC_POISONED_TLP_EGRESS, 0, 1 },
+  { "DMWrReqBlocked", PCI_ERR_UNC_DMWR_REQ_EGRESS_BLOCKED, 0, 0 },
+  { "IDECheck", PCI_ERR_UNC_IDE_CHECK, 0, 0 },
+  { "MisIDETLP", PCI_ERR_UNC_MISR_IDE_TLP, 0, 0 },
+  { "PCRC_CHECK", PCI_ERR_UNC_PCRC_CHECK, 0, 0 },
+  { "TLPXlatBlocked", PCI_ERR_UNC_TLP_XLAT_EGRESS_BLOCKED, 0, 0 },
+  { NULL }
+};
+
+static const struct field_desc aer_cor_fields[] = {
+  { "RxErr", PCI_ERR_COR_RCVR, 0, 0 },
+  { "BadTLP", PCI_ERR_COR_BAD_TLP, 0, 0 },
+  { "BadDLLP", PCI_ERR_COR_BAD_DLLP, 0, 0 },
+  { "Rollover", PCI_ERR_COR_REP_ROLL, 0, 0 },
+  { "Timeout", PCI_ERR_COR_REP_TIMER, 0, 0 },
+  { "AdvNonFatalErr", PCI_ERR_COR_REP_ANFE, 0, 0 },
+  { "CorrIntErr", PCI_ERR_COR_INTERNAL, 0, 0 },
+  { "HeaderOF", PCI_ERR_COR_HDRLOG_OVER, 0, 0 },
+  { NULL }
+};
+
+static const struct reg_desc aer_regs[] = {
+  { "UESta", PCI_ERR_UNCOR_STATUS, 4, aer_uncor_fields },
+  { "UEMsk", PCI_ERR_UNCOR_MASK, 4, aer_uncor_fields },
+  { "UESvrt", PCI_ERR_UNCOR_SEVER, 4, aer_uncor_fields },
+  { "CESta", PCI_ERR_COR_STATUS, 4, aer_cor_fields },
+  { "CEMsk", PCI_ERR_COR_MASK, 4, aer_cor_fields },
+  { NULL }
+};
+
 static void
 cap_aer(struct device *d, int where, int type)
 {
@@ -135,57 +182,7 @@ cap_aer(struct device *d, int where, int type)
   if (!config_fetch(d, where + PCI_ERR_UNCOR_STATUS, 40))
     return;
 
-  l = get_conf_long(d, where + PCI_ERR_UNCOR_STATUS);
-  printf("\t\tUESta:\tDLP%c SDES%c TLP%c FCP%c CmpltTO%c CmpltAbrt%c UnxCmplt%c RxOF%c MalfTLP%c\n"
-  "\t\t\tECRC%c UnsupReq%c ACSViol%c UncorrIntErr%c BlockedTLP%c AtomicOpBlocked%c TLPBlockedErr%c\n"
-  "\t\t\tPoisonTLPBlocked%c DMWrReqBlocked%c IDECheck%c MisIDETLP%c PCRC_CHECK%c TLPXlatBlocked%c\n",
-	FLAG(l, PCI_ERR_UNC_DLP), FLAG(l, PCI_ERR_UNC_SDES), FLAG(l, PCI_ERR_UNC_POISON_TLP),
-	FLAG(l, PCI_ERR_UNC_FCP), FLAG(l, PCI_ERR_UNC_COMP_TIME), FLAG(l, PCI_ERR_UNC_COMP_ABORT),
-	FLAG(l, PCI_ERR_UNC_UNX_COMP), FLAG(l, PCI_ERR_UNC_RX_OVER), FLAG(l, PCI_ERR_UNC_MALF_TLP),
-	FLAG(l, PCI_ERR_UNC_ECRC), FLAG(l, PCI_ERR_UNC_UNSUP), FLAG(l, PCI_ERR_UNC_ACS_VIOL),
-	FLAG(l, PCI_ERR_UNC_INTERNAL), FLAG(l, PCI_ERR_UNC_MC_BLOCKED_TLP),
-	FLAG(l, PCI_ERR_UNC_ATOMICOP_EGRESS_BLOCKED), FLAG(l, PCI_ERR_UNC_TLP_PREFIX_BLOCKED),
-	FLAG(l, PCI_ERR_UNC_POISONED_TLP_EGRESS), FLAG(l, PCI_ERR_UNC_DMWR_REQ_EGRESS_BLOCKED),
-	FLAG(l, PCI_ERR_UNC_IDE_CHECK), FLAG(l, PCI_ERR_UNC_MISR_IDE_TLP), FLAG(l, PCI_ERR_UNC_PCRC_CHECK),
-	FLAG(l, PCI_ERR_UNC_TLP_XLAT_EGRESS_BLOCKED));
-  l = get_conf_long(d, where + PCI_ERR_UNCOR_MASK);
-  printf("\t\tUEMsk:\tDLP%c SDES%c TLP%c FCP%c CmpltTO%c CmpltAbrt%c UnxCmplt%c RxOF%c MalfTLP%c\n"
-  "\t\t\tECRC%c UnsupReq%c ACSViol%c UncorrIntErr%c BlockedTLP%c AtomicOpBlocked%c TLPBlockedErr%c\n"
-  "\t\t\tPoisonTLPBlocked%c DMWrReqBlocked%c IDECheck%c MisIDETLP%c PCRC_CHECK%c TLPXlatBlocked%c\n",
-	FLAG(l, PCI_ERR_UNC_DLP), FLAG(l, PCI_ERR_UNC_SDES), FLAG(l, PCI_ERR_UNC_POISON_TLP),
-	FLAG(l, PCI_ERR_UNC_FCP), FLAG(l, PCI_ERR_UNC_COMP_TIME), FLAG(l, PCI_ERR_UNC_COMP_ABORT),
-	FLAG(l, PCI_ERR_UNC_UNX_COMP), FLAG(l, PCI_ERR_UNC_RX_OVER), FLAG(l, PCI_ERR_UNC_MALF_TLP),
-	FLAG(l, PCI_ERR_UNC_ECRC), FLAG(l, PCI_ERR_UNC_UNSUP), FLAG(l, PCI_ERR_UNC_ACS_VIOL),
-	FLAG(l, PCI_ERR_UNC_INTERNAL), FLAG(l, PCI_ERR_UNC_MC_BLOCKED_TLP),
-	FLAG(l, PCI_ERR_UNC_ATOMICOP_EGRESS_BLOCKED), FLAG(l, PCI_ERR_UNC_TLP_PREFIX_BLOCKED),
-	FLAG(l, PCI_ERR_UNC_POISONED_TLP_EGRESS), FLAG(l, PCI_ERR_UNC_DMWR_REQ_EGRESS_BLOCKED),
-	FLAG(l, PCI_ERR_UNC_IDE_CHECK), FLAG(l, PCI_ERR_UNC_MISR_IDE_TLP), FLAG(l, PCI_ERR_UNC_PCRC_CHECK),
-	FLAG(l, PCI_ERR_UNC_TLP_XLAT_EGRESS_BLOCKED));
-  l = get_conf_long(d, where + PCI_ERR_UNCOR_SEVER);
-  printf("\t\tUESvrt:\tDLP%c SDES%c TLP%c FCP%c CmpltTO%c CmpltAbrt%c UnxCmplt%c RxOF%c MalfTLP%c\n"
-  "\t\t\tECRC%c UnsupReq%c ACSViol%c UncorrIntErr%c BlockedTLP%c AtomicOpBlocked%c TLPBlockedErr%c\n"
-  "\t\t\tPoisonTLPBlocked%c DMWrReqBlocked%c IDECheck%c MisIDETLP%c PCRC_CHECK%c TLPXlatBlocked%c\n",
-	FLAG(l, PCI_ERR_UNC_DLP), FLAG(l, PCI_ERR_UNC_SDES), FLAG(l, PCI_ERR_UNC_POISON_TLP),
-	FLAG(l, PCI_ERR_UNC_FCP), FLAG(l, PCI_ERR_UNC_COMP_TIME), FLAG(l, PCI_ERR_UNC_COMP_ABORT),
-	FLAG(l, PCI_ERR_UNC_UNX_COMP), FLAG(l, PCI_ERR_UNC_RX_OVER), FLAG(l, PCI_ERR_UNC_MALF_TLP),
-	FLAG(l, PCI_ERR_UNC_ECRC), FLAG(l, PCI_ERR_UNC_UNSUP), FLAG(l, PCI_ERR_UNC_ACS_VIOL),
-	FLAG(l, PCI_ERR_UNC_INTERNAL), FLAG(l, PCI_ERR_UNC_MC_BLOCKED_TLP),
-	FLAG(l, PCI_ERR_UNC_ATOMICOP_EGRESS_BLOCKED), FLAG(l, PCI_ERR_UNC_TLP_PREFIX_BLOCKED),
-	FLAG(l, PCI_ERR_UNC_POISONED_TLP_EGRESS), FLAG(l, PCI_ERR_UNC_DMWR_REQ_EGRESS_BLOCKED),
-	FLAG(l, PCI_ERR_UNC_IDE_CHECK), FLAG(l, PCI_ERR_UNC_MISR_IDE_TLP), FLAG(l, PCI_ERR_UNC_PCRC_CHECK),
-	FLAG(l, PCI_ERR_UNC_TLP_XLAT_EGRESS_BLOCKED));
-  l = get_conf_long(d, where + PCI_ERR_COR_STATUS);
-  printf("\t\tCESta:\tRxErr%c BadTLP%c BadDLLP%c Rollover%c Timeout%c AdvNonFatalErr%c "
-  "CorrIntErr%c HeaderOF%c\n",
-	FLAG(l, PCI_ERR_COR_RCVR), FLAG(l, PCI_ERR_COR_BAD_TLP), FLAG(l, PCI_ERR_COR_BAD_DLLP),
-	FLAG(l, PCI_ERR_COR_REP_ROLL), FLAG(l, PCI_ERR_COR_REP_TIMER), FLAG(l, PCI_ERR_COR_REP_ANFE),
-	FLAG(l, PCI_ERR_COR_INTERNAL), FLAG(l, PCI_ERR_COR_HDRLOG_OVER));
-  l = get_conf_long(d, where + PCI_ERR_COR_MASK);
-  printf("\t\tCEMsk:\tRxErr%c BadTLP%c BadDLLP%c Rollover%c Timeout%c AdvNonFatalErr%c "
-  "CorrIntErr%c HeaderOF%c\n",
-	FLAG(l, PCI_ERR_COR_RCVR), FLAG(l, PCI_ERR_COR_BAD_TLP), FLAG(l, PCI_ERR_COR_BAD_DLLP),
-	FLAG(l, PCI_ERR_COR_REP_ROLL), FLAG(l, PCI_ERR_COR_REP_TIMER), FLAG(l, PCI_ERR_COR_REP_ANFE),
-	FLAG(l, PCI_ERR_COR_INTERNAL), FLAG(l, PCI_ERR_COR_HDRLOG_OVER));
+  show_regs(d, where, aer_regs);
   l = get_conf_long(d, where + PCI_ERR_CAP);
   printf("\t\tAERCap:\tFirst Error Pointer: %02x, ECRCGenCap%c ECRCGenEn%c ECRCChkCap%c ECRCChkEn%c\n"
 	"\t\t\tMultHdrRecCap%c MultHdrRecEn%c TLPPfxPres%c HdrLogCap%c\n",
@@ -231,6 +228,33 @@ cap_aer(struct device *d, int where, int type)
     }
 }
 
+static const struct field_desc dpc_ctl_fields[] = {
+  { "Trigger", 0x0003, 1, 0 },
+  { "Cmpl", PCI_DPC_CTL_CMPL, 0, 0 },
+  { "INT", PCI_DPC_CTL_INT, 0, 0 },
+  { "ErrCor", PCI_DPC_CTL_ERR_COR, 0, 0 },
+  { "PoisonedTLP", PCI_DPC_CTL_TLP, 0, 0 },
+  { "SwTrigger", PCI_DPC_CTL_SW_TRIGGER, 0, 0 },
+  { "DL_ActiveErr", PCI_DPC_CTL_DL_ACTIVE, 0, 0 },
+  { NULL }
+};
+
+static const struct field_desc dpc_sta_fields[] = {
+  { "Trigger", PCI_DPC_STS_TRIGGER, 0, 0 },
+  { "Reason", 0x0006, 2, 0 },
+  { "INT", PCI_DPC_STS_INT, 0, 0 },
+  { "RPBusy", PCI_DPC_STS_RP_BUSY, 0, 0 },
+  { "TriggerExt", 0x0060, 2, 0 },
+  { "RP PIO ErrPtr", 0x1f00, 2, 0 },
+  { NULL }
+};
+
+static const struct reg_desc dpc_regs[] = {
+  { "DpcCtl", PCI_DPC_CTL, 2, dpc_ctl_fields },
+  { "DpcSta", PCI_DPC_STATUS, 2, dpc_sta_fields },
+  { NULL }
+};
+
 static void cap_dpc(struct device *d, int where)
 {
   u16 l;
@@ -247,26 +271,43 @@ static void cap_dpc(struct device *d, int where)
     PCI_DPC_CAP_INT_MSG(l), FLAG(l, PCI_DPC_CAP_RP_EXT), FLAG(l, PCI_DPC_CAP_TLP_BLOCK),
     FLAG(l, PCI_DPC_CAP_SW_TRIGGER), PCI_DPC_CAP_RP_LOG(l), FLAG(l, PCI_DPC_CAP_DL_ACT_ERR));
 
-  l = get_conf_word(d, where + PCI_DPC_CTL);
-  printf("\t\tDpcCtl:\tTrigger:%x Cmpl%c INT%c ErrCor%c PoisonedTLP%c SwTrigger%c DL_ActiveErr%c\n",
-    PCI_DPC_CTL_TRIGGER(l), FLAG(l, PCI_DPC_CTL_CMPL), FLAG(l, PCI_DPC_CTL_INT),
-    FLAG(l, PCI_DPC_CTL_ERR_COR), FLAG(l, PCI_DPC_CTL_TLP), FLAG(l, PCI_DPC_CTL_SW_TRIGGER),
-    FLAG(l, PCI_DPC_CTL_DL_ACTIVE));
-
-  l = get_conf_word(d, where + PCI_DPC_STATUS);
-  printf("\t\tDpcSta:\tTrigger%c Reason:%02x INT%c RPBusy%c TriggerExt:%02x RP PIO ErrPtr:%02x\n",
-    FLAG(l, PCI_DPC_STS_TRIGGER), PCI_DPC_STS_REASON(l), FLAG(l, PCI_DPC_STS_INT),
-    FLAG(l, PCI_DPC_STS_RP_BUSY), PCI_DPC_STS_TRIGGER_EXT(l), PCI_DPC_STS_PIO_FEP(l));
+  show_regs(d, where, dpc_regs);
 
   l = get_conf_word(d, where + PCI_DPC_SOURCE);
   printf("\t\tSource:\t%04x\n", l);
 }
 
+static const struct field_desc acs_cap_fields[] = {
+  { "SrcValid", PCI_ACS_CAP_VALID, 0, 0 },
+  { "TransBlk", PCI_ACS_CAP_BLOCK, 0, 0 },
+  { "ReqRedir", PCI_ACS_CAP_REQ_RED, 0, 0 },
+  { "CmpltRedir", PCI_ACS_CAP_CMPLT_RED, 0, 0 },
+  { "UpstreamFwd", PCI_ACS_CAP_FORWARD, 0, 0 },
+  { "EgressCtrl", PCI_ACS_CAP_EGRESS, 0, 0 },
+  { "DirectTrans", PCI_ACS_CAP_TRANS, 0, 0 },
+  { NULL }
+};
+
+static const struct field_desc acs_ctrl_fields[] = {
+  { "SrcValid", PCI_ACS_CTRL_VALID, 0, 0 },
+  { "TransBlk", PCI_ACS_CTRL_BLOCK, 0, 0 },
+  { "ReqRedir", PCI_ACS_CTRL_REQ_RED, 0, 0 },
+  { "CmpltRedir", PCI_ACS_CTRL_CMPLT_RED, 0, 0 },
+  { "UpstreamFwd", PCI_ACS_CTRL_FORWARD, 0, 0 },
+  { "EgressCtrl", PCI_ACS_CTRL_EGRESS, 0, 0 },
+  { "DirectTrans", PCI_ACS_CTRL_TRANS, 0, 0 },
+  { NULL }
+};
+
+static const struct reg_desc acs_regs[] = {
+  { "ACSCap", PCI_ACS_CAP, 2, acs_cap_fields },
+  { "ACSCtl", PCI_ACS_CTRL, 2, acs_ctrl_fields },
+  { NULL }
+};
+
 static void
 cap_acs(struct device *d, int where)
 {
-  u16 w;
-
   printf("Access Control Services\n");
   if (verbose < 2)
     return;
@@ -274,18 +315,7 @@ cap_acs(struct device *d, int where)
   if (!config_fetch(d, where + PCI_ACS_CAP, 4))
     return;
 
-  w = get_conf_word(d, where + PCI_ACS_CAP);
-  printf("\t\tACSCap:\tSrcValid%c TransBlk%c ReqRedir%c CmpltRedir%c UpstreamFwd%c EgressCtrl%c "
-	"DirectTrans%c\n",
-	FLAG(w, PCI_ACS_CAP_VALID), FLAG(w, PCI_ACS_CAP_BLOCK), FLAG(w, PCI_ACS_CAP_REQ_RED),
-	FLAG(w, PCI_ACS_CAP_CMPLT_RED), FLAG(w, PCI_ACS_CAP_FORWARD), FLAG(w, PCI_ACS_CAP_EGRESS),
-	FLAG(w, PCI_ACS_CAP_TRANS));
-  w = get_conf_word(d, where + PCI_ACS_CTRL);
-  printf("\t\tACSCtl:\tSrcValid%c TransBlk%c ReqRedir%c CmpltRedir%c UpstreamFwd%c EgressCtrl%c "
-	"DirectTrans%c\n",
-	FLAG(w, PCI_ACS_CTRL_VALID), FLAG(w, PCI_ACS_CTRL_BLOCK), FLAG(w, PCI_ACS_CTRL_REQ_RED),
-	FLAG(w, PCI_ACS_CTRL_CMPLT_RED), FLAG(w, PCI_ACS_CTRL_FORWARD), FLAG(w, PCI_ACS_CTRL_EGRESS),
-	FLAG(w, PCI_ACS_CTRL_TRANS));
+  show_regs(d, where, acs_regs);
 }
 
 static void
@@ -0,0 +1,86 @@
+/*
+ *	The PCI Utilities -- Table-Driven Decoding of Registers
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+
+#include "lspci.h"
+
+/*
+ *  Registers which consist only of flags and small numbers are described
+ *  by static tables instead of open-coded printf's. The same table produces
+ *  the verbose text and, if field_records is set, also a record of the decoded
+ *  values for the JSON output. The record is emitted on a separate line starting
+ *  with '\f' right after the text, so that show_json_caps() can pick it up
+ *  from the captured output of show_caps().
+ */
+
+int field_records;
+
+static u32
+reg_value(struct device *d, unsigned int pos, int width)
+{
+  switch (width)
+    {
+    case 1:
+      return get_conf_byte(d, pos);
+    case 2:
+      return get_conf_word(d, pos);
+    default:
+      return get_conf_long(d, pos);
+    }
+}
+
+static u32
+field_value(u32 reg, u32 mask)
+{
+  while (!(mask & 1))
+    {
+      mask >>= 1;
+      reg >>= 1;
+    }
+  return reg & mask;
+}
+
+void
+show_reg(struct device *d, int where, const struct reg_desc *r)
+{
+  u32 val = reg_value(d, where + r->offset, r->width);
+  const struct field_desc *f;
+
+  printf("\t\t%s:\t", r->name);
+  for (f = r->fields; f->name; f++)
+    {
+      if (f != r->fields)
+	printf(f->wrap ? "\n\t\t\t" : " ");
+      if (f->digits)
+	printf("%s:%0*x", f->name, f->digits, field_value(val, f->mask));
+      else
+	printf("%s%c", f->name, FLAG(val, f->mask));
+    }
+  putchar('\n');
+
+  if (!field_records)
+    return;
+  printf("\f\"%s\":{", r->name);
+  for (f = r->fields; f->name; f++)
+    {
+      printf("%s\"%s\":", (f != r->fields ? "," : ""), f->name);
+      if (f->digits)
+	printf("%u", field_value(val, f->mask));
+      else
+	printf((val & f->mask) ? "true" : "false");
+    }
+  printf("}\n");
+}
+
+void
+show_regs(struct device *d, int where, const struct reg_desc *regs)
+{
+  for (; regs->name; regs++)
+    show_reg(d, where, regs);
+}
@@ -59,41 +59,91 @@ show_kernel_cleanup(void)
     kmod_unref(kmod_ctx);
 }
 
-static const char *next_module(struct device *d)
+/*
+ *  Looking up an alias in the libkmod index is relatively expensive, so we
+ *  remember the list of modules for each alias. This helps a lot on systems
+ *  with many identical devices.
+ */
+
+struct kmod_alias {
+  struct kmod_alias *next;
+  int num_modules;
+  char **modules;
+  char alias[1];
+};
+
+#define KMOD_ALIAS_HASH_SIZE 256
+
+static struct kmod_alias *kmod_alias_hash[KMOD_ALIAS_HASH_SIZE];
+
+static unsigned int
+kmod_alias_hash_func(const char *alias)
 {
-  static struct kmod_list *klist, *kcurrent;
-  static struct kmod_module *kmodule;
+  unsigned int h = 0;
+  while (*alias)
+    h = h*0x9e3779b1 + (byte)*alias++;
+  return (h ^ (h >> 16)) % KMOD_ALIAS_HASH_SIZE;
+}
 
-  if (kmodule)
+static struct kmod_alias *
+kmod_lookup_alias(const char *alias)
+{
+  unsigned int h = kmod_alias_hash_func(alias);
+  struct kmod_list *klist = NULL, *kcurrent;
+  struct kmod_alias *ka;
+  int n;
+
+  for (ka = kmod_alias_hash[h]; ka; ka = ka->next)
+    if (!strcmp(ka->alias, alias))
+      return ka;
+
+  int err = kmod_module_new_from_lookup(kmod_ctx, alias, &klist);
+  if (err < 0)
+    {
+      fprintf(stderr, "lspci: libkmod lookup failed: error %d\n", err);
+      return NULL;
+    }
+
+  ka = xmalloc(sizeof(*ka) + strlen(alias));
+  strcpy(ka->alias, alias);
+  n = 0;
+  kmod_list_foreach(kcurrent, klist)
+    n++;
+  ka->modules = xmalloc((n ? n : 1) * sizeof(char *));
+  ka->num_modules = 0;
+  kmod_list_foreach(kcurrent, klist)
     {
+      struct kmod_module *kmodule = kmod_module_get_module(kcurrent);
+      const char *name = kmod_module_get_name(kmodule);
+      ka->modules[ka->num_modules] = xmalloc(strlen(name) + 1);
+      strcpy(ka->modules[ka->num_modules++], name);
       kmod_module_unref(kmodule);
-      kmodule = NULL;
     }
+  kmod_module_unref_list(klist);
+
+  ka->next = kmod_alias_hash[h];
+  kmod_alias_hash[h] = ka;
+  return ka;
+}
 
-  if (!klist)
+static const char *next_module(struct device *d)
+{
+  static struct kmod_alias *current;
+  static int pos;
+
+  if (!current)
     {
       pci_fill_info(d->dev, PCI_FILL_MODULE_ALIAS);
       if (!d->dev->module_alias)
 	return NULL;
-      int err = kmod_module_new_from_lookup(kmod_ctx, d->dev->module_alias, &klist);
-      if (err < 0)
-	{
-	  fprintf(stderr, "lspci: libkmod lookup failed: error %d\n", err);
-	  return NULL;
-	}
-      kcurrent = klist;
+      current = kmod_lookup_alias(d->dev->module_alias);
+      pos = 0;
     }
-  else
-    kcurrent = kmod_list_next(klist, kcurrent);
 
-  if (kcurrent)
-    {
-      kmodule = kmod_module_get_module(kcurrent);
-      return kmod_module_get_name(kmodule);
-    }
+  if (current && pos < current->num_modules)
+    return current->modules[pos++];
 
-  kmod_module_unref_list(klist);
-  klist = NULL;
+  current = NULL;
   return NULL;
 }
 
@@ -101,13 +151,33 @@ static const char *next_module(struct device *d)
 
 struct pcimap_entry {
   struct pcimap_entry *next;
+  unsigned int seq;			/* Position in the file, later entries are tried first */
   unsigned int vendor, device;
   unsigned int subvendor, subdevice;
   unsigned int class, class_mask;
   char module[1];
 };
 
-static struct pcimap_entry *pcimap_head;
+/*
+ *  The entries are indexed by (vendor, device), where device can be a wildcard.
+ *  Entries with a wildcard vendor are kept in a separate list, which is tried
+ *  for all devices. The lists are sorted by decreasing sequence number, so they
+ *  can be merged to obtain all matching entries in the original order.
+ */
+
+#define PCIMAP_ANY 0x10000
+#define PCIMAP_HASH_SIZE 1024
+
+static struct pcimap_entry *pcimap_hash[PCIMAP_HASH_SIZE];
+static struct pcimap_entry *pcimap_wild;
+
+static inline unsigned int
+pcimap_hash_func(unsigned int vendor, unsigned int device)
+{
+  unsigned int h = (vendor << 17) ^ device;
+  h *= 0x9e3779b1;
+  return (h >> 16) % PCIMAP_HASH_SIZE;
+}
 
 static int
 show_kernel_init(void)
@@ -115,6 +185,7 @@ show_kernel_init(void)
   static int tried_pcimap;
   struct utsname uts;
   char *name, line[1024];
+  unsigned int seq = 0;
   FILE *f;
 
   if (tried_pcimap)
@@ -141,7 +212,7 @@ show_kernel_init(void)
   while (fgets(line, sizeof(line), f))
     {
       char *c = strchr(line, '\n');
-      struct pcimap_entry *e;
+      struct pcimap_entry *e, **head;
 
       if (!c)
 	die("Unterminated or too long line in %s", name);
@@ -162,8 +233,13 @@ show_kernel_init(void)
 		 &e->subvendor, &e->subdevice,
 		 &e->class, &e->class_mask) != 6)
 	continue;
-      e->next = pcimap_head;
-      pcimap_head = e;
+      e->seq = seq++;
+      if (e->vendor > 0xffff)
+	head = &pcimap_wild;
+      else
+	head = &pcimap_hash[pcimap_hash_func(e->vendor, e->device > 0xffff ? PCIMAP_ANY : e->device)];
+      e->next = *head;
+      *head = e;
       strcpy(e->module, line);
     }
   fclose(f);
@@ -189,20 +265,36 @@ match_pcimap(struct device *d, struct pcimap_entry *e)
 
 static const char *next_module(struct device *d)
 {
-  static struct pcimap_entry *current;
+  /* Candidate lists: exact device, any device of the vendor, any vendor */
+  static struct pcimap_entry *current[3];
+  static int started;
+  struct pcimap_entry *best;
+  int i;
 
-  if (!current)
-    current = pcimap_head;
-  else
-    current = current->next;
+  if (!started)
+    {
+      current[0] = pcimap_hash[pcimap_hash_func(d->dev->vendor_id, d->dev->device_id)];
+      current[1] = pcimap_hash[pcimap_hash_func(d->dev->vendor_id, PCIMAP_ANY)];
+      current[2] = pcimap_wild;
+      started = 1;
+    }
 
-  while (current)
+  for (;;)
     {
-      if (match_pcimap(d, current))
-	return current->module;
-      current = current->next;
+      best = NULL;
+      for (i=0; i<3; i++)
+	if (current[i] && (!best || current[i]->seq > best->seq))
+	  best = current[i];
+      if (!best)
+	break;
+      for (i=0; i<3; i++)
+	if (current[i] == best)
+	  current[i] = best->next;
+      if (match_pcimap(d, best))
+	return best->module;
     }
 
+  started = 0;
   return NULL;
 }
 
@@ -267,6 +359,31 @@ show_kernel_machine(struct device *d)
     printf("Module:\t%s\n", module);
 }
 
+void
+show_kernel_json(struct device *d)
+{
+  const char *driver, *module;
+
+  pci_fill_info(d->dev, PCI_FILL_DRIVER);
+  if (driver = pci_get_string_property(d->dev, PCI_FILL_DRIVER))
+    {
+      printf(",\"driver\":");
+      print_json_string(driver);
+    }
+
+  if (!show_kernel_init())
+    return;
+
+  int cnt = 0;
+  while (module = next_module_filtered(d))
+    {
+      printf(cnt++ ? "," : ",\"modules\":[");
+      print_json_string(module);
+    }
+  if (cnt)
+    putchar(']');
+}
+
 #else
 
 void
@@ -289,6 +406,19 @@ show_kernel_machine(struct device *d)
     printf("Driver:\t%s\n", driver);
 }
 
+void
+show_kernel_json(struct device *d)
+{
+  const char *driver;
+
+  pci_fill_info(d->dev, PCI_FILL_DRIVER);
+  if (driver = pci_get_string_property(d->dev, PCI_FILL_DRIVER))
+    {
+      printf(",\"driver\":");
+      print_json_string(driver);
+    }
+}
+
 void
 show_kernel_cleanup(void)
 {
@@ -25,10 +25,24 @@ struct bus_info {
   struct bus_bridge *bridges, *via;
 };
 
-static struct bus_info *bus_info;
+/*
+ *  Every domain gets its own table of buses, allocated once the domain
+ *  is known to exist.
+ */
+
+struct domain_map {
+  int domain;
+  int start_bus, end_bus;
+  struct bus_info *bus_info;		/* Indexed by bus number */
+  byte (*present)[256];			/* [bus][devfn]: function found by probing */
+};
+
+static struct domain_map *domains;
+static int num_domains;
+static int show_domains;		/* Print domain numbers in bridge lines and summaries */
 
 static void
-map_bridge(struct bus_info *bi, struct device *d, int np, int ns, int nl)
+map_bridge(struct domain_map *dm, struct bus_info *bi, struct device *d, int np, int ns, int nl)
 {
   struct bus_bridge *b = xmalloc(sizeof(struct bus_bridge));
   struct pci_dev *p = d->dev;
@@ -40,8 +54,12 @@ map_bridge(struct bus_info *bi, struct device *d, int np, int ns, int nl)
   b->func = p->func;
   b->first = get_conf_byte(d, ns);
   b->last = get_conf_byte(d, nl);
-  printf("## %02x:%02x.%d is a bridge from %02x to %02x-%02x\n",
-	 p->bus, p->dev, p->func, b->this, b->first, b->last);
+  if (show_domains)
+    printf("## %04x:%02x:%02x.%d is a bridge from %02x to %02x-%02x\n",
+	   dm->domain, p->bus, p->dev, p->func, b->this, b->first, b->last);
+  else
+    printf("## %02x:%02x.%d is a bridge from %02x to %02x-%02x\n",
+	   p->bus, p->dev, p->func, b->this, b->first, b->last);
   if (b->this != p->bus)
     printf("!!! Bridge points to invalid primary bus.\n");
   if (b->first > b->last)
@@ -51,17 +69,27 @@ map_bridge(struct bus_info *bi, struct device *d, int np, int ns, int nl)
     }
 }
 
+/*
+ *  Probing of all addresses is the slow part, so it is done first (in parallel
+ *  if possible) using probe handles, recording which functions exist. Only the
+ *  devices found are then examined and printed, bus by bus in the usual order.
+ *  A probing job covers a single bus of a single domain.
+ */
+
+struct probe_job {
+  struct domain_map *dm;
+  int bus;
+};
+
+static struct probe_job *probe_jobs;
+static int num_probe_jobs;
+
 static void
-do_map_bus(int bus)
+probe_bus(struct pci_dev *t, struct probe_job *job)
 {
-  int domain = (filter.domain >= 0 ? filter.domain : 0);
+  byte *present = job->dm->present[job->bus];
   int dev, func;
-  int verbose = pacc->debugging;
-  struct bus_info *bi = bus_info + bus;
-  struct device *d;
 
-  if (verbose)
-    printf("Mapping bus %04x:%02x\n", domain, bus);
   for (dev = 0; dev < 32; dev++)
     if (filter.slot < 0 || filter.slot == dev)
       {
@@ -69,39 +97,151 @@ do_map_bus(int bus)
 	for (func = 0; func < func_limit; func++)
 	  if (filter.func < 0 || filter.func == func)
 	    {
-	      struct pci_dev *p = pci_get_dev(pacc, domain, bus, dev, func);
-	      u16 vendor = pci_read_word(p, PCI_VENDOR_ID);
+	      u16 vendor;
+	      pci_set_probe_addr(t, job->dm->domain, job->bus, dev, func);
+	      vendor = pci_read_word(t, PCI_VENDOR_ID);
 	      if (vendor && vendor != 0xffff)
 		{
-		  if (!func && (pci_read_byte(p, PCI_HEADER_TYPE) & 0x80))
+		  if (!func && (pci_read_byte(t, PCI_HEADER_TYPE) & 0x80))
 		    func_limit = 8;
-		  if (verbose)
-		    printf("Discovered device %04x:%02x:%02x.%d\n", domain, bus, dev, func);
-		  bi->exists = 1;
-		  if (d = scan_device(p))
-		    {
-		      show_device(d);
-		      switch (get_conf_byte(d, PCI_HEADER_TYPE) & 0x7f)
-			{
-			case PCI_HEADER_TYPE_BRIDGE:
-			  map_bridge(bi, d, PCI_PRIMARY_BUS, PCI_SECONDARY_BUS, PCI_SUBORDINATE_BUS);
-			  break;
-			case PCI_HEADER_TYPE_CARDBUS:
-			  map_bridge(bi, d, PCI_CB_PRIMARY_BUS, PCI_CB_CARD_BUS, PCI_CB_SUBORDINATE_BUS);
-			  break;
-			}
-		      free(d);
-		    }
-		  else if (verbose)
-		    printf("But it was filtered out.\n");
+		  present[dev*8 + func] = 1;
 		}
-	      pci_free_dev(p);
 	    }
       }
 }
 
+#ifdef PCI_HAVE_PTHREAD
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define MAP_MAX_THREADS 16
+
+static pthread_mutex_t probe_lock = PTHREAD_MUTEX_INITIALIZER;
+static int probe_next;
+
+static void *
+probe_worker(void *arg UNUSED)
+{
+  struct pci_dev *t = pci_alloc_probe(pacc);
+  int job;
+
+  for (;;)
+    {
+      pthread_mutex_lock(&probe_lock);
+      job = probe_next++;
+      pthread_mutex_unlock(&probe_lock);
+      if (job >= num_probe_jobs)
+	break;
+      probe_bus(t, &probe_jobs[job]);
+    }
+  pci_free_dev(t);
+  return NULL;
+}
+
+static int
+probe_parallel(void)
+{
+  pthread_t threads[MAP_MAX_THREADS];
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int n, i;
+
+  n = (cpus < MAP_MAX_THREADS) ? cpus : MAP_MAX_THREADS;
+  if (n > num_probe_jobs)
+    n = num_probe_jobs;
+  if (n < 2 || !pci_enable_thread_safety(pacc, 1))
+    return 0;
+
+  probe_next = 0;
+  for (i = 0; i < n; i++)
+    if (pthread_create(&threads[i], NULL, probe_worker, NULL))
+      break;
+  if (!i)
+    return 0;
+  while (i--)
+    pthread_join(threads[i], NULL);
+  pci_enable_thread_safety(pacc, 0);
+  return 1;
+}
+
+#else
+
+static int
+probe_parallel(void)
+{
+  return 0;
+}
+
+#endif
+
+static void
+probe_all(void)
+{
+  struct pci_dev *t;
+  int i, bus;
+
+  num_probe_jobs = 0;
+  for (i = 0; i < num_domains; i++)
+    num_probe_jobs += domains[i].end_bus - domains[i].start_bus + 1;
+  probe_jobs = xmalloc((num_probe_jobs ? num_probe_jobs : 1) * sizeof(struct probe_job));
+  num_probe_jobs = 0;
+  for (i = 0; i < num_domains; i++)
+    for (bus = domains[i].start_bus; bus <= domains[i].end_bus; bus++)
+      {
+	probe_jobs[num_probe_jobs].dm = &domains[i];
+	probe_jobs[num_probe_jobs].bus = bus;
+	num_probe_jobs++;
+      }
+
+  if (!probe_parallel())
+    {
+      t = pci_alloc_probe(pacc);
+      for (i = 0; i < num_probe_jobs; i++)
+	probe_bus(t, &probe_jobs[i]);
+      pci_free_dev(t);
+    }
+  free(probe_jobs);
+}
+
+static void
+do_map_bus(struct domain_map *dm, int bus)
+{
+  int devfn;
+  int verbose = pacc->debugging;
+  struct bus_info *bi = dm->bus_info + bus;
+  struct device *d;
+
+  if (verbose)
+    printf("Mapping bus %04x:%02x\n", dm->domain, bus);
+  for (devfn = 0; devfn < 256; devfn++)
+    if (dm->present[bus][devfn])
+      {
+	struct pci_dev *p = pci_get_dev(pacc, dm->domain, bus, devfn >> 3, devfn & 7);
+	if (verbose)
+	  printf("Discovered device %04x:%02x:%02x.%d\n", dm->domain, bus, p->dev, p->func);
+	bi->exists = 1;
+	if (d = scan_device(p))
+	  {
+	    show_device(d);
+	    switch (get_conf_byte(d, PCI_HEADER_TYPE) & 0x7f)
+	      {
+	      case PCI_HEADER_TYPE_BRIDGE:
+		map_bridge(dm, bi, d, PCI_PRIMARY_BUS, PCI_SECONDARY_BUS, PCI_SUBORDINATE_BUS);
+		break;
+	      case PCI_HEADER_TYPE_CARDBUS:
+		map_bridge(dm, bi, d, PCI_CB_PRIMARY_BUS, PCI_CB_CARD_BUS, PCI_CB_SUBORDINATE_BUS);
+		break;
+	      }
+	    free(d);
+	  }
+	else if (verbose)
+	  printf("But it was filtered out.\n");
+	pci_free_dev(p);
+      }
+}
+
 static void
-do_map_bridges(int bus, int min, int max)
+do_map_bridges(struct bus_info *bus_info, int bus, int min, int max)
 {
   struct bus_info *bi = bus_info + bus;
   struct bus_bridge *b;
@@ -116,20 +256,24 @@ do_map_bridges(int bus, int min, int max)
       else
 	{
 	  bus_info[b->first].via = b;
-	  do_map_bridges(b->first, b->first, b->last);
+	  do_map_bridges(bus_info, b->first, b->first, b->last);
 	}
     }
 }
 
 static void
-map_bridges(void)
+map_bridges(struct domain_map *dm)
 {
+  struct bus_info *bus_info = dm->bus_info;
   int i;
 
-  printf("\nSummary of buses:\n\n");
+  if (show_domains)
+    printf("\nSummary of buses in domain %04x:\n\n", dm->domain);
+  else
+    printf("\nSummary of buses:\n\n");
   for (i=0; i<256; i++)
     if (bus_info[i].exists && !bus_info[i].guestbook)
-      do_map_bridges(i, 0, 255);
+      do_map_bridges(bus_info, i, 0, 255);
   for (i=0; i<256; i++)
     {
       struct bus_info *bi = bus_info + i;
@@ -162,23 +306,72 @@ map_bridges(void)
     }
 }
 
+/* Map the domain selected by the filter, or all domains known to the access method */
+static void
+find_domains(void)
+{
+  struct pci_bus_range *ranges;
+  int i, n;
+
+  if (filter.domain >= 0)
+    {
+      ranges = xmalloc(sizeof(*ranges));
+      ranges->domain = filter.domain;
+      ranges->start_bus = 0;
+      ranges->end_bus = 255;
+      n = 1;
+    }
+  else
+    {
+      n = pci_get_domains(pacc, NULL, 0);
+      ranges = xmalloc((n ? n : 1) * sizeof(*ranges));
+      n = pci_get_domains(pacc, ranges, n);
+    }
+
+  domains = xmalloc((n ? n : 1) * sizeof(struct domain_map));
+  num_domains = 0;
+  for (i = 0; i < n; i++)
+    {
+      struct domain_map *dm = &domains[num_domains];
+      dm->domain = ranges[i].domain;
+      dm->start_bus = ranges[i].start_bus;
+      dm->end_bus = ranges[i].end_bus;
+      if (filter.bus >= 0)
+	{
+	  if (filter.bus < dm->start_bus || filter.bus > dm->end_bus)
+	    continue;
+	  dm->start_bus = dm->end_bus = filter.bus;
+	}
+      dm->bus_info = xmalloc(sizeof(struct bus_info) * 256);
+      memset(dm->bus_info, 0, sizeof(struct bus_info) * 256);
+      dm->present = xmalloc(256 * sizeof(*dm->present));
+      memset(dm->present, 0, 256 * sizeof(*dm->present));
+      num_domains++;
+    }
+  free(ranges);
+  show_domains = (num_domains > 1 || (num_domains && domains[0].domain));
+  if (show_domains && !opt_domains)
+    opt_domains = 1;
+}
+
 void
 map_the_bus(void)
 {
+  int i, bus;
+
   if (pacc->method == PCI_ACCESS_PROC_BUS_PCI ||
       pacc->method == PCI_ACCESS_SYS_BUS_PCI ||
       pacc->method == PCI_ACCESS_WIN32_CFGMGR32 ||
       pacc->method == PCI_ACCESS_DUMP)
     printf("WARNING: Bus mapping can be reliable only with direct hardware access enabled.\n\n");
-  bus_info = xmalloc(sizeof(struct bus_info) * 256);
-  memset(bus_info, 0, sizeof(struct bus_info) * 256);
-  if (filter.bus >= 0)
-    do_map_bus(filter.bus);
-  else
+  find_domains();
+  probe_all();
+  for (i = 0; i < num_domains; i++)
+    for (bus = domains[i].start_bus; bus <= domains[i].end_bus; bus++)
+      do_map_bus(&domains[i], bus);
+  for (i = 0; i < num_domains; i++)
     {
-      int bus;
-      for (bus=0; bus<256; bus++)
-	do_map_bus(bus);
+      map_bridges(&domains[i]);
+      free(domains[i].present);
     }
-  map_bridges();
 }
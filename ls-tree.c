@@ -27,17 +27,53 @@ find_bus(struct bridge *b, unsigned int domain, unsigned int n)
   return bus;
 }
 
+/*
+ *  Devices are looked up by their struct pci_dev many times (once per
+ *  parent link), so we keep a hash table keyed by the device address.
+ */
+static struct device **dev_hash;
+static unsigned int dev_hash_mask;
+
+static unsigned int
+dev_hash_func(struct pci_dev *p)
+{
+  unsigned int h = (((unsigned int) p->domain * 256 + p->bus) * 32 + p->dev) * 8 + p->func;
+  h *= 0x9e3779b1;
+  return (h ^ (h >> 16)) & dev_hash_mask;
+}
+
+static void
+build_dev_hash(void)
+{
+  struct device *d;
+  unsigned int n = 0, size = 16, h;
+
+  for (d=first_dev; d; d=d->next)
+    n++;
+  while (size < 2*n)
+    size *= 2;
+  dev_hash = xmalloc(size * sizeof(struct device *));
+  memset(dev_hash, 0, size * sizeof(struct device *));
+  dev_hash_mask = size - 1;
+  for (d=first_dev; d; d=d->next)
+    {
+      for (h = dev_hash_func(d->dev); dev_hash[h]; h = (h+1) & dev_hash_mask)
+	;
+      dev_hash[h] = d;
+    }
+}
+
 static struct device *
 find_device(struct pci_dev *dd)
 {
-  struct device *d;
+  unsigned int h;
 
   if (!dd)
     return NULL;
-  for (d=first_dev; d; d=d->next)
-    if (d->dev == dd)
-      break;
-  return d;
+  for (h = dev_hash_func(dd); dev_hash[h]; h = (h+1) & dev_hash_mask)
+    if (dev_hash[h]->dev == dd)
+      return dev_hash[h];
+  return NULL;
 }
 
 static struct bus *
@@ -112,6 +148,7 @@ grow_tree(void)
   struct bridge **last_br, *b;
 
   last_br = &host_bridge.chain;
+  build_dev_hash();
 
   /* Build list of top level domain bridges */
 
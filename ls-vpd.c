@@ -83,11 +83,18 @@ print_vpd_binary(const byte *buf, word len)
     }
 }
 
+/* The whole VPD image has been read ahead by the library, so we just copy from it */
+struct vpd_image {
+  byte *data;
+  int len;
+};
+
 static int
-read_vpd(struct device *d, int pos, byte *buf, int len, byte *csum)
+read_vpd(struct vpd_image *vpd, int pos, byte *buf, int len, byte *csum)
 {
-  if (!pci_read_vpd(d->dev, pos, buf, len))
+  if (!vpd->data || pos + len > vpd->len)
     return 0;
+  memcpy(buf, vpd->data + pos, len);
   while (len--)
     *csum += *buf++;
   return 1;
@@ -100,20 +107,24 @@ cap_vpd(struct device *d)
   byte buf[256];
   byte tag;
   byte csum = 0;
+  struct vpd_image vpd;
 
   printf("Vital Product Data\n");
   if (verbose < 2)
     return;
 
+  pci_fill_info(d->dev, PCI_FILL_VPD);
+  vpd.data = pci_get_vpd(d->dev, &vpd.len);
+
   while (res_addr <= PCI_VPD_ADDR_MASK)
     {
-      if (!read_vpd(d, res_addr, &tag, 1, &csum))
+      if (!read_vpd(&vpd, res_addr, &tag, 1, &csum))
 	break;
       if (tag & 0x80)
 	{
 	  if (res_addr > PCI_VPD_ADDR_MASK + 1 - 3)
 	    break;
-	  if (!read_vpd(d, res_addr + 1, buf, 2, &csum))
+	  if (!read_vpd(&vpd, res_addr + 1, buf, 2, &csum))
 	    break;
 	  res_len = buf[0] + (buf[1] << 8);
 	  res_addr += 3;
@@ -142,7 +153,7 @@ cap_vpd(struct device *d)
 	      part_len = res_len - part_pos;
 	      if (part_len > sizeof(buf))
 		part_len = sizeof(buf);
-	      if (!read_vpd(d, res_addr + part_pos, buf, part_len, &csum))
+	      if (!read_vpd(&vpd, res_addr + part_pos, buf, part_len, &csum))
 		break;
 	      print_vpd_string(buf, part_len);
 	      part_pos += part_len;
@@ -161,7 +172,7 @@ cap_vpd(struct device *d)
 	      const struct vpd_item *item;
 	      byte id[2], id1, id2;
 
-	      if (!read_vpd(d, res_addr + part_pos, buf, 3, &csum))
+	      if (!read_vpd(&vpd, res_addr + part_pos, buf, 3, &csum))
 		break;
 	      part_pos += 3;
 	      memcpy(id, buf, 2);
@@ -179,7 +190,7 @@ cap_vpd(struct device *d)
 	      /* Only read the first byte of the RV field because the
 	       * remaining bytes are not included in the checksum. */
 	      read_len = (item->format == F_RESVD) ? 1 : part_len;
-	      if (!read_vpd(d, res_addr + part_pos, buf, read_len, &csum))
+	      if (!read_vpd(&vpd, res_addr + part_pos, buf, read_len, &csum))
 		break;
 
 	      printf("\t\t\t[");
@@ -12,9 +12,17 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "lspci.h"
 
+#if !defined(PCI_OS_WINDOWS) && !defined(PCI_OS_DJGPP) && !defined(PCI_OS_AMIGAOS)
+#define LSPCI_WATCH
+#include <poll.h>
+#include <time.h>
+#endif
+
 /* Options */
 
 int verbose;				/* Show detailed information */
@@ -24,22 +32,28 @@ static int opt_filter;			/* Any filter was given */
 static int opt_tree;			/* Show bus tree */
 static int opt_path;			/* Show bridge path */
 static int opt_machine;			/* Generate machine-readable output */
+static int opt_json;			/* Generate JSON output, one device per line */
 static int opt_map_mode;		/* Bus mapping mode enabled */
-static int opt_domains;			/* Show domain numbers (0=disabled, 1=auto-detected, 2=requested) */
+int opt_domains;			/* Show domain numbers (0=disabled, 1=auto-detected, 2=requested) */
 static int opt_kernel;			/* Show kernel drivers */
 static int opt_query_dns;		/* Query the DNS (0=disabled, 1=enabled, 2=refresh cache) */
 static int opt_query_all;		/* Query the DNS for all entries */
+static char *opt_compile_ids;		/* Compile the ID database to this file and exit */
+static char *opt_bin_dump;		/* Write a binary dump to this file and exit */
+static char *opt_archive;		/* Write an archive of dumps to this file and exit */
+static double opt_watch;		/* Watch for changes with this interval in seconds */
 char *opt_pcimap;			/* Override path to Linux modules.pcimap */
 
 const char program_name[] = "lspci";
 
-static char options[] = "nvbxs:d:tPi:mgp:qkMDQ" GENERIC_OPTIONS ;
+static char options[] = "nvbxs:d:tPi:I:B:Y:mjgp:qkMDQW:" GENERIC_OPTIONS ;
 
 static char help_msg[] =
 "Usage: lspci [<switches>]\n"
 "\n"
 "Basic display modes:\n"
 "-mm\t\tProduce machine-readable output (single -m for an obsolete format)\n"
+"-j\t\tProduce JSON output (one object per device and line)\n"
 "-t\t\tShow bus tree\n"
 "\n"
 "Display options:\n"
@@ -70,10 +84,16 @@ static char help_msg[] =
 "\n"
 "Other options:\n"
 "-i <file>\tUse specified ID database instead of %s\n"
+"-I <file>\tCompile the ID database to a binary file and exit\n"
+"-B <file>\tWrite config space of the selected devices to a binary dump and exit\n"
+"-Y <file> [<host>=]<dump>...\tCollect dumps of many hosts to an archive and exit\n"
 #ifdef PCI_OS_LINUX
 "-p <file>\tLook up kernel modules in a given file instead of default modules.pcimap\n"
 #endif
 "-M\t\tEnable `bus mapping' mode (dangerous; root only)\n"
+#ifdef LSPCI_WATCH
+"-W <sec>\tShow devices, then watch them and show again those which changed\n"
+#endif
 "\n"
 "PCI access options:\n"
 GENERIC_HELP
@@ -86,77 +106,137 @@ struct device *first_dev;
 static int seen_errors;
 static int need_topology;
 
+/*
+ *  Config space is cached by libpci (see pci_enable_config_cache()), so we
+ *  only make sure that the requested range is read and then access the cache.
+ */
 int
 config_fetch(struct device *d, unsigned int pos, unsigned int len)
 {
-  unsigned int end = pos+len;
-  int result;
-
-  while (pos < d->config_bufsize && len && d->present[pos])
-    pos++, len--;
-  while (pos+len <= d->config_bufsize && len && d->present[pos+len-1])
-    len--;
-  if (!len)
-    return 1;
+  byte buf[4096];
 
-  if (end > d->config_bufsize)
-    {
-      int orig_size = d->config_bufsize;
-      while (end > d->config_bufsize)
-	d->config_bufsize *= 2;
-      d->config = xrealloc(d->config, d->config_bufsize);
-      d->present = xrealloc(d->present, d->config_bufsize);
-      memset(d->present + orig_size, 0, d->config_bufsize - orig_size);
-      pci_setup_cache(d->dev, d->config, d->dev->cache_len);
-    }
-  result = pci_read_block(d->dev, pos, d->config + pos, len);
-  if (result)
-    memset(d->present + pos, 1, len);
-  return result;
+  if (pos > sizeof(buf) || len > sizeof(buf) - pos)
+    return 0;
+  return pci_read_block(d->dev, pos, buf, len);
 }
 
-struct device *
-scan_device(struct pci_dev *p)
+static struct device *
+new_device(struct pci_dev *p)
 {
   struct device *d;
 
-  if (p->domain && !opt_domains)
-    opt_domains = 1;
-  if (!pci_filter_match(&filter, p) && !need_topology)
-    return NULL;
   d = xmalloc(sizeof(struct device));
   memset(d, 0, sizeof(*d));
   d->dev = p;
   d->no_config_access = p->no_config_access;
-  d->config_cached = d->config_bufsize = 64;
-  d->config = xmalloc(64);
-  d->present = xmalloc(64);
-  memset(d->present, 1, 64);
-  if (!d->no_config_access && !pci_read_block(p, 0, d->config, 64))
+  d->config_cached = 64;
+  if (!d->no_config_access && !config_fetch(d, 0, 64))
     {
       d->no_config_access = 1;
-      d->config_cached = d->config_bufsize = 0;
-      memset(d->present, 0, 64);
+      d->config_cached = 0;
     }
-  if (!d->no_config_access && (d->config[PCI_HEADER_TYPE] & 0x7f) == PCI_HEADER_TYPE_CARDBUS)
+  if (!d->no_config_access && (get_conf_byte(d, PCI_HEADER_TYPE) & 0x7f) == PCI_HEADER_TYPE_CARDBUS)
     {
       /* For cardbus bridges, we need to fetch 64 bytes more to get the
        * full standard header... */
       if (config_fetch(d, 64, 64))
 	d->config_cached += 64;
     }
-  pci_setup_cache(p, d->config, d->config_cached);
-  pci_fill_info(p, PCI_FILL_IDENT | PCI_FILL_CLASS | PCI_FILL_CLASS_EXT | PCI_FILL_SUBSYS | (need_topology ? PCI_FILL_PARENT : 0));
   return d;
 }
 
+static int
+scan_fill_flags(void)
+{
+  return PCI_FILL_IDENT | PCI_FILL_CLASS | PCI_FILL_CLASS_EXT | PCI_FILL_SUBSYS | (need_topology ? PCI_FILL_PARENT : 0);
+}
+
+struct device *
+scan_device(struct pci_dev *p)
+{
+  struct device *d;
+
+  if (p->domain && !opt_domains)
+    opt_domains = 1;
+  if (!pci_filter_match(&filter, p) && !need_topology)
+    return NULL;
+  d = new_device(p);
+  pci_fill_info(p, scan_fill_flags());
+  return d;
+}
+
+/* Is the filter a complete address of a single device? */
+static int
+single_device(void)
+{
+  return (filter.domain >= 0 && filter.bus >= 0 && filter.slot >= 0 && filter.func >= 0);
+}
+
+/*
+ *  Unless we need the whole topology, the back-end can skip devices which
+ *  do not match the filter. We never see devices in other domains then,
+ *  so we have to ask whether there are any.
+ */
+static void
+scan_bus_filtered(void)
+{
+  struct pci_bus_range ranges[16];
+  int i, n;
+
+  if (!opt_filter || need_topology)
+    {
+      pci_scan_bus(pacc);
+      return;
+    }
+  n = pci_get_domains(pacc, ranges, 16);
+  for (i = 0; i < n && i < 16; i++)
+    if (ranges[i].domain && !opt_domains)
+      opt_domains = 1;
+  pci_scan_bus_filtered(pacc, &filter);
+}
+
 static void
 scan_devices(void)
 {
   struct device *d;
   struct pci_dev *p;
 
-  pci_scan_bus(pacc);
+  if (single_device() && !opt_watch)
+    {
+      /*
+       *  Ask for the one device instead of scanning the whole bus. For the topology,
+       *  we need its ancestors, too; if the back-end cannot find them, we have
+       *  to fall back to the full scan, keeping what has been probed.
+       */
+      p = pci_get_dev_filled(pacc, filter.domain, filter.bus, filter.slot, filter.func, scan_fill_flags());
+      if (!need_topology || !p || p->parent || !p->bus)
+	{
+	  for (; p; p = p->parent)
+	    if (d = scan_device(p))
+	      {
+		d->next = first_dev;
+		first_dev = d;
+	      }
+	  return;
+	}
+      pci_rescan(pacc, NULL, NULL);
+    }
+  else
+    scan_bus_filtered();
+  if (!opt_filter)
+    {
+      /* All devices will be shown, so let the library fill them at once */
+      for (p=pacc->devices; p; p=p->next)
+	{
+	  if (p->domain && !opt_domains)
+	    opt_domains = 1;
+	  d = new_device(p);
+	  d->next = first_dev;
+	  first_dev = d;
+	}
+      pci_fill_info_batch(pacc, scan_fill_flags());
+      return;
+    }
   for (p=pacc->devices; p; p=p->next)
     if (d = scan_device(p))
       {
@@ -167,48 +247,170 @@ scan_devices(void)
 
 /*** Config space accesses ***/
 
-static void
-check_conf_range(struct device *d, unsigned int pos, unsigned int len)
-{
-  while (len)
-    if (!d->present[pos])
-      die("Internal bug: Accessing non-read configuration byte at position %x", pos);
-    else
-      pos++, len--;
-}
-
 byte
 get_conf_byte(struct device *d, unsigned int pos)
 {
-  check_conf_range(d, pos, 1);
-  return d->config[pos];
+  return pci_read_byte(d->dev, pos);
 }
 
+/* Unlike pci_read_word() and pci_read_long(), these allow unaligned positions */
+
 word
 get_conf_word(struct device *d, unsigned int pos)
 {
-  check_conf_range(d, pos, 2);
-  return d->config[pos] | (d->config[pos+1] << 8);
+  if (!(pos & 1))
+    return pci_read_word(d->dev, pos);
+  return get_conf_byte(d, pos) | (get_conf_byte(d, pos+1) << 8);
 }
 
 u32
 get_conf_long(struct device *d, unsigned int pos)
 {
-  check_conf_range(d, pos, 4);
-  return d->config[pos] |
-    (d->config[pos+1] << 8) |
-    (d->config[pos+2] << 16) |
-    (d->config[pos+3] << 24);
+  if (!(pos & 3))
+    return pci_read_long(d->dev, pos);
+  return get_conf_word(d, pos) | ((u32) get_conf_word(d, pos+2) << 16);
+}
+
+/*** Output ***/
+
+/*
+ *  All output consists of small printf's, so unless we are talking to
+ *  a terminal, we let stdio collect it in a large buffer. It can be also
+ *  collected in a buffer in memory instead (see show_json_caps()).
+ */
+
+#define OUTPUT_BUFFER_SIZE 65536
+
+static void
+setup_output(void)
+{
+  if (!isatty(1))
+    setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+}
+
+struct out_buffer {
+  char *data;				/* Always terminated by a zero byte */
+  size_t len, size;
+};
+
+static struct out_buffer *out_capture;	/* If set, output goes here instead of stdout */
+
+static void
+out_reserve(struct out_buffer *b, size_t n)
+{
+  if (b->len + n < b->size)
+    return;
+  while (b->len + n >= b->size)
+    b->size = b->size ? 2*b->size : 4096;
+  b->data = xrealloc(b->data, b->size);
+}
+
+static void
+out_capture_start(struct out_buffer *b)
+{
+  b->data = NULL;
+  b->len = b->size = 0;
+  out_reserve(b, 0);
+  b->data[0] = 0;
+  out_capture = b;
+}
+
+static void
+out_capture_stop(void)
+{
+  out_capture = NULL;
+}
+
+int
+out_printf(const char *fmt, ...)
+{
+  struct out_buffer *b = out_capture;
+  va_list args, again;
+  int n;
+
+  va_start(args, fmt);
+  if (!b)
+    n = vprintf(fmt, args);
+  else
+    {
+      va_copy(again, args);
+      n = vsnprintf(b->data + b->len, b->size - b->len, fmt, args);
+      if (n >= 0 && b->len + n >= b->size)
+	{
+	  out_reserve(b, n);
+	  n = vsnprintf(b->data + b->len, b->size - b->len, fmt, again);
+	}
+      va_end(again);
+      if (n > 0)
+	b->len += n;
+    }
+  va_end(args);
+  return n;
+}
+
+int
+out_putchar(int c)
+{
+  struct out_buffer *b = out_capture;
+
+  if (!b)
+    return putc(c, stdout);
+  out_reserve(b, 1);
+  b->data[b->len++] = c;
+  b->data[b->len] = 0;
+  return c;
+}
+
+int
+out_puts(const char *s)
+{
+  struct out_buffer *b = out_capture;
+  size_t len = strlen(s);
+
+  if (!b)
+    return (fputs(s, stdout) < 0) ? EOF : putc('\n', stdout);
+  out_reserve(b, len + 1);
+  memcpy(b->data + b->len, s, len);
+  b->len += len;
+  b->data[b->len++] = '\n';
+  b->data[b->len] = 0;
+  return 1;
+}
+
+/* Get a part of the config space, unreadable bytes are reported as 0xff like by get_conf_byte() */
+static void
+get_conf_block(struct device *d, unsigned int pos, byte *buf, unsigned int len)
+{
+  unsigned int i;
+
+  if (!pci_read_block(d->dev, pos, buf, len))
+    for (i=0; i<len; i++)
+      buf[i] = get_conf_byte(d, pos + i);
+}
+
+/* Print a part of the config space as hex bytes, each preceded by the separator (if non-zero) */
+static void
+print_conf_hex(struct device *d, unsigned int pos, unsigned int len, int sep)
+{
+  byte data[256];
+  char buf[3*256];
+  unsigned int n;
+
+  while (len)
+    {
+      n = (len < 256) ? len : 256;
+      get_conf_block(d, pos, data, n);
+      fwrite(buf, 1, format_hex(buf, data, n, sep) - buf, stdout);
+      pos += n;
+      len -= n;
+    }
 }
 
 /*** Sorting ***/
 
 static int
-compare_them(const void *A, const void *B)
+compare_addr(const struct pci_dev *a, const struct pci_dev *b)
 {
-  const struct pci_dev *a = (*(const struct device **)A)->dev;
-  const struct pci_dev *b = (*(const struct device **)B)->dev;
-
   if (a->domain < b->domain)
     return -1;
   if (a->domain > b->domain)
@@ -228,6 +430,18 @@ compare_them(const void *A, const void *B)
   return 0;
 }
 
+static int
+compare_them(const void *A, const void *B)
+{
+  return compare_addr((*(const struct device **)A)->dev, (*(const struct device **)B)->dev);
+}
+
+static int
+compare_pci_devs(const void *A, const void *B)
+{
+  return compare_addr(*(const struct pci_dev **)A, *(const struct pci_dev **)B);
+}
+
 static void
 sort_them(void)
 {
@@ -235,8 +449,13 @@ sort_them(void)
   int cnt;
   struct device *d;
 
+  /* Most back-ends do not produce devices in any particular order, but if they do, keep it */
   cnt = 0;
-  for (d=first_dev; d; d=d->next)
+  for (d=first_dev; d && (!d->next || compare_them(&d, &d->next) < 0); d=d->next)
+    cnt++;
+  if (!d)
+    return;
+  for (; d; d=d->next)
     cnt++;
   h = index = alloca(sizeof(struct device *) * cnt);
   for (d=first_dev; d; d=d->next)
@@ -253,6 +472,25 @@ sort_them(void)
   *last_dev = NULL;
 }
 
+/* When querying DNS, resolve all unknown ID's at once instead of one by one during the output */
+static void
+prefetch_names(void)
+{
+  struct pci_dev **index, **h;
+  struct device *d;
+  int cnt;
+
+  if (!(pacc->id_lookup_mode & PCI_LOOKUP_NETWORK))
+    return;
+  cnt = 0;
+  for (d=first_dev; d; d=d->next)
+    cnt++;
+  h = index = alloca(sizeof(struct pci_dev *) * cnt);
+  for (d=first_dev; d; d=d->next)
+    *h++ = d->dev;
+  pci_lookup_prefetch(pacc, index, cnt, 0);
+}
+
 /*** Normal output ***/
 
 static void
@@ -969,7 +1207,9 @@ show_verbose(struct device *d)
 static void
 show_hex_dump(struct device *d)
 {
-  unsigned int i, cnt;
+  byte data[4096];
+  char buf[HEX_DUMP_SIZE(4096)];
+  unsigned int cnt;
 
   if (d->no_config_access)
     {
@@ -985,14 +1225,71 @@ show_hex_dump(struct device *d)
 	cnt = 4096;
     }
 
-  for (i=0; i<cnt; i++)
+  get_conf_block(d, 0, data, cnt);
+  fwrite(buf, 1, format_hex_dump(buf, data, cnt) - buf, stdout);
+}
+
+/* Binary dumps are written by the library, see lib/dump.c for description of the format */
+
+static void
+write_bin_dump(char *name)
+{
+  struct device *d;
+  struct pci_dev **devs;
+  int n = 0;
+
+  for (d=first_dev; d; d=d->next)
+    n++;
+  devs = xmalloc(sizeof(struct pci_dev *) * (n + 1));
+  n = 0;
+  for (d=first_dev; d; d=d->next)
+    if (pci_filter_match(&filter, d->dev))
+      devs[n++] = d->dev;
+  if (!pci_write_dump(pacc, name, devs, n))
+    exit(1);
+  free(devs);
+}
+
+/*
+ *  Each dump given to -Y is either "host=file", or just a file name,
+ *  in which case the host is named after the file without its extension.
+ */
+
+static int
+write_archive(char *name, char **args, int n)
+{
+  char **hosts = xmalloc(sizeof(char *) * (n + 1));
+  char **dumps = xmalloc(sizeof(char *) * (n + 1));
+  int i, ok;
+
+  for (i=0; i<n; i++)
     {
-      if (! (i & 15))
-	printf("%02x:", i);
-      printf(" %02x", get_conf_byte(d, i));
-      if ((i & 15) == 15)
-	putchar('\n');
+      char *eq = strchr(args[i], '=');
+      if (eq)
+	{
+	  hosts[i] = xstrdup(args[i]);
+	  hosts[i][eq - args[i]] = 0;
+	  dumps[i] = eq + 1;
+	}
+      else
+	{
+	  char *base = strrchr(args[i], '/');
+	  char *dot;
+	  hosts[i] = xstrdup(base ? base + 1 : args[i]);
+	  if ((dot = strrchr(hosts[i], '.')) && dot != hosts[i])
+	    *dot = 0;
+	  dumps[i] = args[i];
+	}
     }
+
+  ok = pci_write_dump_archive(pacc, name, hosts, dumps, n);
+
+  for (i=0; i<n; i++)
+    free(hosts[i]);
+  free(hosts);
+  free(dumps);
+  pci_cleanup(pacc);
+  return ok ? 0 : 1;
 }
 
 static void
@@ -1072,11 +1369,226 @@ show_machine(struct device *d)
     }
 }
 
+/*** JSON output ***/
+
+void
+print_json_string(const char *s)
+{
+  putchar('"');
+  for (; *s; s++)
+    {
+      unsigned char c = *s;
+      if (c == '"' || c == '\\')
+	printf("\\%c", c);
+      else if (c == '\n')
+	printf("\\n");
+      else if (c == '\t')
+	printf("\\t");
+      else if (c < 0x20 || c == 0x7f)
+	printf("\\u%04x", c);
+      else
+	putchar(c);
+    }
+  putchar('"');
+}
+
+static void
+print_json_field(const char *name, const char *value)
+{
+  printf(",\"%s\":", name);
+  print_json_string(value);
+}
+
+/*
+ *  Capabilities are decoded by the same functions as in the verbose output.
+ *  Their output is collected in a buffer of the device and split to one object
+ *  per capability, whose details are the indented lines which follow it.
+ */
+
+/* Finish a capability, including the records of registers decoded by show_regs() */
+static void
+show_json_cap_end(int details, char **regs, int nregs)
+{
+  int i;
+
+  if (details)
+    putchar(']');
+  for (i = 0; i < nregs; i++)
+    printf("%s%s", (i ? "," : ",\"registers\":{"), regs[i]);
+  if (nregs)
+    putchar('}');
+  putchar('}');
+}
+
+static void
+show_json_caps(struct device *d)
+{
+  int htype = get_conf_byte(d, PCI_HEADER_TYPE) & 0x7f;
+  struct out_buffer caps;
+  char *line, *next;
+  int cnt = 0, details = 0;
+  char **regs = NULL;
+  int nregs = 0, max_regs = 0;
+
+  if (htype != PCI_HEADER_TYPE_NORMAL && htype != PCI_HEADER_TYPE_BRIDGE && htype != PCI_HEADER_TYPE_CARDBUS)
+    return;
+
+  out_capture_start(&caps);
+  field_records = 1;
+  show_caps(d, (htype == PCI_HEADER_TYPE_CARDBUS) ? PCI_CB_CAPABILITY_LIST : PCI_CAPABILITY_LIST);
+  field_records = 0;
+  out_capture_stop();
+
+  printf(",\"capabilities\":[");
+  for (line = caps.data; *line; line = next)
+    {
+      unsigned int pos, ver;
+      int n;
+
+      next = strchr(line, '\n');
+      if (next)
+	*next++ = 0;
+      else
+	next = line + strlen(line);
+
+      if (!strncmp(line, "\tCapabilities: ", 15))
+	{
+	  line += 15;
+	  if (cnt++)
+	    {
+	      show_json_cap_end(details, regs, nregs);
+	      putchar(',');
+	    }
+	  putchar('{');
+	  details = nregs = 0;
+	  if (sscanf(line, "[%x v%u]%n", &pos, &ver, &n) >= 2 && n > 0)
+	    printf("\"offset\":%u,\"extended\":true,\"version\":%u,", pos, ver);
+	  else if (sscanf(line, "[%x]%n", &pos, &n) >= 1 && n > 0)
+	    printf("\"offset\":%u,\"extended\":%s,", pos, (pos >= 0x100 ? "true" : "false"));
+	  else
+	    n = 0;
+	  line += n;
+	  while (*line == ' ')
+	    line++;
+	  printf("\"name\":");
+	  print_json_string(line);
+	}
+      else if (cnt && *line == '\f')
+	{
+	  if (nregs >= max_regs)
+	    {
+	      max_regs = max_regs ? 2*max_regs : 16;
+	      regs = xrealloc(regs, max_regs * sizeof(char *));
+	    }
+	  regs[nregs++] = line + 1;
+	}
+      else if (cnt)
+	{
+	  for (n = 0; n < 2 && *line == '\t'; n++)
+	    line++;
+	  printf(details++ ? "," : ",\"details\":[");
+	  print_json_string(line);
+	}
+    }
+  if (cnt)
+    show_json_cap_end(details, regs, nregs);
+  putchar(']');
+  free(regs);
+  free(caps.data);
+}
+
+static void
+show_json(struct device *d)
+{
+  struct pci_dev *p = d->dev;
+  char buf[256];
+  char *s;
+  int i;
+
+  printf("{\"slot\":\"%04x:%02x:%02x.%d\"", p->domain, p->bus, p->dev, p->func);
+  print_json_field("class", pci_lookup_name(pacc, buf, sizeof(buf), PCI_LOOKUP_CLASS, p->device_class));
+  printf(",\"class_id\":\"%04x\"", p->device_class);
+  print_json_field("vendor", pci_lookup_name(pacc, buf, sizeof(buf), PCI_LOOKUP_VENDOR, p->vendor_id, p->device_id));
+  printf(",\"vendor_id\":\"%04x\"", p->vendor_id);
+  print_json_field("device", pci_lookup_name(pacc, buf, sizeof(buf), PCI_LOOKUP_DEVICE, p->vendor_id, p->device_id));
+  printf(",\"device_id\":\"%04x\"", p->device_id);
+  if ((p->known_fields & PCI_FILL_SUBSYS) &&
+      p->subsys_vendor_id && p->subsys_vendor_id != 0xffff)
+    {
+      print_json_field("svendor", pci_lookup_name(pacc, buf, sizeof(buf), PCI_LOOKUP_SUBSYSTEM | PCI_LOOKUP_VENDOR, p->subsys_vendor_id));
+      printf(",\"svendor_id\":\"%04x\"", p->subsys_vendor_id);
+      print_json_field("sdevice", pci_lookup_name(pacc, buf, sizeof(buf), PCI_LOOKUP_SUBSYSTEM | PCI_LOOKUP_DEVICE, p->vendor_id, p->device_id, p->subsys_vendor_id, p->subsys_id));
+      printf(",\"sdevice_id\":\"%04x\"", p->subsys_id);
+    }
+  if (p->known_fields & PCI_FILL_CLASS_EXT)
+    printf(",\"rev\":\"%02x\",\"prog_if\":\"%02x\"", p->rev_id, p->prog_if);
+
+  if (verbose)
+    {
+      pci_fill_info(p, PCI_FILL_IRQ | PCI_FILL_BASES | PCI_FILL_SIZES | PCI_FILL_IO_FLAGS |
+	PCI_FILL_PHYS_SLOT | PCI_FILL_NUMA_NODE | PCI_FILL_DT_NODE | PCI_FILL_IOMMU_GROUP);
+      if (p->phy_slot)
+	print_json_field("phy_slot", p->phy_slot);
+      if (p->numa_node != -1)
+	printf(",\"numa_node\":%d", p->numa_node);
+      if (s = pci_get_string_property(p, PCI_FILL_DT_NODE))
+	print_json_field("dt_node", s);
+      if (s = pci_get_string_property(p, PCI_FILL_IOMMU_GROUP))
+	print_json_field("iommu_group", s);
+      if (p->irq)
+	printf(",\"irq\":%d", p->irq);
+
+      int cnt = 0;
+      for (i=0; i<6; i++)
+	{
+	  pciaddr_t a = p->base_addr[i];
+	  if (!a && !p->size[i])
+	    continue;
+	  printf("%s{\"index\":%d", (cnt++ ? "," : ",\"regions\":["), i);
+	  if (a & PCI_BASE_ADDRESS_SPACE_IO)
+	    printf(",\"type\":\"io\",\"address\":\"%" PCI_U64_FMT_X "\"", (u64) (a & PCI_ADDR_IO_MASK));
+	  else
+	    printf(",\"type\":\"memory\",\"address\":\"%" PCI_U64_FMT_X "\",\"prefetchable\":%s", (u64) (a & PCI_ADDR_MEM_MASK),
+		   ((a & PCI_BASE_ADDRESS_MEM_PREFETCH) ? "true" : "false"));
+	  printf(",\"size\":%" PCI_U64_FMT_U "}", (u64) p->size[i]);
+	}
+      if (cnt)
+	putchar(']');
+    }
+
+  if (opt_kernel || verbose)
+    show_kernel_json(d);
+
+  if (verbose && !d->no_config_access)
+    show_json_caps(d);
+
+  if (opt_hex && !d->no_config_access)
+    {
+      unsigned int cnt = d->config_cached;
+      if (opt_hex >= 3 && config_fetch(d, cnt, 256-cnt))
+	{
+	  cnt = 256;
+	  if (opt_hex >= 4 && config_fetch(d, 256, 4096-256))
+	    cnt = 4096;
+	}
+      printf(",\"config\":\"");
+      print_conf_hex(d, 0, cnt, 0);
+      putchar('"');
+    }
+
+  printf("}\n");
+}
+
 /*** Main show function ***/
 
 void
 show_device(struct device *d)
 {
+  if (opt_json)
+    {
+      show_json(d);
+      return;
+    }
   if (opt_machine)
     show_machine(d);
   else
@@ -1104,6 +1616,267 @@ show(void)
       show_device(d);
 }
 
+/*
+ *  If the devices need not be arranged to a tree, we can show each device
+ *  as soon as we get to it and free everything we know about it afterwards,
+ *  so memory consumption does not grow with the number of devices. Only the
+ *  list of pci_dev's from the scan is sorted first, so that the records come
+ *  in the same order as in the other output modes.
+ */
+static void
+sort_pci_devs(void)
+{
+  struct pci_dev **index, **h, **last, *p;
+  int cnt = 0;
+
+  for (p = pacc->devices; p && (!p->next || compare_addr(p, p->next) < 0); p = p->next)
+    cnt++;
+  if (!p)
+    return;
+  for (; p; p = p->next)
+    cnt++;
+  h = index = alloca(sizeof(struct pci_dev *) * cnt);
+  for (p = pacc->devices; p; p = p->next)
+    *h++ = p;
+  qsort(index, cnt, sizeof(struct pci_dev *), compare_pci_devs);
+  last = &pacc->devices;
+  for (h = index; cnt--; h++)
+    {
+      *last = *h;
+      last = &(*h)->next;
+    }
+  *last = NULL;
+}
+
+static void
+show_stream(void)
+{
+  struct device *d;
+  struct pci_dev *p;
+
+  scan_bus_filtered();
+  sort_pci_devs();
+  while (p = pacc->devices)
+    {
+      pacc->devices = p->next;
+      if (d = scan_device(p))
+	{
+	  show_device(d);
+	  free(d);
+	}
+      pci_free_dev(p);
+    }
+}
+
+/*** Watching of changes ***/
+
+#ifdef LSPCI_WATCH
+
+/*
+ *  In the watch mode, all devices are shown once and then we periodically
+ *  re-read only the registers which are expected to change at run time:
+ *  status and control registers of the header and of common capabilities.
+ *  Everything else stays in the config cache, so a device whose registers
+ *  changed is decoded again without reading the rest of its config space.
+ *  Devices added and removed are found by pci_monitor_process() if the
+ *  back-end reports hot-plug events, otherwise by pci_rescan() in every round.
+ */
+
+#define WATCH_HEADER -1			/* Any header type */
+#define WATCH_BRIDGE -2			/* Header of a PCI-to-PCI bridge */
+
+struct watch_reg {
+  int type;				/* WATCH_xxx or PCI_CAP_NORMAL/EXTENDED */
+  int cap_id;
+  int offset;				/* Dword containing the register */
+};
+
+static const struct watch_reg watch_regs[] = {
+  { WATCH_HEADER,	0,			PCI_COMMAND },
+  { WATCH_BRIDGE,	0,			PCI_PRIMARY_BUS },
+  { WATCH_BRIDGE,	0,			PCI_SEC_STATUS & ~3 },
+  { WATCH_BRIDGE,	0,			PCI_BRIDGE_CONTROL & ~3 },
+  { PCI_CAP_NORMAL,	PCI_CAP_ID_PM,		PCI_PM_CTRL },
+  { PCI_CAP_NORMAL,	PCI_CAP_ID_MSI,		0 },
+  { PCI_CAP_NORMAL,	PCI_CAP_ID_MSIX,	0 },
+  { PCI_CAP_NORMAL,	PCI_CAP_ID_EXP,		PCI_EXP_DEVCTL },
+  { PCI_CAP_NORMAL,	PCI_CAP_ID_EXP,		PCI_EXP_LNKCTL },
+  { PCI_CAP_NORMAL,	PCI_CAP_ID_EXP,		PCI_EXP_SLTCTL },
+  { PCI_CAP_NORMAL,	PCI_CAP_ID_EXP,		PCI_EXP_RTSTA },
+  { PCI_CAP_NORMAL,	PCI_CAP_ID_EXP,		PCI_EXP_DEVCTL2 },
+  { PCI_CAP_NORMAL,	PCI_CAP_ID_EXP,		PCI_EXP_LNKCTL2 },
+  { PCI_CAP_EXTENDED,	PCI_EXT_CAP_ID_AER,	PCI_ERR_UNCOR_STATUS },
+  { PCI_CAP_EXTENDED,	PCI_EXT_CAP_ID_AER,	PCI_ERR_COR_STATUS },
+  { PCI_CAP_EXTENDED,	PCI_EXT_CAP_ID_AER,	PCI_ERR_CAP },
+  { PCI_CAP_EXTENDED,	PCI_EXT_CAP_ID_AER,	PCI_ERR_ROOT_STATUS },
+  { PCI_CAP_EXTENDED,	PCI_EXT_CAP_ID_DPC,	PCI_DPC_CTL & ~3 },
+  { PCI_CAP_EXTENDED,	PCI_EXT_CAP_ID_DPC,	PCI_DPC_STATUS },
+  { PCI_CAP_EXTENDED,	PCI_EXT_CAP_ID_ACS,	PCI_ACS_CAP },
+  { 0,			0,			0 }
+};
+
+static int
+watch_pos(struct device *d, const struct watch_reg *w)
+{
+  struct pci_cap *cap;
+
+  switch (w->type)
+    {
+    case WATCH_HEADER:
+      return w->offset;
+    case WATCH_BRIDGE:
+      return ((get_conf_byte(d, PCI_HEADER_TYPE) & 0x7f) == PCI_HEADER_TYPE_BRIDGE) ? w->offset : -1;
+    default:
+      cap = pci_find_cap(d->dev, w->cap_id, w->type);
+      return cap ? (int) cap->addr + w->offset : -1;
+    }
+}
+
+static void
+watch_event(const char *event, struct device *d)
+{
+  time_t now = time(NULL);
+  char buf[64];
+
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&now));
+  if (opt_json)
+    {
+      struct pci_dev *p = d->dev;
+      printf("{\"event\":\"%s\",\"time\":\"%s\",\"slot\":\"%04x:%02x:%02x.%d\"}\n",
+	     event, buf, p->domain, p->bus, p->dev, p->func);
+      return;
+    }
+  printf("@ %s %s ", buf, event);
+  show_slot_name(d);
+  putchar('\n');
+}
+
+static void
+watch_rescan_cb(struct pci_dev *p, int event, void *data UNUSED)
+{
+  struct device *d, **dd;
+
+  switch (event)
+    {
+    case PCI_RESCAN_ADDED:
+      if (d = scan_device(p))
+	{
+	  for (dd = &first_dev; *dd && compare_them(dd, &d) < 0; dd = &(*dd)->next)
+	    ;
+	  d->next = *dd;
+	  *dd = d;
+	  watch_event("added", d);
+	  show_device(d);
+	}
+      break;
+    case PCI_RESCAN_REMOVED:
+    case PCI_RESCAN_CHANGED:
+      for (dd = &first_dev; *dd && (*dd)->dev != p; dd = &(*dd)->next)
+	;
+      if (!(d = *dd))
+	break;
+      if (event == PCI_RESCAN_CHANGED)
+	{
+	  watch_event("changed", d);
+	  show_device(d);
+	  break;
+	}
+      watch_event("removed", d);
+      *dd = d->next;
+      free(d);
+      break;
+    }
+}
+
+/* Re-read the watched registers of all devices and show those which changed */
+static void
+watch_registers(void)
+{
+  struct device *d;
+  const struct watch_reg *w;
+  struct pci_read_req *reqs;
+  u32 *old, *new;
+  int n = 0, i, pos, changed;
+
+  for (d=first_dev; d; d=d->next)
+    n++;
+  n *= sizeof(watch_regs) / sizeof(watch_regs[0]);
+  reqs = xmalloc((n ? n : 1) * sizeof(*reqs));
+  old = xmalloc((n ? n : 1) * sizeof(*old));
+  new = xmalloc((n ? n : 1) * sizeof(*new));
+
+  n = 0;
+  for (d=first_dev; d; d=d->next)
+    if (!d->no_config_access)
+      for (w=watch_regs; w->type; w++)
+	if ((pos = watch_pos(d, w)) >= 0)
+	  {
+	    old[n] = pci_read_long(d->dev, pos);
+	    pci_invalidate_config_cache(d->dev, pos, 4);
+	    reqs[n].dev = d->dev;
+	    reqs[n].pos = pos;
+	    reqs[n].len = 4;
+	    reqs[n].buf = (u8 *) &new[n];
+	    n++;
+	  }
+  pci_read_multi(pacc, reqs, n);
+
+  for (i=0; i<n; )
+    {
+      struct pci_dev *p = reqs[i].dev;
+      changed = 0;
+      for (; i<n && reqs[i].dev == p; i++)
+	if (reqs[i].ok && le32_to_cpu(new[i]) != old[i])
+	  changed = 1;
+      if (changed)
+	{
+	  for (d=first_dev; d->dev != p; d=d->next)
+	    ;
+	  watch_event("changed", d);
+	  show_device(d);
+	}
+    }
+
+  free(new);
+  free(old);
+  free(reqs);
+}
+
+static void
+watch(void)
+{
+  int fd = pci_monitor_fd(pacc);
+  struct pollfd pfd;
+
+  for (;;)
+    {
+      fflush(stdout);
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      if (fd >= 0)
+	{
+	  if (poll(&pfd, 1, opt_watch * 1000) > 0)
+	    pci_monitor_process(pacc, watch_rescan_cb, NULL);
+	}
+      else
+	{
+	  poll(NULL, 0, opt_watch * 1000);
+	  pci_rescan(pacc, watch_rescan_cb, NULL);
+	}
+      watch_registers();
+    }
+}
+
+#else
+
+static void
+watch(void)
+{
+  die("Watch mode is not available on this system");
+}
+
+#endif
+
 /* Main */
 
 int
@@ -1118,6 +1891,7 @@ main(int argc, char **argv)
       return 0;
     }
 
+  setup_output();
   pacc = pci_alloc();
   pacc->error = die;
   pci_filter_init(pacc, &filter);
@@ -1158,9 +1932,21 @@ main(int argc, char **argv)
       case 'i':
         pci_set_name_list_path(pacc, optarg, 0);
 	break;
+      case 'I':
+	opt_compile_ids = optarg;
+	break;
+      case 'B':
+	opt_bin_dump = optarg;
+	break;
+      case 'Y':
+	opt_archive = optarg;
+	break;
       case 'm':
 	opt_machine++;
 	break;
+      case 'j':
+	opt_json = 1;
+	break;
       case 'p':
 	opt_pcimap = optarg;
 	break;
@@ -1175,6 +1961,11 @@ main(int argc, char **argv)
       case 'D':
 	opt_domains = 2;
 	break;
+      case 'W':
+	opt_watch = atof(optarg);
+	if (opt_watch <= 0)
+	  die("-W: Invalid interval");
+	break;
 #ifdef PCI_USE_DNS
       case 'q':
 	opt_query_dns++;
@@ -1194,6 +1985,8 @@ main(int argc, char **argv)
 	fprintf(stderr, help_msg, pacc->id_file_name);
 	return 1;
       }
+  if (opt_archive)
+    return write_archive(opt_archive, argv + optind, argc - optind);
   if (optind < argc)
     goto bad;
 
@@ -1205,26 +1998,51 @@ main(int argc, char **argv)
     }
   if (opt_query_all)
     pacc->id_lookup_mode |= PCI_LOOKUP_NETWORK | PCI_LOOKUP_SKIP_LOCAL;
+  if (opt_watch && (opt_tree || need_topology || opt_map_mode || opt_bin_dump || opt_compile_ids))
+    die("-W cannot be combined with -t, -P, -M, -B or -I");
+
+  if (opt_compile_ids)
+    {
+      if (!pci_compile_name_list(pacc, opt_compile_ids))
+	die("Cannot compile %s to %s", pacc->id_file_name, opt_compile_ids);
+      pci_cleanup(pacc);
+      return 0;
+    }
 
   pci_init(pacc);
+  pci_enable_config_cache(pacc, 1);
   if (opt_map_mode)
     {
       if (need_topology)
 	die("Bus mapping mode does not recognize bus topology");
       map_the_bus();
     }
+  else if (opt_json && !opt_tree && !need_topology && !opt_bin_dump && !single_device() && !opt_watch)
+    show_stream();
   else
     {
       scan_devices();
       sort_them();
+      if (opt_bin_dump)
+	{
+	  write_bin_dump(opt_bin_dump);
+	  show_pci_stats(pacc);
+	  pci_cleanup(pacc);
+	  return 0;
+	}
+      prefetch_names();
       if (need_topology)
 	grow_tree();
       if (opt_tree)
 	show_forest(opt_filter ? &filter : NULL);
       else
 	show();
+      if (opt_watch)
+	watch();
     }
   show_kernel_cleanup();
+  fflush(stdout);
+  show_pci_stats(pacc);
   pci_cleanup(pacc);
 
   return (seen_errors ? 2 : 0);
@@ -9,6 +9,7 @@
  */
 
 #define PCIUTILS_LSPCI
+#include <stdio.h>
 #include "pciutils.h"
 
 /*
@@ -30,6 +31,25 @@
 extern int verbose;
 extern struct pci_filter filter;
 extern char *opt_pcimap;
+extern int opt_domains;
+
+/*** Output ***/
+
+/*
+ *  All output goes through these functions, which write either to stdout or to
+ *  a buffer in memory, where the JSON output collects the text of capabilities
+ *  decoded by the usual functions. The standard functions are redirected to
+ *  them, so that the decoders need not care.
+ */
+
+int out_printf(const char *fmt, ...) PCI_PRINTF(1,2);
+int out_putchar(int c);
+int out_puts(const char *s);
+
+#undef putchar
+#define printf(...) out_printf(__VA_ARGS__)
+#define putchar(c) out_putchar(c)
+#define puts(s) out_puts(s)
 
 /*** PCI devices and access to their config space ***/
 
@@ -40,11 +60,8 @@ struct device {
   struct device *bus_next;
   struct bus *parent_bus;
   struct bridge *bridge;
-  /* Cache */
   int no_config_access;
-  unsigned int config_cached, config_bufsize;
-  byte *config;				/* Cached configuration space data */
-  byte *present;			/* Maps which configuration bytes are present */
+  unsigned int config_cached;		/* Size of the standard header we have read */
 };
 
 extern struct device *first_dev;
@@ -52,6 +69,7 @@ extern struct pci_access *pacc;
 
 struct device *scan_device(struct pci_dev *p);
 void show_device(struct device *d);
+void print_json_string(const char *s);
 
 int config_fetch(struct device *d, unsigned int pos, unsigned int len);
 u32 get_conf_long(struct device *d, unsigned int pos);
@@ -62,6 +80,27 @@ byte get_conf_byte(struct device *d, unsigned int pos);
 
 void cap_vpd(struct device *d);
 
+/* ls-fields.c */
+
+struct field_desc {
+  const char *name;			/* NULL terminates the list */
+  u32 mask;				/* Bits of the field within the register */
+  int digits;				/* Shown as a hex number of this width, 0 for a flag */
+  int wrap;				/* Start a new line before this field */
+};
+
+struct reg_desc {
+  const char *name;			/* NULL terminates the list */
+  unsigned int offset;			/* Relative to the start of the capability */
+  int width;				/* In bytes */
+  const struct field_desc *fields;
+};
+
+extern int field_records;
+
+void show_reg(struct device *d, int where, const struct reg_desc *r);
+void show_regs(struct device *d, int where, const struct reg_desc *regs);
+
 /* ls-caps.c */
 
 void show_caps(struct device *d, int where);
@@ -78,6 +117,7 @@ void show_vendor_caps(struct device *d, int where, int cap);
 
 void show_kernel_machine(struct device *d UNUSED);
 void show_kernel(struct device *d UNUSED);
+void show_kernel_json(struct device *d UNUSED);
 void show_kernel_cleanup(void);
 
 /* ls-tree.c */
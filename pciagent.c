@@ -0,0 +1,356 @@
+/*
+ *	The PCI Utilities -- Agent for the Remote Access Method
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "pciutils.h"
+#include "lib/remote.h"
+
+/*
+ *  Serves requests of the remote access method of the library (see
+ *  lib/remote.h) read from the standard input, replies go to the standard
+ *  output. Replies are buffered and flushed only when there is no further
+ *  request waiting, so a pipelined batch of requests is answered by a batch
+ *  of replies.
+ */
+
+const char program_name[] = "pciagent";
+
+static struct pci_access *pacc;
+static struct pci_dev **devs;
+static int num_devs;
+
+/*** Input and output ***/
+
+static byte in_buf[65536];
+static unsigned int in_pos, in_len;
+
+static int
+read_bytes(byte *buf, unsigned int n)
+{
+  while (n)
+    {
+      unsigned int k;
+      if (in_pos >= in_len)
+	{
+	  ssize_t r;
+	  fflush(stdout);
+	  do
+	    r = read(0, in_buf, sizeof(in_buf));
+	  while (r < 0 && errno == EINTR);
+	  if (r < 0)
+	    die("read: %m");
+	  if (!r)
+	    return 0;
+	  in_pos = 0;
+	  in_len = r;
+	}
+      k = in_len - in_pos;
+      if (k > n)
+	k = n;
+      memcpy(buf, in_buf + in_pos, k);
+      in_pos += k;
+      buf += k;
+      n -= k;
+    }
+  return 1;
+}
+
+static struct remote_buf reply;
+
+static void
+put(u64 x, unsigned int n)
+{
+  if (reply.len + n > reply.max)
+    {
+      while (reply.len + n > reply.max)
+	reply.max = reply.max ? 2*reply.max : 4096;
+      reply.data = xrealloc(reply.data, reply.max);
+    }
+  remote_store(reply.data + reply.len, x, n);
+  reply.len += n;
+}
+
+static void
+put_bytes(void *p, unsigned int n)
+{
+  put(0, n);
+  memcpy(reply.data + reply.len - n, p, n);
+}
+
+static void
+send_reply(int status)
+{
+  byte hdr[4];
+
+  remote_store(hdr, ((u32) status << 24) | reply.len, 4);
+  fwrite(hdr, 4, 1, stdout);
+  fwrite(reply.data, reply.len, 1, stdout);
+  reply.len = 0;
+}
+
+/*** Requests ***/
+
+static struct pci_dev *
+get_dev(struct remote_buf *req)
+{
+  u32 i = remote_get_int(req, 4);
+
+  return (!req->error && i < (u32) num_devs) ? devs[i] : NULL;
+}
+
+static int
+do_hello(struct remote_buf *req)
+{
+  if (remote_get_int(req, 4) != REMOTE_MAGIC)
+    return REMOTE_ERROR;
+  put(REMOTE_MAGIC, 4);
+  put(REMOTE_VERSION, 4);
+  return REMOTE_OK;
+}
+
+static int
+do_scan(void)
+{
+  int i;
+
+  for (i=0; i<num_devs; i++)
+    {
+      struct pci_dev *d = devs[i];
+      pci_fill_info(d, PCI_FILL_IDENT);
+      put(d->domain, 4);
+      put(d->bus, 1);
+      put(d->dev, 1);
+      put(d->func, 1);
+      put(pci_read_byte(d, PCI_HEADER_TYPE) & 0x7f, 1);
+      put(d->vendor_id, 2);
+      put(d->device_id, 2);
+    }
+  return REMOTE_OK;
+}
+
+static int
+dev_index(struct pci_dev *d)
+{
+  int i;
+
+  for (i=0; i<num_devs; i++)
+    if (devs[i] == d)
+      return i;
+  return -1;
+}
+
+/* The layout is decoded by remote_apply_fill() in lib/remote.c */
+static void
+remote_put_dev(struct pci_dev *d, unsigned int known)
+{
+  int i;
+
+  put(known, 4);
+  put(d->vendor_id, 2);
+  put(d->device_id, 2);
+  put(d->device_class | (d->prog_if << 16) | ((u32) d->rev_id << 24), 4);
+  put(d->subsys_vendor_id | ((u32) d->subsys_id << 16), 4);
+  put(d->irq, 4);
+  put(d->numa_node, 4);
+  put((known & PCI_FILL_PARENT) && d->parent ? dev_index(d->parent) : -1, 4);
+  put(d->rcd_link_cap, 4);
+  put(d->rcd_link_status | ((u32) d->rcd_link_ctrl << 16), 4);
+  for (i=0; i<6; i++)
+    {
+      put(d->base_addr[i], 8);
+      put(d->size[i], 8);
+      put(d->flags[i], 8);
+    }
+  put(d->rom_base_addr, 8);
+  put(d->rom_size, 8);
+  put(d->rom_flags, 8);
+  for (i=0; i<4; i++)
+    {
+      put(d->bridge_base_addr[i], 8);
+      put(d->bridge_size[i], 8);
+      put(d->bridge_flags[i], 8);
+    }
+  for (i=0; remote_string_props[i]; i++)
+    {
+      char *s = pci_get_string_property(d, remote_string_props[i]);
+      if (s && (known & remote_string_props[i]))
+	{
+	  unsigned int len = strlen(s);
+	  if (len > 0xffff)
+	    len = 0xffff;
+	  put(remote_string_props[i], 4);
+	  put(len, 2);
+	  put_bytes(s, len);
+	}
+    }
+}
+
+static int
+do_fill(struct remote_buf *req)
+{
+  struct pci_dev *d = get_dev(req);
+  unsigned int flags = remote_get_int(req, 4) & REMOTE_FILL_FIELDS;
+
+  if (!d || req->error)
+    return REMOTE_ERROR;
+  remote_put_dev(d, pci_fill_info(d, flags) & REMOTE_FILL_FIELDS);
+  return REMOTE_OK;
+}
+
+static int
+do_read(struct remote_buf *req)
+{
+  struct pci_dev *d = get_dev(req);
+  unsigned int pos = remote_get_int(req, 4);
+  unsigned int len = remote_get_int(req, 4);
+  byte buf[4096];
+
+  if (!d || req->error || pos > sizeof(buf) || len > sizeof(buf) - pos)
+    return REMOTE_ERROR;
+
+  /* If the whole range is not accessible, try to stop at the end of the standard or PCI config space */
+  if (!pci_read_block(d, pos, buf, len) &&
+      !(pos < 256 && pos + len > 256 && pci_read_block(d, pos, buf, len = 256 - pos)) &&
+      !(pos < 64 && pos + len > 64 && pci_read_block(d, pos, buf, len = 64 - pos)))
+    return REMOTE_ERROR;
+  put_bytes(buf, len);
+  return REMOTE_OK;
+}
+
+static int
+do_write(struct remote_buf *req)
+{
+  struct pci_dev *d = get_dev(req);
+  unsigned int pos = remote_get_int(req, 4);
+  unsigned int len = req->len - req->pos;
+
+  if (!d || req->error || pos > 4096 || len > 4096 - pos)
+    return REMOTE_ERROR;
+  return pci_write_block(d, pos, req->data + req->pos, len) ? REMOTE_OK : REMOTE_ERROR;
+}
+
+static void
+serve(void)
+{
+  struct remote_buf req;
+  byte hdr[4];
+  u32 h;
+  int status;
+
+  memset(&req, 0, sizeof(req));
+  req.data = xmalloc(REMOTE_MAX_PAYLOAD + 1);
+  while (read_bytes(hdr, 4))
+    {
+      h = remote_get_u32(hdr);
+      req.len = h & REMOTE_MAX_PAYLOAD;
+      req.pos = 0;
+      req.error = 0;
+      if (!read_bytes(req.data, req.len))
+	die("Truncated request");
+      switch (h >> 24)
+	{
+	case REMOTE_HELLO:
+	  status = do_hello(&req);
+	  break;
+	case REMOTE_SCAN:
+	  status = do_scan();
+	  break;
+	case REMOTE_FILL:
+	  status = do_fill(&req);
+	  break;
+	case REMOTE_READ:
+	  status = do_read(&req);
+	  break;
+	case REMOTE_WRITE:
+	  status = do_write(&req);
+	  break;
+	default:
+	  status = REMOTE_ERROR;
+	}
+      if (status != REMOTE_OK)
+	reply.len = 0;
+      send_reply(status);
+    }
+  fflush(stdout);
+  free(req.data);
+}
+
+/* The standard output carries the replies, so debugging messages must go elsewhere */
+static void
+debug(char *msg, ...)
+{
+  va_list args;
+
+  va_start(args, msg);
+  vfprintf(stderr, msg, args);
+  va_end(args);
+}
+
+static const char help_msg[] =
+"Usage: pciagent [<options>]\n"
+"\n"
+"Serves requests of the remote access method on its standard input and output.\n"
+"\n"
+"PCI access options:\n"
+GENERIC_HELP
+;
+
+int
+main(int argc, char **argv)
+{
+  struct pci_dev *d;
+  int i;
+
+  if (argc == 2 && !strcmp(argv[1], "--version"))
+    {
+      puts("pciagent version " PCIUTILS_VERSION);
+      return 0;
+    }
+  if (argc == 2 && !strcmp(argv[1], "--help"))
+    {
+      fputs(help_msg, stdout);
+      return 0;
+    }
+
+  pacc = pci_alloc();
+  pacc->error = die;
+  pacc->debug = debug;
+  while ((i = getopt(argc, argv, GENERIC_OPTIONS)) != -1)
+    if (!parse_generic_option(i, pacc, optarg))
+      {
+	fputs(help_msg, stderr);
+	return 1;
+      }
+  if (optind < argc)
+    {
+      fputs(help_msg, stderr);
+      return 1;
+    }
+
+  pci_init(pacc);
+  pci_scan_bus(pacc);
+  for (d=pacc->devices; d; d=d->next)
+    num_devs++;
+  devs = xmalloc((num_devs + 1) * sizeof(*devs));
+  i = 0;
+  for (d=pacc->devices; d; d=d->next)
+    devs[i++] = d;
+
+  serve();
+
+  free(devs);
+  free(reply.data);
+  pci_cleanup(pacc);
+  return 0;
+}
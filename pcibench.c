@@ -0,0 +1,508 @@
+/*
+ *	The PCI Utilities -- Micro-benchmarks of the PCI Library
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pciutils.h"
+
+#if defined(PCI_HAVE_PM_DUMP) && !defined(PCI_FIXED_METHOD) && !defined(PCI_OS_WINDOWS) && !defined(PCI_OS_DJGPP) && !defined(PCI_OS_AMIGAOS)
+#include <unistd.h>
+#define BENCH_DUMP
+#endif
+
+/*
+ *  Every benchmark is run with an increasing number of iterations until it
+ *  takes at least the minimum time. It measures only its own operations, so
+ *  setting up a fresh pci_access before each iteration is not counted.
+ *  Results are printed as tab-separated lines with a header, one per benchmark:
+ *
+ *	name  iterations  ns/iteration  ops/iteration  ns/op  MB/s
+ *
+ *  where ops and MB/s are zero if they make no sense for the given benchmark.
+ */
+
+const char program_name[] = "pcibench";
+
+static char *opt_ids;			/* ID file to use */
+static char *opt_select;		/* Run only benchmarks containing this string */
+static int opt_min_ms = 200;		/* Minimum time of a single benchmark */
+static long opt_iters;			/* Fixed number of iterations */
+static int opt_cache;			/* Enable the config space cache */
+
+/* Generic options are replayed for every pci_access we create */
+struct genopt {
+  int opt;
+  char *arg;
+};
+static struct genopt genopts[64];
+static int num_genopts;
+
+static struct pci_access *
+bench_access(int scan)
+{
+  struct pci_access *a = pci_alloc();
+  int i;
+
+  for (i=0; i<num_genopts; i++)
+    {
+      /* Parsing of -O modifies the argument */
+      char *arg = genopts[i].arg ? xstrdup(genopts[i].arg) : NULL;
+      parse_generic_option(genopts[i].opt, a, arg);
+      free(arg);
+    }
+  if (opt_ids)
+    pci_set_name_list_path(a, opt_ids, 0);
+  pci_init(a);
+  if (opt_cache)
+    pci_enable_config_cache(a, 1);
+  if (scan)
+    pci_scan_bus(a);
+  return a;
+}
+
+/*** Timing ***/
+
+struct bench {
+  long n;				/* Number of iterations */
+  long long ns;				/* Time measured so far */
+  long long start;
+  long ops;				/* Operations per iteration */
+  long bytes;				/* Bytes transferred per iteration */
+};
+
+static long long
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void
+bench_start(struct bench *b)
+{
+  b->start = now_ns();
+}
+
+static inline void
+bench_stop(struct bench *b)
+{
+  b->ns += now_ns() - b->start;
+}
+
+/* Keep results of reads alive, so that the compiler does not drop them */
+static volatile unsigned int sink;
+
+/*** Benchmarks ***/
+
+static void
+bench_scan(struct bench *b, void *arg UNUSED)
+{
+  struct pci_access *a;
+  struct pci_dev *d;
+  long i;
+
+  for (i=0; i<b->n; i++)
+    {
+      bench_start(b);
+      a = bench_access(1);
+      bench_stop(b);
+      b->ops = 0;
+      for (d=a->devices; d; d=d->next)
+	b->ops++;
+      pci_cleanup(a);
+    }
+}
+
+static void
+bench_fill(struct bench *b, void *arg)
+{
+  unsigned int flags = *(unsigned int *) arg;
+  struct pci_access *a;
+  struct pci_dev *d;
+  long i;
+
+  for (i=0; i<b->n; i++)
+    {
+      a = bench_access(1);
+      b->ops = 0;
+      bench_start(b);
+      for (d=a->devices; d; d=d->next)
+	{
+	  pci_fill_info(d, flags);
+	  b->ops++;
+	}
+      bench_stop(b);
+      pci_cleanup(a);
+    }
+}
+
+static struct pci_access *read_acc;
+
+static void
+bench_read(struct bench *b, void *arg)
+{
+  int width = *(int *) arg;
+  struct pci_dev *d;
+  unsigned int acc = 0;
+  byte buf[256];
+  long i;
+  int pos;
+
+  b->ops = b->bytes = 0;
+  for (d=read_acc->devices; d; d=d->next)
+    {
+      b->ops += (width ? 256 / width : 1);
+      b->bytes += 256;
+    }
+
+  bench_start(b);
+  for (i=0; i<b->n; i++)
+    for (d=read_acc->devices; d; d=d->next)
+      switch (width)
+	{
+	case 1:
+	  for (pos=0; pos<256; pos++)
+	    acc += pci_read_byte(d, pos);
+	  break;
+	case 2:
+	  for (pos=0; pos<256; pos+=2)
+	    acc += pci_read_word(d, pos);
+	  break;
+	case 4:
+	  for (pos=0; pos<256; pos+=4)
+	    acc += pci_read_long(d, pos);
+	  break;
+	default:
+	  pci_read_block(d, 0, buf, 256);
+	  acc += buf[0];
+	}
+  bench_stop(b);
+  sink = acc;
+}
+
+static void
+bench_find_cap(struct bench *b, void *arg)
+{
+  unsigned int type = *(unsigned int *) arg;
+  unsigned int id = (type == PCI_CAP_NORMAL) ? PCI_CAP_ID_EXP : PCI_EXT_CAP_ID_AER;
+  struct pci_dev *d;
+  unsigned int acc = 0;
+  long i;
+
+  b->ops = 0;
+  for (d=read_acc->devices; d; d=d->next)
+    {
+      pci_find_cap(d, id, type);	/* Let the first call read the capabilities */
+      b->ops++;
+    }
+
+  bench_start(b);
+  for (i=0; i<b->n; i++)
+    for (d=read_acc->devices; d; d=d->next)
+      acc += !!pci_find_cap(d, id, type);
+  bench_stop(b);
+  sink = acc;
+}
+
+static void
+lookup_all(struct bench *b, struct pci_access *a)
+{
+  char buf[256];
+  struct pci_dev *d;
+
+  for (d=read_acc->devices; d; d=d->next)
+    {
+      pci_lookup_name(a, buf, sizeof(buf), PCI_LOOKUP_VENDOR | PCI_LOOKUP_DEVICE, d->vendor_id, d->device_id);
+      pci_lookup_name(a, buf, sizeof(buf), PCI_LOOKUP_CLASS, d->device_class);
+      b->ops += 2;
+    }
+}
+
+static void
+bench_lookup(struct bench *b, void *arg)
+{
+  int cold = *(int *) arg;
+  struct pci_access *a;
+  long i;
+
+  if (!cold)
+    {
+      a = bench_access(0);
+      lookup_all(b, a);
+      b->ops = 0;
+      bench_start(b);
+      for (i=0; i<b->n; i++)
+	lookup_all(b, a);
+      bench_stop(b);
+      b->ops /= b->n;
+      pci_cleanup(a);
+      return;
+    }
+
+  for (i=0; i<b->n; i++)
+    {
+      a = bench_access(0);
+      b->ops = 0;
+      bench_start(b);
+      lookup_all(b, a);
+      bench_stop(b);
+      pci_cleanup(a);
+    }
+}
+
+static void
+bench_load_ids(struct bench *b, void *arg UNUSED)
+{
+  struct pci_access *a;
+  long i;
+
+  for (i=0; i<b->n; i++)
+    {
+      a = bench_access(0);
+      bench_start(b);
+      if (!pci_load_name_list(a))
+	die("Cannot load %s", a->id_file_name);
+      bench_stop(b);
+      pci_cleanup(a);
+    }
+}
+
+/* Config space of the devices of read_acc, unreadable parts are all ones */
+static byte *
+read_config(int *num_devs)
+{
+  struct pci_dev *d;
+  byte *conf, *p;
+  int n = 0;
+
+  for (d=read_acc->devices; d; d=d->next)
+    n++;
+  conf = p = xmalloc(256 * (n ? n : 1));
+  for (d=read_acc->devices; d; d=d->next, p+=256)
+    if (!pci_read_block(d, 0, p, 256))
+      memset(p, 0xff, 256);
+  *num_devs = n;
+  return conf;
+}
+
+static void
+bench_hex_encode(struct bench *b, void *arg UNUSED)
+{
+  char buf[HEX_DUMP_SIZE(256)];
+  int n, j;
+  byte *conf = read_config(&n);
+  unsigned int acc = 0;
+  long i;
+
+  b->ops = n;
+  b->bytes = 256 * n;
+  bench_start(b);
+  for (i=0; i<b->n; i++)
+    for (j=0; j<n; j++)
+      acc += format_hex_dump(buf, conf + 256*j, 256) - buf;
+  bench_stop(b);
+  sink = acc;
+  free(conf);
+}
+
+#ifdef BENCH_DUMP
+
+/* Load a text dump of the devices of read_acc, as produced by lspci -xxx */
+static void
+bench_load_dump(struct bench *b, void *arg UNUSED)
+{
+  char name[] = "/tmp/pcibench-XXXXXX";
+  char buf[HEX_DUMP_SIZE(256)];
+  struct pci_access *a;
+  struct pci_dev *d;
+  byte *conf;
+  FILE *f;
+  int fd, n, j;
+  long i;
+
+  if ((fd = mkstemp(name)) < 0 || !(f = fdopen(fd, "w")))
+    die("Cannot create a temporary dump: %m");
+  conf = read_config(&n);
+  for (d=read_acc->devices, j=0; d; d=d->next, j++)
+    {
+      fprintf(f, "%04x:%02x:%02x.%d x\n", d->domain, d->bus, d->dev, d->func);
+      fwrite(buf, 1, format_hex_dump(buf, conf + 256*j, 256) - buf, f);
+      fputc('\n', f);
+    }
+  b->bytes = ftell(f);
+  b->ops = n;
+  if (fclose(f))
+    die("Cannot write %s: %m", name);
+  free(conf);
+
+  for (i=0; i<b->n; i++)
+    {
+      a = pci_alloc();
+      a->method = PCI_ACCESS_DUMP;
+      pci_set_param(a, "dump.name", name);
+      bench_start(b);
+      pci_init(a);
+      pci_scan_bus(a);
+      bench_stop(b);
+      pci_cleanup(a);
+    }
+  unlink(name);
+}
+
+#endif
+
+/*** The driver ***/
+
+static unsigned int fill_ident = PCI_FILL_IDENT | PCI_FILL_CLASS;
+static unsigned int fill_bases = PCI_FILL_IRQ | PCI_FILL_BASES | PCI_FILL_ROM_BASE | PCI_FILL_SIZES;
+static unsigned int fill_caps = PCI_FILL_CAPS | PCI_FILL_EXT_CAPS;
+static unsigned int fill_all = ~PCI_FILL_RESCAN;
+static int width_byte = 1, width_word = 2, width_long = 4, width_block = 0;
+static unsigned int cap_normal = PCI_CAP_NORMAL, cap_extended = PCI_CAP_EXTENDED;
+static int lookup_cold = 1, lookup_warm = 0;
+
+static const struct benchmark {
+  const char *name;
+  void (*func)(struct bench *b, void *arg);
+  void *arg;
+} benchmarks[] = {
+  { "scan",		bench_scan,	NULL },
+  { "fill.ident",	bench_fill,	&fill_ident },
+  { "fill.bases",	bench_fill,	&fill_bases },
+  { "fill.caps",	bench_fill,	&fill_caps },
+  { "fill.all",		bench_fill,	&fill_all },
+  { "read.byte",	bench_read,	&width_byte },
+  { "read.word",	bench_read,	&width_word },
+  { "read.long",	bench_read,	&width_long },
+  { "read.block",	bench_read,	&width_block },
+  { "find_cap.normal",	bench_find_cap,	&cap_normal },
+  { "find_cap.ext",	bench_find_cap,	&cap_extended },
+  { "ids.load",		bench_load_ids,	NULL },
+  { "lookup.cold",	bench_lookup,	&lookup_cold },
+  { "lookup.warm",	bench_lookup,	&lookup_warm },
+  { "hex.encode",	bench_hex_encode, NULL },
+#ifdef BENCH_DUMP
+  { "dump.load",	bench_load_dump, NULL },
+#endif
+  { NULL,		NULL,		NULL }
+};
+
+static void
+run(const struct benchmark *bm)
+{
+  struct bench b;
+  long long min_ns = (long long) opt_min_ms * 1000000;
+  long n = opt_iters ? opt_iters : 1;
+
+  for (;;)
+    {
+      memset(&b, 0, sizeof(b));
+      b.n = n;
+      bm->func(&b, bm->arg);
+      if (opt_iters || b.ns >= min_ns || n >= (1L << 30))
+	break;
+      /* Aim a little beyond the minimum time, but do not grow too fast */
+      if (b.ns < min_ns / 100)
+	n *= 100;
+      else
+	n = (long) (n * 1.2 * min_ns / (b.ns ? b.ns : 1)) + 1;
+    }
+
+  printf("%s\t%ld\t%.1f\t%ld\t%.1f\t%.1f\n",
+	 bm->name, b.n,
+	 (double) b.ns / b.n,
+	 b.ops,
+	 b.ops ? (double) b.ns / b.n / b.ops : 0.,
+	 (b.bytes && b.ns) ? (double) b.bytes * b.n / b.ns * 1000 : 0.);
+  fflush(stdout);
+}
+
+static const char help_msg[] =
+"Usage: pcibench [<options>]\n"
+"\n"
+"-b <name>\tRun only benchmarks whose names contain <name>\n"
+"-t <ms>\t\tMinimum duration of each benchmark (default: 200)\n"
+"-n <count>\tRun a fixed number of iterations\n"
+"-c\t\tEnable the config space cache\n"
+"-i <file>\tUse specified ID database instead of %s\n"
+"\n"
+"PCI access options:\n"
+GENERIC_HELP
+;
+
+int
+main(int argc, char **argv)
+{
+  const struct benchmark *bm;
+  struct pci_access *a;
+  struct pci_dev *d;
+  int i;
+
+  if (argc == 2 && !strcmp(argv[1], "--version"))
+    {
+      puts("pcibench version " PCIUTILS_VERSION);
+      return 0;
+    }
+
+  a = pci_alloc();
+  while ((i = getopt(argc, argv, "b:t:n:ci:" GENERIC_OPTIONS)) != -1)
+    switch (i)
+      {
+      case 'b':
+	opt_select = optarg;
+	break;
+      case 't':
+	opt_min_ms = atoi(optarg);
+	break;
+      case 'n':
+	opt_iters = atol(optarg);
+	break;
+      case 'c':
+	opt_cache = 1;
+	break;
+      case 'i':
+	opt_ids = optarg;
+	break;
+      default:
+	if (num_genopts >= (int) (sizeof(genopts) / sizeof(genopts[0])))
+	  die("Too many options");
+	genopts[num_genopts].opt = i;
+	genopts[num_genopts].arg = optarg ? xstrdup(optarg) : NULL;
+	num_genopts++;
+	/* Check the option on a scratch pci_access, so that "help" works */
+	if (!parse_generic_option(i, a, optarg))
+	  {
+	    fprintf(stderr, help_msg, a->id_file_name);
+	    return 1;
+	  }
+      }
+  if (optind < argc)
+    {
+      fprintf(stderr, help_msg, a->id_file_name);
+      return 1;
+    }
+  pci_cleanup(a);
+
+  /* Benchmarks of reads, capabilities and names share one list of filled devices */
+  read_acc = bench_access(1);
+  for (d=read_acc->devices; d; d=d->next)
+    pci_fill_info(d, PCI_FILL_IDENT | PCI_FILL_CLASS);
+
+  printf("# name\titerations\tns/iter\tops/iter\tns/op\tMB/s\n");
+  for (bm=benchmarks; bm->name; bm++)
+    if (!opt_select || strstr(bm->name, opt_select))
+      run(bm);
+
+  pci_cleanup(read_acc);
+  return 0;
+}
@@ -48,6 +48,25 @@ scan_links(struct pci_access *pacc, bool only_ready)
   exit(0);
 }
 
+static void
+link_done(struct margin_link *link, bool tested, struct margin_results *results)
+{
+  if (!tested)
+    {
+      if (results->test_status == MARGIN_TEST_ARGS_RECVS)
+        {
+          margin_log_link(link);
+          printf("\nInvalid RecNums specified.\n");
+        }
+      else if (results->test_status == MARGIN_TEST_ARGS_LANES)
+        {
+          margin_log_link(link);
+          printf("\nInvalid lanes specified.\n");
+        }
+    }
+  printf("\n----\n\n");
+}
+
 int
 main(int argc, char **argv)
 {
@@ -130,6 +149,7 @@ main(int argc, char **argv)
           checks_status_ports[i] = false;
           results[i] = xmalloc(sizeof(*results[i]));
           results[i]->test_status = args_status;
+          results_n[i] = 1;
           continue;
         }
 
@@ -139,54 +159,62 @@ main(int argc, char **argv)
 
       for (int j = 0; j < link_args->recvs_n; j++)
         {
-          if (margin_read_params(
-                pacc, link_args->recvs[j] == 6 ? links[i].up_port.dev : links[i].down_port.dev,
-                link_args->recvs[j], &params))
-            {
-              u8 steps_t = link_args->steps_t ? link_args->steps_t : params.timing_steps;
-              u8 steps_v = link_args->steps_v ? link_args->steps_v : params.volt_steps;
-              u8 parallel_recv = link_args->parallel_lanes > params.max_lanes + 1 ?
-                                   params.max_lanes + 1 :
-                                   link_args->parallel_lanes;
-
-              u8 step_multiplier
-                = link_args->lanes_n / parallel_recv + ((link_args->lanes_n % parallel_recv) > 0);
-
-              com_args->steps_utility += steps_t * step_multiplier;
-              if (params.ind_left_right_tim)
-                com_args->steps_utility += steps_t * step_multiplier;
-              if (params.volt_support)
-                {
-                  com_args->steps_utility += steps_v * step_multiplier;
-                  if (params.ind_up_down_volt)
-                    com_args->steps_utility += steps_v * step_multiplier;
-                }
-            }
+          if (margin_read_link_params(&links[i], link_args->recvs[j], &params))
+            com_args->steps_utility += margin_recv_steps(
+              link_args, &params, margin_recv_parallel_lanes(link_args, &params));
         }
     }
 
-  for (int i = 0; i < links_n; i++)
+  com_args->steps_utility *= com_args->runs;
+
+  /* Progress reports of concurrently margined links cannot be shown */
+  if (com_args->threads > 1)
+    com_args->verbosity = 0;
+
+  /* Results of repeated runs are folded into statistics and freed after each run */
+  struct margin_agg *aggs = NULL;
+  if (com_args->runs > 1)
     {
-      if (checks_status_ports[i])
-        results[i] = margin_test_link(&links[i], &results_n[i]);
-      else
+      aggs = xmalloc(links_n * sizeof(*aggs));
+      memset(aggs, 0, links_n * sizeof(*aggs));
+    }
+
+  for (com_args->run = 1; com_args->run <= com_args->runs; com_args->run++)
+    {
+      if (com_args->runs > 1)
+        printf("Run %d of %d:\n\n", com_args->run, com_args->runs);
+      margin_test_links(links, links_n, checks_status_ports, com_args->threads,
+                        com_args->numa_bind, results, results_n, link_done);
+      if (!aggs)
+        break;
+      for (int i = 0; i < links_n; i++)
+        if (checks_status_ports[i])
+          {
+            margin_agg_add(&aggs[i], results[i], results_n[i]);
+            margin_free_results(results[i], results_n[i]);
+            results[i] = NULL;
+            results_n[i] = 0;
+          }
+    }
+
+  if (aggs)
+    {
+      printf("Results of %d runs:\n", com_args->runs);
+      printf("Minimum and median of margins reached in each direction.\n\n");
+      for (int i = 0; i < links_n; i++)
         {
-          results_n[i] = 1;
-          if (results[i]->test_status == MARGIN_TEST_ARGS_RECVS)
-            {
-              margin_log_link(&links[i]);
-              printf("\nInvalid RecNums specified.\n");
-            }
-          else if (results[i]->test_status == MARGIN_TEST_ARGS_LANES)
-            {
-              margin_log_link(&links[i]);
-              printf("\nInvalid lanes specified.\n");
-            }
+          if (!checks_status_ports[i])
+            continue;
+          printf("Link ");
+          margin_log_bdfs(links[i].down_port.dev, links[i].up_port.dev);
+          printf(":\n\n");
+          margin_agg_print(&aggs[i]);
+          margin_agg_free(&aggs[i]);
         }
-      printf("\n----\n\n");
+      free(aggs);
     }
 
-  if (com_args->run_margin)
+  if (com_args->run_margin && com_args->runs == 1)
     {
       printf("Results:\n");
       printf(
@@ -211,6 +239,8 @@ main(int argc, char **argv)
     margin_free_results(results[i], results_n[i]);
   free(results_n);
   free(results);
+  if (com_args->stream)
+    fclose(com_args->stream);
   free(com_args);
   free(links);
   free(checks_status_ports);
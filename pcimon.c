@@ -0,0 +1,425 @@
+/*
+ *	The PCI Utilities -- Monitor Link and Error Status Registers
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+
+#include "pciutils.h"
+
+#ifdef PCI_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/*
+ *  Offsets of the watched registers are resolved once at start. Then every
+ *  sample reads only these registers of all selected devices by a single
+ *  pci_read_multi() call and compares them with the previous sample.
+ *  Changes are passed to the output through a single-producer single-consumer
+ *  ring buffer, so that slow output never delays sampling. When the ring
+ *  is full, changes are dropped and counted.
+ */
+
+const char program_name[] = "pcimon";
+
+static struct pci_filter filter;	/* Devices to watch */
+static double opt_interval = 10;	/* Sampling interval in milliseconds */
+static long opt_count;			/* Number of samples, 0 = infinite */
+static int opt_json;			/* NDJSON output instead of CSV */
+static int opt_all;			/* Report all samples, not only changes */
+static char *opt_regs;			/* Comma-separated names of registers to watch */
+
+struct reg {
+  const char *name;
+  unsigned int cap_id, cap_type;
+  int offset, width;
+};
+
+static const struct reg regs[] = {
+  { "LnkSta",	PCI_CAP_ID_EXP,		PCI_CAP_NORMAL,		PCI_EXP_LNKSTA,		2 },
+  { "UESta",	PCI_EXT_CAP_ID_AER,	PCI_CAP_EXTENDED,	PCI_ERR_UNCOR_STATUS,	4 },
+  { "CESta",	PCI_EXT_CAP_ID_AER,	PCI_CAP_EXTENDED,	PCI_ERR_COR_STATUS,	4 },
+  { "DpcSta",	PCI_EXT_CAP_ID_DPC,	PCI_CAP_EXTENDED,	PCI_DPC_STATUS,		2 },
+  { NULL,	0,			0,			0,			0 }
+};
+
+struct probe {
+  struct pci_dev *dev;
+  const struct reg *reg;
+  u32 value;				/* From the previous sample */
+  byte buf[4];
+};
+
+static struct probe *probes;
+static struct pci_read_req *reqs;
+static int num_probes;
+
+/*** Ring buffer of events ***/
+
+struct event {
+  u64 time;				/* Monotonic time in ns */
+  int probe;
+  int first;				/* No previous value known */
+  u32 old, new;
+};
+
+#define RING_SIZE 65536			/* Must be a power of 2 */
+
+static struct event ring[RING_SIZE];
+static unsigned long ring_head;		/* Written only by the sampler */
+static unsigned long ring_tail;		/* Written only by the output */
+static unsigned long dropped;
+static int sampling_done;
+static volatile sig_atomic_t stop;
+
+static void
+push_event(struct event *e)
+{
+  unsigned long h = ring_head;
+
+  if (h - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) >= RING_SIZE)
+    {
+      __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  ring[h % RING_SIZE] = *e;
+  __atomic_store_n(&ring_head, h + 1, __ATOMIC_RELEASE);
+}
+
+/*** Sampling ***/
+
+static u64
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+sleep_until(u64 t)
+{
+  u64 now = now_ns();
+  struct timespec ts;
+
+  if (t <= now)
+    return;
+  ts.tv_sec = (t - now) / 1000000000;
+  ts.tv_nsec = (t - now) % 1000000000;
+  nanosleep(&ts, NULL);
+}
+
+static void
+sample(int first)
+{
+  struct event e;
+  int i;
+
+  e.time = now_ns();
+  pci_read_multi(probes[0].dev->access, reqs, num_probes);
+  for (i=0; i<num_probes; i++)
+    {
+      struct probe *p = &probes[i];
+      u32 val;
+      if (!reqs[i].ok)
+	val = (p->reg->width == 2) ? 0xffff : 0xffffffff;
+      else if (p->reg->width == 2)
+	val = p->buf[0] | (p->buf[1] << 8);
+      else
+	val = p->buf[0] | (p->buf[1] << 8) | (p->buf[2] << 16) | ((u32) p->buf[3] << 24);
+      if (first || opt_all || val != p->value)
+	{
+	  e.probe = i;
+	  e.first = first;
+	  e.old = p->value;
+	  e.new = val;
+	  push_event(&e);
+	}
+      p->value = val;
+    }
+}
+
+static void drain(void);
+
+static void *
+sampler(void *arg UNUSED)
+{
+  u64 interval = opt_interval * 1000000;
+  u64 next = now_ns();
+  long n;
+
+  for (n=0; !stop && (!opt_count || n < opt_count); n++)
+    {
+      sample(!n);
+#ifndef PCI_HAVE_PTHREAD
+      drain();
+#endif
+      next += interval;
+      /* If we are late, do not try to catch up */
+      if (now_ns() > next + interval)
+	next = now_ns();
+      if (!opt_count || n+1 < opt_count)
+	sleep_until(next);
+    }
+  __atomic_store_n(&sampling_done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/*** Output ***/
+
+static u64 mono_start;
+static struct timespec real_start;
+
+static void
+show_event(struct event *e)
+{
+  struct probe *p = &probes[e->probe];
+  struct pci_dev *d = p->dev;
+  u64 t = real_start.tv_sec * 1000000000ULL + real_start.tv_nsec + (e->time - mono_start);
+  int digits = 2 * p->reg->width;
+
+  if (opt_json)
+    {
+      printf("{\"time\":%llu.%06u,\"device\":\"%04x:%02x:%02x.%d\",\"register\":\"%s\",\"old\":",
+	     (unsigned long long) (t / 1000000000), (unsigned int) (t % 1000000000 / 1000),
+	     d->domain, d->bus, d->dev, d->func, p->reg->name);
+      if (e->first)
+	printf("null");
+      else
+	printf("%u", e->old);
+      printf(",\"new\":%u}\n", e->new);
+    }
+  else
+    {
+      printf("%llu.%06u,%04x:%02x:%02x.%d,%s,",
+	     (unsigned long long) (t / 1000000000), (unsigned int) (t % 1000000000 / 1000),
+	     d->domain, d->bus, d->dev, d->func, p->reg->name);
+      if (!e->first)
+	printf("%0*x", digits, e->old);
+      printf(",%0*x\n", digits, e->new);
+    }
+}
+
+static void
+drain(void)
+{
+  unsigned long h = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+  unsigned long t = ring_tail;
+
+  if (t == h)
+    return;
+  while (t != h)
+    show_event(&ring[t++ % RING_SIZE]);
+  __atomic_store_n(&ring_tail, t, __ATOMIC_RELEASE);
+  fflush(stdout);
+}
+
+#ifdef PCI_HAVE_PTHREAD
+
+static void
+run(void)
+{
+  struct timespec ts = { 0, 10000000 };
+  pthread_t thread;
+  int done;
+
+  if (pthread_create(&thread, NULL, sampler, NULL))
+    die("Cannot create the sampling thread");
+  do
+    {
+      done = __atomic_load_n(&sampling_done, __ATOMIC_ACQUIRE);
+      drain();
+      if (!done)
+	nanosleep(&ts, NULL);
+    }
+  while (!done);
+  pthread_join(thread, NULL);
+}
+
+#else
+
+static void
+run(void)
+{
+  sampler(NULL);
+}
+
+#endif
+
+/*** Setup ***/
+
+static int
+want_reg(const struct reg *r)
+{
+  char *list, *name, *next;
+  int found = 0;
+
+  if (!opt_regs)
+    return 1;
+  list = xstrdup(opt_regs);
+  for (name=list; name && !found; name=next)
+    {
+      if (next = strchr(name, ','))
+	*next++ = 0;
+      found = !strcasecmp(name, r->name);
+    }
+  free(list);
+  return found;
+}
+
+static void
+setup_probes(struct pci_access *a)
+{
+  struct pci_dev *d;
+  const struct reg *r;
+  struct pci_cap *cap;
+  int n = 0, max;
+
+  for (d=a->devices; d; d=d->next)
+    n++;
+  max = n * (sizeof(regs) / sizeof(regs[0]));
+  probes = xmalloc(max * sizeof(*probes));
+  reqs = xmalloc(max * sizeof(*reqs));
+
+  for (d=a->devices; d; d=d->next)
+    {
+      if (!pci_filter_match(&filter, d))
+	continue;
+      for (r=regs; r->name; r++)
+	if (want_reg(r) && (cap = pci_find_cap(d, r->cap_id, r->cap_type)))
+	  {
+	    struct probe *p = &probes[num_probes];
+	    struct pci_read_req *q = &reqs[num_probes];
+	    p->dev = d;
+	    p->reg = r;
+	    p->value = 0;
+	    q->dev = d;
+	    q->pos = cap->addr + r->offset;
+	    q->len = r->width;
+	    q->buf = p->buf;
+	    num_probes++;
+	  }
+    }
+}
+
+static void
+sig_stop(int sig UNUSED)
+{
+  stop = 1;
+}
+
+static const char help_msg[] =
+"Usage: pcimon [<options>]\n"
+"\n"
+"-s [[[[<domain>]:]<bus>]:][<slot>][.[<func>]]\tWatch only devices in selected slots\n"
+"-d [<vendor>]:[<device>][:<class>]\t\tWatch only devices with specified ID's\n"
+"-r <reg>,...\tWatch only given registers (LnkSta, UESta, CESta, DpcSta)\n"
+"-i <ms>\t\tSampling interval in milliseconds (default: 10)\n"
+"-c <count>\tStop after the given number of samples\n"
+"-a\t\tReport all samples, not only changes\n"
+"-j\t\tProduce JSON lines instead of CSV\n"
+"\n"
+"PCI access options:\n"
+GENERIC_HELP
+;
+
+int
+main(int argc, char **argv)
+{
+  struct pci_access *a;
+  const struct reg *r;
+  char *msg;
+  int i;
+
+  if (argc == 2 && !strcmp(argv[1], "--version"))
+    {
+      puts("pcimon version " PCIUTILS_VERSION);
+      return 0;
+    }
+
+  a = pci_alloc();
+  pci_filter_init(a, &filter);
+  while ((i = getopt(argc, argv, "s:d:r:i:c:aj" GENERIC_OPTIONS)) != -1)
+    switch (i)
+      {
+      case 's':
+	if (msg = pci_filter_parse_slot(&filter, optarg))
+	  die("-s: %s", msg);
+	break;
+      case 'd':
+	if (msg = pci_filter_parse_id(&filter, optarg))
+	  die("-d: %s", msg);
+	break;
+      case 'r':
+	opt_regs = optarg;
+	break;
+      case 'i':
+	opt_interval = atof(optarg);
+	if (opt_interval < 0)
+	  die("-i: Invalid interval");
+	break;
+      case 'c':
+	opt_count = atol(optarg);
+	break;
+      case 'a':
+	opt_all = 1;
+	break;
+      case 'j':
+	opt_json = 1;
+	break;
+      default:
+	if (parse_generic_option(i, a, optarg))
+	  break;
+	fputs(help_msg, stderr);
+	return 1;
+      }
+  if (optind < argc)
+    {
+      fputs(help_msg, stderr);
+      return 1;
+    }
+  if (opt_regs)
+    {
+      char *list = xstrdup(opt_regs), *name, *next;
+      for (name=list; name; name=next)
+	{
+	  if (next = strchr(name, ','))
+	    *next++ = 0;
+	  for (r=regs; r->name && strcasecmp(name, r->name); r++)
+	    ;
+	  if (!r->name)
+	    die("-r: Unknown register %s", name);
+	}
+      free(list);
+    }
+
+  pci_init(a);
+  pci_scan_bus(a);
+  setup_probes(a);
+  if (!num_probes)
+    die("No registers to watch");
+
+  signal(SIGINT, sig_stop);
+  signal(SIGTERM, sig_stop);
+  mono_start = now_ns();
+  clock_gettime(CLOCK_REALTIME, &real_start);
+  if (!opt_json)
+    printf("time,device,register,old,new\n");
+  run();
+  drain();
+
+  if (dropped)
+    fprintf(stderr, "pcimon: %lu changes dropped, output too slow\n", dropped);
+  free(reqs);
+  free(probes);
+  pci_cleanup(a);
+  return 0;
+}
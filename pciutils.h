@@ -41,6 +41,22 @@ void *xmalloc(size_t howmuch);
 void *xrealloc(void *ptr, size_t howmuch);
 char *xstrdup(const char *str);
 int parse_generic_option(int i, struct pci_access *pacc, char *arg);
+void show_pci_stats(struct pci_access *pacc);
+
+/*
+ *  Format bytes as pairs of hex digits, each preceded by sep if it is non-zero.
+ *  Returns the end of the output, which is not terminated.
+ */
+char *format_hex(char *out, const byte *data, unsigned int len, int sep);
+
+/*
+ *  Format a hex dump of config space (at most 4096 bytes) in the format of lspci -x,
+ *  that is lines of 16 bytes preceded by their offset. The output is at most
+ *  HEX_DUMP_SIZE(len) characters long, only complete lines end with a newline.
+ */
+char *format_hex_dump(char *out, const byte *data, unsigned int len);
+#define HEX_DUMP_SIZE(len) (((len) + 15) / 16 * 53)
+void add_pci_stats(struct pci_access *to, struct pci_access *from);
 
 #ifdef PCI_HAVE_PM_INTEL_CONF
 #define GENOPT_INTEL "H:"
@@ -20,7 +20,11 @@
 static int force;			/* Don't complain if no devices match */
 static int verbose;			/* Verbosity level */
 static int demo_mode;			/* Only show */
+static int strict_order;		/* Every operation does its own accesses */
 static int allow_raw_access;
+static int max_jobs = 1;		/* Number of devices processed in parallel */
+static int batch_mode;			/* Read operations from stdin */
+static int batch_line;			/* Line of the batch being processed */
 
 const char program_name[] = "setpci";
 
@@ -53,6 +57,7 @@ struct group {
 
 static struct group *first_group, **last_group = &first_group;
 static int need_bus_scan;
+static int bus_scanned;
 static unsigned int max_values[] = { 0, 0xff, 0xffff, 0, 0xffffffff };
 
 static int
@@ -79,47 +84,69 @@ select_devices(struct group *group)
     }
   else
     {
-      struct pci_dev **devs, *dev;
-      int i = 0;
-      int cnt = 1;
-
-      for (dev = pacc->devices; dev; dev = dev->next)
-	if (pci_filter_match(f, dev))
-	  cnt++;
-
-      devs = xmalloc(sizeof(struct device *) * cnt);
+      struct pci_filter_set *set = pci_filter_compile(pacc, f, 1);
+      int cnt;
+      struct pci_dev **found = pci_filter_select(set, &cnt);
+      struct pci_dev **devs = xmalloc(sizeof(struct pci_dev *) * (cnt + 1));
 
-      for (dev = pacc->devices; dev; dev = dev->next)
-	if (pci_filter_match(f, dev))
-	  devs[i++] = dev;
-
-      devs[i] = NULL;
+      memcpy(devs, found, sizeof(struct pci_dev *) * (cnt + 1));
+      pci_filter_free(set);
       return devs;
     }
 }
 
-static void PCI_PRINTF(1,2)
-trace(const char *fmt, ...)
+/*
+ *  Output of operations applied to a single device. When devices are processed
+ *  in parallel, it is collected in memory and printed in the order of devices.
+ */
+
+struct output {
+  char *buf;
+  size_t len, size;
+};
+
+static void PCI_PRINTF(2,3)
+out_printf(struct output *out, const char *fmt, ...)
 {
   va_list args;
   va_start(args, fmt);
-  if (verbose)
+  if (!out)
     vprintf(fmt, args);
+  else
+    {
+      va_list args2;
+      int n;
+      va_copy(args2, args);
+      n = vsnprintf(NULL, 0, fmt, args2);
+      va_end(args2);
+      if (out->len + n + 1 > out->size)
+	{
+	  out->size = 2*out->size + n + 64;
+	  out->buf = xrealloc(out->buf, out->size);
+	}
+      vsnprintf(out->buf + out->len, out->size - out->len, fmt, args);
+      out->len += n;
+    }
   va_end(args);
 }
 
+#define trace(out, ...) do { if (verbose) out_printf(out, __VA_ARGS__); } while (0)
+
 static void
-exec_op(struct op *op, struct pci_dev *dev)
+device_slot(struct pci_dev *dev, char *slot)
 {
-  const char * const formats[] = { NULL, " %02x", " %04x", NULL, " %08x" };
-  const char * const mask_formats[] = { NULL, " %02x->(%02x:%02x)->%02x", " %04x->(%04x:%04x)->%04x", NULL, " %08x->(%08x:%08x)->%08x" };
-  unsigned int i, x, y;
-  int addr = 0;
+  sprintf(slot, "%04x:%02x:%02x.%x", dev->domain, dev->bus, dev->dev, dev->func);
+}
+
+/* Find address of the capability the operation is relative to (0 if none) and check the access */
+static unsigned int
+resolve_op(struct op *op, struct pci_dev *dev)
+{
+  unsigned int addr = 0;
   int width = op->width;
   char slot[16];
 
-  sprintf(slot, "%04x:%02x:%02x.%x", dev->domain, dev->bus, dev->dev, dev->func);
-  trace("%s ", slot);
+  device_slot(dev, slot);
   if (op->cap_type)
     {
       struct pci_cap *cap;
@@ -136,17 +163,13 @@ exec_op(struct op *op, struct pci_dev *dev)
             op->number, ((op->cap_type == PCI_CAP_NORMAL) ? "Capability" : "Extended capability"),
             op->cap_id, ((cap_nr == 1) ? "is" : "are"), cap_nr,
             ((cap_nr == 1) ? "capability" : "capabilities"));
-
-      trace(((op->cap_type == PCI_CAP_NORMAL) ? "(cap %02x @%02x) " : "(ecap %04x @%03x) "), op->cap_id, addr);
     }
-  addr += op->addr;
-  trace("@%02x", addr);
 
   /* We have already checked it when parsing, but addressing relative to capabilities can change the address. */
-  if (addr & (width-1))
-    die("%s: Unaligned access of width %d to register %04x", slot, width, addr);
-  if (addr + width > 0x1000)
-    die("%s: Access of width %d to register %04x out of range", slot, width, addr);
+  if ((addr + op->addr) & (width-1))
+    die("%s: Unaligned access of width %d to register %04x", slot, width, addr + op->addr);
+  if (addr + op->addr + width > 0x1000)
+    die("%s: Access of width %d to register %04x out of range", slot, width, addr + op->addr);
 
   if (op->hdr_type_mask)
     {
@@ -155,6 +178,104 @@ exec_op(struct op *op, struct pci_dev *dev)
         die("%s: Does not have register %s.", slot, op->name);
     }
 
+  return addr;
+}
+
+/*
+ *  Writes of the operations applied to a device are not issued immediately,
+ *  but collected in a per-device buffer as long as each of them continues
+ *  right after the end of the previous one, so that writing several adjacent
+ *  registers in ascending order (e.g., CACHE_LINE_SIZE and LATENCY_TIMER) is
+ *  merged to the widest aligned accesses covering exactly the bytes written.
+ *  Any other write, any read and moving to the next device flushes the buffer
+ *  first, so accesses still reach the device in the order they were given.
+ *  Masked writes read the register at the width of the operation.
+ *
+ *  With -S, the buffer is flushed after every value, which gives the same
+ *  accesses as applying each operation on its own.
+ */
+
+struct wbuf {
+  byte val[0x1000];
+  unsigned int lo, hi;			/* Pending bytes, lo == hi if there are none */
+};
+
+static void
+wb_init(struct wbuf *wb)
+{
+  wb->lo = wb->hi = 0;
+}
+
+static inline unsigned int
+wb_get(struct wbuf *wb, unsigned int addr, unsigned int width)
+{
+  unsigned int x = 0;
+
+  while (width--)
+    x = (x << 8) | wb->val[addr + width];
+  return x;
+}
+
+static void
+wb_flush(struct wbuf *wb, struct pci_dev *dev)
+{
+  unsigned int pos = wb->lo;
+
+  while (pos < wb->hi)
+    {
+      if (!(pos & 3) && pos + 4 <= wb->hi)
+	{
+	  if (!demo_mode)
+	    pci_write_long(dev, pos, wb_get(wb, pos, 4));
+	  pos += 4;
+	}
+      else if (!(pos & 1) && pos + 2 <= wb->hi)
+	{
+	  if (!demo_mode)
+	    pci_write_word(dev, pos, wb_get(wb, pos, 2));
+	  pos += 2;
+	}
+      else
+	{
+	  if (!demo_mode)
+	    pci_write_byte(dev, pos, wb->val[pos]);
+	  pos++;
+	}
+    }
+  wb_init(wb);
+}
+
+static void
+wb_write(struct wbuf *wb, struct pci_dev *dev, unsigned int addr, unsigned int width, unsigned int x)
+{
+  unsigned int i;
+
+  if (wb->lo == wb->hi || addr != wb->hi)
+    {
+      wb_flush(wb, dev);
+      wb->lo = wb->hi = addr;
+    }
+  for (i=0; i<width; i++, x >>= 8)
+    wb->val[addr+i] = x;
+  wb->hi = addr + width;
+}
+
+static void
+apply_op(struct op *op, struct pci_dev *dev, unsigned int cap_addr, struct wbuf *wb, struct output *out)
+{
+  const char * const formats[] = { NULL, " %02x", " %04x", NULL, " %08x" };
+  const char * const mask_formats[] = { NULL, " %02x->(%02x:%02x)->%02x", " %04x->(%04x:%04x)->%04x", NULL, " %08x->(%08x:%08x)->%08x" };
+  unsigned int i, x, y;
+  int addr = cap_addr + op->addr;
+  int width = op->width;
+  char slot[16];
+
+  device_slot(dev, slot);
+  trace(out, "%s ", slot);
+  if (op->cap_type)
+    trace(out, ((op->cap_type == PCI_CAP_NORMAL) ? "(cap %02x @%02x) " : "(ecap %04x @%03x) "), op->cap_id, cap_addr);
+  trace(out, "@%02x", addr);
+
   if (op->num_values)
     {
       for (i=0; i<op->num_values; i++)
@@ -162,10 +283,11 @@ exec_op(struct op *op, struct pci_dev *dev)
 	  if ((op->values[i].mask & max_values[width]) == max_values[width])
 	    {
 	      x = op->values[i].value;
-	      trace(formats[width], op->values[i].value);
+	      trace(out, formats[width], op->values[i].value);
 	    }
 	  else
 	    {
+	      wb_flush(wb, dev);
 	      switch (width)
 		{
 		case 1:
@@ -179,30 +301,19 @@ exec_op(struct op *op, struct pci_dev *dev)
 		  break;
 		}
 	      x = (y & ~op->values[i].mask) | op->values[i].value;
-	      trace(mask_formats[width], y, op->values[i].value, op->values[i].mask, x);
-	    }
-	  if (!demo_mode)
-	    {
-	      switch (width)
-		{
-		case 1:
-		  pci_write_byte(dev, addr, x);
-		  break;
-		case 2:
-		  pci_write_word(dev, addr, x);
-		  break;
-		default:
-		  pci_write_long(dev, addr, x);
-		  break;
-		}
+	      trace(out, mask_formats[width], y, op->values[i].value, op->values[i].mask, x);
 	    }
+	  wb_write(wb, dev, addr, width, x);
+	  if (strict_order)
+	    wb_flush(wb, dev);
 	  addr += width;
 	}
-      trace("\n");
+      trace(out, "\n");
     }
   else
     {
-      trace(" = ");
+      wb_flush(wb, dev);
+      trace(out, " = ");
       switch (width)
 	{
 	case 1:
@@ -215,17 +326,175 @@ exec_op(struct op *op, struct pci_dev *dev)
 	  x = pci_read_long(dev, addr);
 	  break;
 	}
-      printf(formats[width]+1, x);
-      putchar('\n');
+      out_printf(out, formats[width]+1, x);
+      out_printf(out, "\n");
+    }
+}
+
+#ifdef PCI_HAVE_PTHREAD
+
+/*
+ *  Applying operations to many devices in parallel (-j). The PCI library is not
+ *  thread-safe, so each worker uses its own pci_access and raw pci_dev's. All
+ *  capability lookups and checks are done in advance by the main thread, so
+ *  that errors are reported deterministically and before anything is written.
+ */
+
+#include <pthread.h>
+
+struct par_exec {
+  struct group *group;
+  struct pci_dev **vec;
+  unsigned int num_devs, num_ops;
+  unsigned int *cap_addrs;		/* [device][op] */
+  struct output *outs;
+  unsigned int next;
+  pthread_mutex_t lock;
+};
+
+struct par_worker {
+  pthread_t thread;
+  struct par_exec *pe;
+  struct pci_access *acc;
+};
+
+static void *
+par_worker(void *arg)
+{
+  struct par_worker *w = arg;
+  struct par_exec *pe = w->pe;
+  struct wbuf *wb = xmalloc(sizeof(*wb));
+
+  wb_init(wb);
+
+  for (;;)
+    {
+      unsigned int i, j;
+      struct pci_dev *orig, *dev;
+      struct op *op;
+
+      pthread_mutex_lock(&pe->lock);
+      i = pe->next++;
+      pthread_mutex_unlock(&pe->lock);
+      if (i >= pe->num_devs)
+	break;
+
+      orig = pe->vec[i];
+      dev = pci_get_dev(w->acc, orig->domain, orig->bus, orig->dev, orig->func);
+      for (op = pe->group->first_op, j = 0; op; op = op->next, j++)
+	apply_op(op, dev, pe->cap_addrs[i*pe->num_ops + j], wb, &pe->outs[i]);
+      wb_flush(wb, dev);
+      pci_free_dev(dev);
+    }
+  free(wb);
+  return NULL;
+}
+
+static struct pci_access *
+clone_access(void)
+{
+  struct pci_access *a = pci_alloc();
+  struct pci_param *p;
+
+  for (p = NULL; p = pci_walk_params(pacc, p); )
+    pci_set_param(a, p->param, p->value);
+  a->method = pacc->method;
+  a->writeable = pacc->writeable;
+  a->buscentric = pacc->buscentric;
+  a->debugging = pacc->debugging;
+  a->error = pacc->error;
+  a->warning = pacc->warning;
+  a->debug = pacc->debug;
+  pci_init(a);
+  return a;
+}
+
+static int
+execute_parallel(struct group *group, struct pci_dev **vec)
+{
+  struct par_exec pe;
+  struct par_worker *workers;
+  unsigned int i, j, num_workers;
+  struct op *op;
+
+  /* Only back-ends whose accesses to different devices are independent */
+  if (pacc->method != PCI_ACCESS_SYS_BUS_PCI && pacc->method != PCI_ACCESS_PROC_BUS_PCI &&
+      pacc->method != PCI_ACCESS_ECAM)
+    return 0;
+
+  memset(&pe, 0, sizeof(pe));
+  pe.group = group;
+  pe.vec = vec;
+  while (vec[pe.num_devs])
+    pe.num_devs++;
+  for (op = group->first_op; op; op = op->next)
+    pe.num_ops++;
+  if (pe.num_devs < 2)
+    return 0;
+
+  pe.cap_addrs = xmalloc(sizeof(unsigned int) * pe.num_devs * pe.num_ops);
+  for (i = 0; i < pe.num_devs; i++)
+    for (op = group->first_op, j = 0; op; op = op->next, j++)
+      pe.cap_addrs[i*pe.num_ops + j] = resolve_op(op, vec[i]);
+
+  pe.outs = xmalloc(sizeof(struct output) * pe.num_devs);
+  memset(pe.outs, 0, sizeof(struct output) * pe.num_devs);
+  pthread_mutex_init(&pe.lock, NULL);
+
+  num_workers = (pe.num_devs < (unsigned int) max_jobs) ? pe.num_devs : (unsigned int) max_jobs;
+  workers = xmalloc(sizeof(struct par_worker) * num_workers);
+  for (i = 0; i < num_workers; i++)
+    {
+      workers[i].pe = &pe;
+      workers[i].acc = clone_access();
+    }
+  for (i = 0; i < num_workers; i++)
+    if (pthread_create(&workers[i].thread, NULL, par_worker, &workers[i]))
+      die("Cannot create thread: %m");
+  for (i = 0; i < num_workers; i++)
+    {
+      pthread_join(workers[i].thread, NULL);
+      add_pci_stats(pacc, workers[i].acc);
+      pci_cleanup(workers[i].acc);
     }
+
+  for (i = 0; i < pe.num_devs; i++)
+    if (pe.outs[i].len)
+      {
+	fwrite(pe.outs[i].buf, 1, pe.outs[i].len, stdout);
+	free(pe.outs[i].buf);
+      }
+
+  pthread_mutex_destroy(&pe.lock);
+  free(workers);
+  free(pe.outs);
+  free(pe.cap_addrs);
+  return 1;
+}
+
+#endif
+
+static void
+free_devices(struct pci_dev **vec)
+{
+  unsigned int i;
+
+  /* Devices obtained without a bus scan are not linked to the list of devices */
+  if (!bus_scanned)
+    for (i = 0; vec[i]; i++)
+      pci_free_dev(vec[i]);
+  free(vec);
 }
 
 static void
 execute(void)
 {
+  static struct wbuf wb;
   struct group *group;
   int group_cnt = 0;
 
+  wb_init(&wb);
+
   for (group = first_group; group; group = group->next)
     {
       struct pci_dev **vec = select_devices(group);
@@ -236,15 +505,43 @@ execute(void)
       if (!vec[0] && !force)
 	fprintf(stderr, "setpci: Warning: No devices selected for operation group %d.\n", group_cnt);
 
+#ifdef PCI_HAVE_PTHREAD
+      if (max_jobs > 1 && execute_parallel(group, vec))
+	{
+	  free_devices(vec);
+	  continue;
+	}
+#endif
+
       for (i = 0; dev = vec[i]; i++)
 	{
 	  struct op *op;
 	  for (op = group->first_op; op; op = op->next)
-	    exec_op(op, dev);
+	    apply_op(op, dev, resolve_op(op, dev), &wb, NULL);
+	  wb_flush(&wb, dev);
 	}
+      free_devices(vec);
+    }
+}
 
-      free(vec);
+static void
+free_groups(void)
+{
+  struct group *group, *next_group;
+  struct op *op, *next_op;
+
+  for (group = first_group; group; group = next_group)
+    {
+      next_group = group->next;
+      for (op = group->first_op; op; op = next_op)
+	{
+	  next_op = op->next;
+	  free(op);
+	}
+      free(group);
     }
+  first_group = NULL;
+  last_group = &first_group;
 }
 
 static void
@@ -428,7 +725,10 @@ usage(void)
 "-f\t\tDon't complain if there's nothing to do\n"
 "-v\t\tBe verbose\n"
 "-D\t\tList changes, don't commit them\n"
+"-S\t\tDo not merge adjacent writes\n"
 "-r\t\tUse raw access without bus scan if possible\n"
+"-j <jobs>\tApply operations to up to <jobs> devices in parallel\n"
+"-b\t\tRead setting commands from stdin, one group per line\n"
 "--dumpregs\tDump all known register names and exit\n"
 "\n"
 "PCI access options:\n"
@@ -454,6 +754,8 @@ parse_err(const char *msg, ...)
   va_list args;
   va_start(args, msg);
   fprintf(stderr, "setpci: ");
+  if (batch_line)
+    fprintf(stderr, "line %d: ", batch_line);
   vfprintf(stderr, msg, args);
   fprintf(stderr, ".\nTry `setpci --help' for more information.\n");
   exit(1);
@@ -503,10 +805,31 @@ parse_options(int argc, char **argv)
 	    demo_mode++;
 	    c++;
 	    break;
+	  case 'S':
+	    strict_order++;
+	    c++;
+	    break;
 	  case 'r':
 	    allow_raw_access++;
 	    c++;
 	    break;
+	  case 'b':
+	    batch_mode++;
+	    c++;
+	    break;
+	  case 'j':
+	    c++;
+	    if (*c)
+	      e = c;
+	    else if (i < argc)
+	      e = argv[i++];
+	    else
+	      parse_err("Option -j requires an argument");
+	    max_jobs = strtol(e, &e, 10);
+	    if (*e || max_jobs < 1)
+	      parse_err("Invalid number of jobs");
+	    c = "";
+	    break;
 	  default:
 	    if (e = strchr(opts, *c))
 	      {
@@ -772,6 +1095,8 @@ static void parse_op(char *c, struct group *group)
 	op->values[j].mask = ~0U;
       value = e;
     }
+
+  free(base);
 }
 
 static struct group *new_group(void)
@@ -812,6 +1137,70 @@ static void parse_ops(int argc, char **argv, int i)
     parse_err("No operation specified");
 }
 
+static void
+run_ops(void)
+{
+  scan_ops();
+  if (need_bus_scan && !bus_scanned)
+    {
+      pci_scan_bus(pacc);
+      bus_scanned = 1;
+    }
+  execute();
+}
+
+/*
+ *  In batch mode, every line of stdin contains the same operation groups
+ *  as the command line would. They are executed one line at a time, sharing
+ *  the initialized access, the result of the bus scan and the capabilities
+ *  found on the devices, and the output is flushed after each line.
+ *  Like on the command line, errors terminate setpci.
+ */
+
+#define BATCH_MAX_LINE 4096
+
+static void
+run_batch(void)
+{
+  char line[BATCH_MAX_LINE];
+  char **args = NULL;
+  int max_args = 0;
+
+  while (fgets(line, sizeof(line), stdin))
+    {
+      char *c = line;
+      int n = 0;
+
+      batch_line++;
+      if (!strchr(line, '\n') && !feof(stdin))
+	parse_err("Line too long");
+      for (;;)
+	{
+	  while (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r')
+	    *c++ = 0;
+	  if (!*c || *c == '#')
+	    break;
+	  if (n >= max_args)
+	    {
+	      max_args = max_args ? 2*max_args : 16;
+	      args = xrealloc(args, max_args * sizeof(char *));
+	    }
+	  args[n++] = c;
+	  while (*c && *c != ' ' && *c != '\t' && *c != '\n' && *c != '\r')
+	    c++;
+	}
+      if (!n)
+	continue;
+
+      parse_ops(n, args, 0);
+      run_ops();
+      free_groups();
+      fflush(stdout);
+    }
+  batch_line = 0;
+  free(args);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -823,13 +1212,19 @@ main(int argc, char **argv)
 
   pci_init(pacc);
 
-  parse_ops(argc, argv, i);
-  scan_ops();
-
-  if (need_bus_scan)
-    pci_scan_bus(pacc);
-
-  execute();
+  if (batch_mode)
+    {
+      if (i < argc)
+	parse_err("No operations can be given on the command line with -b");
+      run_batch();
+    }
+  else
+    {
+      parse_ops(argc, argv, i);
+      run_ops();
+    }
 
+  fflush(stdout);
+  show_pci_stats(pacc);
   return 0;
 }
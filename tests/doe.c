@@ -0,0 +1,150 @@
+/*
+ *	The PCI Library -- Test of DOE Mailbox Discovery on a Dump
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL v2+.
+ *
+ *	SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*
+ *  Runs pci_doe_discover() on copies of a dump with DOE capabilities placed
+ *  on several buses, first without and then with thread safety enabled.
+ *  The mailboxes of a dump never respond, so every discovery has to fail
+ *  cleanly (after the timeout if the mailbox looks idle) and its result has
+ *  to be remembered. Without thread safety, all accesses must come from the
+ *  calling thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lib/pci.h"
+#include "lib/sysdep.h"
+
+#ifdef PCI_HAVE_PTHREAD
+#include <pthread.h>
+
+static pthread_t main_thread;
+static int foreign_accesses;
+
+static void
+trace_thread(struct pci_access *a UNUSED, struct pci_trace_record *rec UNUSED, void *data UNUSED)
+{
+  if (!pthread_equal(pthread_self(), main_thread))
+    foreign_accesses = 1;
+}
+#endif
+
+static int failed;
+
+static void
+check(int ok, char *msg, ...)
+{
+  va_list args;
+
+  va_start(args, msg);
+  printf("%s: ", ok ? "OK" : "FAIL");
+  vprintf(msg, args);
+  putchar('\n');
+  va_end(args);
+  if (!ok)
+    failed = 1;
+}
+
+#define COPIES 4
+
+/* Write COPIES copies of the devices of a text dump, the i-th one on bus i */
+static int
+make_dump(char *src, char *dest)
+{
+  char line[256];
+  FILE *in, *out;
+  int fd, i;
+
+  if (!(in = fopen(src, "r")) || (fd = mkstemp(dest)) < 0 || !(out = fdopen(fd, "w")))
+    return 0;
+  for (i = 0; i < COPIES; i++)
+    {
+      rewind(in);
+      while (fgets(line, sizeof(line), in))
+	if (strlen(line) > 7 && line[2] == ':' && line[5] == '.')
+	  fprintf(out, "%02x%s", i, line + 2);
+	else
+	  fputs(line, out);
+    }
+  fclose(in);
+  return !fclose(out);
+}
+
+static void
+run(char *dump, int thread_safe)
+{
+  struct pci_access *a = pci_alloc();
+  struct pci_doe_protocol *protocols;
+  struct pci_dev *d;
+  struct pci_cap *cap;
+  int mailboxes = 0;
+
+  pci_set_param(a, "dump.name", dump);
+  pci_set_param(a, "dump.writable", "1");
+  a->method = PCI_ACCESS_DUMP;
+  pci_init(a);
+  if (thread_safe && !pci_enable_thread_safety(a, 1))
+    {
+      printf("SKIP: thread safety not available\n");
+      pci_cleanup(a);
+      return;
+    }
+#ifdef PCI_HAVE_PTHREAD
+  main_thread = pthread_self();
+  foreign_accesses = 0;
+  pci_set_trace(a, trace_thread, NULL);
+#endif
+  pci_scan_bus(a);
+
+  pci_doe_discover(a, 4);
+
+  for (d = a->devices; d; d = d->next)
+    for (cap = d->first_cap; cap; cap = cap->next)
+      if (cap->type == PCI_CAP_EXTENDED && cap->id == PCI_EXT_CAP_ID_DOE)
+	{
+	  mailboxes++;
+	  check(pci_doe_get_protocols(d, cap->addr, &protocols) == -1,
+		"%02x:%02x.%d mailbox at %03x reports a failed discovery", d->bus, d->dev, d->func, cap->addr);
+	}
+  check(mailboxes == 2*COPIES, "%d mailboxes found", mailboxes);
+  for (d = a->devices; d; d = d->next)
+    check(!pci_doe_find_mailbox(d, 0x0001, 0), "%02x:%02x.%d has no mailbox supporting discovery", d->bus, d->dev, d->func);
+#ifdef PCI_HAVE_PTHREAD
+  if (!thread_safe)
+    check(!foreign_accesses, "no accesses from other threads without thread safety");
+  else
+    check(foreign_accesses > 0, "accesses from other threads with thread safety");
+#endif
+
+  pci_cleanup(a);
+}
+
+int
+main(int argc, char **argv)
+{
+  char dump[] = "/tmp/pci-doe-XXXXXX";
+
+  if (argc != 2)
+    {
+      fprintf(stderr, "Usage: doe <dump>\n");
+      return 2;
+    }
+  if (!make_dump(argv[1], dump))
+    {
+      perror("Cannot create a copy of the dump");
+      return 2;
+    }
+  run(dump, 0);
+  run(dump, 1);
+  unlink(dump);
+  return failed;
+}
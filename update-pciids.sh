@@ -9,6 +9,8 @@ GREP=grep
 VERSION=unknown
 USER_AGENT=update-pciids/$VERSION
 QUIET=
+LSPCI=lspci
+IDSBIN=no
 
 [ "$1" = "-q" ] && quiet=true || quiet=false
 
@@ -88,6 +90,14 @@ else
 	rm -f $DEST.new
 fi
 
+if [ "$IDSBIN" = yes ] ; then
+	BIN=${DEST%.gz}.bin
+	if ! $LSPCI -i $DEST -I $BIN ; then
+		echo >&2 "update-pciids: compilation of the binary ID list failed"
+		rm -f $BIN
+	fi
+fi
+
 # Older versions did not compress the ids file, so let's make sure we
 # clean that up.
 if [ ${DEST%.gz} != ${DEST} ] ; then